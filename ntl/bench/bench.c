@@ -0,0 +1,202 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#define _GNU_SOURCE
+#include "bench.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Heap allocations are counted by interposing the allocator entry
+ * points over glibc's own. The counters are per thread so that the
+ * counting does not add contention to threaded runs. Elsewhere the
+ * count is reported as null.
+ */
+
+#ifdef __GLIBC__
+extern void* __libc_malloc(size_t n);
+extern void* __libc_calloc(size_t n, size_t sz);
+extern void* __libc_realloc(void* p, size_t n);
+extern void* __libc_memalign(size_t align, size_t n);
+
+static __thread guint64 allocs = 0;
+
+void* malloc(size_t n)
+{
+    allocs++;
+    return __libc_malloc(n);
+}
+
+void* calloc(size_t n, size_t sz)
+{
+    allocs++;
+    return __libc_calloc(n, sz);
+}
+
+void* realloc(void* p, size_t n)
+{
+    allocs++;
+    return __libc_realloc(p, n);
+}
+
+int posix_memalign(void** p, size_t align, size_t n)
+{
+    allocs++;
+    *p = __libc_memalign(align, n);
+    return *p ? 0 : 12 /* ENOMEM */;
+}
+
+guint64 bench_allocs(void)
+{
+    return allocs;
+}
+#define COUNTS_ALLOCS TRUE
+#else
+guint64 bench_allocs(void)
+{
+    return 0;
+}
+#define COUNTS_ALLOCS FALSE
+#endif
+
+/* private */
+#define BATCHES     200
+#define WARMUP      20
+#define MIN_BATCH_NS 200000
+
+static const gchar* selection = NULL;
+
+typedef struct {
+    bench_func fn;
+    gpointer   state;
+    guint64    iters;
+    gdouble*   samples; /* ns/op of each batch */
+    guint64    allocs;
+} Worker;
+
+static guint64 now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (guint64) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static gpointer run_batches(gpointer d)
+{
+    Worker* w = (Worker*) d;
+    guint   i = 0;
+    guint64 a0 = 0;
+
+    for ( i = 0; i < WARMUP; i++ ) {
+        w->fn(w->state, w->iters);
+    }
+    a0 = bench_allocs();
+    for ( i = 0; i < BATCHES; i++ ) {
+        guint64 t0 = now_ns();
+        w->fn(w->state, w->iters);
+        w->samples[i] = (gdouble) (now_ns() - t0) / w->iters;
+    }
+    w->allocs = bench_allocs() - a0;
+    return NULL;
+}
+
+/* grows the batch until it is long enough to time reliably */
+static guint64 calibrate(bench_func fn, gpointer state)
+{
+    guint64 rv = 1;
+
+    /* the first call may pay for one-off setup */
+    fn(state, 1);
+    while ( TRUE ) {
+        guint64 t0 = now_ns();
+        fn(state, rv);
+        if ( now_ns() - t0 >= MIN_BATCH_NS || rv >= (1ull << 30) ) {
+            return rv;
+        }
+        rv *= 2;
+    }
+}
+
+static gint cmp_double(gconstpointer a, gconstpointer b)
+{
+    gdouble x = *((const gdouble*) a);
+    gdouble y = *((const gdouble*) b);
+    return (x > y) - (x < y);
+}
+
+/* public */
+gboolean bench_selected(const gchar* name)
+{
+    return NULL == selection || NULL != strstr(name, selection);
+}
+
+void bench_select(const gchar* substring)
+{
+    selection = substring;
+}
+
+void bench_run(const gchar* name, const gchar* variant, guint threads, bench_func fn, gpointer state)
+{
+    Worker*   workers = g_new0(Worker, threads);
+    GThread** handles = g_new0(GThread*, threads);
+    gdouble*  all = g_new(gdouble, (gsize) threads * BATCHES);
+    guint64   iters = calibrate(fn, state);
+    guint64   allocs = 0;
+    guint64   t0 = 0;
+    gdouble   wall = 0;
+    guint     i = 0;
+
+    for ( i = 0; i < threads; i++ ) {
+        workers[i].fn = fn;
+        workers[i].state = state;
+        workers[i].iters = iters;
+        workers[i].samples = all + (gsize) i * BATCHES;
+    }
+    t0 = now_ns();
+    if ( 1 == threads ) {
+        run_batches(workers);
+    } else {
+        for ( i = 0; i < threads; i++ ) {
+            handles[i] = g_thread_new(name, run_batches, workers + i);
+        }
+        for ( i = 0; i < threads; i++ ) {
+            g_thread_join(handles[i]);
+        }
+    }
+    /* includes warm-up, which runs the same work */
+    wall = (gdouble) (now_ns() - t0) / ((gdouble) iters * (BATCHES + WARMUP) * threads);
+    for ( i = 0; i < threads; i++ ) {
+        allocs += workers[i].allocs;
+    }
+    qsort(all, (gsize) threads * BATCHES, sizeof(gdouble), cmp_double);
+
+    g_print("{\"bench\":\"%s\",\"variant\":\"%s\",\"threads\":%u,\"iters\":%" G_GUINT64_FORMAT
+            ",\"ns_op\":%.1f,\"p50\":%.1f,\"p99\":%.1f,\"allocs_op\":",
+        name, variant, threads, iters * BATCHES * threads, wall,
+        all[threads * BATCHES / 2], all[threads * BATCHES * 99 / 100]);
+    if ( COUNTS_ALLOCS ) {
+        g_print("%.2f}\n", (gdouble) allocs / ((gdouble) iters * BATCHES * threads));
+    } else {
+        g_print("null}\n");
+    }
+
+    g_free(all);
+    g_free(handles);
+    g_free(workers);
+}
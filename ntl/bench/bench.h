@@ -0,0 +1,49 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef __bench_h_
+#define __bench_h_
+
+/*
+ * A small microbenchmark harness. Each benchmark runs in timed
+ * batches after calibration and warm-up, and reports one JSON object
+ * per line on stdout: wall ns/op over the whole run (across all
+ * threads), p50/p99 of the per-op cost of each batch, and heap
+ * allocations per op.
+ *
+ * This header must not include ntlc.h or ntll.h; the benchmarks for
+ * each library live in separate files since both headers define the
+ * trace levels.
+ */
+
+#include <glib.h>
+
+typedef void (*bench_func)(gpointer state, guint64 iters);
+
+void     bench_select(const gchar* substring);
+gboolean bench_selected(const gchar* name);
+void     bench_run(const gchar* name, const gchar* variant, guint threads, bench_func fn, gpointer state);
+
+guint64  bench_allocs(void);
+
+void     bench_trace(void);
+void     bench_span(void);
+void     bench_decode(void);
+void     bench_time_format(void);
+void     bench_template(void);
+
+#endif
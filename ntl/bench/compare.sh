@@ -0,0 +1,40 @@
+#  Part of "NTL" - a simple network logging system
+#
+#  Copyright 2011 Don Kelly <karfai@gmail.com>
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+
+#!/bin/bash
+# usage: compare.sh <before.jsonl> <after.jsonl>
+# prints the ns/op and allocs/op of each benchmark in both runs
+awk '
+function field(line, k,    m) {
+    if ( match(line, "\"" k "\":(\"[^\"]*\"|[^,}]*)") ) {
+        m = substr(line, RSTART + length(k) + 3, RLENGTH - length(k) - 3)
+        gsub(/"/, "", m)
+        return m
+    }
+    return ""
+}
+{
+    key = field($0, "bench") "/" field($0, "variant") "/" field($0, "threads")
+    if ( FNR == NR ) {
+        ns[key] = field($0, "ns_op"); al[key] = field($0, "allocs_op")
+        next
+    }
+    if ( key in ns ) {
+        now = field($0, "ns_op")
+        printf "%-28s %10.1f -> %10.1f ns/op (%+6.1f%%)  %s -> %s allocs/op\n", \
+            key, ns[key], now, (now - ns[key]) * 100 / ns[key], al[key], field($0, "allocs_op")
+    }
+}' "$1" "$2"
@@ -0,0 +1,145 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "bench.h"
+
+#include "ntll.h"
+#include <string.h>
+
+/*
+ * The listener side: decoding packets of increasing message size,
+ * formatting the time and rendering through the output templates.
+ */
+
+/* private */
+static gchar* make_packet(gsize msg_len)
+{
+    gchar* msg = g_strnfill(msg_len, 'x');
+    gchar* rv = g_strdup_printf(
+        "{ pn:bench, pid:4242, tid:4243, tl:1, tm:1300000000, millis:123, tag:bench, mod:bench_mod, fn:bench_fn, msg:%s }",
+        msg);
+    g_free(msg);
+    return rv;
+}
+
+static ntl_Packet* sample_packet(void)
+{
+    gchar*      s = make_packet(64);
+    ntl_Packet* rv = ntl_packet_decode(s);
+    g_free(s);
+    return rv;
+}
+
+static void decode(gpointer state, guint64 iters)
+{
+    guint64 i = 0;
+    for ( i = 0; i < iters; i++ ) {
+        ntl_packet_free(ntl_packet_decode((const char*) state));
+    }
+}
+
+static void time_format(gpointer state, guint64 iters)
+{
+    guint64 i = 0;
+    for ( i = 0; i < iters; i++ ) {
+        g_free(ntl_listener_default_time_format((const ntl_Packet*) state));
+    }
+}
+
+typedef struct {
+    const ntl_Template* tmpl;
+    const ntl_Packet*   pkt;
+    GString*            out;
+} RenderState;
+
+static void time_append(gpointer state, guint64 iters)
+{
+    RenderState* rs = (RenderState*) state;
+    guint64      i = 0;
+    for ( i = 0; i < iters; i++ ) {
+        g_string_truncate(rs->out, 0);
+        ntl_listener_default_time_append(rs->out, rs->pkt);
+    }
+}
+
+static void render(gpointer state, guint64 iters)
+{
+    RenderState* rs = (RenderState*) state;
+    guint64      i = 0;
+    for ( i = 0; i < iters; i++ ) {
+        g_string_truncate(rs->out, 0);
+        ntl_template_render(rs->tmpl, rs->out, rs->pkt);
+    }
+}
+
+/* public */
+void bench_decode(void)
+{
+    gsize sizes[] = { 16, 256, 4096 };
+    guint i = 0;
+
+    if ( !bench_selected("decode") ) {
+        return;
+    }
+    for ( i = 0; i < G_N_ELEMENTS(sizes); i++ ) {
+        gchar* pkt = make_packet(sizes[i]);
+        gchar* variant = g_strdup_printf("msg=%" G_GSIZE_FORMAT, sizes[i]);
+        bench_run("decode", variant, 1, decode, pkt);
+        g_free(variant);
+        g_free(pkt);
+    }
+}
+
+void bench_time_format(void)
+{
+    RenderState rs;
+
+    if ( !bench_selected("time_format") ) {
+        return;
+    }
+    rs.tmpl = NULL;
+    rs.pkt = sample_packet();
+    rs.out = g_string_sized_new(64);
+    bench_run("time_format", "alloc", 1, time_format, (gpointer) rs.pkt);
+    bench_run("time_format", "append", 1, time_append, &rs);
+    ntl_packet_free((ntl_Packet*) rs.pkt);
+    g_string_free(rs.out, TRUE);
+}
+
+void bench_template(void)
+{
+    const gchar*  names[] = { "text", "json", "logfmt" };
+    ntl_Template* tmpls[3];
+    RenderState   rs;
+    guint         i = 0;
+
+    if ( !bench_selected("template") ) {
+        return;
+    }
+    tmpls[0] = ntl_template_compile(NTL_TEMPLATE_DEFAULT);
+    tmpls[1] = ntl_template_json();
+    tmpls[2] = ntl_template_logfmt();
+    rs.pkt = sample_packet();
+    rs.out = g_string_sized_new(256);
+    for ( i = 0; i < G_N_ELEMENTS(names); i++ ) {
+        rs.tmpl = tmpls[i];
+        bench_run("template", names[i], 1, render, &rs);
+        ntl_template_free(tmpls[i]);
+    }
+    ntl_packet_free((ntl_Packet*) rs.pkt);
+    g_string_free(rs.out, TRUE);
+}
@@ -0,0 +1,39 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "bench.h"
+
+/*
+ * Runs every benchmark, or those whose name contains argv[1]. Output
+ * is one JSON object per line; see run_bench.sh for keeping results
+ * per commit.
+ */
+
+int main(int argc, char* argv[])
+{
+    if ( argc > 1 ) {
+        bench_select(argv[1]);
+    }
+
+    bench_trace();
+    bench_span();
+    bench_decode();
+    bench_time_format();
+    bench_template();
+
+    return 0;
+}
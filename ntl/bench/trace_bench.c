@@ -0,0 +1,96 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "bench.h"
+
+#include "ntlc.h"
+
+/*
+ * ntl_trace() against a send function which discards the packet, so
+ * only formatting is measured.
+ */
+
+/* private */
+static void discard(const char* pkt)
+{
+}
+
+static void fixed_timestamp(time_t* tm, long* millis)
+{
+    *tm = 1300000000;
+    *millis = 123;
+}
+
+static void trace_fixed(gpointer state, guint64 iters)
+{
+    guint64 i = 0;
+    for ( i = 0; i < iters; i++ ) {
+        ntl_trace(ntl_tl_Debug, "bench", "bench", __FUNCTION__, "a short message");
+    }
+}
+
+static void trace_args(gpointer state, guint64 iters)
+{
+    guint64 i = 0;
+    for ( i = 0; i < iters; i++ ) {
+        ntl_trace(ntl_tl_Warn, "bench", "bench", __FUNCTION__, "request %s took %lu ms (attempt %i)", "GET /index", (unsigned long) i, 3);
+    }
+}
+
+static void span(gpointer state, guint64 iters)
+{
+    guint64 i = 0;
+    for ( i = 0; i < iters; i++ ) {
+        ntl_SpanId outer = ntl_span_begin("bench.outer");
+        ntl_span_end(ntl_span_begin("bench.inner"));
+        ntl_span_end(outer);
+    }
+}
+
+/* public */
+void bench_trace(void)
+{
+    guint threads[] = { 1, 2, 4, 8 };
+    guint i = 0;
+
+    if ( !bench_selected("trace") ) {
+        return;
+    }
+    ntl_setup_override("bench", discard, fixed_timestamp);
+    bench_run("trace", "fixed", 1, trace_fixed, NULL);
+    for ( i = 0; i < G_N_ELEMENTS(threads); i++ ) {
+        bench_run("trace", "args", threads[i], trace_args, NULL);
+    }
+    ntl_teardown();
+}
+
+void bench_span(void)
+{
+    guint threads[] = { 1, 4 };
+    guint i = 0;
+
+    if ( !bench_selected("span") ) {
+        return;
+    }
+    ntl_setup_override("bench", discard, fixed_timestamp);
+    ntl_span_configure(1000, 0);
+    for ( i = 0; i < G_N_ELEMENTS(threads); i++ ) {
+        /* two spans per op */
+        bench_run("span", "nested", threads[i], span, NULL);
+    }
+    ntl_teardown();
+}
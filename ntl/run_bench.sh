@@ -0,0 +1,20 @@
+#  Part of "NTL" - a simple network logging system
+#
+#  Copyright 2011 Don Kelly <karfai@gmail.com>
+#
+#  Licensed under the Apache License, Version 2.0 (the "License");
+#  you may not use this file except in compliance with the License.
+#  You may obtain a copy of the License at
+#
+#      http://www.apache.org/licenses/LICENSE-2.0
+#
+#  Unless required by applicable law or agreed to in writing, software
+#  distributed under the License is distributed on an "AS IS" BASIS,
+#  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+#  See the License for the specific language governing permissions and
+#  limitations under the License.
+
+#!/bin/bash
+# usage: run_bench.sh [name filter]
+# writes bench-<commit>.jsonl; compare two runs with bench/compare.sh
+./build.sh && ./bench/all_benches "$@" | tee "bench-$(git rev-parse --short HEAD).jsonl"
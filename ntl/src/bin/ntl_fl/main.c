@@ -19,6 +19,9 @@
 #include <gnet.h>
 #include <stdio.h>
 #include "ntll.h"
+#include "ntl_archive.h"
+#include "ntl_writer.h"
+#include "ntl_shard.h"
 
 #include <stdlib.h>
 #include <string.h>
@@ -26,42 +29,234 @@
 
 /* a listener that writes to stdout or to a file */
 
-static ntl_Listener* ltner = NULL;
-static GIOChannel*   chan = NULL;
+static ntl_Listener*      ltner = NULL;
+static ntl_Writer*        writer = NULL;
+static ntl_Template*      tmpl = NULL;
+static ntl_ArchiveWriter* archive = NULL;
+static ntl_Sharder*       sharder = NULL;
+
+static gint          buffer_kb = 0;
+static gint          flush_ms = 0;
+static gchar*        sync_policy = NULL;
+static gint          sync_ms = 0;
+static gint          rotate_mb = 0;
+static gint          rotate_secs = 0;
+static gboolean      compress = FALSE;
+static gboolean      index_segments = FALSE;
+static gint          keep_count = 0;
+static gint          keep_mb = 0;
+static gchar*        format = NULL;
+static gchar*        template_spec = NULL;
+static gboolean      archive_mode = FALSE;
+static gint          block_rows = 0;
+static gboolean      dedup = FALSE;
+static gboolean      rollup = FALSE;
+static gboolean      zlib = FALSE;
+static gboolean      order = FALSE;
+static gchar*        shm_path = NULL;
+static gchar*        shard_by = NULL;
+static gint          writers = 4;
+static gint          max_shards = 256;
+static gchar**       shard_dirs = NULL;
+static gchar**       files = NULL;
+
+static GOptionEntry entries[] = {
+    { "format", 'o', 0, G_OPTION_ARG_STRING, &format, "Output format: text, json or logfmt (default: text)", "FORMAT" },
+    { "template", 't', 0, G_OPTION_ARG_STRING, &template_spec, "Output template, e.g. \"%{time} %{tag}: %{msg}\"", "TEMPLATE" },
+    { "buffer-size", 'b', 0, G_OPTION_ARG_INT, &buffer_kb, "Flush after this many KiB are pending (default: 1024)", "KB" },
+    { "flush-interval", 'f', 0, G_OPTION_ARG_INT, &flush_ms, "Flush pending lines at least this often (default: 200)", "MS" },
+    { "sync", 's', 0, G_OPTION_ARG_STRING, &sync_policy, "Durability policy: none, periodic or batch (default: none)", "POLICY" },
+    { "sync-interval", 0, 0, G_OPTION_ARG_INT, &sync_ms, "Interval for the periodic policy (default: 1000)", "MS" },
+    { "rotate-size", 0, 0, G_OPTION_ARG_INT, &rotate_mb, "Start a new segment after this many MiB", "MB" },
+    { "rotate-interval", 0, 0, G_OPTION_ARG_INT, &rotate_secs, "Start a new segment every SECS seconds of wall-clock time", "SECS" },
+    { "compress", 'z', 0, G_OPTION_ARG_NONE, &compress, "Compress closed segments with gzip in the background", NULL },
+    { "index", 'x', 0, G_OPTION_ARG_NONE, &index_segments, "Index the messages of closed segments for ntl_query in the background (default template only)", NULL },
+    { "keep", 0, 0, G_OPTION_ARG_INT, &keep_count, "Keep at most this many closed segments, of each shard with --shard-by", "N" },
+    { "keep-size", 0, 0, G_OPTION_ARG_INT, &keep_mb, "Keep at most this many MiB of closed segments, of each shard with --shard-by", "MB" },
+    { "archive", 'a', 0, G_OPTION_ARG_NONE, &archive_mode, "Write a columnar, compressed archive instead of text (not rotated)", NULL },
+    { "block-rows", 0, 0, G_OPTION_ARG_INT, &block_rows, "Traces per archive block (default: 4096)", "N" },
+    { "shard-by", 0, 0, G_OPTION_ARG_STRING, &shard_by, "Write a file per prog or tag, FILE.VALUE, from a pool of writer threads", "prog|tag" },
+    { "writers", 0, 0, G_OPTION_ARG_INT, &writers, "Writer threads for --shard-by (default: 4)", "N" },
+    { "max-shards", 0, 0, G_OPTION_ARG_INT, &max_shards, "Shards open at once, closing the longest idle first; 0 for no limit (default: 256)", "N" },
+    { "shard-dir", 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &shard_dirs, "Spread the shards over these directories, one per writer thread in turn; repeatable", "DIR" },
+    { "dedup", 'd', 0, G_OPTION_ARG_NONE, &dedup, "Have ntld replace runs of repeated traces with a summary", NULL },
+    { "rollup", 'r', 0, G_OPTION_ARG_NONE, &rollup, "Write only ntld's per-window counts by prog, tag and level", NULL },
+    { "order", 'O', 0, G_OPTION_ARG_NONE, &order, "Have ntld send traces in time order, within its reorder window", NULL },
+    { "zlib", 0, 0, G_OPTION_ARG_NONE, &zlib, "Have ntld compress the traces it sends", NULL },
+    { "shm", 0, 0, G_OPTION_ARG_FILENAME, &shm_path, "Read every trace from the ring a local ntld --shm publishes to FILE", "FILE" },
+    { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &files, NULL, "[FILE]" },
+    { NULL }
+};
 
 static void write_log(const ntl_Packet* pkt, gpointer d)
 {
-    gsize       wrote = 0;
-    gchar*      ln = NULL;
-    gchar*      tm = ntl_listener_default_time_format(pkt);
+    ntl_template_render(tmpl, ntl_writer_buffer(writer), pkt);
+    ntl_writer_commit(writer);
+}
+
+static void write_archive(const ntl_Packet* pkt, gpointer d)
+{
+    ntl_archive_writer_append(archive, pkt);
+}
 
-    ln = g_strdup_printf("[%s] [%s] [%s, %u, %u] [%s] [%s/%s]: %s\n",
-        pkt->tag, ntl_level_to_string(pkt->lvl),
-        pkt->prog, pkt->pid, pkt->tid,
-        tm, pkt->mod, pkt->fn, pkt->msg);
-    g_io_channel_write_chars(chan, ln, strlen(ln), &wrote, NULL);
-    g_io_channel_flush(chan, NULL);
-    g_free(tm);
-    g_free(ln);
+static void write_shard(const ntl_Packet* pkt, gpointer d)
+{
+    ntl_sharder_push(sharder, pkt);
 }
 
-void open_channel(const gchar* fn)
+static gboolean compile_template(void)
 {
-    if ( fn ) {
-        chan = g_io_channel_new_file(fn, "a", NULL);
+    if ( template_spec ) {
+        tmpl = ntl_template_compile(template_spec);
+    } else if ( NULL == format || 0 == g_strcmp0(format, "text") ) {
+        tmpl = ntl_template_compile(NTL_TEMPLATE_DEFAULT);
+    } else if ( 0 == g_strcmp0(format, "json") ) {
+        tmpl = ntl_template_json();
+    } else if ( 0 == g_strcmp0(format, "logfmt") ) {
+        tmpl = ntl_template_logfmt();
     } else {
-        chan = g_io_channel_unix_new(fileno(stdout));
+        g_printerr("unknown format: %s\n", format);
+        return FALSE;
+    }
+    if ( NULL == tmpl ) {
+        g_printerr("invalid template: %s\n", template_spec);
+        return FALSE;
     }
+    return TRUE;
+}
+
+/* the index finds messages by the "]: " which only it puts before them */
+static gboolean default_template(void)
+{
+    return (NULL == template_spec || 0 == strcmp(template_spec, NTL_TEMPLATE_DEFAULT))
+        && (NULL == format || 0 == g_strcmp0(format, "text"));
+}
+
+static gboolean flush_timeout(gpointer d)
+{
+    ntl_writer_tick(writer);
+    return TRUE;
+}
+
+static gboolean writer_config(ntl_WriterConfig* cfg)
+{
+    ntl_writer_config_init(cfg);
+    if ( buffer_kb > 0 ) {
+        cfg->buffer_size = (gsize) buffer_kb * 1024;
+    }
+    if ( flush_ms > 0 ) {
+        cfg->flush_ms = flush_ms;
+    }
+    if ( sync_ms > 0 ) {
+        cfg->sync_ms = sync_ms;
+    }
+    cfg->rotate_bytes = (guint64) MAX(rotate_mb, 0) * 1024 * 1024;
+    cfg->rotate_secs = MAX(rotate_secs, 0);
+    cfg->compress = compress;
+    cfg->index = index_segments;
+    cfg->keep_count = MAX(keep_count, 0);
+    cfg->keep_bytes = (guint64) MAX(keep_mb, 0) * 1024 * 1024;
+    if ( sync_policy && !ntl_writer_sync_from_string(sync_policy, &cfg->sync) ) {
+        g_printerr("unknown sync policy: %s\n", sync_policy);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean open_writer(const gchar* fn)
+{
+    ntl_WriterConfig cfg;
+
+    if ( !writer_config(&cfg) ) {
+        return FALSE;
+    }
+    writer = ntl_writer_new(fn, &cfg);
+    if ( NULL == writer ) {
+        g_printerr("failed to open %s\n", fn);
+        return FALSE;
+    }
+    g_timeout_add(MIN(cfg.flush_ms, cfg.sync_ms), flush_timeout, NULL);
+    return TRUE;
+}
+
+static gboolean archive_timeout(gpointer d)
+{
+    /* bound how long a quiet stream keeps traces in a partial block */
+    ntl_archive_writer_flush(archive);
+    return TRUE;
+}
+
+static gboolean open_archive(const gchar* fn)
+{
+    if ( NULL == fn ) {
+        g_printerr("an archive needs a file name\n");
+        return FALSE;
+    }
+    archive = ntl_archive_writer_new(fn, MAX(block_rows, 0));
+    if ( NULL == archive ) {
+        g_printerr("failed to open %s\n", fn);
+        return FALSE;
+    }
+    g_timeout_add_seconds(10, archive_timeout, NULL);
+    return TRUE;
+}
+
+static gboolean open_sharder(const gchar* fn)
+{
+    ntl_ShardConfig cfg;
+
+    if ( NULL == fn ) {
+        g_printerr("shards need a file name\n");
+        return FALSE;
+    }
+    if ( !ntl_shard_key_from_string(shard_by, &cfg.key) ) {
+        g_printerr("unknown shard key: %s\n", shard_by);
+        return FALSE;
+    }
+    if ( !writer_config(&cfg.writer) ) {
+        return FALSE;
+    }
+    cfg.threads = MAX(writers, 1);
+    if ( max_shards > 0 && (guint) max_shards < cfg.threads ) {
+        g_printerr("--max-shards must be at least --writers, so every writer can keep a shard open\n");
+        return FALSE;
+    }
+    cfg.dirs = shard_dirs;
+    cfg.tmpl = tmpl;
+    cfg.archive = archive_mode;
+    cfg.block_rows = MAX(block_rows, 0);
+    cfg.max_open = MAX(max_shards, 0);
+    sharder = ntl_sharder_new(fn, &cfg);
+    return TRUE;
+}
+
+static ntl_listener_pkt_func packet_sink(void)
+{
+    if ( sharder ) {
+        return write_shard;
+    }
+    return archive ? write_archive : write_log;
 }
 
 void connect_listener(void)
 {
-    ltner = ntl_listener_new("localhost", write_log, NULL);
+    guint sub = (dedup ? ntl_sub_Dedup : 0) | (rollup ? ntl_sub_Rollup : 0) | (zlib ? ntl_sub_Compress : 0)
+        | (order ? ntl_sub_Order : 0);
+    if ( shm_path ) {
+        ltner = ntl_listener_new_shm(shm_path, packet_sink(), NULL);
+    } else {
+        ltner = ntl_listener_new_full("localhost", sub, packet_sink(), NULL);
+    }
 }
 
 static void cleanup(void)
 {
     ntl_listener_free(ltner);
+    /* drains the shards' queues, so before the template goes */
+    ntl_sharder_free(sharder);
+    ntl_writer_free(writer);
+    ntl_archive_writer_free(archive);
+    ntl_template_free(tmpl);
 }
 
 static void sig_interrupt(int sign)
@@ -81,17 +276,49 @@ static void run_main_event_loop()
 
 int main(int argc, char* argv[])
 {
-    gchar* fn = NULL;
-    
-    if ( argc > 1 ) {
-        fn = argv[1];
+    GError*         err = NULL;
+    GOptionContext* ctx = g_option_context_new("- write NTL traces to a file");
+
+    g_option_context_add_main_entries(ctx, entries, NULL);
+    if ( !g_option_context_parse(ctx, &argc, &argv, &err) ) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(ctx);
+
+    if ( !compile_template() ) {
+        return EXIT_FAILURE;
+    }
+    if ( index_segments && !default_template() ) {
+        g_printerr("--index only reads segments in the default text template; it cannot be combined with --template or --format\n");
+        return EXIT_FAILURE;
+    }
+    if ( archive_mode && (rotate_mb || rotate_secs || keep_count || keep_mb || compress || index_segments
+            || template_spec || format) ) {
+        g_printerr("an archive is neither rotated nor rendered; --archive cannot be combined with --rotate-size, "
+            "--rotate-interval, --keep, --keep-size, --compress, --index, --template or --format\n");
+        return EXIT_FAILURE;
+    }
+    if ( shm_path && (dedup || rollup || zlib || order) ) {
+        g_printerr("the shared ring carries every trace as sent; it cannot be combined with --dedup, --rollup, --zlib or --order\n");
+        return EXIT_FAILURE;
     }
 
     gnet_init();
-    open_channel(fn);
+    if ( shard_by ) {
+        if ( !open_sharder(files ? files[0] : NULL) ) {
+            return EXIT_FAILURE;
+        }
+    } else if ( archive_mode ) {
+        if ( !open_archive(files ? files[0] : NULL) ) {
+            return EXIT_FAILURE;
+        }
+    } else if ( !open_writer(files ? files[0] : NULL) ) {
+        return EXIT_FAILURE;
+    }
     connect_listener();
     run_main_event_loop();
 
     return EXIT_SUCCESS;
 }
-
@@ -0,0 +1,335 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "ntl_rotate.h"
+
+#include "ntl_trigram.h"
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/*
+ * Closed segments are queued to a single worker thread. The worker
+ * indexes each one for ntl_query (see ntl_trigram.h), compresses it
+ * to <segment>.gz (via a temporary file so a reader never sees a
+ * partial archive) and then trims the oldest segments, and their
+ * indexes, until the retention limits are met.
+ */
+
+struct _s_ntl_rotator {
+    gchar*       dir;
+    gchar*       base;     /* live file name; segments are base.<stamp>[.gz] */
+    gboolean     compress;
+    gboolean     index;
+    guint        keep_count;
+    guint64      keep_bytes;
+    GAsyncQueue* queue;
+    GThread*     thread;
+    time_t       last_stamp; /* of the last segment named, and */
+    guint        last_seq;   /* its sequence within that second */
+};
+
+/* a segment is cut into at most this many blocks of at least this size */
+#define INDEX_BLOCKS    1024
+#define INDEX_BLOCK_MIN (256 * 1024)
+
+/* segment names are <base>.YYYYmmdd-HHMMSS[.N][.gz] */
+#define STAMP_FORMAT "%Y%m%d-%H%M%S"
+#define STAMP_LEN    15
+
+typedef struct {
+    gchar*       path;
+    const gchar* stamp; /* within path */
+    guint        seq;   /* the .N suffix of a name reused within a second */
+    guint64      size;
+} Segment;
+
+/* private */
+static gboolean compress_segment(const gchar* path)
+{
+    gchar*   tmp = g_strdup_printf("%s.gz.tmp", path);
+    gchar*   dst = g_strdup_printf("%s.gz", path);
+    gboolean rv = FALSE;
+    int      fd = open(path, O_RDONLY);
+    gzFile   gz = NULL;
+
+    if ( fd >= 0 ) {
+        gz = gzopen(tmp, "wb6");
+    }
+    if ( gz ) {
+        gchar   buf[64 * 1024];
+        ssize_t n = 0;
+
+        rv = TRUE;
+        while ( (n = read(fd, buf, sizeof(buf))) != 0 ) {
+            if ( n < 0 ) {
+                if ( EINTR == errno ) {
+                    continue;
+                }
+                rv = FALSE;
+                break;
+            }
+            if ( gzwrite(gz, buf, n) != n ) {
+                rv = FALSE;
+                break;
+            }
+        }
+        if ( Z_OK != gzclose(gz) ) {
+            rv = FALSE;
+        }
+        if ( rv && 0 == rename(tmp, dst) ) {
+            unlink(path);
+        } else {
+            unlink(tmp);
+            rv = FALSE;
+        }
+    }
+    if ( fd >= 0 ) {
+        close(fd);
+    }
+    g_free(tmp);
+    g_free(dst);
+    return rv;
+}
+
+static gboolean index_segment(const gchar* path)
+{
+    ntl_TrigramBuilder* b = NULL;
+    gboolean            rv = TRUE;
+    struct stat         st;
+    int                 fd = open(path, O_RDONLY);
+
+    if ( fd < 0 || 0 != fstat(fd, &st) ) {
+        if ( fd >= 0 ) {
+            close(fd);
+        }
+        return FALSE;
+    }
+    b = ntl_trigram_builder_new(MAX(INDEX_BLOCK_MIN, st.st_size / INDEX_BLOCKS));
+    while ( TRUE ) {
+        gchar   buf[64 * 1024];
+        ssize_t n = read(fd, buf, sizeof(buf));
+        if ( 0 == n ) {
+            break;
+        }
+        if ( n < 0 ) {
+            if ( EINTR == errno ) {
+                continue;
+            }
+            rv = FALSE;
+            break;
+        }
+        ntl_trigram_builder_add(b, buf, n);
+    }
+    close(fd);
+    if ( rv ) {
+        gchar* fn = ntl_trigram_index_name(path);
+        rv = ntl_trigram_builder_write(b, fn);
+        g_free(fn);
+    }
+    ntl_trigram_builder_free(b);
+    return rv;
+}
+
+static gint compare_segments(gconstpointer a, gconstpointer b)
+{
+    const Segment* sa = *((const Segment**) a);
+    const Segment* sb = *((const Segment**) b);
+    gint           rv = strncmp(sa->stamp, sb->stamp, STAMP_LEN);
+
+    if ( 0 == rv ) {
+        rv = (sa->seq > sb->seq) - (sa->seq < sb->seq);
+    }
+    return rv;
+}
+
+static void free_segment(gpointer d)
+{
+    Segment* s = (Segment*) d;
+    g_free(s->path);
+    g_free(s);
+}
+
+static gboolean segment_exists(const gchar* path)
+{
+    gchar*   gz = g_strdup_printf("%s.gz", path);
+    gboolean rv = g_file_test(path, G_FILE_TEST_EXISTS) || g_file_test(gz, G_FILE_TEST_EXISTS);
+    g_free(gz);
+    return rv;
+}
+
+/* exactly <base>.YYYYmmdd-HHMMSS[.N][.gz], so that another shard's
+ * segments, as base.v1.2's are to base.v1, never match */
+static gboolean is_segment(const ntl_Rotator* r, const gchar* name)
+{
+    gsize        len = strlen(r->base);
+    const gchar* p = name + len + 1;
+    guint        i = 0;
+
+    if ( 0 != strncmp(name, r->base, len) || '.' != name[len] ) {
+        return FALSE;
+    }
+    for ( i = 0; i < STAMP_LEN; i++ ) {
+        if ( 8 == i ? '-' != p[i] : !g_ascii_isdigit(p[i]) ) {
+            return FALSE;
+        }
+    }
+    p += STAMP_LEN;
+    if ( '.' == *p && g_ascii_isdigit(p[1]) ) {
+        for ( p++; g_ascii_isdigit(*p); p++ ) {
+        }
+    }
+    return '\0' == *p || 0 == strcmp(p, ".gz");
+}
+
+static void apply_retention(ntl_Rotator* r)
+{
+    GDir*        d = NULL;
+    GPtrArray*   segs = NULL;
+    const gchar* name = NULL;
+    guint64      total = 0;
+    guint        i = 0;
+
+    if ( 0 == r->keep_count && 0 == r->keep_bytes ) {
+        return;
+    }
+    d = g_dir_open(r->dir, 0, NULL);
+    if ( NULL == d ) {
+        return;
+    }
+
+    segs = g_ptr_array_new_with_free_func(free_segment);
+    while ( (name = g_dir_read_name(d)) ) {
+        if ( is_segment(r, name) ) {
+            struct stat st;
+            Segment*    s = g_new(Segment, 1);
+            s->path = g_build_filename(r->dir, name, NULL);
+            s->stamp = s->path + strlen(s->path) - strlen(name) + strlen(r->base) + 1;
+            s->seq = ('.' == s->stamp[STAMP_LEN] && g_ascii_isdigit(s->stamp[STAMP_LEN + 1]))
+                ? strtoul(s->stamp + STAMP_LEN + 1, NULL, 10) : 0;
+            s->size = (0 == stat(s->path, &st)) ? st.st_size : 0;
+            total += s->size;
+            g_ptr_array_add(segs, s);
+        }
+    }
+    g_dir_close(d);
+
+    /* segment names embed their rotation time, then a sequence within the second */
+    g_ptr_array_sort(segs, compare_segments);
+    for ( i = 0; i < segs->len; i++ ) {
+        Segment* s = (Segment*) g_ptr_array_index(segs, i);
+        gboolean over_count = r->keep_count && segs->len - i > r->keep_count;
+        gboolean over_bytes = r->keep_bytes && total > r->keep_bytes;
+
+        if ( !over_count && !over_bytes ) {
+            break;
+        }
+        unlink(s->path);
+        {
+            gchar* idx = ntl_trigram_index_name(s->path);
+            unlink(idx);
+            g_free(idx);
+        }
+        total -= s->size;
+    }
+    g_ptr_array_free(segs, TRUE);
+}
+
+static gpointer run(gpointer d)
+{
+    ntl_Rotator* r = (ntl_Rotator*) d;
+
+    while ( TRUE ) {
+        gpointer seg = g_async_queue_pop(r->queue);
+        if ( seg == (gpointer) r ) {
+            break;
+        }
+        if ( r->index ) {
+            index_segment((const gchar*) seg);
+        }
+        if ( r->compress ) {
+            compress_segment((const gchar*) seg);
+        }
+        apply_retention(r);
+        g_free(seg);
+    }
+    return NULL;
+}
+
+/* public */
+ntl_Rotator* ntl_rotator_new(const gchar* fn, gboolean compress, gboolean index, guint keep_count, guint64 keep_bytes)
+{
+    ntl_Rotator* rv = g_new(ntl_Rotator, 1);
+    rv->dir = g_path_get_dirname(fn);
+    rv->base = g_path_get_basename(fn);
+    rv->compress = compress;
+    rv->index = index;
+    rv->keep_count = keep_count;
+    rv->keep_bytes = keep_bytes;
+    rv->queue = g_async_queue_new();
+    rv->last_stamp = 0;
+    rv->last_seq = 0;
+    rv->thread = g_thread_new("ntl_rotator", run, rv);
+    return rv;
+}
+
+gchar* ntl_rotator_segment_name(ntl_Rotator* r, const gchar* fn, time_t t)
+{
+    struct tm tm;
+    char      stamp[32];
+    gchar*    rv = NULL;
+    guint     n = 0;
+
+    /* an earlier segment of the same second may since have been
+     * compressed or trimmed, so its name is no guide to the next */
+    if ( t == r->last_stamp ) {
+        n = r->last_seq + 1;
+    }
+    localtime_r(&t, &tm);
+    strftime(stamp, sizeof(stamp), STAMP_FORMAT, &tm);
+    rv = n ? g_strdup_printf("%s.%s.%u", fn, stamp, n) : g_strdup_printf("%s.%s", fn, stamp);
+    while ( segment_exists(rv) ) {
+        g_free(rv);
+        rv = g_strdup_printf("%s.%s.%u", fn, stamp, ++n);
+    }
+    r->last_stamp = t;
+    r->last_seq = n;
+    return rv;
+}
+
+void ntl_rotator_submit(ntl_Rotator* r, gchar* segment)
+{
+    g_async_queue_push(r->queue, segment);
+}
+
+void ntl_rotator_free(ntl_Rotator* r)
+{
+    if ( r ) {
+        /* the rotator itself is the stop marker; pending segments drain first */
+        g_async_queue_push(r->queue, r);
+        g_thread_join(r->thread);
+        g_async_queue_unref(r->queue);
+        g_free(r->dir);
+        g_free(r->base);
+        g_free(r);
+    }
+}
@@ -0,0 +1,36 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef __ntl_rotate_h_
+#define __ntl_rotate_h_
+
+/*
+ * Background handling of closed log segments: indexing, compression
+ * and retention run on their own thread so that they never stall the
+ * thread receiving traces.
+ */
+
+#include <glib.h>
+
+typedef struct _s_ntl_rotator ntl_Rotator;
+
+ntl_Rotator* ntl_rotator_new(const gchar* fn, gboolean compress, gboolean index, guint keep_count, guint64 keep_bytes);
+gchar*       ntl_rotator_segment_name(ntl_Rotator* r, const gchar* fn, time_t t);
+void         ntl_rotator_submit(ntl_Rotator* r, gchar* segment);
+void         ntl_rotator_free(ntl_Rotator* r);
+
+#endif
@@ -0,0 +1,288 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "ntl_shard.h"
+
+#include <string.h>
+
+/*
+ * The receiving thread copies each packet and hands it to the thread
+ * owning its shard through a single-producer, single-consumer ring:
+ * the receiving thread only ever moves head and the worker tail, so
+ * neither takes a lock. A worker opens a shard on its first packet for
+ * it, and between packets ticks its shards' flush and sync timers. Each
+ * worker has an equal share of max_open; to open one more, it closes
+ * the shard it wrote to least recently, which also ends its rotator.
+ */
+
+/* private */
+#define RING_SIZE        8192 /* packets per worker */
+#define IDLE_US          1000
+#define TICK_US          (10 * 1000)
+#define ARCHIVE_FLUSH_US (10 * G_USEC_PER_SEC)
+
+typedef struct {
+    ntl_Writer*        text;
+    ntl_ArchiveWriter* archive;
+    guint64            used;  /* the worker's clock at its last packet */
+} Shard;
+
+typedef struct {
+    ntl_Sharder* owner;
+    guint        index;
+    GHashTable*  shards;   /* file name -> Shard*, only touched by the worker */
+    GThread*     thread;
+    guint        max_open; /* shards; 0 for no limit */
+    guint64      clock;    /* packets written */
+    ntl_Packet*  slots[RING_SIZE];
+    guint64      head;     /* moved only by the receiving thread */
+    guint8       pad[56];  /* keeps head and tail on their own cache lines */
+    guint64      tail;     /* moved only by the worker */
+} Worker;
+
+struct _s_ntl_sharder {
+    gchar*          fn;
+    ntl_ShardConfig cfg;
+    guint           n_dirs;
+    Worker**        workers;
+    GString*        name;  /* scratch, for the receiving thread */
+    gint            stopping;
+};
+
+/* the shard's part of its file name: the key, made safe to use as one */
+static void shard_name(const ntl_Sharder* s, const ntl_Packet* pkt, GString* out)
+{
+    const gchar* key = (ntl_sk_Tag == s->cfg.key) ? pkt->tag : pkt->prog;
+    const gchar* p = NULL;
+
+    g_string_truncate(out, 0);
+    for ( p = key ? key : ""; *p && out->len < 128; p++ ) {
+        g_string_append_c(out, (g_ascii_isalnum(*p) || '-' == *p || '_' == *p || '.' == *p) ? *p : '_');
+    }
+    if ( 0 == out->len || '.' == out->str[0] ) {
+        g_string_prepend_c(out, '_');
+    }
+}
+
+static void free_shard(gpointer d)
+{
+    Shard* sh = (Shard*) d;
+    ntl_writer_free(sh->text);
+    ntl_archive_writer_free(sh->archive);
+    g_free(sh);
+}
+
+static void close_idlest(Worker* w)
+{
+    GHashTableIter it;
+    gpointer       k = NULL;
+    gpointer       d = NULL;
+    gpointer       idlest = NULL;
+    guint64        used = G_MAXUINT64;
+
+    g_hash_table_iter_init(&it, w->shards);
+    while ( g_hash_table_iter_next(&it, &k, &d) ) {
+        if ( ((Shard*) d)->used < used ) {
+            used = ((Shard*) d)->used;
+            idlest = k;
+        }
+    }
+    if ( idlest ) {
+        /* flushes, and waits for its rotator */
+        g_hash_table_remove(w->shards, idlest);
+    }
+}
+
+static Shard* open_shard(Worker* w, const gchar* name)
+{
+    const ntl_Sharder* s = w->owner;
+    Shard*             rv = g_new0(Shard, 1);
+    gchar*             path = NULL;
+
+    if ( w->max_open && g_hash_table_size(w->shards) >= w->max_open ) {
+        close_idlest(w);
+    }
+    if ( s->n_dirs ) {
+        gchar* base = g_path_get_basename(s->fn);
+        gchar* file = g_strdup_printf("%s.%s", base, name);
+        path = g_build_filename(s->cfg.dirs[w->index % s->n_dirs], file, NULL);
+        g_free(file);
+        g_free(base);
+    } else {
+        path = g_strdup_printf("%s.%s", s->fn, name);
+    }
+    if ( s->cfg.archive ) {
+        rv->archive = ntl_archive_writer_new(path, s->cfg.block_rows);
+    } else {
+        rv->text = ntl_writer_new(path, &s->cfg.writer);
+    }
+    if ( NULL == rv->archive && NULL == rv->text ) {
+        /* its traces are dropped; say so once */
+        g_printerr("failed to open %s\n", path);
+    }
+    g_hash_table_insert(w->shards, g_strdup(name), rv);
+    g_free(path);
+    return rv;
+}
+
+static void write_packet(Worker* w, const ntl_Packet* pkt, GString* name)
+{
+    Shard* sh = NULL;
+
+    shard_name(w->owner, pkt, name);
+    sh = (Shard*) g_hash_table_lookup(w->shards, name->str);
+    if ( NULL == sh ) {
+        sh = open_shard(w, name->str);
+    }
+    sh->used = ++w->clock;
+    if ( sh->text ) {
+        ntl_template_render(w->owner->cfg.tmpl, ntl_writer_buffer(sh->text), pkt);
+        ntl_writer_commit(sh->text);
+    } else if ( sh->archive ) {
+        ntl_archive_writer_append(sh->archive, pkt);
+    }
+}
+
+static void tick(Worker* w, gboolean flush_archives)
+{
+    GHashTableIter it;
+    gpointer       d = NULL;
+
+    g_hash_table_iter_init(&it, w->shards);
+    while ( g_hash_table_iter_next(&it, NULL, &d) ) {
+        Shard* sh = (Shard*) d;
+        if ( sh->text ) {
+            ntl_writer_tick(sh->text);
+        } else if ( sh->archive && flush_archives ) {
+            /* bound how long a quiet shard keeps traces in a partial block */
+            ntl_archive_writer_flush(sh->archive);
+        }
+    }
+}
+
+static gpointer run(gpointer d)
+{
+    Worker*  w = (Worker*) d;
+    GString* name = g_string_sized_new(64);
+    gint64   last_tick = 0;
+    gint64   last_flush = g_get_monotonic_time();
+
+    while ( TRUE ) {
+        /* before head: once stopping, every packet is already pushed */
+        gboolean stopping = __atomic_load_n(&w->owner->stopping, __ATOMIC_ACQUIRE);
+        guint64  tail = w->tail;
+        guint64  head = __atomic_load_n(&w->head, __ATOMIC_ACQUIRE);
+        gboolean idle = (tail == head);
+        gint64   now = 0;
+
+        for ( ; tail < head; tail++ ) {
+            ntl_Packet* pkt = w->slots[tail % RING_SIZE];
+            write_packet(w, pkt, name);
+            ntl_packet_free(pkt);
+            __atomic_store_n(&w->tail, tail + 1, __ATOMIC_RELEASE);
+        }
+        now = g_get_monotonic_time();
+        if ( now - last_tick >= TICK_US ) {
+            gboolean flush = now - last_flush >= ARCHIVE_FLUSH_US;
+            tick(w, flush);
+            last_tick = now;
+            if ( flush ) {
+                last_flush = now;
+            }
+        }
+        if ( stopping ) {
+            break;
+        }
+        if ( idle ) {
+            g_usleep(IDLE_US);
+        }
+    }
+    g_string_free(name, TRUE);
+    return NULL;
+}
+
+/* public */
+gboolean ntl_shard_key_from_string(const gchar* s, ntl_ShardKeyT* key)
+{
+    if ( 0 == g_strcmp0(s, "prog") ) {
+        *key = ntl_sk_Prog;
+    } else if ( 0 == g_strcmp0(s, "tag") ) {
+        *key = ntl_sk_Tag;
+    } else {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+ntl_Sharder* ntl_sharder_new(const gchar* fn, const ntl_ShardConfig* cfg)
+{
+    ntl_Sharder* rv = g_new0(ntl_Sharder, 1);
+    guint        i = 0;
+
+    rv->fn = g_strdup(fn);
+    rv->cfg = *cfg;
+    rv->cfg.threads = MAX(cfg->threads, 1);
+    rv->n_dirs = cfg->dirs ? g_strv_length(cfg->dirs) : 0;
+    rv->name = g_string_sized_new(64);
+    rv->workers = g_new0(Worker*, rv->cfg.threads);
+    for ( i = 0; i < rv->cfg.threads; i++ ) {
+        Worker* w = g_new0(Worker, 1);
+        w->owner = rv;
+        w->index = i;
+        /* the first threads take the remainder of an uneven split */
+        w->max_open = cfg->max_open / rv->cfg.threads + (i < cfg->max_open % rv->cfg.threads);
+        w->max_open = cfg->max_open ? MAX(w->max_open, 1) : 0;
+        w->shards = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free_shard);
+        w->thread = g_thread_new("ntl_shard", run, w);
+        rv->workers[i] = w;
+    }
+    return rv;
+}
+
+void ntl_sharder_push(ntl_Sharder* s, const ntl_Packet* pkt)
+{
+    Worker* w = NULL;
+    guint64 head = 0;
+
+    shard_name(s, pkt, s->name);
+    w = s->workers[g_str_hash(s->name->str) % s->cfg.threads];
+    head = w->head;
+    while ( head - __atomic_load_n(&w->tail, __ATOMIC_ACQUIRE) >= RING_SIZE ) {
+        /* rather than drop a trace or reorder a shard */
+        g_usleep(IDLE_US);
+    }
+    w->slots[head % RING_SIZE] = ntl_packet_copy(pkt);
+    __atomic_store_n(&w->head, head + 1, __ATOMIC_RELEASE);
+}
+
+void ntl_sharder_free(ntl_Sharder* s)
+{
+    if ( s ) {
+        guint i = 0;
+        __atomic_store_n(&s->stopping, 1, __ATOMIC_RELEASE);
+        for ( i = 0; i < s->cfg.threads; i++ ) {
+            Worker* w = s->workers[i];
+            g_thread_join(w->thread);
+            g_hash_table_destroy(w->shards);
+            g_free(w);
+        }
+        g_free(s->workers);
+        g_string_free(s->name, TRUE);
+        g_free(s->fn);
+        g_free(s);
+    }
+}
@@ -0,0 +1,64 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef __ntl_shard_h_
+#define __ntl_shard_h_
+
+/*
+ * Output split by prog or tag into a file per value, written by a pool
+ * of threads. Each value always goes to the same thread, so the traces
+ * of a shard stay in the order they were received. Each shard is a
+ * writer of its own, so rotation and retention (keep_count, keep_bytes)
+ * apply to every shard separately. At most max_open shards are open at
+ * once; past that, a thread closes its longest idle shard to open
+ * another, which appends to the file when its value comes back.
+ */
+
+#include "ntll.h"
+#include "ntl_archive.h"
+#include "ntl_writer.h"
+#include <glib.h>
+
+typedef enum {
+    ntl_sk_Prog,
+    ntl_sk_Tag,
+} ntl_ShardKeyT;
+
+typedef struct {
+    ntl_ShardKeyT    key;
+    guint            threads;
+    gchar**          dirs;       /* spread over these, by thread; NULL for fn's own */
+    ntl_Template*    tmpl;       /* for text shards */
+    gboolean         archive;    /* an ntl_ArchiveWriter per shard instead */
+    guint            block_rows;
+    guint            max_open;   /* over all threads, at least one each; 0 for no limit */
+    ntl_WriterConfig writer;
+} ntl_ShardConfig;
+
+typedef struct _s_ntl_sharder ntl_Sharder;
+
+gboolean     ntl_shard_key_from_string(const gchar* s, ntl_ShardKeyT* key);
+
+/* shards are fn.<value>, or that name within one of the dirs */
+ntl_Sharder* ntl_sharder_new(const gchar* fn, const ntl_ShardConfig* cfg);
+/* from the receiving thread only; waits while the shard's thread is a
+ * whole queue behind */
+void         ntl_sharder_push(ntl_Sharder* s, const ntl_Packet* pkt);
+/* writes out whatever is queued first */
+void         ntl_sharder_free(ntl_Sharder* s);
+
+#endif
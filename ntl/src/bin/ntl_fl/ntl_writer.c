@@ -0,0 +1,376 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "ntl_writer.h"
+#include "ntl_rotate.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * Lines are formatted by the caller straight into the pending
+ * buffer. The buffer is written out with a single write() when it
+ * grows past the configured size or when its oldest line has waited
+ * longer than the flush interval. Durability is a separate policy
+ * applied after each write. When a write fails (a full disk, say) the
+ * unwritten lines stay buffered and are retried on each tick; only
+ * past several buffers' worth are the oldest dropped.
+ *
+ * Rotation happens only between batches, and a batch only ever holds
+ * whole lines, so a line lands in exactly one segment. The live file
+ * is renamed aside and a fresh one opened under the original name;
+ * indexing, compression and retention of the closed segment are
+ * handed off to the rotator thread.
+ */
+
+struct _s_ntl_writer {
+    int              fd;
+    gchar*           fn;            /* NULL when writing to stdout */
+    guint64          size;          /* bytes in the live segment */
+    time_t           next_rotation; /* wall-clock deadline; 0 when unused */
+    GString*         pending;
+    ntl_WriterConfig cfg;
+    gint64           first_pending; /* when the oldest pending line was committed */
+    gint64           last_sync;
+    gboolean         unsynced;      /* written since the last sync */
+    ntl_Rotator*     rotator;
+    gboolean         failing;       /* the last write failed */
+    guint64          dropped;       /* bytes dropped while failing */
+    gboolean         rotate_failing; /* the last rotation failed */
+    time_t           rotate_retry;  /* no rotation is tried before this */
+};
+
+/* while writes fail, lines stay buffered up to this many times the
+ * buffer size; past it the oldest are dropped */
+#define FAILING_BUFFERS 8
+
+/* a failed rotation is retried no sooner than this many seconds later */
+#define ROTATE_RETRY_SECS 10
+
+/* private */
+/* the bytes written before any error, which is left in *err */
+static gsize write_all(int fd, const gchar* data, gsize len, int* err)
+{
+    gsize rv = 0;
+
+    while ( rv < len ) {
+        ssize_t n = write(fd, data + rv, len - rv);
+        if ( n < 0 ) {
+            if ( EINTR == errno ) {
+                continue;
+            }
+            *err = errno;
+            break;
+        }
+        rv += n;
+    }
+    return rv;
+}
+
+static const gchar* name_of(const ntl_Writer* w)
+{
+    return w->fn ? w->fn : "stdout";
+}
+
+static void write_failed(ntl_Writer* w, int err)
+{
+    if ( !w->failing ) {
+        g_printerr("writing %s failed: %s; buffering up to %" G_GSIZE_FORMAT " KiB\n",
+            name_of(w), g_strerror(err), FAILING_BUFFERS * w->cfg.buffer_size / 1024);
+        w->failing = TRUE;
+    }
+}
+
+static void write_recovered(ntl_Writer* w)
+{
+    if ( w->failing ) {
+        g_printerr("writing %s again, %" G_GUINT64_FORMAT " bytes dropped meanwhile\n", name_of(w), w->dropped);
+        w->failing = FALSE;
+        w->dropped = 0;
+    }
+}
+
+/* drops whole lines from the front, down to the limit */
+static void drop_oldest(ntl_Writer* w)
+{
+    gsize        limit = FAILING_BUFFERS * w->cfg.buffer_size;
+    const gchar* nl = NULL;
+    gsize        n = 0;
+
+    if ( w->pending->len <= limit ) {
+        return;
+    }
+    nl = memchr(w->pending->str + (w->pending->len - limit), '\n', limit);
+    n = nl ? (gsize) (nl - w->pending->str) + 1 : w->pending->len;
+    g_string_erase(w->pending, 0, n);
+    w->dropped += n;
+}
+
+static void sync_fd(ntl_Writer* w, gint64 now)
+{
+    switch (w->cfg.sync) {
+        case ntl_ws_Batch:
+            fsync(w->fd);
+            break;
+
+        case ntl_ws_Periodic:
+            if ( now - w->last_sync < (gint64) w->cfg.sync_ms * 1000 ) {
+                return;
+            }
+            fdatasync(w->fd);
+            break;
+
+        default:
+            return;
+    }
+    w->last_sync = now;
+    w->unsynced = FALSE;
+}
+
+static int open_segment(const gchar* fn, guint64* size)
+{
+    struct stat st;
+    int         fd = open(fn, O_WRONLY | O_CREAT | O_APPEND, 0644);
+
+    *size = (fd >= 0 && 0 == fstat(fd, &st)) ? st.st_size : 0;
+    return fd;
+}
+
+static time_t next_boundary(guint secs)
+{
+    time_t now = time(NULL);
+    return secs ? (now / secs + 1) * secs : 0;
+}
+
+static gboolean rotation_due(ntl_Writer* w, gsize incoming)
+{
+    gboolean by_time = FALSE;
+
+    if ( NULL == w->rotator || time(NULL) < w->rotate_retry ) {
+        return FALSE;
+    }
+    by_time = w->next_rotation && time(NULL) >= w->next_rotation;
+    if ( 0 == w->size ) {
+        /* nothing to close yet; an empty interval does not make a segment */
+        if ( by_time ) {
+            w->next_rotation = next_boundary(w->cfg.rotate_secs);
+        }
+        return FALSE;
+    }
+    return by_time || (w->cfg.rotate_bytes && w->size + incoming > w->cfg.rotate_bytes);
+}
+
+/* the live file stays as it is; the next try waits for the retry delay
+ * and, with --rotate-interval, for the next boundary */
+static void rotate_failed(ntl_Writer* w, const gchar* what, int err)
+{
+    if ( !w->rotate_failing ) {
+        g_printerr("rotating %s failed: %s: %s; retrying every %d s\n",
+            w->fn, what, g_strerror(err), ROTATE_RETRY_SECS);
+        w->rotate_failing = TRUE;
+    }
+    w->rotate_retry = time(NULL) + ROTATE_RETRY_SECS;
+    w->next_rotation = next_boundary(w->cfg.rotate_secs);
+}
+
+static void rotate(ntl_Writer* w)
+{
+    gchar*  seg = ntl_rotator_segment_name(w->rotator, w->fn, time(NULL));
+    guint64 size = 0;
+    int     fd = -1;
+    int     err = 0;
+
+    if ( w->cfg.sync != ntl_ws_None && w->unsynced ) {
+        fsync(w->fd);
+        w->unsynced = FALSE;
+    }
+    if ( 0 != rename(w->fn, seg) ) {
+        rotate_failed(w, "rename", errno);
+        g_free(seg);
+        return;
+    }
+    fd = open_segment(w->fn, &size);
+    if ( fd < 0 ) {
+        err = errno;
+        /* put the segment back, so the live file keeps its name and
+         * is rotated once the reopen works */
+        if ( 0 != rename(seg, w->fn) ) {
+            g_printerr("renaming %s back to %s failed: %s\n", seg, w->fn, g_strerror(errno));
+        }
+        rotate_failed(w, "reopen", err);
+        g_free(seg);
+        return;
+    }
+    close(w->fd);
+    w->fd = fd;
+    w->size = size;
+    w->next_rotation = next_boundary(w->cfg.rotate_secs);
+    w->rotate_retry = 0;
+    if ( w->rotate_failing ) {
+        g_printerr("rotating %s again\n", w->fn);
+        w->rotate_failing = FALSE;
+    }
+    ntl_rotator_submit(w->rotator, seg);
+}
+
+/* public */
+void ntl_writer_config_init(ntl_WriterConfig* cfg)
+{
+    cfg->buffer_size = 1024 * 1024;
+    cfg->flush_ms = 200;
+    cfg->sync = ntl_ws_None;
+    cfg->sync_ms = 1000;
+    cfg->rotate_bytes = 0;
+    cfg->rotate_secs = 0;
+    cfg->compress = FALSE;
+    cfg->index = FALSE;
+    cfg->keep_count = 0;
+    cfg->keep_bytes = 0;
+}
+
+gboolean ntl_writer_sync_from_string(const gchar* s, ntl_WriterSyncT* sync)
+{
+    if ( 0 == g_strcmp0(s, "none") ) {
+        *sync = ntl_ws_None;
+    } else if ( 0 == g_strcmp0(s, "periodic") ) {
+        *sync = ntl_ws_Periodic;
+    } else if ( 0 == g_strcmp0(s, "batch") ) {
+        *sync = ntl_ws_Batch;
+    } else {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+ntl_Writer* ntl_writer_new(const gchar* fn, const ntl_WriterConfig* cfg)
+{
+    ntl_Writer* rv = NULL;
+    guint64 size = 0;
+    int fd = STDOUT_FILENO;
+
+    if ( fn ) {
+        fd = open_segment(fn, &size);
+        if ( fd < 0 ) {
+            return NULL;
+        }
+    }
+
+    rv = g_new(ntl_Writer, 1);
+    rv->fd = fd;
+    rv->fn = g_strdup(fn);
+    rv->size = size;
+    rv->cfg = *cfg;
+    rv->rotator = NULL;
+    rv->next_rotation = 0;
+    if ( fn && (cfg->rotate_bytes || cfg->rotate_secs) ) {
+        rv->rotator = ntl_rotator_new(fn, cfg->compress, cfg->index, cfg->keep_count, cfg->keep_bytes);
+        rv->next_rotation = next_boundary(cfg->rotate_secs);
+    }
+    /* leave room for the line that pushes us over the threshold */
+    rv->pending = g_string_sized_new(cfg->buffer_size + 4096);
+    rv->first_pending = 0;
+    rv->last_sync = g_get_monotonic_time();
+    rv->unsynced = FALSE;
+    rv->failing = FALSE;
+    rv->dropped = 0;
+    rv->rotate_failing = FALSE;
+    rv->rotate_retry = 0;
+    return rv;
+}
+
+GString* ntl_writer_buffer(ntl_Writer* w)
+{
+    return w->pending;
+}
+
+void ntl_writer_commit(ntl_Writer* w)
+{
+    if ( 0 == w->first_pending ) {
+        w->first_pending = g_get_monotonic_time();
+    }
+    if ( w->failing ) {
+        /* retried from ntl_writer_tick, not on every line */
+        drop_oldest(w);
+    } else if ( w->pending->len >= w->cfg.buffer_size ) {
+        ntl_writer_flush(w);
+    }
+}
+
+gboolean ntl_writer_flush(ntl_Writer* w)
+{
+    gboolean rv = TRUE;
+
+    if ( rotation_due(w, w->pending->len) ) {
+        rotate(w);
+    }
+    if ( w->pending->len > 0 ) {
+        int   err = 0;
+        gsize n = write_all(w->fd, w->pending->str, w->pending->len, &err);
+
+        w->size += n;
+        w->unsynced = w->unsynced || n > 0;
+        /* what did not go out is kept, to be retried */
+        g_string_erase(w->pending, 0, n);
+        if ( w->pending->len > 0 ) {
+            write_failed(w, err);
+            rv = FALSE;
+        } else {
+            w->first_pending = 0;
+            write_recovered(w);
+        }
+    }
+    if ( w->unsynced ) {
+        sync_fd(w, g_get_monotonic_time());
+    }
+    return rv;
+}
+
+void ntl_writer_tick(ntl_Writer* w)
+{
+    gint64 now = g_get_monotonic_time();
+
+    if ( w->first_pending && now - w->first_pending >= (gint64) w->cfg.flush_ms * 1000 ) {
+        ntl_writer_flush(w);
+    } else if ( rotation_due(w, 0) ) {
+        ntl_writer_flush(w);
+    } else if ( w->unsynced ) {
+        sync_fd(w, now);
+    }
+}
+
+void ntl_writer_free(ntl_Writer* w)
+{
+    if ( w ) {
+        if ( !ntl_writer_flush(w) ) {
+            g_printerr("%" G_GSIZE_FORMAT " bytes could not be written to %s\n", w->pending->len, name_of(w));
+        }
+        if ( w->cfg.sync != ntl_ws_None && w->unsynced ) {
+            fsync(w->fd);
+        }
+        if ( w->fn ) {
+            close(w->fd);
+        }
+        ntl_rotator_free(w->rotator);
+        g_free(w->fn);
+        g_string_free(w->pending, TRUE);
+        g_free(w);
+    }
+}
@@ -0,0 +1,59 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef __ntl_writer_h_
+#define __ntl_writer_h_
+
+/*
+ * A buffered file writer which batches formatted lines in userspace
+ * and commits them to disk in groups.
+ */
+
+#include <glib.h>
+
+typedef enum {
+    ntl_ws_None,     /* leave durability to the kernel */
+    ntl_ws_Periodic, /* fdatasync() at most once per sync interval */
+    ntl_ws_Batch,    /* fsync() after every flushed batch */
+} ntl_WriterSyncT;
+
+typedef struct {
+    gsize           buffer_size; /* flush once this many bytes are pending */
+    guint           flush_ms;    /* flush pending bytes at least this often */
+    ntl_WriterSyncT sync;
+    guint           sync_ms;     /* interval for ntl_ws_Periodic */
+    guint64         rotate_bytes; /* start a new segment past this size (0: never) */
+    guint           rotate_secs;  /* start a new segment on this wall-clock interval (0: never) */
+    gboolean        compress;     /* gzip closed segments */
+    gboolean        index;        /* build a trigram index of closed segments */
+    guint           keep_count;   /* closed segments to retain (0: unlimited) */
+    guint64         keep_bytes;   /* bytes of closed segments to retain (0: unlimited) */
+} ntl_WriterConfig;
+
+typedef struct _s_ntl_writer ntl_Writer;
+
+void        ntl_writer_config_init(ntl_WriterConfig* cfg);
+gboolean    ntl_writer_sync_from_string(const gchar* s, ntl_WriterSyncT* sync);
+
+ntl_Writer* ntl_writer_new(const gchar* fn, const ntl_WriterConfig* cfg);
+GString*    ntl_writer_buffer(ntl_Writer* w);
+void        ntl_writer_commit(ntl_Writer* w);
+gboolean    ntl_writer_flush(ntl_Writer* w);
+void        ntl_writer_tick(ntl_Writer* w);
+void        ntl_writer_free(ntl_Writer* w);
+
+#endif
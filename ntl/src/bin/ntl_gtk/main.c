@@ -16,6 +16,7 @@
  *  limitations under the License.
  */
 #include "ntll.h"
+#include "ntl_ring_model.h"
 #include <gtk/gtk.h>
 
 /* a prettier, Gtk+ 2.0 listener client */
@@ -23,6 +24,11 @@
 static gchar default_host[] = "localhost";
 static gchar host_label_text[] = "Host:";
 
+/* packets retained for display; older ones are dropped */
+#define RING_CAPACITY 100000
+/* arriving packets are applied to the view once per frame */
+#define FRAME_MS      16
+
 static void write_log(const ntl_Packet* pkt, gpointer d);
 
 typedef struct {
@@ -30,7 +36,14 @@ typedef struct {
     GtkWidget*     label;
     GtkWidget*     connect;
     GtkWidget*     disconnect;
-    GtkTextBuffer* text_buffer;
+    GtkWidget*     view;
+    GtkWidget*     scroll;
+    GtkWidget*     level;
+    GtkWidget*     tag;
+    GtkWidget*     prog;
+    GtkWidget*     text;
+    guint          refilter;
+    NtlRingModel*  model;
     ntl_Listener*  listener;
 } ntl_Mediator;
 
@@ -41,7 +54,14 @@ static ntl_Mediator* ntl_mediator_new(void)
     rv->label = NULL;
     rv->connect = NULL;
     rv->disconnect = NULL;
-    rv->text_buffer = NULL;
+    rv->view = NULL;
+    rv->scroll = NULL;
+    rv->level = NULL;
+    rv->tag = NULL;
+    rv->prog = NULL;
+    rv->text = NULL;
+    rv->refilter = 0;
+    rv->model = ntl_ring_model_new(RING_CAPACITY);
     rv->listener = NULL;
     return rv;
 }
@@ -49,6 +69,7 @@ static ntl_Mediator* ntl_mediator_new(void)
 static void ntl_mediator_free(ntl_Mediator* m)
 {
     ntl_listener_free(m->listener);
+    g_object_unref(m->model);
     g_free(m);
 }
 
@@ -78,58 +99,94 @@ static void ntl_mediator_disconnect(ntl_Mediator* m)
     gtk_label_set_text(GTK_LABEL(m->label), host_label_text);
 }
 
-static gchar trace_tag[] = "trace";
-static gchar debug_tag[] = "debug";
-static gchar warning_tag[] = "warning";
-static gchar error_tag[] = "error";
-static gchar unknown_tag[] = "unknown";
+static void write_log(const ntl_Packet* pkt, gpointer d)
+{
+    ntl_Mediator* m = (ntl_Mediator*) d;
+    ntl_ring_model_queue(m->model, pkt);
+}
+
+static gboolean at_bottom(ntl_Mediator* m)
+{
+    GtkAdjustment* adj = gtk_scrolled_window_get_vadjustment(GTK_SCROLLED_WINDOW(m->scroll));
+    return gtk_adjustment_get_value(adj) >= gtk_adjustment_get_upper(adj) - gtk_adjustment_get_page_size(adj) - 1;
+}
+
+static void scroll_to_end(ntl_Mediator* m)
+{
+    gint n = gtk_tree_model_iter_n_children(GTK_TREE_MODEL(m->model), NULL);
+
+    if ( n > 0 ) {
+        GtkTreePath* path = gtk_tree_path_new_from_indices(n - 1, -1);
+        gtk_tree_view_scroll_to_cell(GTK_TREE_VIEW(m->view), path, NULL, FALSE, 0, 0);
+        gtk_tree_path_free(path);
+    }
+}
+
+static gchar* entry_value(GtkWidget* w)
+{
+    const gchar* s = gtk_entry_get_text(GTK_ENTRY(w));
+    return (s && *s) ? g_strdup(s) : NULL;
+}
 
-static gchar* get_tag_for_level(ntl_TraceLevelT lvl)
+static gboolean apply_filter(gpointer d)
 {
-    switch (lvl) {
-        case ntl_tl_Trace:
-            return trace_tag;
+    ntl_Mediator*  m = (ntl_Mediator*) d;
+    ntl_RingFilter f;
 
-        case ntl_tl_Debug:
-            return debug_tag;
+    /* the level choices are All, then Debug and above, and so on */
+    f.min_level = gtk_combo_box_get_active(GTK_COMBO_BOX(m->level));
+    if ( 0 == f.min_level ) {
+        f.min_level = -1;
+    }
+    f.tag = entry_value(m->tag);
+    f.prog = entry_value(m->prog);
+    f.text = entry_value(m->text);
+
+    gtk_tree_view_set_model(GTK_TREE_VIEW(m->view), NULL);
+    ntl_ring_model_set_filter(m->model, &f);
+    gtk_tree_view_set_model(GTK_TREE_VIEW(m->view), GTK_TREE_MODEL(m->model));
+    scroll_to_end(m);
+
+    g_free(f.tag);
+    g_free(f.prog);
+    g_free(f.text);
+    m->refilter = 0;
+    return FALSE;
+}
 
-        case ntl_tl_Warn:
-            return warning_tag;
+static void filter_changed(GtkWidget* w, gpointer d)
+{
+    ntl_Mediator* m = (ntl_Mediator*) d;
 
-        case ntl_tl_Error:
-            return error_tag;
-            
-        default:
-            ;
+    /* coalesce keystrokes arriving within a frame */
+    if ( 0 == m->refilter ) {
+        m->refilter = g_timeout_add(FRAME_MS, apply_filter, m);
     }
-    return unknown_tag;
 }
 
-static void write_log(const ntl_Packet* pkt, gpointer d)
+static gboolean apply_frame(gpointer d)
 {
     ntl_Mediator* m = (ntl_Mediator*) d;
-    gsize         wrote = 0;
-    gchar*        tm = ntl_listener_default_time_format(pkt);
-    gchar*        tag = g_strdup_printf("[%s]", pkt->tag);
-    gchar*        proc = g_strdup_printf("[%s/%u/%u]", pkt->prog, pkt->pid, pkt->tid);
-    gchar*        loc = g_strdup_printf("[%s/%s]", pkt->mod, pkt->fn);
-
-    gchar* ln = g_strdup_printf("%24s %12s %20s %20s: %s\n",
-        tm, tag, proc, loc, pkt->msg);
-    {
-        GtkTextIter it;
-        GtkTextIter st;
-        GtkTextMark* mrk = NULL;
-
-        gtk_text_buffer_get_end_iter(m->text_buffer, &it);
-        mrk = gtk_text_buffer_create_mark(m->text_buffer, NULL, &it, TRUE);
-        gtk_text_buffer_insert_with_tags_by_name(m->text_buffer, &it, ln, -1, get_tag_for_level(pkt->lvl), NULL);
+    guint         pending = ntl_ring_model_pending(m->model);
+    gboolean      follow = FALSE;
+
+    if ( 0 == pending ) {
+        return TRUE;
     }
-    g_free(tm);
-    g_free(tag);
-    g_free(proc);
-    g_free(loc);
-    g_free(ln);
+    follow = at_bottom(m);
+    if ( pending > RING_CAPACITY / 8 ) {
+        /* for a large burst, rebuilding the view once is cheaper
+         * than announcing every row */
+        gtk_tree_view_set_model(GTK_TREE_VIEW(m->view), NULL);
+        ntl_ring_model_apply(m->model, FALSE);
+        gtk_tree_view_set_model(GTK_TREE_VIEW(m->view), GTK_TREE_MODEL(m->model));
+    } else {
+        ntl_ring_model_apply(m->model, TRUE);
+    }
+    if ( follow ) {
+        scroll_to_end(m);
+    }
+    return TRUE;
 }
 
 static void window_destroy(GtkWidget* w, gpointer d)
@@ -147,21 +204,37 @@ static void disconnect_listener(GtkWidget* w, gpointer d)
     ntl_mediator_disconnect((ntl_Mediator*) d);
 }
 
-static GtkWidget* build_textview(ntl_Mediator* m)
+static void add_column(GtkWidget* view, const gchar* title, gint col, gint width)
+{
+    GtkCellRenderer*   r = gtk_cell_renderer_text_new();
+    GtkTreeViewColumn* c = gtk_tree_view_column_new_with_attributes(
+        title, r, "text", col, "foreground", NTL_RING_COL_COLOR, NULL);
+
+    /* fixed sizing lets the view skip measuring rows it isn't showing */
+    gtk_tree_view_column_set_sizing(c, GTK_TREE_VIEW_COLUMN_FIXED);
+    gtk_tree_view_column_set_fixed_width(c, width);
+    gtk_tree_view_column_set_resizable(c, TRUE);
+    gtk_tree_view_append_column(GTK_TREE_VIEW(view), c);
+}
+
+static GtkWidget* build_listview(ntl_Mediator* m)
 {
     PangoFontDescription* f = pango_font_description_from_string("Courier 10");
-    GtkWidget* w = gtk_text_view_new();
-    gtk_text_view_set_editable(GTK_TEXT_VIEW(w), FALSE);
+    GtkWidget* w = gtk_tree_view_new_with_model(GTK_TREE_MODEL(m->model));
+
     gtk_widget_modify_font(GTK_WIDGET(w), f);
     pango_font_description_free(f);
+    add_column(w, "Time", NTL_RING_COL_TIME, 200);
+    add_column(w, "Tag", NTL_RING_COL_TAG, 100);
+    add_column(w, "Process", NTL_RING_COL_PROC, 180);
+    add_column(w, "Location", NTL_RING_COL_LOC, 180);
+    add_column(w, "Message", NTL_RING_COL_MSG, 600);
+    gtk_tree_view_set_fixed_height_mode(GTK_TREE_VIEW(w), TRUE);
+    gtk_tree_view_set_enable_search(GTK_TREE_VIEW(w), FALSE);
     gtk_widget_show(w);
 
-    m->text_buffer = gtk_text_view_get_buffer(GTK_TEXT_VIEW(w));
-    gtk_text_buffer_create_tag(m->text_buffer, error_tag, "foreground", "red", NULL);
-    gtk_text_buffer_create_tag(m->text_buffer, warning_tag, "foreground", "orange", NULL);
-    gtk_text_buffer_create_tag(m->text_buffer, debug_tag, "foreground", "blue", NULL);
-    gtk_text_buffer_create_tag(m->text_buffer, trace_tag, "foreground", "black", NULL);
-    gtk_text_buffer_create_tag(m->text_buffer, unknown_tag, "foreground", "gray", NULL);
+    m->view = w;
+    g_timeout_add(FRAME_MS, apply_frame, m);
 
     return w;
 }
@@ -175,8 +248,10 @@ static GtkWidget* build_output(ntl_Mediator* m)
         GTK_POLICY_AUTOMATIC);
     gtk_scrolled_window_set_shadow_type(
         GTK_SCROLLED_WINDOW(w), GTK_SHADOW_ETCHED_IN);
-    gtk_container_add(GTK_CONTAINER(w), build_textview(m));
+    gtk_container_add(GTK_CONTAINER(w), build_listview(m));
     gtk_widget_show(w);
+
+    m->scroll = w;
     
     return w;
 }
@@ -241,12 +316,54 @@ static GtkWidget* build_connection(ntl_Mediator* m)
     return w;
 }
 
+static GtkWidget* build_filter_entry(ntl_Mediator* m, GtkWidget* box, const gchar* label, gint width)
+{
+    GtkWidget* l = gtk_label_new(label);
+    GtkWidget* w = gtk_entry_new();
+
+    gtk_entry_set_width_chars(GTK_ENTRY(w), width);
+    g_signal_connect(G_OBJECT(w), "changed", G_CALLBACK(filter_changed), m);
+    gtk_box_pack_start(GTK_BOX(box), l, FALSE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(box), w, width > 20, TRUE, 0);
+    gtk_widget_show(l);
+    gtk_widget_show(w);
+
+    return w;
+}
+
+static GtkWidget* build_filter(ntl_Mediator* m)
+{
+    GtkWidget* w = gtk_hbox_new(FALSE, 4);
+    GtkWidget* l = gtk_label_new("Level:");
+    GtkWidget* c = gtk_combo_box_new_text();
+
+    gtk_combo_box_append_text(GTK_COMBO_BOX(c), "All");
+    gtk_combo_box_append_text(GTK_COMBO_BOX(c), "Debug+");
+    gtk_combo_box_append_text(GTK_COMBO_BOX(c), "Warn+");
+    gtk_combo_box_append_text(GTK_COMBO_BOX(c), "Error");
+    gtk_combo_box_set_active(GTK_COMBO_BOX(c), 0);
+    g_signal_connect(G_OBJECT(c), "changed", G_CALLBACK(filter_changed), m);
+    gtk_box_pack_start(GTK_BOX(w), l, FALSE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(w), c, FALSE, TRUE, 0);
+    gtk_widget_show(l);
+    gtk_widget_show(c);
+    m->level = c;
+
+    m->tag = build_filter_entry(m, w, "Tag:", 12);
+    m->prog = build_filter_entry(m, w, "Prog:", 12);
+    m->text = build_filter_entry(m, w, "Search:", 30);
+    gtk_widget_show(w);
+
+    return w;
+}
+
 static GtkWidget* build_parts(ntl_Mediator* m)
 {
     GtkWidget* w = gtk_vbox_new(FALSE, 6);
 
     gtk_box_set_spacing(GTK_BOX(w), 6);
     gtk_box_pack_start(GTK_BOX(w), build_connection(m), FALSE, TRUE, 0);
+    gtk_box_pack_start(GTK_BOX(w), build_filter(m), FALSE, TRUE, 0);
     gtk_box_pack_end(GTK_BOX(w), build_output(m), TRUE, TRUE, 0);
     gtk_widget_show(w);
 
@@ -0,0 +1,93 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "ntl_ring.h"
+
+/*
+ * Slots are indexed by sequence modulo capacity; [first, end) are
+ * the sequence numbers currently held.
+ */
+
+struct _s_ntl_ring {
+    ntl_Packet** slots;
+    guint        capacity;
+    guint64      first;
+    guint64      end;
+};
+
+ntl_Ring* ntl_ring_new(guint capacity)
+{
+    ntl_Ring* rv = g_new(ntl_Ring, 1);
+    rv->capacity = MAX(capacity, 1);
+    rv->slots = g_new0(ntl_Packet*, rv->capacity);
+    rv->first = 0;
+    rv->end = 0;
+    return rv;
+}
+
+guint64 ntl_ring_push(ntl_Ring* r, ntl_Packet* pkt)
+{
+    if ( r->end - r->first == r->capacity ) {
+        ntl_ring_shift(r);
+    }
+    r->slots[r->end % r->capacity] = pkt;
+    return r->end++;
+}
+
+void ntl_ring_shift(ntl_Ring* r)
+{
+    if ( r->first < r->end ) {
+        ntl_packet_free(r->slots[r->first % r->capacity]);
+        r->slots[r->first % r->capacity] = NULL;
+        r->first++;
+    }
+}
+
+guint64 ntl_ring_first(const ntl_Ring* r)
+{
+    return r->first;
+}
+
+guint64 ntl_ring_end(const ntl_Ring* r)
+{
+    return r->end;
+}
+
+guint ntl_ring_capacity(const ntl_Ring* r)
+{
+    return r->capacity;
+}
+
+const ntl_Packet* ntl_ring_get(const ntl_Ring* r, guint64 seq)
+{
+    if ( seq < r->first || seq >= r->end ) {
+        return NULL;
+    }
+    return r->slots[seq % r->capacity];
+}
+
+void ntl_ring_free(ntl_Ring* r)
+{
+    if ( r ) {
+        guint64 seq = 0;
+        for ( seq = r->first; seq < r->end; seq++ ) {
+            ntl_packet_free(r->slots[seq % r->capacity]);
+        }
+        g_free(r->slots);
+        g_free(r);
+    }
+}
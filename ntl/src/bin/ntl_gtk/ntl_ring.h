@@ -0,0 +1,39 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef __ntl_ring_h_
+#define __ntl_ring_h_
+
+/*
+ * A fixed-capacity ring of packets addressed by sequence number.
+ * Pushing into a full ring evicts the oldest packet.
+ */
+
+#include "ntll.h"
+
+typedef struct _s_ntl_ring ntl_Ring;
+
+ntl_Ring*         ntl_ring_new(guint capacity);
+guint64           ntl_ring_push(ntl_Ring* r, ntl_Packet* pkt);
+void              ntl_ring_shift(ntl_Ring* r);
+guint64           ntl_ring_first(const ntl_Ring* r);
+guint64           ntl_ring_end(const ntl_Ring* r);
+guint             ntl_ring_capacity(const ntl_Ring* r);
+const ntl_Packet* ntl_ring_get(const ntl_Ring* r, guint64 seq);
+void              ntl_ring_free(ntl_Ring* r);
+
+#endif
@@ -0,0 +1,293 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "ntl_ring_index.h"
+
+#include <string.h>
+
+/*
+ * Every posting list is a GArray of ascending guint64 sequence
+ * numbers. Packets leave the ring from the front, so expiry only
+ * ever trims a prefix; it is done lazily (queries skip expired
+ * sequences with a binary search) and in bulk by
+ * ntl_ring_index_expire().
+ *
+ * A query picks the cheapest constraint it can answer from a posting
+ * list (the levels at or above the minimum count as one constraint
+ * made of several lists), walks those candidates in order and checks
+ * each against the whole filter.
+ */
+
+#define N_LEVELS 5 /* the four known levels, then everything else */
+
+struct _s_ntl_ring_index {
+    GArray*     levels[N_LEVELS];
+    GHashTable* tags;     /* gchar* -> GArray* */
+    GHashTable* progs;    /* gchar* -> GArray* */
+    GHashTable* trigrams; /* guint32 -> GArray* */
+};
+
+/* private */
+static GArray* new_postings(void)
+{
+    return g_array_new(FALSE, FALSE, sizeof(guint64));
+}
+
+static void free_postings(gpointer d)
+{
+    g_array_free((GArray*) d, TRUE);
+}
+
+static guint level_slot(ntl_TraceLevelT lvl)
+{
+    return MIN((guint) lvl, N_LEVELS - 1);
+}
+
+static void post(GArray* a, guint64 seq)
+{
+    /* a message repeating a trigram posts it once */
+    if ( 0 == a->len || g_array_index(a, guint64, a->len - 1) != seq ) {
+        g_array_append_val(a, seq);
+    }
+}
+
+static GArray* lookup_or_add(GHashTable* ht, gpointer key, gboolean copy_key)
+{
+    GArray* rv = (GArray*) g_hash_table_lookup(ht, key);
+    if ( NULL == rv ) {
+        rv = new_postings();
+        g_hash_table_insert(ht, copy_key ? g_strdup((const gchar*) key) : key, rv);
+    }
+    return rv;
+}
+
+static guint32 trigram(const gchar* p)
+{
+    return ((guint32) (guchar) p[0] << 16) | ((guint32) (guchar) p[1] << 8) | (guchar) p[2];
+}
+
+static guint lower_bound(GArray* a, guint64 seq)
+{
+    guint lo = 0;
+    guint hi = a->len;
+
+    while ( lo < hi ) {
+        guint mid = lo + (hi - lo) / 2;
+        if ( g_array_index(a, guint64, mid) < seq ) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+static void expire_postings(GArray* a, guint64 first)
+{
+    guint n = lower_bound(a, first);
+    if ( n > 0 ) {
+        g_array_remove_range(a, 0, n);
+    }
+}
+
+static gboolean expire_entry(gpointer k, gpointer v, gpointer d)
+{
+    GArray* a = (GArray*) v;
+    expire_postings(a, *((guint64*) d));
+    return 0 == a->len;
+}
+
+static guint live_len(GArray* a, guint64 first)
+{
+    return a->len - lower_bound(a, first);
+}
+
+typedef struct {
+    GPtrArray* lists;
+    guint      cost;
+} Candidates;
+
+/* offers a constraint made of the given lists; keeps the cheapest */
+static void consider(Candidates* best, GArray** lists, guint n, guint64 first)
+{
+    guint cost = 0;
+    guint i = 0;
+
+    for ( i = 0; i < n; i++ ) {
+        cost += lists[i] ? live_len(lists[i], first) : 0;
+    }
+    if ( NULL == best->lists || cost < best->cost ) {
+        if ( NULL == best->lists ) {
+            best->lists = g_ptr_array_new();
+        }
+        g_ptr_array_set_size(best->lists, 0);
+        for ( i = 0; i < n; i++ ) {
+            if ( lists[i] ) {
+                g_ptr_array_add(best->lists, lists[i]);
+            }
+        }
+        best->cost = cost;
+    }
+}
+
+/* walks the union of the candidate lists in sequence order */
+static void collect(GPtrArray* lists, const ntl_Ring* ring, const ntl_RingFilter* f, GArray* out)
+{
+    guint64 first = ntl_ring_first(ring);
+    guint   pos[N_LEVELS];
+    guint   i = 0;
+
+    for ( i = 0; i < lists->len; i++ ) {
+        pos[i] = lower_bound((GArray*) g_ptr_array_index(lists, i), first);
+    }
+    while ( TRUE ) {
+        guint64 next = G_MAXUINT64;
+        guint   which = 0;
+        for ( i = 0; i < lists->len; i++ ) {
+            GArray* a = (GArray*) g_ptr_array_index(lists, i);
+            if ( pos[i] < a->len && g_array_index(a, guint64, pos[i]) < next ) {
+                next = g_array_index(a, guint64, pos[i]);
+                which = i;
+            }
+        }
+        if ( G_MAXUINT64 == next ) {
+            break;
+        }
+        pos[which]++;
+        if ( ntl_ring_filter_matches(f, ntl_ring_get(ring, next)) ) {
+            g_array_append_val(out, next);
+        }
+    }
+}
+
+/* public */
+gboolean ntl_ring_filter_is_empty(const ntl_RingFilter* f)
+{
+    return f->min_level <= 0 && NULL == f->tag && NULL == f->prog && NULL == f->text;
+}
+
+gboolean ntl_ring_filter_matches(const ntl_RingFilter* f, const ntl_Packet* pkt)
+{
+    return pkt
+        && (f->min_level < 0 || (gint) pkt->lvl >= f->min_level)
+        && (NULL == f->tag || 0 == g_strcmp0(f->tag, pkt->tag))
+        && (NULL == f->prog || 0 == g_strcmp0(f->prog, pkt->prog))
+        && (NULL == f->text || (pkt->msg && strstr(pkt->msg, f->text)));
+}
+
+ntl_RingIndex* ntl_ring_index_new(void)
+{
+    ntl_RingIndex* rv = g_new(ntl_RingIndex, 1);
+    guint          i = 0;
+
+    for ( i = 0; i < N_LEVELS; i++ ) {
+        rv->levels[i] = new_postings();
+    }
+    rv->tags = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free_postings);
+    rv->progs = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free_postings);
+    rv->trigrams = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, free_postings);
+    return rv;
+}
+
+void ntl_ring_index_add(ntl_RingIndex* ix, guint64 seq, const ntl_Packet* pkt)
+{
+    post(ix->levels[level_slot(pkt->lvl)], seq);
+    if ( pkt->tag ) {
+        post(lookup_or_add(ix->tags, pkt->tag, TRUE), seq);
+    }
+    if ( pkt->prog ) {
+        post(lookup_or_add(ix->progs, pkt->prog, TRUE), seq);
+    }
+    if ( pkt->msg ) {
+        const gchar* p = pkt->msg;
+        for ( ; p[0] && p[1] && p[2]; p++ ) {
+            post(lookup_or_add(ix->trigrams, GUINT_TO_POINTER(trigram(p)), FALSE), seq);
+        }
+    }
+}
+
+void ntl_ring_index_expire(ntl_RingIndex* ix, guint64 first)
+{
+    guint i = 0;
+
+    for ( i = 0; i < N_LEVELS; i++ ) {
+        expire_postings(ix->levels[i], first);
+    }
+    g_hash_table_foreach_remove(ix->tags, expire_entry, &first);
+    g_hash_table_foreach_remove(ix->progs, expire_entry, &first);
+    g_hash_table_foreach_remove(ix->trigrams, expire_entry, &first);
+}
+
+GArray* ntl_ring_index_query(ntl_RingIndex* ix, const ntl_Ring* ring, const ntl_RingFilter* f)
+{
+    GArray*    rv = new_postings();
+    guint64    first = ntl_ring_first(ring);
+    Candidates best = { NULL, 0 };
+    GArray*    lists[N_LEVELS];
+    guint      i = 0;
+
+    if ( f->min_level > 0 ) {
+        guint n = 0;
+        for ( i = f->min_level; i < N_LEVELS; i++ ) {
+            lists[n++] = ix->levels[i];
+        }
+        consider(&best, lists, n, first);
+    }
+    if ( f->tag ) {
+        lists[0] = (GArray*) g_hash_table_lookup(ix->tags, f->tag);
+        consider(&best, lists, 1, first);
+    }
+    if ( f->prog ) {
+        lists[0] = (GArray*) g_hash_table_lookup(ix->progs, f->prog);
+        consider(&best, lists, 1, first);
+    }
+    if ( f->text && strlen(f->text) >= 3 ) {
+        const gchar* p = f->text;
+        for ( ; p[2]; p++ ) {
+            lists[0] = (GArray*) g_hash_table_lookup(ix->trigrams, GUINT_TO_POINTER(trigram(p)));
+            consider(&best, lists, 1, first);
+        }
+    }
+
+    if ( best.lists ) {
+        collect(best.lists, ring, f, rv);
+        g_ptr_array_free(best.lists, TRUE);
+    } else {
+        /* nothing indexable (e.g. a one or two character search) */
+        guint64 seq = 0;
+        for ( seq = first; seq < ntl_ring_end(ring); seq++ ) {
+            if ( ntl_ring_filter_matches(f, ntl_ring_get(ring, seq)) ) {
+                g_array_append_val(rv, seq);
+            }
+        }
+    }
+    return rv;
+}
+
+void ntl_ring_index_free(ntl_RingIndex* ix)
+{
+    if ( ix ) {
+        guint i = 0;
+        for ( i = 0; i < N_LEVELS; i++ ) {
+            free_postings(ix->levels[i]);
+        }
+        g_hash_table_destroy(ix->tags);
+        g_hash_table_destroy(ix->progs);
+        g_hash_table_destroy(ix->trigrams);
+        g_free(ix);
+    }
+}
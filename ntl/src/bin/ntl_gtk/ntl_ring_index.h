@@ -0,0 +1,47 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef __ntl_ring_index_h_
+#define __ntl_ring_index_h_
+
+/*
+ * Incremental indexes over the packets held in a ring: postings of
+ * sequence numbers by level, tag and prog, and by message trigram,
+ * so that a filter can be answered without scanning every packet.
+ */
+
+#include "ntl_ring.h"
+
+typedef struct {
+    gint   min_level; /* -1: any level */
+    gchar* tag;       /* NULL: any */
+    gchar* prog;      /* NULL: any */
+    gchar* text;      /* a substring of msg; NULL: any */
+} ntl_RingFilter;
+
+typedef struct _s_ntl_ring_index ntl_RingIndex;
+
+gboolean       ntl_ring_filter_is_empty(const ntl_RingFilter* f);
+gboolean       ntl_ring_filter_matches(const ntl_RingFilter* f, const ntl_Packet* pkt);
+
+ntl_RingIndex* ntl_ring_index_new(void);
+void           ntl_ring_index_add(ntl_RingIndex* ix, guint64 seq, const ntl_Packet* pkt);
+void           ntl_ring_index_expire(ntl_RingIndex* ix, guint64 first);
+GArray*        ntl_ring_index_query(ntl_RingIndex* ix, const ntl_Ring* ring, const ntl_RingFilter* f);
+void           ntl_ring_index_free(ntl_RingIndex* ix);
+
+#endif
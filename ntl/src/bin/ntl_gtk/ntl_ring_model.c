@@ -0,0 +1,393 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "ntl_ring_model.h"
+
+/*
+ * Rows map onto ring sequence numbers: row i is sequence first + i.
+ * Arriving packets wait in a queue until ntl_ring_model_apply() moves
+ * them into the ring, so the view never sees rows disappear under it
+ * between the signals that announce them.
+ *
+ * While a filter is set, rows instead map onto the ascending list of
+ * matching sequences starting at rows_head. Each packet is tested
+ * against the filter once, as it is applied.
+ */
+
+struct _NtlRingModel {
+    GObject        parent;
+    ntl_Ring*      ring;
+    ntl_RingIndex* index;
+    guint          expired;
+    ntl_RingFilter filter;
+    GArray*        rows; /* NULL when unfiltered */
+    guint          rows_head;
+    GQueue         queue;
+    gint           stamp;
+};
+
+struct _NtlRingModelClass {
+    GObjectClass parent_class;
+};
+
+static void tree_model_init(GtkTreeModelIface* iface);
+
+G_DEFINE_TYPE_WITH_CODE(NtlRingModel, ntl_ring_model, G_TYPE_OBJECT,
+    G_IMPLEMENT_INTERFACE(GTK_TYPE_TREE_MODEL, tree_model_init))
+
+/* private */
+static void set_iter(NtlRingModel* m, GtkTreeIter* it, guint64 seq)
+{
+    it->stamp = m->stamp;
+    it->user_data = GUINT_TO_POINTER((guint) (seq & 0xffffffff));
+    it->user_data2 = GUINT_TO_POINTER((guint) (seq >> 32));
+    it->user_data3 = NULL;
+}
+
+static guint64 iter_seq(GtkTreeIter* it)
+{
+    return ((guint64) GPOINTER_TO_UINT(it->user_data2) << 32) | GPOINTER_TO_UINT(it->user_data);
+}
+
+static guint n_rows(NtlRingModel* m)
+{
+    if ( m->rows ) {
+        return m->rows->len - m->rows_head;
+    }
+    return (guint) (ntl_ring_end(m->ring) - ntl_ring_first(m->ring));
+}
+
+static guint64 row_seq(NtlRingModel* m, guint i)
+{
+    if ( m->rows ) {
+        return g_array_index(m->rows, guint64, m->rows_head + i);
+    }
+    return ntl_ring_first(m->ring) + i;
+}
+
+static guint seq_row(NtlRingModel* m, guint64 seq)
+{
+    guint lo = m->rows_head;
+    guint hi = 0;
+
+    if ( NULL == m->rows ) {
+        return (guint) (seq - ntl_ring_first(m->ring));
+    }
+    hi = m->rows->len;
+    while ( lo < hi ) {
+        guint mid = lo + (hi - lo) / 2;
+        if ( g_array_index(m->rows, guint64, mid) < seq ) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return lo - m->rows_head;
+}
+
+static void clear_filter(ntl_RingFilter* f)
+{
+    g_free(f->tag);
+    g_free(f->prog);
+    g_free(f->text);
+    f->min_level = -1;
+    f->tag = NULL;
+    f->prog = NULL;
+    f->text = NULL;
+}
+
+static const gchar* level_color(ntl_TraceLevelT lvl)
+{
+    switch (lvl) {
+        case ntl_tl_Trace:
+            return "black";
+
+        case ntl_tl_Debug:
+            return "blue";
+
+        case ntl_tl_Warn:
+            return "orange";
+
+        case ntl_tl_Error:
+            return "red";
+
+        default:
+            ;
+    }
+    return "gray";
+}
+
+static GtkTreeModelFlags get_flags(GtkTreeModel* tm)
+{
+    return GTK_TREE_MODEL_LIST_ONLY;
+}
+
+static gint get_n_columns(GtkTreeModel* tm)
+{
+    return NTL_RING_N_COLS;
+}
+
+static GType get_column_type(GtkTreeModel* tm, gint col)
+{
+    return G_TYPE_STRING;
+}
+
+static gboolean get_iter(GtkTreeModel* tm, GtkTreeIter* it, GtkTreePath* path)
+{
+    NtlRingModel* m = NTL_RING_MODEL(tm);
+    gint          i = gtk_tree_path_get_indices(path)[0];
+
+    if ( i < 0 || (guint) i >= n_rows(m) ) {
+        return FALSE;
+    }
+    set_iter(m, it, row_seq(m, i));
+    return TRUE;
+}
+
+static GtkTreePath* get_path(GtkTreeModel* tm, GtkTreeIter* it)
+{
+    NtlRingModel* m = NTL_RING_MODEL(tm);
+    GtkTreePath*  rv = gtk_tree_path_new();
+    gtk_tree_path_append_index(rv, (gint) seq_row(m, iter_seq(it)));
+    return rv;
+}
+
+static void get_value(GtkTreeModel* tm, GtkTreeIter* it, gint col, GValue* v)
+{
+    NtlRingModel*     m = NTL_RING_MODEL(tm);
+    const ntl_Packet* pkt = ntl_ring_get(m->ring, iter_seq(it));
+
+    g_value_init(v, G_TYPE_STRING);
+    if ( NULL == pkt ) {
+        return;
+    }
+    switch (col) {
+        case NTL_RING_COL_TIME:
+            g_value_take_string(v, ntl_listener_default_time_format(pkt));
+            break;
+
+        case NTL_RING_COL_TAG:
+            g_value_take_string(v, g_strdup_printf("[%s]", pkt->tag));
+            break;
+
+        case NTL_RING_COL_PROC:
+            g_value_take_string(v, g_strdup_printf("[%s/%u/%u]", pkt->prog, pkt->pid, pkt->tid));
+            break;
+
+        case NTL_RING_COL_LOC:
+            g_value_take_string(v, g_strdup_printf("[%s/%s]", pkt->mod, pkt->fn));
+            break;
+
+        case NTL_RING_COL_MSG:
+            g_value_set_string(v, pkt->msg);
+            break;
+
+        case NTL_RING_COL_COLOR:
+            g_value_set_static_string(v, level_color(pkt->lvl));
+            break;
+    }
+}
+
+static gboolean iter_next(GtkTreeModel* tm, GtkTreeIter* it)
+{
+    NtlRingModel* m = NTL_RING_MODEL(tm);
+    guint         i = seq_row(m, iter_seq(it)) + 1;
+
+    if ( i >= n_rows(m) ) {
+        return FALSE;
+    }
+    set_iter(m, it, row_seq(m, i));
+    return TRUE;
+}
+
+static gboolean iter_nth_child(GtkTreeModel* tm, GtkTreeIter* it, GtkTreeIter* parent, gint n)
+{
+    NtlRingModel* m = NTL_RING_MODEL(tm);
+
+    if ( parent || n < 0 || (guint) n >= n_rows(m) ) {
+        return FALSE;
+    }
+    set_iter(m, it, row_seq(m, n));
+    return TRUE;
+}
+
+static gboolean iter_children(GtkTreeModel* tm, GtkTreeIter* it, GtkTreeIter* parent)
+{
+    return iter_nth_child(tm, it, parent, 0);
+}
+
+static gboolean iter_has_child(GtkTreeModel* tm, GtkTreeIter* it)
+{
+    return FALSE;
+}
+
+static gint iter_n_children(GtkTreeModel* tm, GtkTreeIter* it)
+{
+    return it ? 0 : (gint) n_rows(NTL_RING_MODEL(tm));
+}
+
+static gboolean iter_parent(GtkTreeModel* tm, GtkTreeIter* it, GtkTreeIter* child)
+{
+    return FALSE;
+}
+
+static void tree_model_init(GtkTreeModelIface* iface)
+{
+    iface->get_flags = get_flags;
+    iface->get_n_columns = get_n_columns;
+    iface->get_column_type = get_column_type;
+    iface->get_iter = get_iter;
+    iface->get_path = get_path;
+    iface->get_value = get_value;
+    iface->iter_next = iter_next;
+    iface->iter_children = iter_children;
+    iface->iter_has_child = iter_has_child;
+    iface->iter_n_children = iter_n_children;
+    iface->iter_nth_child = iter_nth_child;
+    iface->iter_parent = iter_parent;
+}
+
+static void finalize(GObject* o)
+{
+    NtlRingModel* m = NTL_RING_MODEL(o);
+    ntl_ring_free(m->ring);
+    ntl_ring_index_free(m->index);
+    clear_filter(&m->filter);
+    if ( m->rows ) {
+        g_array_free(m->rows, TRUE);
+    }
+    g_queue_foreach(&m->queue, (GFunc) ntl_packet_free, NULL);
+    g_queue_clear(&m->queue);
+    G_OBJECT_CLASS(ntl_ring_model_parent_class)->finalize(o);
+}
+
+static void ntl_ring_model_class_init(NtlRingModelClass* c)
+{
+    G_OBJECT_CLASS(c)->finalize = finalize;
+}
+
+static void ntl_ring_model_init(NtlRingModel* m)
+{
+    m->ring = NULL;
+    m->index = ntl_ring_index_new();
+    m->expired = 0;
+    m->filter.tag = m->filter.prog = m->filter.text = NULL;
+    clear_filter(&m->filter);
+    m->rows = NULL;
+    m->rows_head = 0;
+    g_queue_init(&m->queue);
+    m->stamp = g_random_int();
+}
+
+/* public */
+NtlRingModel* ntl_ring_model_new(guint capacity)
+{
+    NtlRingModel* rv = NTL_RING_MODEL(g_object_new(NTL_TYPE_RING_MODEL, NULL));
+    rv->ring = ntl_ring_new(capacity);
+    return rv;
+}
+
+void ntl_ring_model_queue(NtlRingModel* m, const ntl_Packet* pkt)
+{
+    g_queue_push_tail(&m->queue, ntl_packet_copy(pkt));
+    if ( g_queue_get_length(&m->queue) > ntl_ring_capacity(m->ring) ) {
+        /* it would be evicted by the time the batch is applied */
+        ntl_packet_free((ntl_Packet*) g_queue_pop_head(&m->queue));
+    }
+}
+
+guint ntl_ring_model_pending(NtlRingModel* m)
+{
+    return g_queue_get_length(&m->queue);
+}
+
+guint ntl_ring_model_apply(NtlRingModel* m, gboolean notify)
+{
+    GtkTreeModel* tm = GTK_TREE_MODEL(m);
+    guint         rv = 0;
+    ntl_Packet*   pkt = NULL;
+
+    while ( (pkt = (ntl_Packet*) g_queue_pop_head(&m->queue)) ) {
+        guint64 seq = 0;
+
+        if ( ntl_ring_end(m->ring) - ntl_ring_first(m->ring) == ntl_ring_capacity(m->ring) ) {
+            /* announce the eviction before the new row appears */
+            guint64  evicted = ntl_ring_first(m->ring);
+            gboolean shown = TRUE;
+
+            ntl_ring_shift(m->ring);
+            m->expired++;
+            if ( m->rows ) {
+                shown = m->rows_head < m->rows->len
+                    && g_array_index(m->rows, guint64, m->rows_head) == evicted;
+                if ( shown ) {
+                    m->rows_head++;
+                }
+            }
+            if ( notify && shown ) {
+                GtkTreePath* path = gtk_tree_path_new_from_indices(0, -1);
+                gtk_tree_model_row_deleted(tm, path);
+                gtk_tree_path_free(path);
+            }
+        }
+        seq = ntl_ring_push(m->ring, pkt);
+        ntl_ring_index_add(m->index, seq, pkt);
+        rv++;
+        if ( m->rows ) {
+            if ( !ntl_ring_filter_matches(&m->filter, pkt) ) {
+                continue;
+            }
+            g_array_append_val(m->rows, seq);
+        }
+        if ( notify ) {
+            GtkTreeIter  it;
+            GtkTreePath* path = gtk_tree_path_new_from_indices(n_rows(m) - 1, -1);
+            set_iter(m, &it, seq);
+            gtk_tree_model_row_inserted(tm, path, &it);
+            gtk_tree_path_free(path);
+        }
+    }
+
+    /* trim expired postings and rows in bulk rather than per packet */
+    if ( m->expired >= ntl_ring_capacity(m->ring) / 2 ) {
+        ntl_ring_index_expire(m->index, ntl_ring_first(m->ring));
+        m->expired = 0;
+    }
+    if ( m->rows && m->rows_head > 0 && m->rows_head >= m->rows->len / 2 ) {
+        g_array_remove_range(m->rows, 0, m->rows_head);
+        m->rows_head = 0;
+    }
+    return rv;
+}
+
+void ntl_ring_model_set_filter(NtlRingModel* m, const ntl_RingFilter* f)
+{
+    clear_filter(&m->filter);
+    if ( m->rows ) {
+        g_array_free(m->rows, TRUE);
+        m->rows = NULL;
+    }
+    m->rows_head = 0;
+    m->stamp++;
+    if ( f && !ntl_ring_filter_is_empty(f) ) {
+        m->filter.min_level = f->min_level;
+        m->filter.tag = g_strdup(f->tag);
+        m->filter.prog = g_strdup(f->prog);
+        m->filter.text = g_strdup(f->text);
+        m->rows = ntl_ring_index_query(m->index, m->ring, &m->filter);
+    }
+}
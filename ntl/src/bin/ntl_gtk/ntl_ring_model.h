@@ -0,0 +1,55 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef __ntl_ring_model_h_
+#define __ntl_ring_model_h_
+
+/*
+ * A GtkTreeModel over a ring of packets. Packets are queued as they
+ * arrive and applied to the model in batches, so a GtkTreeView in
+ * fixed-height mode only ever formats the rows it is showing. A filter
+ * narrows the rows to the matching packets; the view must be detached
+ * while it is changed.
+ */
+
+#include "ntl_ring_index.h"
+#include <gtk/gtk.h>
+
+enum {
+    NTL_RING_COL_TIME,
+    NTL_RING_COL_TAG,
+    NTL_RING_COL_PROC,
+    NTL_RING_COL_LOC,
+    NTL_RING_COL_MSG,
+    NTL_RING_COL_COLOR,
+    NTL_RING_N_COLS,
+};
+
+#define NTL_TYPE_RING_MODEL (ntl_ring_model_get_type())
+#define NTL_RING_MODEL(o)   (G_TYPE_CHECK_INSTANCE_CAST((o), NTL_TYPE_RING_MODEL, NtlRingModel))
+
+typedef struct _NtlRingModel      NtlRingModel;
+typedef struct _NtlRingModelClass NtlRingModelClass;
+
+GType         ntl_ring_model_get_type(void);
+NtlRingModel* ntl_ring_model_new(guint capacity);
+void          ntl_ring_model_queue(NtlRingModel* m, const ntl_Packet* pkt);
+guint         ntl_ring_model_pending(NtlRingModel* m);
+guint         ntl_ring_model_apply(NtlRingModel* m, gboolean notify);
+void          ntl_ring_model_set_filter(NtlRingModel* m, const ntl_RingFilter* f);
+
+#endif
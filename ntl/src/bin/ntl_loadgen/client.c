@@ -0,0 +1,106 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "loadgen.h"
+
+#include "ntlc.h"
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * A synthetic client: posts traces at a steady rate, choosing the
+ * level, tag and message size of each at random.
+ */
+
+/* private */
+#define MAX_TAGS 4096
+
+static gint choose_level(const ntl_LoadConfig* cfg, GRand* rnd)
+{
+    guint total = 0;
+    guint pick = 0;
+    gint  i = 0;
+
+    for ( i = 0; i < 4; i++ ) {
+        total += cfg->level_weights[i];
+    }
+    pick = g_rand_int_range(rnd, 0, MAX(total, 1));
+    for ( i = 0; i < 3; i++ ) {
+        if ( pick < cfg->level_weights[i] ) {
+            break;
+        }
+        pick -= cfg->level_weights[i];
+    }
+    return i;
+}
+
+static gdouble seconds_since(const struct timespec* t0)
+{
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - t0->tv_sec) + (now.tv_nsec - t0->tv_nsec) / 1e9;
+}
+
+/* public */
+int loadgen_client(const ntl_LoadConfig* cfg, guint id, int report_fd)
+{
+    gint            ntags = CLAMP(cfg->tags, 1, MAX_TAGS);
+    gchar**         tags = g_new(gchar*, ntags);
+    gchar*          filler = g_strnfill(cfg->max_size, 'x');
+    GRand*          rnd = g_rand_new_with_seed(id);
+    gchar*          prog = g_strdup_printf("loadgen%u", id);
+    ntl_LoadReport  r = { 0, 0, 0 };
+    struct timespec t0;
+    gint            i = 0;
+
+    for ( i = 0; i < ntags; i++ ) {
+        tags[i] = g_strdup_printf("t%d", i);
+    }
+    ntl_setup(prog);
+    ntl_stamp_latency(cfg->stamps);
+
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+    while ( (r.elapsed = seconds_since(&t0)) < cfg->duration ) {
+        /* catch up with the schedule, then sleep a tick */
+        guint64 due = cfg->rate > 0 ? (guint64) (r.elapsed * cfg->rate) + 1 : r.count + 1000;
+        while ( r.count < due ) {
+            gint size = g_rand_int_range(rnd, cfg->min_size, cfg->max_size + 1);
+            ntl_trace(
+                (ntl_TraceLevelT) choose_level(cfg, rnd), tags[g_rand_int_range(rnd, 0, ntags)],
+                "loadgen", __FUNCTION__, NTL_LOADGEN_MARK "%u %" G_GUINT64_FORMAT " %.*s",
+                id, r.count, size, filler);
+            r.count++;
+        }
+        if ( cfg->rate > 0 ) {
+            g_usleep(1000);
+        }
+    }
+
+    r.shed = ntl_shed_count();
+    ntl_teardown();
+    loadgen_report(report_fd, &r);
+
+    for ( i = 0; i < ntags; i++ ) {
+        g_free(tags[i]);
+    }
+    g_free(tags);
+    g_free(filler);
+    g_free(prog);
+    g_rand_free(rnd);
+    return EXIT_SUCCESS;
+}
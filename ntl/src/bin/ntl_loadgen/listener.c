@@ -0,0 +1,95 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "loadgen.h"
+
+#include "ntll.h"
+#include <gnet.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * A synthetic listener: counts the load generator's traces until it
+ * is sent SIGTERM.
+ */
+
+/* private */
+static volatile sig_atomic_t stopping = 0;
+
+typedef struct {
+    ntl_LoadReport  r;
+    struct timespec first;
+    struct timespec last;
+    GMainLoop*      ml;
+} Counter;
+
+static void count(const ntl_Packet* pkt, gpointer d)
+{
+    Counter* c = (Counter*) d;
+
+    if ( pkt && pkt->msg && g_str_has_prefix(pkt->msg, NTL_LOADGEN_MARK) ) {
+        clock_gettime(CLOCK_MONOTONIC, &c->last);
+        if ( 0 == c->r.count++ ) {
+            c->first = c->last;
+        }
+    }
+}
+
+static void sig_term(int sig)
+{
+    stopping = 1;
+}
+
+static gboolean check_stop(gpointer d)
+{
+    Counter* c = (Counter*) d;
+    if ( stopping ) {
+        g_main_loop_quit(c->ml);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* public */
+int loadgen_listener(const ntl_LoadConfig* cfg, guint id, int report_fd)
+{
+    Counter       c;
+    ntl_Listener* l = NULL;
+
+    memset(&c, 0, sizeof(c));
+    c.ml = g_main_loop_new(NULL, FALSE);
+    signal(SIGTERM, sig_term);
+
+    gnet_init();
+    l = ntl_listener_new("localhost", count, &c);
+    g_timeout_add(100, check_stop, &c);
+    g_main_loop_run(c.ml);
+    if ( cfg->stamps ) {
+        GString* out = g_string_new("");
+        ntl_listener_latency_dump(l, out);
+        g_printerr("listener %u latency (us):\n%s", id, out->str);
+        g_string_free(out, TRUE);
+    }
+    ntl_listener_free(l);
+
+    c.r.elapsed = (c.last.tv_sec - c.first.tv_sec) + (c.last.tv_nsec - c.first.tv_nsec) / 1e9;
+    loadgen_report(report_fd, &c.r);
+    g_main_loop_unref(c.ml);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,54 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef __loadgen_h_
+#define __loadgen_h_
+
+/*
+ * Shared between the parts of ntl_loadgen. The client and listener
+ * roles are in separate files since ntlc.h and ntll.h cannot be
+ * included together. Each role runs in its own forked process and
+ * writes an ntl_LoadReport to the pipe it is given before exiting.
+ */
+
+#include <glib.h>
+
+typedef struct {
+    gint     rate;          /* traces per second per client; 0 is unlimited */
+    gint     duration;      /* seconds */
+    gint     min_size;      /* message sizes are uniform in [min, max] */
+    gint     max_size;
+    guint    level_weights[4];
+    gint     tags;          /* distinct tags used */
+    gboolean stamps;        /* measure latency from client to listener */
+} ntl_LoadConfig;
+
+typedef struct {
+    guint64 count;          /* traces sent or received */
+    gdouble elapsed;        /* seconds from first to last */
+    guint64 shed;           /* bulk traces the client dropped */
+} ntl_LoadReport;
+
+/* a message body; the listeners only count traces starting with it */
+#define NTL_LOADGEN_MARK "lg "
+
+int loadgen_client(const ntl_LoadConfig* cfg, guint id, int report_fd);
+int loadgen_listener(const ntl_LoadConfig* cfg, guint id, int report_fd);
+
+void loadgen_report(int fd, const ntl_LoadReport* r);
+
+#endif
@@ -0,0 +1,309 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "loadgen.h"
+
+#include <dirent.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+/*
+ * Drives a local ntld with synthetic clients and listeners, each in
+ * its own process, and reports the rates achieved, the traces lost
+ * between them and the CPU used by each component.
+ */
+
+static gint     clients = 4;
+static gint     listeners = 1;
+static gint     rate = 1000;
+static gint     duration = 10;
+static gchar*   msg_size = NULL;
+static gchar*   levels = NULL;
+static gint     tags = 8;
+static gint     drain = 2;
+static gint     ntld_pid = 0;
+static gboolean stamps = FALSE;
+
+static GOptionEntry entries[] = {
+    { "clients", 'c', 0, G_OPTION_ARG_INT, &clients, "Client processes (default: 4)", "N" },
+    { "listeners", 'l', 0, G_OPTION_ARG_INT, &listeners, "Listener processes (default: 1)", "N" },
+    { "rate", 'r', 0, G_OPTION_ARG_INT, &rate, "Traces per second per client, 0 for as fast as possible (default: 1000)", "N" },
+    { "duration", 'd', 0, G_OPTION_ARG_INT, &duration, "Seconds to send for (default: 10)", "SECS" },
+    { "msg-size", 's', 0, G_OPTION_ARG_STRING, &msg_size, "Message size, or a uniform range (default: 64)", "N|MIN-MAX" },
+    { "levels", 0, 0, G_OPTION_ARG_STRING, &levels, "Relative weights of trace,debug,warn,error (default: 40,40,15,5)", "T,D,W,E" },
+    { "tags", 't', 0, G_OPTION_ARG_INT, &tags, "Distinct tags (default: 8)", "N" },
+    { "drain", 0, 0, G_OPTION_ARG_INT, &drain, "Seconds listeners wait after the clients finish (default: 2)", "SECS" },
+    { "ntld-pid", 0, 0, G_OPTION_ARG_INT, &ntld_pid, "The daemon to measure (default: the process named ntld)", "PID" },
+    { "stamps", 0, 0, G_OPTION_ARG_NONE, &stamps, "Stamp traces and report each listener's per-hop latency", NULL },
+    { NULL }
+};
+
+typedef struct {
+    pid_t          pid;
+    int            fd;
+    ntl_LoadReport report;
+    struct rusage  usage;
+} Child;
+
+/* private */
+static gboolean parse_config(ntl_LoadConfig* cfg)
+{
+    memset(cfg, 0, sizeof(*cfg));
+    cfg->rate = MAX(rate, 0);
+    cfg->duration = MAX(duration, 1);
+    cfg->tags = MAX(tags, 1);
+    cfg->stamps = stamps;
+    cfg->min_size = cfg->max_size = 64;
+    if ( msg_size && 2 != sscanf(msg_size, "%d-%d", &cfg->min_size, &cfg->max_size) ) {
+        if ( 1 != sscanf(msg_size, "%d", &cfg->min_size) ) {
+            g_printerr("invalid message size: %s\n", msg_size);
+            return FALSE;
+        }
+        cfg->max_size = cfg->min_size;
+    }
+    if ( cfg->min_size < 0 || cfg->max_size < cfg->min_size ) {
+        g_printerr("invalid message size: %s\n", msg_size);
+        return FALSE;
+    }
+    cfg->level_weights[0] = 40;
+    cfg->level_weights[1] = 40;
+    cfg->level_weights[2] = 15;
+    cfg->level_weights[3] = 5;
+    if ( levels && 4 != sscanf(levels, "%u,%u,%u,%u", cfg->level_weights, cfg->level_weights + 1, cfg->level_weights + 2, cfg->level_weights + 3) ) {
+        g_printerr("invalid level weights: %s\n", levels);
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static gboolean spawn(Child* c, int (*role)(const ntl_LoadConfig*, guint, int), const ntl_LoadConfig* cfg, guint id)
+{
+    int fds[2];
+
+    if ( pipe(fds) < 0 ) {
+        return FALSE;
+    }
+    c->pid = fork();
+    if ( c->pid < 0 ) {
+        close(fds[0]);
+        close(fds[1]);
+        return FALSE;
+    }
+    if ( 0 == c->pid ) {
+        close(fds[0]);
+        _exit(role(cfg, id, fds[1]));
+    }
+    close(fds[1]);
+    c->fd = fds[0];
+    return TRUE;
+}
+
+static void reap(Child* c)
+{
+    int    status = 0;
+    gsize  got = 0;
+
+    while ( got < sizeof(c->report) ) {
+        ssize_t n = read(c->fd, ((gchar*) &c->report) + got, sizeof(c->report) - got);
+        if ( n <= 0 ) {
+            break;
+        }
+        got += n;
+    }
+    if ( got < sizeof(c->report) ) {
+        memset(&c->report, 0, sizeof(c->report));
+    }
+    close(c->fd);
+    wait4(c->pid, &status, 0, &c->usage);
+}
+
+static gdouble tv_seconds(const struct timeval* tv)
+{
+    return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+static pid_t find_ntld(void)
+{
+    DIR*           d = opendir("/proc");
+    struct dirent* e = NULL;
+    pid_t          rv = 0;
+
+    while ( d && 0 == rv && (e = readdir(d)) ) {
+        gchar* fn = g_strdup_printf("/proc/%s/comm", e->d_name);
+        gchar* comm = NULL;
+        if ( g_ascii_isdigit(e->d_name[0]) && g_file_get_contents(fn, &comm, NULL, NULL) ) {
+            if ( 0 == strcmp(g_strchomp(comm), "ntld") ) {
+                rv = atoi(e->d_name);
+            }
+        }
+        g_free(comm);
+        g_free(fn);
+    }
+    if ( d ) {
+        closedir(d);
+    }
+    return rv;
+}
+
+/* user and system seconds used so far by a process */
+static gboolean proc_cpu(pid_t pid, gdouble* user, gdouble* sys)
+{
+    gchar*        fn = g_strdup_printf("/proc/%d/stat", pid);
+    gchar*        stat = NULL;
+    gboolean      rv = FALSE;
+    unsigned long ut = 0;
+    unsigned long st = 0;
+
+    if ( g_file_get_contents(fn, &stat, NULL, NULL) ) {
+        /* skip past the command, which may contain spaces */
+        const gchar* p = strrchr(stat, ')');
+        if ( p && 2 == sscanf(p + 2, "%*c %*d %*d %*d %*d %*d %*u %*u %*u %*u %*u %lu %lu", &ut, &st) ) {
+            *user = (gdouble) ut / sysconf(_SC_CLK_TCK);
+            *sys = (gdouble) st / sysconf(_SC_CLK_TCK);
+            rv = TRUE;
+        }
+    }
+    g_free(stat);
+    g_free(fn);
+    return rv;
+}
+
+static void sum_usage(Child* cs, gint n, gdouble* user, gdouble* sys)
+{
+    gint i = 0;
+
+    *user = *sys = 0;
+    for ( i = 0; i < n; i++ ) {
+        *user += tv_seconds(&cs[i].usage.ru_utime);
+        *sys += tv_seconds(&cs[i].usage.ru_stime);
+    }
+}
+
+/* public */
+void loadgen_report(int fd, const ntl_LoadReport* r)
+{
+    if ( write(fd, r, sizeof(*r)) != sizeof(*r) ) {
+        g_printerr("failed to report\n");
+    }
+    close(fd);
+}
+
+int main(int argc, char* argv[])
+{
+    GError*         err = NULL;
+    GOptionContext* ctx = g_option_context_new("- generate load against a local ntld");
+    ntl_LoadConfig  cfg;
+    Child*          cs = NULL;
+    Child*          ls = NULL;
+    pid_t           daemon = 0;
+    gdouble         d_user0 = 0, d_sys0 = 0, d_user1 = 0, d_sys1 = 0;
+    gdouble         user = 0, sys = 0;
+    guint64         sent = 0, shed = 0, delivered = 0, expected = 0;
+    gdouble         sent_elapsed = 0, delivered_rate = 0;
+    gint            i = 0;
+
+    g_option_context_add_main_entries(ctx, entries, NULL);
+    if ( !g_option_context_parse(ctx, &argc, &argv, &err) ) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(ctx);
+    if ( !parse_config(&cfg) ) {
+        return EXIT_FAILURE;
+    }
+    clients = MAX(clients, 1);
+    listeners = MAX(listeners, 0);
+
+    daemon = ntld_pid > 0 ? ntld_pid : find_ntld();
+    if ( 0 == daemon ) {
+        g_printerr("warning: no ntld found; its CPU will not be reported\n");
+    }
+
+    cs = g_new0(Child, clients);
+    ls = g_new0(Child, MAX(listeners, 1));
+    for ( i = 0; i < listeners; i++ ) {
+        if ( !spawn(ls + i, loadgen_listener, &cfg, i) ) {
+            g_printerr("failed to start listener %d\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+    /* let the listeners connect before anything is sent */
+    sleep(1);
+
+    if ( daemon ) {
+        proc_cpu(daemon, &d_user0, &d_sys0);
+    }
+    for ( i = 0; i < clients; i++ ) {
+        if ( !spawn(cs + i, loadgen_client, &cfg, i) ) {
+            g_printerr("failed to start client %d\n", i);
+            return EXIT_FAILURE;
+        }
+    }
+    for ( i = 0; i < clients; i++ ) {
+        reap(cs + i);
+        sent += cs[i].report.count;
+        shed += cs[i].report.shed;
+        sent_elapsed = MAX(sent_elapsed, cs[i].report.elapsed);
+    }
+
+    sleep(MAX(drain, 0));
+    if ( daemon && !proc_cpu(daemon, &d_user1, &d_sys1) ) {
+        g_printerr("warning: ntld (%d) went away\n", daemon);
+        daemon = 0;
+    }
+    for ( i = 0; i < listeners; i++ ) {
+        kill(ls[i].pid, SIGTERM);
+    }
+    for ( i = 0; i < listeners; i++ ) {
+        reap(ls + i);
+        delivered += ls[i].report.count;
+        if ( ls[i].report.elapsed > 0 ) {
+            delivered_rate += ls[i].report.count / ls[i].report.elapsed;
+        }
+    }
+    expected = sent * listeners;
+
+    g_print("config:    %d clients x %d/s for %ds, msg %d-%d bytes, %d tags, levels %u/%u/%u/%u\n",
+        clients, cfg.rate, cfg.duration, cfg.min_size, cfg.max_size, cfg.tags,
+        cfg.level_weights[0], cfg.level_weights[1], cfg.level_weights[2], cfg.level_weights[3]);
+    sum_usage(cs, clients, &user, &sys);
+    g_print("ingest:    %" G_GUINT64_FORMAT " traces, %.1f/s, %" G_GUINT64_FORMAT " shed; clients cpu %.2fs user %.2fs sys\n",
+        sent, sent_elapsed > 0 ? sent / sent_elapsed : 0.0, shed, user, sys);
+    if ( listeners > 0 ) {
+        sum_usage(ls, listeners, &user, &sys);
+        g_print("delivered: %" G_GUINT64_FORMAT " traces to %d listeners, %.1f/s each; listeners cpu %.2fs user %.2fs sys\n",
+            delivered, listeners, delivered_rate / listeners, user, sys);
+        g_print("drops:     %" G_GUINT64_FORMAT " (%.3f%%)\n",
+            expected > delivered ? expected - delivered : 0,
+            expected > delivered ? 100.0 * (expected - delivered) / expected : 0.0);
+    }
+    if ( daemon ) {
+        g_print("ntld:      pid %d cpu %.2fs user %.2fs sys\n", daemon, d_user1 - d_user0, d_sys1 - d_sys0);
+    }
+
+    g_free(cs);
+    g_free(ls);
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,674 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#define _GNU_SOURCE
+#include <glib.h>
+#include <stdio.h>
+#include "ntll.h"
+#include "ntl_archive.h"
+#include "ntl_trigram.h"
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <zlib.h>
+
+/* an offline query over stored trace files: the default text output
+ * of ntl_fl (plain or gzipped segments) and ntl_fl archives.
+ *
+ * Files are memory-mapped and cut into chunks (text) or blocks
+ * (archives); a thread pool evaluates the filters over each piece
+ * independently and the matches are merged into time order at the end.
+ * When a text segment has a trigram index beside it, --grep and the
+ * literals of --regex pick the blocks worth reading.
+ */
+
+typedef struct {
+    gchar*       name;
+    GMappedFile* map;
+    gchar*       data;  /* owned copy when the file had to be inflated */
+    const gchar* contents;
+    gsize        len;
+} Source;
+
+typedef struct {
+    guint    source;
+    gsize    start;
+    gsize    end;
+    gboolean archive_block;
+} Task;
+
+typedef struct {
+    gchar* time;   /* "YYYY-mm-dd HH:MM:SS.mmm", sorts chronologically */
+    gchar* line;
+    guint  source;
+    gsize  offset;
+} Match;
+
+typedef struct {
+    const gchar* tag;
+    gsize        tag_len;
+    const gchar* level;
+    gsize        level_len;
+    const gchar* prog;
+    gsize        prog_len;
+    const gchar* time;
+    gsize        time_len;
+    const gchar* mod;
+    gsize        mod_len;
+    const gchar* msg;
+    gsize        msg_len;
+} Line;
+
+#define CHUNK_SIZE (8 * 1024 * 1024)
+
+static gchar*  since = NULL;
+static gchar*  until = NULL;
+static gchar*  level = NULL;
+static gchar*  prog = NULL;
+static gchar*  tag = NULL;
+static gchar*  mod = NULL;
+static gchar*  grep = NULL;
+static gchar*  regex = NULL;
+static gint    threads = 0;
+static gchar** files = NULL;
+
+static GOptionEntry entries[] = {
+    { "since", 's', 0, G_OPTION_ARG_STRING, &since, "Only traces at or after this local time", "\"YYYY-mm-dd HH:MM:SS\"" },
+    { "until", 'u', 0, G_OPTION_ARG_STRING, &until, "Only traces at or before this local time", "\"YYYY-mm-dd HH:MM:SS\"" },
+    { "level", 'l', 0, G_OPTION_ARG_STRING, &level, "Only traces at this level or above", "trace|debug|warn|error" },
+    { "prog", 'p', 0, G_OPTION_ARG_STRING, &prog, "Only traces from this program", "PROG" },
+    { "tag", 't', 0, G_OPTION_ARG_STRING, &tag, "Only traces with this tag", "TAG" },
+    { "mod", 'm', 0, G_OPTION_ARG_STRING, &mod, "Only traces from this module", "MOD" },
+    { "grep", 'g', 0, G_OPTION_ARG_STRING, &grep, "Only traces whose message contains this string", "STRING" },
+    { "regex", 'e', 0, G_OPTION_ARG_STRING, &regex, "Only traces whose message matches this regular expression", "RE" },
+    { "threads", 'j', 0, G_OPTION_ARG_INT, &threads, "Worker threads (default: one per core)", "N" },
+    { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &files, NULL, "FILE..." },
+    { NULL }
+};
+
+static GPtrArray*      sources = NULL;
+static GRegex*         re = NULL;
+static ntl_TraceLevelT min_level = ntl_tl_Trace;
+static long long       since_ms = 0;
+static long long       until_ms = G_MAXINT64;
+static gsize           since_len = 0;
+static gsize           until_len = 0;
+static gsize           grep_len = 0;
+static gchar**         literals = NULL; /* those every --regex match contains */
+static ntl_Template*   tmpl = NULL;
+
+static GMutex          results_lock;
+static GPtrArray*      results = NULL;
+
+/* private */
+static gboolean field_equal(const gchar* s, gsize len, const gchar* want)
+{
+    return NULL == want || (strlen(want) == len && 0 == memcmp(s, want, len));
+}
+
+static gboolean level_from_string(const gchar* s, ntl_TraceLevelT* lvl)
+{
+    static const gchar* names[] = { "trace", "debug", "warn", "error" };
+    guint i = 0;
+
+    for ( i = 0; i < G_N_ELEMENTS(names); i++ ) {
+        if ( 0 == g_ascii_strcasecmp(s, names[i]) || 0 == g_strcmp0(s, ntl_level_to_string((ntl_TraceLevelT) i)) ) {
+            *lvl = (ntl_TraceLevelT) i;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* parses a bound given at second, minute or day precision */
+static gboolean time_bound(const gchar* s, gboolean upper, long long* ms)
+{
+    static const struct {
+        const gchar* fmt;
+        long long    span;
+    } fmts[] = {
+        { "%Y-%m-%d %H:%M:%S", 1 },
+        { "%Y-%m-%d %H:%M", 60 },
+        { "%Y-%m-%d", 86400 },
+    };
+    guint i = 0;
+
+    for ( i = 0; i < G_N_ELEMENTS(fmts); i++ ) {
+        struct tm   tm;
+        const char* end = NULL;
+
+        memset(&tm, 0, sizeof(tm));
+        end = strptime(s, fmts[i].fmt, &tm);
+        if ( end && '\0' == *end ) {
+            tm.tm_isdst = -1;
+            *ms = (long long) mktime(&tm) * 1000;
+            if ( upper ) {
+                *ms += fmts[i].span * 1000 - 1;
+            }
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+static gboolean time_in_range(const gchar* t, gsize len)
+{
+    if ( since && strncmp(t, since, MIN(len, since_len)) < 0 ) {
+        return FALSE;
+    }
+    if ( until && strncmp(t, until, MIN(len, until_len)) > 0 ) {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static const gchar* find_sep(const gchar* p, const gchar* end, const gchar* sep, gsize sep_len)
+{
+    return memmem(p, end - p, sep, sep_len);
+}
+
+/* [tag] [level] [prog, pid, tid] [time] [mod/fn]: msg */
+static gboolean parse_line(const gchar* p, const gchar* end, Line* ln)
+{
+    const gchar* q = NULL;
+
+    if ( p >= end || '[' != *p ) {
+        return FALSE;
+    }
+    ln->tag = ++p;
+    if ( !(q = find_sep(p, end, "] [", 3)) ) {
+        return FALSE;
+    }
+    ln->tag_len = q - p;
+    ln->level = p = q + 3;
+    if ( !(q = find_sep(p, end, "] [", 3)) ) {
+        return FALSE;
+    }
+    ln->level_len = q - p;
+    ln->prog = p = q + 3;
+    if ( !(q = find_sep(p, end, "] [", 3)) ) {
+        return FALSE;
+    }
+    {
+        const gchar* comma = find_sep(p, q, ", ", 2);
+        ln->prog_len = (comma ? comma : q) - p;
+    }
+    ln->time = p = q + 3;
+    if ( !(q = find_sep(p, end, "] [", 3)) ) {
+        return FALSE;
+    }
+    ln->time_len = q - p;
+    ln->mod = p = q + 3;
+    if ( !(q = find_sep(p, end, "]: ", 3)) ) {
+        return FALSE;
+    }
+    {
+        const gchar* slash = memchr(p, '/', q - p);
+        ln->mod_len = (slash ? slash : q) - p;
+    }
+    ln->msg = q + 3;
+    ln->msg_len = end - ln->msg;
+    return TRUE;
+}
+
+static gboolean line_matches(const Line* ln)
+{
+    ntl_TraceLevelT lvl = ntl_tl_Trace;
+    gchar           lvl_buf[32];
+
+    if ( ln->level_len < sizeof(lvl_buf) ) {
+        memcpy(lvl_buf, ln->level, ln->level_len);
+        lvl_buf[ln->level_len] = '\0';
+        level_from_string(lvl_buf, &lvl);
+    }
+    if ( lvl < min_level
+         || !field_equal(ln->tag, ln->tag_len, tag)
+         || !field_equal(ln->prog, ln->prog_len, prog)
+         || !field_equal(ln->mod, ln->mod_len, mod)
+         || !time_in_range(ln->time, ln->time_len) ) {
+        return FALSE;
+    }
+    if ( grep && NULL == memmem(ln->msg, ln->msg_len, grep, grep_len) ) {
+        return FALSE;
+    }
+    if ( re && !g_regex_match_full(re, ln->msg, ln->msg_len, 0, 0, NULL, NULL) ) {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+static void add_match(GPtrArray* out, guint source, gsize offset, const gchar* line, gsize len, const Line* ln)
+{
+    Match* m = g_new(Match, 1);
+    m->time = g_strndup(ln->time, ln->time_len);
+    m->line = g_strndup(line, len);
+    m->source = source;
+    m->offset = offset;
+    g_ptr_array_add(out, m);
+}
+
+static void scan_text(const Task* t, GPtrArray* out)
+{
+    const Source* src = (const Source*) g_ptr_array_index(sources, t->source);
+    const gchar*  base = src->contents;
+    const gchar*  p = base + t->start;
+    const gchar*  end = base + t->end;
+
+    while ( p < end ) {
+        const gchar* eol = NULL;
+        const gchar* sol = p;
+        Line         ln;
+
+        if ( grep ) {
+            /* jump straight to the next occurrence of the needle and
+             * only then find the line around it; memmem() is SIMD
+             * accelerated in glibc, so most of the chunk is never
+             * looked at line by line */
+            const gchar* hit = memmem(p, end - p, grep, grep_len);
+            if ( NULL == hit ) {
+                break;
+            }
+            sol = hit;
+            while ( sol > p && '\n' != sol[-1] ) {
+                sol--;
+            }
+        }
+        eol = memchr(sol, '\n', end - sol);
+        if ( NULL == eol ) {
+            eol = end;
+        }
+        if ( parse_line(sol, eol, &ln) && line_matches(&ln) ) {
+            add_match(out, t->source, sol - base, sol, eol - sol, &ln);
+        }
+        p = eol + 1;
+    }
+}
+
+static gboolean block_may_match(const ntl_ArchiveStats* s)
+{
+    guint wanted = ~((1u << min_level) - 1);
+
+    return s->max_ms >= since_ms && s->min_ms <= until_ms
+        && (s->level_mask & wanted)
+        && (NULL == prog || ntl_archive_stats_has(s, ntl_ad_Prog, prog))
+        && (NULL == tag || ntl_archive_stats_has(s, ntl_ad_Tag, tag))
+        && (NULL == mod || ntl_archive_stats_has(s, ntl_ad_Mod, mod));
+}
+
+static gboolean packet_matches(const ntl_Packet* pkt)
+{
+    long long ms = (long long) pkt->time * 1000 + pkt->millis;
+
+    if ( pkt->lvl < min_level
+         || (tag && 0 != g_strcmp0(pkt->tag, tag))
+         || (prog && 0 != g_strcmp0(pkt->prog, prog))
+         || (mod && 0 != g_strcmp0(pkt->mod, mod))
+         || ms < since_ms || ms > until_ms ) {
+        return FALSE;
+    }
+    if ( grep && NULL == strstr(pkt->msg, grep) ) {
+        return FALSE;
+    }
+    if ( re && !g_regex_match(re, pkt->msg, 0, NULL) ) {
+        return FALSE;
+    }
+    return TRUE;
+}
+
+/* archive rows are filtered as decoded; only matches are rendered */
+static void scan_archive_block(const Task* t, GPtrArray* out)
+{
+    const Source*      src = (const Source*) g_ptr_array_index(sources, t->source);
+    ntl_ArchiveReader* r = ntl_archive_reader_new(src->contents, src->len);
+    GPtrArray*         pkts = NULL;
+    GString*           s = g_string_sized_new(256);
+    guint              i = 0;
+
+    ntl_archive_reader_seek(r, t->start);
+    if ( ntl_archive_reader_next(r) ) {
+        pkts = ntl_archive_reader_decode(r);
+    }
+    for ( i = 0; pkts && i < pkts->len; i++ ) {
+        const ntl_Packet* pkt = (const ntl_Packet*) g_ptr_array_index(pkts, i);
+        Match*            m = NULL;
+
+        if ( !packet_matches(pkt) ) {
+            continue;
+        }
+        g_string_truncate(s, 0);
+        ntl_template_render(tmpl, s, pkt);
+        g_string_truncate(s, s->len - 1); /* the newline */
+        m = g_new(Match, 1);
+        m->time = ntl_listener_default_time_format(pkt);
+        m->line = g_strndup(s->str, s->len);
+        m->source = t->source;
+        m->offset = t->start + i;
+        g_ptr_array_add(out, m);
+    }
+    if ( pkts ) {
+        g_ptr_array_free(pkts, TRUE);
+    }
+    g_string_free(s, TRUE);
+    ntl_archive_reader_free(r);
+}
+
+static void run_task(gpointer d, gpointer ud)
+{
+    Task*      t = (Task*) d;
+    GPtrArray* out = g_ptr_array_new();
+    guint      i = 0;
+
+    if ( t->archive_block ) {
+        scan_archive_block(t, out);
+    } else {
+        scan_text(t, out);
+    }
+
+    g_mutex_lock(&results_lock);
+    for ( i = 0; i < out->len; i++ ) {
+        g_ptr_array_add(results, g_ptr_array_index(out, i));
+    }
+    g_mutex_unlock(&results_lock);
+
+    g_ptr_array_free(out, TRUE);
+    g_free(t);
+}
+
+static Task* new_task(guint source, gsize start, gsize end, gboolean archive_block)
+{
+    Task* rv = g_new(Task, 1);
+    rv->source = source;
+    rv->start = start;
+    rv->end = end;
+    rv->archive_block = archive_block;
+    return rv;
+}
+
+static gchar* inflate_file(const gchar* fn, gsize* len, GError** err)
+{
+    gzFile   gz = gzopen(fn, "rb");
+    GString* s = NULL;
+    gchar    buf[64 * 1024];
+    int      n = 0;
+
+    if ( NULL == gz ) {
+        g_set_error(err, G_FILE_ERROR, g_file_error_from_errno(errno), "%s", g_strerror(errno));
+        return NULL;
+    }
+    s = g_string_sized_new(sizeof(buf));
+    while ( (n = gzread(gz, buf, sizeof(buf))) > 0 ) {
+        g_string_append_len(s, buf, n);
+    }
+    if ( n < 0 ) {
+        int zerr = 0;
+        g_set_error(err, G_FILE_ERROR, G_FILE_ERROR_FAILED, "%s", gzerror(gz, &zerr));
+        g_string_free(s, TRUE);
+        gzclose(gz);
+        return NULL;
+    }
+    gzclose(gz);
+    *len = s->len;
+    return g_string_free(s, FALSE);
+}
+
+/* NULL, with err set, when the file cannot be read */
+static Source* open_source(const gchar* fn, GError** err)
+{
+    Source* rv = g_new0(Source, 1);
+
+    rv->name = g_strdup(fn);
+    if ( g_str_has_suffix(fn, ".gz") ) {
+        rv->data = inflate_file(fn, &rv->len, err);
+        rv->contents = rv->data;
+        if ( NULL == rv->data ) {
+            g_free(rv->name);
+            g_free(rv);
+            return NULL;
+        }
+    } else {
+        rv->map = g_mapped_file_new(fn, FALSE, err);
+        if ( NULL == rv->map ) {
+            g_free(rv->name);
+            g_free(rv);
+            return NULL;
+        }
+        /* NULL for an empty file, which simply holds no traces */
+        rv->contents = g_mapped_file_get_contents(rv->map);
+        rv->len = g_mapped_file_get_length(rv->map);
+    }
+    return rv;
+}
+
+static void free_source(gpointer d)
+{
+    Source* s = (Source*) d;
+    if ( s->map ) {
+        g_mapped_file_unref(s->map);
+    }
+    g_free(s->data);
+    g_free(s->name);
+    g_free(s);
+}
+
+static void queue_text(GThreadPool* pool, guint idx, gsize start, gsize stop)
+{
+    const Source* src = (const Source*) g_ptr_array_index(sources, idx);
+
+    while ( start < stop ) {
+        gsize        end = MIN(start + CHUNK_SIZE, stop);
+        const gchar* nl = NULL;
+
+        /* chunks end on a line boundary */
+        if ( end < stop && (nl = memchr(src->contents + end, '\n', stop - end)) ) {
+            end = nl - src->contents + 1;
+        } else {
+            end = stop;
+        }
+        g_thread_pool_push(pool, new_task(idx, start, end, FALSE), NULL);
+        start = end;
+    }
+}
+
+/* FALSE when there is no index to use, so the whole source is read */
+static gboolean queue_candidates(GThreadPool* pool, guint idx)
+{
+    const Source*     src = (const Source*) g_ptr_array_index(sources, idx);
+    gchar*            fn = NULL;
+    ntl_TrigramIndex* ti = NULL;
+    guint8*           cand = NULL;
+    gboolean          pruned = FALSE;
+    guint             n = 0;
+    guint             i = 0;
+
+    if ( NULL == grep && (NULL == literals || NULL == literals[0]) ) {
+        return FALSE;
+    }
+    fn = ntl_trigram_index_name(src->name);
+    ti = ntl_trigram_index_open(fn, src->len);
+    g_free(fn);
+    if ( NULL == ti ) {
+        return FALSE;
+    }
+    n = ntl_trigram_index_blocks(ti);
+    cand = g_malloc(MAX(n, 1));
+    memset(cand, 1, n);
+    if ( grep ) {
+        pruned |= ntl_trigram_index_require(ti, grep, grep_len, cand);
+    }
+    for ( i = 0; literals && literals[i]; i++ ) {
+        pruned |= ntl_trigram_index_require(ti, literals[i], strlen(literals[i]), cand);
+    }
+    /* runs of candidate blocks are read as one range */
+    for ( i = 0; pruned && i < n; i++ ) {
+        gsize start = 0;
+        gsize from = 0;
+        gsize end = 0;
+
+        if ( !cand[i] ) {
+            continue;
+        }
+        ntl_trigram_index_block(ti, i, &start, &end);
+        while ( i + 1 < n && cand[i + 1] ) {
+            ntl_trigram_index_block(ti, ++i, &from, &end);
+        }
+        queue_text(pool, idx, start, end);
+    }
+    g_free(cand);
+    ntl_trigram_index_free(ti);
+    return pruned;
+}
+
+static void queue_source(GThreadPool* pool, guint idx)
+{
+    const Source* src = (const Source*) g_ptr_array_index(sources, idx);
+
+    if ( NULL == src->contents ) {
+        return;
+    }
+    if ( ntl_archive_is_archive(src->contents, src->len) ) {
+        /* block statistics are cheap to read, so prune here and only
+         * hand candidate blocks to the workers */
+        ntl_ArchiveReader*      r = ntl_archive_reader_new(src->contents, src->len);
+        const ntl_ArchiveStats* s = NULL;
+        while ( (s = ntl_archive_reader_next(r)) ) {
+            if ( block_may_match(s) ) {
+                g_thread_pool_push(pool, new_task(idx, ntl_archive_reader_tell(r), 0, TRUE), NULL);
+            }
+        }
+        ntl_archive_reader_free(r);
+    } else if ( !queue_candidates(pool, idx) ) {
+        queue_text(pool, idx, 0, src->len);
+    }
+}
+
+static gint compare_matches(gconstpointer a, gconstpointer b)
+{
+    const Match* ma = *((const Match**) a);
+    const Match* mb = *((const Match**) b);
+    gint         rv = strcmp(ma->time, mb->time);
+
+    if ( 0 == rv ) {
+        rv = (ma->source > mb->source) - (ma->source < mb->source);
+    }
+    if ( 0 == rv ) {
+        rv = (ma->offset > mb->offset) - (ma->offset < mb->offset);
+    }
+    return rv;
+}
+
+static void free_match(gpointer d)
+{
+    Match* m = (Match*) d;
+    g_free(m->time);
+    g_free(m->line);
+    g_free(m);
+}
+
+static gboolean setup_filters(void)
+{
+    if ( level && !level_from_string(level, &min_level) ) {
+        g_printerr("unknown level: %s\n", level);
+        return FALSE;
+    }
+    if ( since && !time_bound(since, FALSE, &since_ms) ) {
+        g_printerr("bad time: %s\n", since);
+        return FALSE;
+    }
+    if ( until && !time_bound(until, TRUE, &until_ms) ) {
+        g_printerr("bad time: %s\n", until);
+        return FALSE;
+    }
+    if ( regex ) {
+        GError* err = NULL;
+        re = g_regex_new(regex, G_REGEX_OPTIMIZE | G_REGEX_RAW, 0, &err);
+        if ( NULL == re ) {
+            g_printerr("bad regular expression: %s\n", err->message);
+            g_error_free(err);
+            return FALSE;
+        }
+        literals = ntl_trigram_literals(regex);
+    }
+    since_len = since ? strlen(since) : 0;
+    until_len = until ? strlen(until) : 0;
+    grep_len = grep ? strlen(grep) : 0;
+    if ( grep && 0 == grep_len ) {
+        grep = NULL;
+    }
+    tmpl = ntl_template_compile(NTL_TEMPLATE_DEFAULT);
+    return TRUE;
+}
+
+int main(int argc, char* argv[])
+{
+    GError*         err = NULL;
+    GOptionContext* ctx = g_option_context_new("FILE... - search stored NTL traces");
+    GThreadPool*    pool = NULL;
+    guint           failed = 0;
+    guint           i = 0;
+
+    g_option_context_add_main_entries(ctx, entries, NULL);
+    if ( !g_option_context_parse(ctx, &argc, &argv, &err) ) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(ctx);
+    if ( NULL == files || !setup_filters() ) {
+        return EXIT_FAILURE;
+    }
+
+    g_mutex_init(&results_lock);
+    results = g_ptr_array_new_with_free_func(free_match);
+    sources = g_ptr_array_new_with_free_func(free_source);
+    pool = g_thread_pool_new(run_task, NULL, threads > 0 ? threads : (gint) g_get_num_processors(), TRUE, NULL);
+
+    for ( i = 0; files[i]; i++ ) {
+        Source* src = open_source(files[i], &err);
+        if ( NULL == src ) {
+            g_printerr("failed to read %s: %s\n", files[i], err->message);
+            g_clear_error(&err);
+            failed++;
+            continue;
+        }
+        g_ptr_array_add(sources, src);
+    }
+    for ( i = 0; i < sources->len; i++ ) {
+        queue_source(pool, i);
+    }
+    g_thread_pool_free(pool, FALSE, TRUE);
+
+    g_ptr_array_sort(results, compare_matches);
+    for ( i = 0; i < results->len; i++ ) {
+        const Match* m = (const Match*) g_ptr_array_index(results, i);
+        fputs(m->line, stdout);
+        fputc('\n', stdout);
+    }
+
+    g_ptr_array_free(results, TRUE);
+    g_ptr_array_free(sources, TRUE);
+    ntl_template_free(tmpl);
+    if ( re ) {
+        g_regex_unref(re);
+    }
+    g_strfreev(literals);
+    g_mutex_clear(&results_lock);
+
+    /* the matches from the files that could be read are still printed */
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
@@ -0,0 +1,139 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include <glib.h>
+#include <stdio.h>
+#include "ntlc.h"
+#include "ntl_crash_ring.h"
+
+#include <errno.h>
+#include <signal.h>
+#include <stdlib.h>
+#include <string.h>
+
+/* forwards the traces a crashed process left unsent in its crash ring */
+
+static gboolean dry_run = FALSE;
+static gboolean keep = FALSE;
+static gboolean force = FALSE;
+static gchar**  files = NULL;
+
+static GOptionEntry entries[] = {
+    { "dry-run", 'n', 0, G_OPTION_ARG_NONE, &dry_run, "Print the unsent traces instead of forwarding them", NULL },
+    { "keep", 'k', 0, G_OPTION_ARG_NONE, &keep, "Keep ring files once they have been forwarded", NULL },
+    { "force", 'f', 0, G_OPTION_ARG_NONE, &force, "Recover rings whose process is still running", NULL },
+    { G_OPTION_REMAINING, 0, 0, G_OPTION_ARG_FILENAME_ARRAY, &files, NULL, "[RING...]" },
+    { NULL }
+};
+
+static gboolean print_packet(const gchar* pkt, gpointer d)
+{
+    printf("%s\n", pkt);
+    return TRUE;
+}
+
+static gboolean forward_packet(const gchar* pkt, gpointer d)
+{
+    return 0 == ntl_forward(pkt);
+}
+
+static gboolean is_running(pid_t pid)
+{
+    return 0 == kill(pid, 0) || EPERM == errno;
+}
+
+static gboolean recover(const gchar* fn)
+{
+    ntl_CrashRing* r = ntl_crash_ring_open(fn);
+    guint          n = 0;
+    gboolean       rv = TRUE;
+
+    if ( NULL == r ) {
+        g_printerr("%s: not a crash ring\n", fn);
+        return FALSE;
+    }
+    if ( !force && is_running(ntl_crash_ring_pid(r)) ) {
+        g_printerr("%s: %s (%d) is still running\n", fn, ntl_crash_ring_prog(r), ntl_crash_ring_pid(r));
+        ntl_crash_ring_close(r, FALSE);
+        return FALSE;
+    }
+
+    /* a dry run leaves the ring as it found it, for the real one */
+    n = ntl_crash_ring_recover(r, dry_run ? print_packet : forward_packet, NULL, !dry_run);
+    if ( !dry_run && ntl_crash_ring_pending(r) ) {
+        g_printerr("%s: forwarded %u traces, ntld stopped taking the rest\n", fn, n);
+        rv = FALSE;
+    } else if ( !dry_run ) {
+        g_printerr("%s: forwarded %u traces from %s (%d)\n", fn, n, ntl_crash_ring_prog(r), ntl_crash_ring_pid(r));
+    }
+    ntl_crash_ring_close(r, rv && !dry_run && !keep);
+    return rv;
+}
+
+static gchar** find_rings(void)
+{
+    GPtrArray*   rv = g_ptr_array_new();
+    gchar*       path = ntl_crash_ring_dir();
+    GDir*        dir = path ? g_dir_open(path, 0, NULL) : NULL;
+    const gchar* name = NULL;
+
+    while ( dir && (name = g_dir_read_name(dir)) ) {
+        if ( g_str_has_prefix(name, "ntl-") && g_str_has_suffix(name, ".ring") ) {
+            g_ptr_array_add(rv, g_build_filename(path, name, NULL));
+        }
+    }
+    if ( dir ) {
+        g_dir_close(dir);
+    }
+    g_free(path);
+    g_ptr_array_add(rv, NULL);
+    return (gchar**) g_ptr_array_free(rv, FALSE);
+}
+
+int main(int argc, char* argv[])
+{
+    GError*         err = NULL;
+    GOptionContext* ctx = g_option_context_new("- forward traces left in crash rings");
+    gboolean        ok = TRUE;
+    gint            i = 0;
+
+    g_option_context_add_main_entries(ctx, entries, NULL);
+    if ( !g_option_context_parse(ctx, &argc, &argv, &err) ) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(ctx);
+
+    if ( NULL == files ) {
+        /* without names, only dead processes' rings are wanted */
+        files = find_rings();
+        force = FALSE;
+    }
+    if ( !dry_run ) {
+        ntl_setup("ntl_recover");
+    }
+    for ( i = 0; files[i]; i++ ) {
+        ok = recover(files[i]) && ok;
+    }
+    if ( !dry_run ) {
+        ntl_teardown();
+    }
+    g_strfreev(files);
+
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -20,6 +20,9 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+#include "ntlu.h"
+#include "ntl_types.h"
 
 /* a network peer that receives log traces and broadcasts them to
  * listeners.
@@ -32,37 +35,1109 @@ typedef struct {
     connection_func new;
     connection_func close;
     data_func       read;
+    connection_func written;
 } ConnHandling;
 
+/*
+ * Each listener has a queue per lane. Warn and Error traces go on the
+ * urgent lane, which is drained first and may fill more of the
+ * listener's write window; when a listener falls behind, its bulk
+ * queue sheds its oldest traces first.
+ */
+enum {
+    LANE_URGENT,
+    LANE_BULK,
+    N_LANES,
+};
+
+static const gchar* lane_names[] = { "urgent", "bulk" };
+
+/* a client connection that has said hello, so can be sent control lines */
+typedef struct {
+    GConn* conn;
+    gchar* prog;
+    guint  pid;
+} Logger;
+
+typedef struct {
+    GConn*       conn;
+    gsize        pending; /* written to the conn but not yet sent */
+    GQueue       inflight; /* the length of each of those writes */
+    GQueue       queue[N_LANES];
+    gsize        queued[N_LANES];
+    guint64      shed[N_LANES];
+    guint        subs;
+    ntl_ZWriter* z;     /* if it subscribes to compression */
+    GString*     batch; /* lines being gathered into one chunk */
+} Listener;
+
+/* what a listener subscribes to, sent as "sub NAME..." */
+enum {
+    SUB_DEDUP = 1 << 0,
+    SUB_ROLLUP = 1 << 1, /* only the rollup stream */
+    SUB_ORDER = 1 << 2,  /* traces in time order, from the reorder stage */
+};
+
+/* the connections on the log port that send compressed chunks */
+static GHashTable* readers = NULL; /* GConn* -> ntl_ZReader* */
+static GString*    unzipped = NULL;
+static GString*    zout = NULL;
+static GString*    egressed = NULL; /* scratch, for lines written out whole */
+
 static GServer* logs = NULL;
 static GServer* broad = NULL;
+static GServer* stats = NULL;
 
 static ConnHandling* logger = NULL;
 static ConnHandling* listener = NULL;
+static ConnHandling* control = NULL;
 
 static GPtrArray* listeners = NULL;
+static GPtrArray* loggers = NULL;
+
+static gint   log_port = 4242;
+static gint   listen_port = 4243;
+static gint   stats_port = 4244;
+static gint   lane_window_kb = 64;
+static gint   lane_queue_kb = 1024;
+static gint   top_window = 60;
+static gint   dedup_ms = 1000;
+static gint   reorder_ms = 50;
+static gint   rollup_secs = 60;
+static gchar* metrics_file = NULL;
+static gchar* relay_to = NULL;
+static gchar* relay_level = NULL;
+static gchar* relay_tag = NULL;
+static gint   relay_batch = 256;
+static gint   relay_buffer_kb = 4096;
+static gchar* host_name = NULL;
+static gint   memory_mb = 256;
+static gchar* memory_policy = NULL;
+static gint   listen_zlevel = 1;
+static gint   relay_zlevel = 0;
+static gchar* zdict_file = NULL;
+static gchar* zdict = NULL;
+static gsize  zdict_len = 0;
+static gchar* shm_path = NULL;
+static gint   shm_mb = 16;
+
+static GOptionEntry entries[] = {
+    { "log-port", 0, 0, G_OPTION_ARG_INT, &log_port, "Port accepting traces from clients (default: 4242)", "PORT" },
+    { "listen-port", 0, 0, G_OPTION_ARG_INT, &listen_port, "Port accepting listeners (default: 4243)", "PORT" },
+    { "stats-port", 0, 0, G_OPTION_ARG_INT, &stats_port, "Port accepting stats commands, 0 for none (default: 4244)", "PORT" },
+    { "lane-window", 0, 0, G_OPTION_ARG_INT, &lane_window_kb, "Bulk traces in flight to a listener before queueing (default: 64)", "KB" },
+    { "lane-queue", 0, 0, G_OPTION_ARG_INT, &lane_queue_kb, "Bulk traces queued for a listener before shedding (default: 1024)", "KB" },
+    { "top-window", 0, 0, G_OPTION_ARG_INT, &top_window, "Seconds of traffic the top command covers (default: 60)", "SECS" },
+    { "rollup-window", 0, 0, G_OPTION_ARG_INT, &rollup_secs, "Seconds in each window of the rollup counts (default: 60)", "SECS" },
+    { "metrics-file", 0, 0, G_OPTION_ARG_FILENAME, &metrics_file, "Rewrite the metrics snapshot to FILE as each rollup window closes", "FILE" },
+    { "dedup-window", 0, 0, G_OPTION_ARG_INT, &dedup_ms, "Longest gap within a run of repeats, for dedup listeners (default: 1000)", "MS" },
+    { "reorder-window", 0, 0, G_OPTION_ARG_INT, &reorder_ms, "How long traces are held to put them in time order, for listeners that ask (default: 50)", "MS" },
+    { "relay", 0, 0, G_OPTION_ARG_STRING, &relay_to, "Also forward traces to the ntld at HOST, on its log port (default: 4242)", "HOST[:PORT]" },
+    { "relay-level", 0, 0, G_OPTION_ARG_STRING, &relay_level, "Forward only traces at LEVEL or above (default: trace)", "LEVEL" },
+    { "relay-tag", 0, 0, G_OPTION_ARG_STRING, &relay_tag, "Forward only traces whose tag starts with PREFIX", "PREFIX" },
+    { "relay-batch", 0, 0, G_OPTION_ARG_INT, &relay_batch, "Traces in each batch forwarded upstream (default: 256)", "N" },
+    { "relay-buffer", 0, 0, G_OPTION_ARG_INT, &relay_buffer_kb, "Traces held for the upstream, unsent or unacked, before dropping the oldest (default: 4096)", "KB" },
+    { "memory-budget", 0, 0, G_OPTION_ARG_INT, &memory_mb, "Memory for traces held for listeners and time ordering, 0 for no limit (default: 256)", "MB" },
+    { "memory-policy", 0, 0, G_OPTION_ARG_STRING, &memory_policy, "Over budget, stop reading from clients, or first shed queued traces, least urgent first: pause or shed (default: pause)", "POLICY" },
+    { "listen-zlevel", 0, 0, G_OPTION_ARG_INT, &listen_zlevel, "zlib level for listeners that ask for compression, 0 to refuse them (default: 1)", "N" },
+    { "relay-zlevel", 0, 0, G_OPTION_ARG_INT, &relay_zlevel, "zlib level for traces relayed upstream, 0 for none (default: 0)", "N" },
+    { "zdict", 0, 0, G_OPTION_ARG_FILENAME, &zdict_file, "Sample of typical traces to start the relay's zlib stream with, for both ends of it", "FILE" },
+    { "shm", 0, 0, G_OPTION_ARG_FILENAME, &shm_path, "Also publish every trace to a ring in FILE, for listeners on this host (e.g. /dev/shm/ntld)", "FILE" },
+    { "shm-size", 0, 0, G_OPTION_ARG_INT, &shm_mb, "Size of the shared ring (default: 16)", "MB" },
+    { "host-name", 0, 0, G_OPTION_ARG_STRING, &host_name, "Name forwarded traces are tagged with (default: this host's name)", "NAME" },
+    { NULL }
+};
+
+/* latency of the hops up to and through the daemon, for stamped traces */
+enum {
+    HOP_CLIENT,
+    HOP_INBOUND,
+    HOP_DAEMON,
+    N_HOPS,
+};
+
+static const gchar* hop_names[] = { "client", "inbound", "daemon" };
+static ntl_Histogram* latency[N_HOPS];
+
+/* the noisiest call sites (prog/tag/mod/fn) and programs */
+#define TOP_K       32
+#define TOP_WINDOWS 6
+
+static ntl_TopK* top_sites = NULL;
+static ntl_TopK* top_progs = NULL;
+static GString*  top_key = NULL;
+
+/* per-window counts by (prog, tag, level), kept for every trace */
+#define ROLLUP_KEYS 10000
+
+static ntl_Rollup* rollup = NULL;
+static gint64      rollup_epoch = 0;
+static GString*    rollup_prog = NULL;
+static GString*    rollup_tag = NULL;
+
+/* repeats are coalesced only for the listeners which subscribe to it */
+static ntl_Dedup* dedup = NULL;
+static guint      dedup_listeners = 0;
+
+/* traces are held for time ordering only while a listener wants it */
+#define REORDER_HELD 100000
+
+static ntl_Reorder* reorder = NULL;
+static guint        order_listeners = 0;
+
+/* traces forwarded to an upstream ntld, in acked batches (see
+ * ntl_RelayQueue in ntlu.h); unacked ones are sent again on reconnect */
+#define RELAY_FLUSH_MS   100
+#define RELAY_RETRY_SECS 2
+
+static GConn*          relay = NULL;
+static gboolean        relay_up = FALSE;
+static guint64         relay_connects = 0;
+static guint           relay_retry_id = 0;
+static guint           relay_min = ntl_tl_Trace;
+static ntl_RelayQueue* relay_queue = NULL;
+static GString*        relay_out = NULL;
+static ntl_ZWriter*    relay_z = NULL;
+static gboolean        relay_zok = FALSE; /* the upstream has agreed to it */
+
+/* the traces held in memory for listeners and for time ordering,
+ * against a budget. Over it, clients are no longer read from, so that
+ * TCP pushes back on them, until usage is back under 7/8 of it; with
+ * the shed policy, queued traces are first dropped, bulk before
+ * urgent. The relay's queue has a limit of its own and is left out, as
+ * a stalled upstream would otherwise keep every client paused. */
+#define MEMORY_CHECK_MS 100
+
+static gboolean   memory_shed = FALSE;
+static GPtrArray* paused = NULL; /* GConn*s not being read from */
+static guint64    pauses = 0;
+static guint64    memory_sheds = 0;
+static gsize      held = 0; /* pending and queued, across listeners */
+static guint      batch_id = 0; /* writes out the gathered chunks */
+
+/* every trace, for local listeners to read straight from memory; it
+ * never waits for them, so they cost the daemon a copy per trace */
+static ntl_ShmRing* shm = NULL;
+
+/* a command read on the stats port; the reply ends with an empty line */
+typedef void (*command_func)(GString* out, gchar** args);
+
+typedef struct {
+    const gchar* name;
+    command_func fn;
+    const gchar* help;
+} Command;
+
+static void cmd_help(GString* out, gchar** args);
+static void cmd_latency(GString* out, gchar** args);
+static void cmd_lanes(GString* out, gchar** args);
+static void cmd_clients(GString* out, gchar** args);
+static void cmd_top(GString* out, gchar** args);
+static void cmd_dedup(GString* out, gchar** args);
+static void cmd_metrics(GString* out, gchar** args);
+static void cmd_lvl(GString* out, gchar** args);
+static void cmd_relay(GString* out, gchar** args);
+static void cmd_zlib(GString* out, gchar** args);
+static void cmd_memory(GString* out, gchar** args);
+static void cmd_order(GString* out, gchar** args);
+static void cmd_shm(GString* out, gchar** args);
+static void cmd_reset(GString* out, gchar** args);
+
+static const Command commands[] = {
+    { "help", cmd_help, "list the commands" },
+    { "latency", cmd_latency, "per-hop latency of stamped traces, in microseconds" },
+    { "lanes", cmd_lanes, "queued bytes and shed traces per listener and lane" },
+    { "top", cmd_top, "top [N] - the busiest call sites and programs, by count" },
+    { "metrics", cmd_metrics, "trace counts by prog, tag and level, in the Prometheus text format" },
+    { "dedup", cmd_dedup, "runs of repeats being tracked, and how many were suppressed" },
+    { "clients", cmd_clients, "the programs and pids of connected clients" },
+    { "relay", cmd_relay, "the upstream connection and the traces awaiting it" },
+    { "order", cmd_order, "traces held for time ordering, and those that arrived too late" },
+    { "shm", cmd_shm, "the shared ring, and how far behind each of its readers is" },
+    { "memory", cmd_memory, "memory used by held traces, against the budget" },
+    { "zlib", cmd_zlib, "bytes before and after compression, and its cost, per link" },
+    { "lvl", cmd_lvl, "lvl PROG|PID|* *|tag:NAME|mod:NAME LEVEL|reset - set clients' minimum level" },
+    { "reset", cmd_reset, "clear the latency histograms, shed counts and top talkers" },
+    { NULL }
+};
+
+/* the urgent lane may use twice the window, and queue four times as
+ * much, as the bulk one */
+static gsize lane_window(guint lane)
+{
+    return (gsize) MAX(lane_window_kb, 1) * 1024 * (LANE_URGENT == lane ? 2 : 1);
+}
+
+static gsize lane_limit(guint lane)
+{
+    return (gsize) MAX(lane_queue_kb, 1) * 1024 * (LANE_URGENT == lane ? 4 : 1);
+}
+
+/* where a " key:" sits in a trace. The header fields come before
+ * " msg:"; after it are the message, which may hold anything, and the
+ * trailer (kv, stamps, hn). As in ntl_packet_decode(), a key not in
+ * the header is taken from its last occurrence. */
+static const gchar* find_key(const char* data, const gchar* key)
+{
+    const gchar* msg = strstr(data, " msg:");
+    const gchar* rv = NULL;
+    const gchar* p = NULL;
+
+    if ( NULL == msg ) {
+        return strstr(data, key);
+    }
+    rv = g_strstr_len(data, msg - data, key);
+    if ( NULL == rv ) {
+        for ( p = strstr(msg + 5, key); p; p = strstr(p + 1, key) ) {
+            rv = p;
+        }
+    }
+    return rv;
+}
+
+static gint64 stamp_of(const char* data, const gchar* key)
+{
+    const gchar* p = find_key(data, key);
+    return p ? g_ascii_strtoll(p + strlen(key), NULL, 10) : 0;
+}
+
+static void record(guint hop, gint64 from, gint64 to)
+{
+    if ( from && to ) {
+        ntl_histogram_record(latency[hop], to > from ? to - from : 0);
+    }
+}
+
+/* where a line's egress stamp goes: after its ingress stamp, which
+ * stamp_line made its last field; NULL for unstamped lines, and for
+ * relayed ones, which end with their host */
+static const gchar* egress_point(const gchar* ln, gsize len, gint64* ingress)
+{
+    const gchar* p = ln + len;
+    const gchar* end = NULL;
+
+    while ( p > ln && ('\0' == p[-1] || '\n' == p[-1]) ) {
+        p--;
+    }
+    if ( p - ln < 2 || 0 != strncmp(p - 2, " }", 2) ) {
+        return NULL;
+    }
+    end = p - 2;
+    for ( p = end; p > ln && g_ascii_isdigit(p[-1]); p-- ) {
+    }
+    if ( p == end || p - ln < 5 || 0 != strncmp(p - 5, ", li:", 5) ) {
+        return NULL;
+    }
+    *ingress = g_ascii_strtoll(p, NULL, 10);
+    return end;
+}
+
+/* appends ln as it leaves the daemon: with its egress stamp, taken now,
+ * if it carries an ingress one; the hop through the daemon ends here */
+static void append_egress(GString* out, const gchar* ln, gsize len)
+{
+    gint64       ingress = 0;
+    gint64       egress = 0;
+    const gchar* end = egress_point(ln, len, &ingress);
+
+    if ( NULL == end ) {
+        g_string_append_len(out, ln, len);
+        return;
+    }
+    egress = g_get_real_time();
+    record(HOP_DAEMON, ingress, egress);
+    g_string_append_len(out, ln, end - ln);
+    g_string_append_printf(out, ", le:%" G_GINT64_FORMAT, egress);
+    g_string_append_len(out, end, ln + len - end);
+}
+
+static guint lane_of(const gchar* ln)
+{
+    const gchar* p = find_key(ln, " tl:");
+    return p && atoi(p + 4) >= ntl_tl_Warn ? LANE_URGENT : LANE_BULK;
+}
+
+static void write_line(Listener* l, const gchar* ln, gsize len)
+{
+    if ( l->z ) {
+        g_string_truncate(zout, 0);
+        ntl_zwriter_write(l->z, ln, len, zout);
+        ln = zout->str;
+        len = zout->len;
+    }
+    gnet_conn_write(l->conn, (gchar*) ln, len);
+    g_queue_push_tail(&l->inflight, GSIZE_TO_POINTER(len));
+    l->pending += len;
+    held += len;
+}
+
+/* a line as it goes into a chunk: newline-terminated */
+static void append_line(GString* batch, const gchar* ln)
+{
+    gsize len = strlen(ln);
+    while ( len > 0 && ('\n' == ln[len - 1] || '\r' == ln[len - 1]) ) {
+        len--;
+    }
+    append_egress(batch, ln, len);
+    g_string_append_c(batch, '\n');
+}
+
+/* a line written on its own, uncompressed */
+static void write_plain(Listener* l, const gchar* ln, gsize len)
+{
+    gint64 ingress = 0;
+
+    if ( NULL == egress_point(ln, len, &ingress) ) {
+        write_line(l, ln, len);
+        return;
+    }
+    g_string_truncate(egressed, 0);
+    append_egress(egressed, ln, len);
+    write_line(l, egressed->str, egressed->len);
+}
+
+/* writes queued lines, most urgent first, while there is room; for a
+ * compressing listener, as one chunk */
+static void drain(Listener* l)
+{
+    guint lane = 0;
+    for ( lane = 0; lane < N_LANES; lane++ ) {
+        while ( !g_queue_is_empty(&l->queue[lane]) && l->pending + l->batch->len < lane_window(lane) ) {
+            GString* s = (GString*) g_queue_pop_head(&l->queue[lane]);
+            l->queued[lane] -= s->len;
+            held -= s->len;
+            if ( l->z ) {
+                append_line(l->batch, s->str);
+            } else {
+                write_plain(l, s->str, s->len);
+            }
+            g_string_free(s, TRUE);
+        }
+    }
+    if ( l->batch->len > 0 ) {
+        write_line(l, l->batch->str, l->batch->len);
+        g_string_truncate(l->batch, 0);
+    }
+}
+
+/* a compressing listener's chunk is written once every line read so
+ * far has gone into it, when the main loop is next idle */
+static gboolean write_batches(gpointer d)
+{
+    guint i = 0;
+    for ( i = 0; i < listeners->len; i++ ) {
+        Listener* l = (Listener*) g_ptr_array_index(listeners, i);
+        if ( l->batch->len > 0 ) {
+            write_line(l, l->batch->str, l->batch->len);
+            g_string_truncate(l->batch, 0);
+        }
+    }
+    batch_id = 0;
+    return FALSE;
+}
 
 static void send(gpointer d, gpointer ud)
 {
-    gchar* ln = (gchar*) ud;
-    guint  len = strlen(ln) + 1;
-    gnet_conn_write((GConn*) d, ln, len);
+    Listener*    l = (Listener*) d;
+    const gchar* ln = (const gchar*) ud;
+    guint        lane = lane_of(ln);
+    gsize        len = strlen(ln) + 1;
+    guint        i = 0;
+    gboolean     behind = l->pending + l->batch->len >= lane_window(lane);
+
+    for ( i = 0; i <= lane; i++ ) {
+        behind = behind || !g_queue_is_empty(&l->queue[i]);
+    }
+    if ( !behind ) {
+        if ( l->z ) {
+            append_line(l->batch, ln);
+            if ( 0 == batch_id ) {
+                batch_id = g_idle_add(write_batches, NULL);
+            }
+        } else {
+            write_plain(l, ln, len);
+        }
+        return;
+    }
+    g_queue_push_tail(&l->queue[lane], g_string_new_len(ln, len));
+    l->queued[lane] += len;
+    held += len;
+    while ( l->queued[lane] > lane_limit(lane) ) {
+        GString* s = (GString*) g_queue_pop_head(&l->queue[lane]);
+        l->queued[lane] -= s->len;
+        held -= s->len;
+        l->shed[lane]++;
+        g_string_free(s, TRUE);
+    }
+}
+
+/* to the listeners with none of the skip subscriptions and, if only is
+ * set, one of those */
+static void broadcast(const gchar* ln, guint skip, guint only)
+{
+    guint i = 0;
+    for ( i = 0; i < listeners->len; i++ ) {
+        Listener* l = (Listener*) g_ptr_array_index(listeners, i);
+        if ( 0 == (l->subs & skip) && (0 == only || 0 != (l->subs & only)) ) {
+            send(l, (gpointer) ln);
+        }
+    }
+}
+
+static gsize memory_budget(void)
+{
+    return (gsize) MAX(memory_mb, 0) * 1024 * 1024;
+}
+
+static gsize memory_used(void)
+{
+    return held + ntl_reorder_bytes(reorder);
+}
+
+static gboolean over_budget(void)
+{
+    return memory_mb > 0 && memory_used() > memory_budget();
+}
+
+/* the listener with the most queued on a lane, if any */
+static Listener* fullest(guint lane)
+{
+    Listener* rv = NULL;
+    guint     i = 0;
+    for ( i = 0; i < listeners->len; i++ ) {
+        Listener* l = (Listener*) g_ptr_array_index(listeners, i);
+        if ( l->queued[lane] > 0 && (NULL == rv || l->queued[lane] > rv->queued[lane]) ) {
+            rv = l;
+        }
+    }
+    return rv;
+}
+
+static void shed_to_budget(void)
+{
+    gsize used = memory_used();
+    gsize budget = memory_budget();
+    guint i = 0;
+
+    for ( i = 0; i < N_LANES; i++ ) {
+        guint     lane = N_LANES - 1 - i;
+        Listener* l = NULL;
+        while ( used > budget && (l = fullest(lane)) ) {
+            GString* s = (GString*) g_queue_pop_head(&l->queue[lane]);
+            l->queued[lane] -= s->len;
+            l->shed[lane]++;
+            held -= s->len;
+            used -= s->len;
+            memory_sheds++;
+            g_string_free(s, TRUE);
+        }
+    }
+}
+
+static void resume_reading(void)
+{
+    guint i = 0;
+    if ( 0 == paused->len || memory_used() > memory_budget() / 8 * 7 ) {
+        return;
+    }
+    for ( i = 0; i < paused->len; i++ ) {
+        gnet_conn_readline((GConn*) g_ptr_array_index(paused, i));
+    }
+    g_ptr_array_set_size(paused, 0);
+}
+
+static gboolean memory_timeout(gpointer d)
+{
+    resume_reading();
+    return TRUE;
+}
+
+static void send_summary(const gchar* ln, gpointer d)
+{
+    broadcast(ln, SUB_ROLLUP, SUB_DEDUP);
+}
+
+static void send_ordered(const gchar* ln, guint flags, gpointer d)
+{
+    broadcast(ln, SUB_ROLLUP | flags, SUB_ORDER);
+}
+
+static gboolean reorder_timeout(gpointer d)
+{
+    ntl_reorder_flush(reorder, g_get_real_time());
+    return TRUE;
+}
+
+static void send_rollup(const gchar* ln, gpointer d)
+{
+    broadcast(ln, 0, SUB_ROLLUP);
+}
+
+static void append_metrics(GString* out)
+{
+    ntl_rollup_snapshot(rollup, out);
+    g_string_append_printf(out,
+        "# HELP ntl_late_traces_total Traces that arrived too late to be put in time order\n"
+        "# TYPE ntl_late_traces_total counter\n"
+        "ntl_late_traces_total %" G_GUINT64_FORMAT "\n", ntl_reorder_late(reorder));
+}
+
+static void write_metrics(void)
+{
+    GString* out = g_string_sized_new(4096);
+    GError*  err = NULL;
+
+    append_metrics(out);
+    if ( !g_file_set_contents(metrics_file, out->str, out->len, &err) ) {
+        g_printerr("failed to write %s: %s\n", metrics_file, err->message);
+        g_error_free(err);
+    }
+    g_string_free(out, TRUE);
+}
+
+/* closes rollup windows even when no traces arrive */
+static gboolean rollup_timeout(gpointer d)
+{
+    gint64 now = g_get_real_time();
+    gint64 epoch = now / ((gint64) MAX(rollup_secs, 1) * G_USEC_PER_SEC);
+
+    ntl_rollup_tick(rollup, now);
+    if ( epoch != rollup_epoch ) {
+        rollup_epoch = epoch;
+        if ( metrics_file ) {
+            write_metrics();
+        }
+    }
+    return TRUE;
+}
+
+static gboolean dedup_timeout(gpointer d)
+{
+    ntl_dedup_expire(dedup, g_get_monotonic_time());
+    return TRUE;
+}
+
+static Listener* find_listener(GConn* conn)
+{
+    guint i = 0;
+    for ( i = 0; i < listeners->len; i++ ) {
+        Listener* l = (Listener*) g_ptr_array_index(listeners, i);
+        if ( conn == l->conn ) {
+            return l;
+        }
+    }
+    return NULL;
+}
+
+static void free_listener(Listener* l)
+{
+    guint lane = 0;
+    held -= l->pending + l->queued[LANE_URGENT] + l->queued[LANE_BULK];
+    g_queue_clear(&l->inflight);
+    for ( lane = 0; lane < N_LANES; lane++ ) {
+        GString* s = NULL;
+        while ( (s = (GString*) g_queue_pop_head(&l->queue[lane])) ) {
+            g_string_free(s, TRUE);
+        }
+    }
+    ntl_zwriter_free(l->z);
+    g_string_free(l->batch, TRUE);
+    g_free(l);
+}
+
+/* adds the ingress stamp to a stamped trace, NULL if it carries none;
+ * the egress stamp is added as each copy of it is written out */
+static gchar* stamp_line(const char* data)
+{
+    gint64       ingress = 0;
+    gint64       sent = stamp_of(data, " ls:");
+    const gchar* end = strrchr(data, '}');
+    gint         len = 0;
+
+    /* relayed traces keep the first daemon's stamps; clocks differ
+     * across hosts */
+    if ( 0 == sent || NULL == end || find_key(data, " hn:") ) {
+        return NULL;
+    }
+    ingress = g_get_real_time();
+    for ( len = end - data; len > 0 && ' ' == data[len - 1]; len-- ) {
+        ;
+    }
+    record(HOP_CLIENT, stamp_of(data, " lq:"), sent);
+    record(HOP_INBOUND, sent, ingress);
+    return g_strdup_printf("%.*s, li:%" G_GINT64_FORMAT " }%s", len, data, ingress, end + 1);
+}
+
+/* the value of a "key:value" field, up to the next separator */
+static gchar* field_of(const char* data, const gchar* key)
+{
+    const gchar* p = find_key(data, key);
+    if ( NULL == p ) {
+        return NULL;
+    }
+    p += strlen(key);
+    return g_strndup(p, strcspn(p, ", }"));
+}
+
+/* appends a field's value to the key, without allocating */
+static void append_field(GString* key, const char* data, const gchar* name)
+{
+    const gchar* p = find_key(data, name);
+    if ( p ) {
+        p += strlen(name);
+        g_string_append_len(key, p, strcspn(p, ", }"));
+    }
+}
+
+static guint level_of(const gchar* ln)
+{
+    const gchar* p = find_key(ln, " tl:");
+    return p ? (guint) atoi(p + 4) : ntl_tl_Trace;
+}
+
+static void count_talkers(const char* data)
+{
+    gint64 now = g_get_monotonic_time();
+    gsize  len = strlen(data);
+
+    g_string_truncate(rollup_prog, 0);
+    append_field(rollup_prog, data, " pn:");
+    g_string_truncate(rollup_tag, 0);
+    append_field(rollup_tag, data, " tag:");
+    ntl_rollup_add(rollup, rollup_prog->str, rollup_tag->str, level_of(data), len, g_get_real_time());
+
+    g_string_truncate(top_key, 0);
+    append_field(top_key, data, " pn:");
+    ntl_top_k_add(top_progs, top_key->str, len, now);
+    g_string_append_c(top_key, '/');
+    append_field(top_key, data, " tag:");
+    g_string_append_c(top_key, '/');
+    append_field(top_key, data, " mod:");
+    g_string_append_c(top_key, '/');
+    append_field(top_key, data, " fn:");
+    ntl_top_k_add(top_sites, top_key->str, len, now);
+}
+
+static void hello(GConn* conn, const char* data)
+{
+    Logger* l = g_new0(Logger, 1);
+    l->conn = conn;
+    l->prog = field_of(data, " pn:");
+    l->pid = (guint) stamp_of(data, " pid:");
+    g_ptr_array_add(loggers, l);
+    if ( stamp_of(data, " z:") > 0 ) {
+        /* it may send compressed chunks from now on */
+        gnet_conn_write(conn, "zok\n", 4);
+    }
+}
+
+/* writes out the unsent traces, while the upstream is connected */
+static void relay_flush(void)
+{
+    if ( !relay_up ) {
+        return;
+    }
+    g_string_truncate(relay_out, 0);
+    while ( ntl_relay_queue_batch(relay_queue, MAX(relay_batch, 1), relay_out) ) {
+        ;
+    }
+    if ( relay_out->len > 0 && relay_zok ) {
+        g_string_truncate(zout, 0);
+        ntl_zwriter_write(relay_z, relay_out->str, relay_out->len, zout);
+        gnet_conn_write(relay, zout->str, zout->len);
+    } else if ( relay_out->len > 0 ) {
+        gnet_conn_write(relay, relay_out->str, relay_out->len);
+    }
+}
+
+static void relay_forward(const gchar* ln)
+{
+    if ( level_of(ln) < relay_min ) {
+        return;
+    }
+    if ( relay_tag ) {
+        const gchar* p = find_key(ln, " tag:");
+        if ( NULL == p || 0 != strncmp(p + 5, relay_tag, strlen(relay_tag)) ) {
+            return;
+        }
+    }
+    /* leaving for the relay is this daemon's egress */
+    g_string_truncate(egressed, 0);
+    append_egress(egressed, ln, strlen(ln));
+    ntl_relay_queue_push(relay_queue, egressed->str, host_name);
+    if ( ntl_relay_queue_unsent(relay_queue) >= (guint) MAX(relay_batch, 1) ) {
+        relay_flush();
+    }
+}
+
+/* a downstream relay's batch has been read */
+static void ack_batch(GConn* conn, const char* data)
+{
+    gchar* ack = g_strdup_printf("ack %" G_GINT64_FORMAT "\n", stamp_of(data, " seq:"));
+    gnet_conn_write(conn, ack, strlen(ack));
+    g_free(ack);
+}
+
+static void log_line(GConn* conn, const char* data)
+{
+    if ( g_str_has_prefix(data, "{ ctl:hello,") ) {
+        hello(conn, data);
+    } else if ( g_str_has_prefix(data, "{ ctl:batch,") ) {
+        ack_batch(conn, data);
+    } else {
+        gchar*   stamped = NULL;
+        gboolean repeat = dedup_listeners > 0 && ntl_dedup_check(dedup, data, g_get_monotonic_time());
+        count_talkers(data);
+        stamped = stamp_line(data);
+        broadcast(stamped ? stamped : data, SUB_ROLLUP | SUB_ORDER | (repeat ? SUB_DEDUP : 0), 0);
+        if ( shm ) {
+            const gchar* ln = stamped ? stamped : data;
+            g_string_truncate(egressed, 0);
+            append_egress(egressed, ln, strlen(ln));
+            ntl_shm_ring_publish(shm, egressed->str, egressed->len);
+        }
+        if ( order_listeners > 0 ) {
+            ntl_reorder_push(reorder, stamped ? stamped : data, repeat ? SUB_DEDUP : 0, g_get_real_time());
+        }
+        if ( relay_queue ) {
+            relay_forward(stamped ? stamped : data);
+        }
+        g_free(stamped);
+    }
 }
 
-static void broadcast(const gchar* ln)
+static void unzip_lines(GConn* conn, const char* data)
 {
-    g_ptr_array_foreach(listeners, send, (gpointer) ln);
+    ntl_ZReader* z = (ntl_ZReader*) g_hash_table_lookup(readers, conn);
+    gchar*       p = NULL;
+    gchar*       nl = NULL;
+
+    if ( NULL == z ) {
+        z = ntl_zreader_new(zdict, zdict_len);
+        g_hash_table_insert(readers, conn, z);
+    }
+    g_string_truncate(unzipped, 0);
+    if ( !ntl_zreader_read(z, data, unzipped) ) {
+        return;
+    }
+    for ( p = unzipped->str; (nl = strchr(p, '\n')); p = nl + 1 ) {
+        *nl = '\0';
+        if ( *p ) {
+            log_line(conn, p);
+        }
+    }
 }
 
 static void read_log_line(GConn* conn, const char* data)
 {
-    broadcast(data);
+    if ( NTL_ZCHUNK(data) ) {
+        unzip_lines(conn, data);
+    } else {
+        log_line(conn, data);
+    }
+    if ( memory_shed && over_budget() ) {
+        shed_to_budget();
+    }
+    if ( over_budget() ) {
+        /* what is held must drain before more is read */
+        g_ptr_array_add(paused, conn);
+        pauses++;
+        return;
+    }
+    gnet_conn_readline(conn);
+}
+
+static void free_logger(gpointer d)
+{
+    Logger* l = (Logger*) d;
+    g_free(l->prog);
+    g_free(l);
+}
+
+static void remove_logger(GConn* conn)
+{
+    guint i = 0;
+    g_hash_table_remove(readers, conn);
+    g_ptr_array_remove(paused, conn);
+    for ( i = 0; i < loggers->len; i++ ) {
+        Logger* l = (Logger*) g_ptr_array_index(loggers, i);
+        if ( conn == l->conn ) {
+            g_ptr_array_remove_index_fast(loggers, i);
+            return;
+        }
+    }
+}
+
+static void cmd_clients(GString* out, gchar** args)
+{
+    guint i = 0;
+    for ( i = 0; i < loggers->len; i++ ) {
+        Logger* l = (Logger*) g_ptr_array_index(loggers, i);
+        g_string_append_printf(out, "%s %u\n", l->prog ? l->prog : "?", l->pid);
+    }
+}
+
+static void cmd_top(GString* out, gchar** args)
+{
+    gint64 now = g_get_monotonic_time();
+    guint  n = args[1] ? (guint) CLAMP(atoi(args[1]), 1, TOP_K) : 10;
+
+    ntl_top_k_dump(top_sites, "site", now, n, out);
+    ntl_top_k_dump(top_progs, "prog", now, n, out);
+}
+
+static void cmd_metrics(GString* out, gchar** args)
+{
+    append_metrics(out);
+}
+
+static void cmd_order(GString* out, gchar** args)
+{
+    g_string_append_printf(out, "listeners=%u ", order_listeners);
+    ntl_reorder_dump(reorder, out);
+}
+
+static void cmd_shm(GString* out, gchar** args)
+{
+    if ( shm ) {
+        ntl_shm_ring_dump(shm, out);
+    } else {
+        g_string_append(out, "no shared ring\n");
+    }
+}
+
+static void cmd_dedup(GString* out, gchar** args)
+{
+    g_string_append_printf(out, "listeners=%u\n", dedup_listeners);
+    ntl_dedup_dump(dedup, out);
+}
+
+static const gchar* level_names[] = { "trace", "debug", "warn", "error", "reset", NULL };
+
+/* the index of a level's name, or -1 */
+static gint level_index(const gchar* s)
+{
+    gint i = 0;
+    for ( i = 0; level_names[i]; i++ ) {
+        if ( 0 == g_ascii_strcasecmp(s, level_names[i]) ) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+static gboolean valid_level(const gchar* s)
+{
+    return level_index(s) >= 0;
+}
+
+static void cmd_lvl(GString* out, gchar** args)
+{
+    gchar* ln = NULL;
+    guint  sent = 0;
+    guint  i = 0;
+
+    if ( g_strv_length(args) != 4 || !valid_level(args[3])
+         || !(0 == g_strcmp0(args[2], "*") || g_str_has_prefix(args[2], "tag:") || g_str_has_prefix(args[2], "mod:")) ) {
+        g_string_append(out, "usage: lvl PROG|PID|* *|tag:NAME|mod:NAME trace|debug|warn|error|reset\n");
+        return;
+    }
+    ln = g_strdup_printf("lvl %s %s\n", args[2], args[3]);
+    for ( i = 0; i < loggers->len; i++ ) {
+        Logger* l = (Logger*) g_ptr_array_index(loggers, i);
+        gchar*  pid = g_strdup_printf("%u", l->pid);
+        if ( 0 == g_strcmp0(args[1], "*") || 0 == g_strcmp0(args[1], l->prog) || 0 == g_strcmp0(args[1], pid) ) {
+            gnet_conn_write(l->conn, ln, strlen(ln));
+            sent++;
+        }
+        g_free(pid);
+    }
+    g_string_append_printf(out, "sent to %u clients\n", sent);
+    g_free(ln);
+}
+
+static void cmd_help(GString* out, gchar** args)
+{
+    const Command* c = NULL;
+    for ( c = commands; c->name; c++ ) {
+        g_string_append_printf(out, "%s: %s\n", c->name, c->help);
+    }
+}
+
+static void cmd_latency(GString* out, gchar** args)
+{
+    guint i = 0;
+    for ( i = 0; i < N_HOPS; i++ ) {
+        ntl_histogram_dump(latency[i], hop_names[i], out);
+    }
+}
+
+static void cmd_lanes(GString* out, gchar** args)
+{
+    guint i = 0;
+    guint lane = 0;
+    for ( i = 0; i < listeners->len; i++ ) {
+        Listener* l = (Listener*) g_ptr_array_index(listeners, i);
+        g_string_append_printf(out, "listener %u: pending=%" G_GSIZE_FORMAT, i, l->pending);
+        for ( lane = 0; lane < N_LANES; lane++ ) {
+            g_string_append_printf(out, " %s.queued=%" G_GSIZE_FORMAT " %s.shed=%" G_GUINT64_FORMAT,
+                lane_names[lane], l->queued[lane], lane_names[lane], l->shed[lane]);
+        }
+        g_string_append_c(out, '\n');
+    }
+}
+
+static void cmd_relay(GString* out, gchar** args)
+{
+    if ( NULL == relay_queue ) {
+        g_string_append(out, "not relaying\n");
+        return;
+    }
+    g_string_append_printf(out, "upstream=%s host=%s up=%s connects=%" G_GUINT64_FORMAT "\n",
+        relay_to, host_name, relay_up ? "yes" : "no", relay_connects);
+    ntl_relay_queue_dump(relay_queue, out);
+}
+
+static Logger* find_logger(GConn* conn)
+{
+    guint i = 0;
+    for ( i = 0; i < loggers->len; i++ ) {
+        Logger* l = (Logger*) g_ptr_array_index(loggers, i);
+        if ( conn == l->conn ) {
+            return l;
+        }
+    }
+    return NULL;
+}
+
+static void cmd_memory(GString* out, gchar** args)
+{
+    g_string_append_printf(out,
+        "budget=%" G_GSIZE_FORMAT " used=%" G_GSIZE_FORMAT " listeners=%" G_GSIZE_FORMAT " relay=%" G_GSIZE_FORMAT
+        " policy=%s paused=%u pauses=%" G_GUINT64_FORMAT " shed=%" G_GUINT64_FORMAT "\n",
+        memory_budget(), memory_used(), held, relay_queue ? ntl_relay_queue_bytes(relay_queue) : 0,
+        memory_shed ? "shed" : "pause", paused->len, pauses, memory_sheds);
+}
+
+static void cmd_zlib(GString* out, gchar** args)
+{
+    GHashTableIter it;
+    gpointer       k = NULL;
+    gpointer       v = NULL;
+    guint          i = 0;
+
+    for ( i = 0; i < listeners->len; i++ ) {
+        Listener* l = (Listener*) g_ptr_array_index(listeners, i);
+        if ( l->z ) {
+            gchar* name = g_strdup_printf("listener %u:", i);
+            ntl_zwriter_dump(l->z, name, out);
+            g_free(name);
+        }
+    }
+    if ( relay_z ) {
+        ntl_zwriter_dump(relay_z, "relay:", out);
+    }
+    g_hash_table_iter_init(&it, readers);
+    while ( g_hash_table_iter_next(&it, &k, &v) ) {
+        Logger* lg = find_logger((GConn*) k);
+        gchar*  name = lg ? g_strdup_printf("client %s %u:", lg->prog ? lg->prog : "?", lg->pid)
+                          : g_strdup("client (bulk lane):");
+        ntl_zreader_dump((ntl_ZReader*) v, name, out);
+        g_free(name);
+    }
+}
+
+static void cmd_reset(GString* out, gchar** args)
+{
+    guint i = 0;
+    for ( i = 0; i < N_HOPS; i++ ) {
+        ntl_histogram_reset(latency[i]);
+    }
+    ntl_top_k_reset(top_sites);
+    ntl_top_k_reset(top_progs);
+    for ( i = 0; i < listeners->len; i++ ) {
+        Listener* l = (Listener*) g_ptr_array_index(listeners, i);
+        memset(l->shed, 0, sizeof(l->shed));
+    }
+    g_string_append(out, "ok\n");
+}
+
+static void read_command(GConn* conn, const char* data)
+{
+    gchar*         ln = g_strstrip(g_strdup(data));
+    gchar**        args = g_strsplit_set(ln, " \t", -1);
+    GString*       out = g_string_sized_new(256);
+    const Command* c = NULL;
+
+    for ( c = commands; c->name; c++ ) {
+        if ( 0 == g_strcmp0(c->name, args[0]) ) {
+            (*c->fn)(out, args);
+            break;
+        }
+    }
+    if ( NULL == c->name && args[0] && *args[0] ) {
+        g_string_append_printf(out, "unknown command: %s\n", args[0]);
+    }
+    g_string_append_c(out, '\n');
+    gnet_conn_write(conn, out->str, out->len);
+
+    g_string_free(out, TRUE);
+    g_strfreev(args);
+    g_free(ln);
     gnet_conn_readline(conn);
 }
 
 static void remove_listener(GConn* conn)
 {
-    g_ptr_array_remove(listeners, conn);
+    Listener* l = find_listener(conn);
+    if ( l ) {
+        if ( l->subs & SUB_DEDUP ) {
+            dedup_listeners--;
+        }
+        if ( l->subs & SUB_ORDER ) {
+            order_listeners--;
+        }
+        g_ptr_array_remove(listeners, l);
+        free_listener(l);
+    }
+}
+
+static void read_subscription(GConn* conn, const char* data)
+{
+    Listener* l = find_listener(conn);
+    gchar**   args = g_strsplit_set(data, " \t\r\n", -1);
+    guint     i = 0;
+
+    if ( l && 0 == g_strcmp0(args[0], "sub") ) {
+        for ( i = 1; args[i]; i++ ) {
+            if ( 0 == g_strcmp0(args[i], "dedup") && !(l->subs & SUB_DEDUP) ) {
+                l->subs |= SUB_DEDUP;
+                dedup_listeners++;
+            } else if ( 0 == g_strcmp0(args[i], "rollup") ) {
+                l->subs |= SUB_ROLLUP;
+            } else if ( 0 == g_strcmp0(args[i], "order") && !(l->subs & SUB_ORDER) ) {
+                l->subs |= SUB_ORDER;
+                order_listeners++;
+            } else if ( 0 == g_strcmp0(args[i], "z") && listen_zlevel > 0 && NULL == l->z ) {
+                l->z = ntl_zwriter_new(listen_zlevel, NULL, 0);
+            }
+        }
+    }
+    g_strfreev(args);
+    gnet_conn_readline(conn);
+}
+
+/* gnet reports each write as it completes, in order */
+static void listener_written(GConn* conn)
+{
+    Listener* l = find_listener(conn);
+    if ( l && !g_queue_is_empty(&l->inflight) ) {
+        gsize len = GPOINTER_TO_SIZE(g_queue_pop_head(&l->inflight));
+        l->pending -= len;
+        held -= len;
+        drain(l);
+        resume_reading();
+    }
 }
 
 static void activity(GConn* conn, GConnEvent* event, gpointer ud)
@@ -76,7 +1151,9 @@ static void activity(GConn* conn, GConnEvent* event, gpointer ud)
             break;
             
         case GNET_CONN_WRITE:
-            ; /* Do nothing */
+            if ( ch->written ) {
+                (*ch->written)(conn);
+            }
             break;
             
         case GNET_CONN_CLOSE:
@@ -87,6 +1164,10 @@ static void activity(GConn* conn, GConnEvent* event, gpointer ud)
 
         case GNET_CONN_TIMEOUT:
         case GNET_CONN_ERROR:
+            /* forget it first, so nothing writes to it afterwards */
+            if ( ch->close ) {
+                (*ch->close)(conn);
+            }
             gnet_conn_unref(conn);
             break;
             
@@ -95,6 +1176,90 @@ static void activity(GConn* conn, GConnEvent* event, gpointer ud)
     }
 }
 
+static gboolean relay_timeout(gpointer d)
+{
+    relay_flush();
+    return TRUE;
+}
+
+static gboolean relay_retry(gpointer d)
+{
+    relay_retry_id = 0;
+    gnet_conn_timeout(relay, 30000);
+    gnet_conn_connect(relay);
+    return FALSE;
+}
+
+/* keeps the unacked traces for when the upstream is back */
+static void relay_lost(void)
+{
+    relay_up = FALSE;
+    ntl_relay_queue_rewind(relay_queue);
+    gnet_conn_disconnect(relay);
+    if ( 0 == relay_retry_id ) {
+        relay_retry_id = g_timeout_add_seconds(RELAY_RETRY_SECS, relay_retry, NULL);
+    }
+}
+
+static void relay_activity(GConn* conn, GConnEvent* event, gpointer ud)
+{
+    switch (event->type) {
+        case GNET_CONN_CONNECT:
+            gnet_conn_timeout(conn, 0);
+            relay_up = TRUE;
+            relay_connects++;
+            relay_zok = FALSE;
+            if ( relay_z ) {
+                /* asks for compression, as a client does */
+                gchar* hello = g_strdup_printf("{ ctl:hello, pn:ntld, pid:%u, z:%d }\n", getpid(), relay_zlevel);
+                gnet_conn_write(conn, hello, strlen(hello));
+                g_free(hello);
+            }
+            gnet_conn_readline(conn);
+            relay_flush();
+            break;
+
+        case GNET_CONN_READ:
+            if ( g_str_has_prefix(event->buffer, "ack ") ) {
+                ntl_relay_queue_ack(relay_queue, g_ascii_strtoull(event->buffer + 4, NULL, 10));
+            } else if ( g_str_has_prefix(event->buffer, "zok") ) {
+                relay_zok = TRUE;
+                ntl_zwriter_reset(relay_z);
+            }
+            gnet_conn_readline(conn);
+            break;
+
+        case GNET_CONN_WRITE:
+            break;
+
+        case GNET_CONN_CLOSE:
+        case GNET_CONN_TIMEOUT:
+        case GNET_CONN_ERROR:
+            relay_lost();
+            break;
+
+        default:
+            g_assert_not_reached();
+    }
+}
+
+static void start_relay(void)
+{
+    gchar** hp = g_strsplit(relay_to, ":", 2);
+
+    if ( NULL == host_name ) {
+        host_name = g_strdup(g_get_host_name());
+    }
+    relay_queue = ntl_relay_queue_new((gsize) MAX(relay_buffer_kb, 1) * 1024);
+    relay_out = g_string_sized_new(64 * 1024);
+    relay_z = relay_zlevel > 0 ? ntl_zwriter_new(relay_zlevel, zdict, zdict_len) : NULL;
+    relay = gnet_conn_new(hp[0], hp[1] ? atoi(hp[1]) : 4242, relay_activity, NULL);
+    gnet_conn_set_watch_error(relay, TRUE);
+    relay_retry(NULL);
+    g_timeout_add(RELAY_FLUSH_MS, relay_timeout, NULL);
+    g_strfreev(hp);
+}
+
 static void new_logger(GConn* conn)
 {
     /* start a read - blocks until data */
@@ -103,7 +1268,18 @@ static void new_logger(GConn* conn)
 
 static void new_listener(GConn* conn)
 {
-    g_ptr_array_add(listeners, conn);
+    Listener* l = g_new0(Listener, 1);
+    guint     lane = 0;
+
+    l->conn = conn;
+    l->batch = g_string_sized_new(256);
+    g_queue_init(&l->inflight);
+    for ( lane = 0; lane < N_LANES; lane++ ) {
+        g_queue_init(&l->queue[lane]);
+    }
+    g_ptr_array_add(listeners, l);
+    /* for a subscription, if it sends one */
+    gnet_conn_readline(conn);
 }
 
 static void on_connection(GServer* serv, GConn* conn, gpointer ud)
@@ -121,24 +1297,68 @@ static void create_servers()
     logger = g_new(ConnHandling, 1);
     logger->new = new_logger;
     logger->read = read_log_line;
-    logger->close = NULL;
+    logger->close = remove_logger;
+    logger->written = NULL;
 
     listener = g_new(ConnHandling, 1);
     listener->new = new_listener;
-    listener->read = NULL;
+    listener->read = read_subscription;
     listener->close = remove_listener;
+    listener->written = listener_written;
+
+    control = g_new(ConnHandling, 1);
+    control->new = new_logger;
+    control->read = read_command;
+    control->close = NULL;
+    control->written = NULL;
 
-    logs = gnet_server_new(NULL, 4242, on_connection, logger);
-    broad = gnet_server_new(NULL, 4243, on_connection, listener);
+    logs = gnet_server_new(NULL, log_port, on_connection, logger);
+    broad = gnet_server_new(NULL, listen_port, on_connection, listener);
+    if ( stats_port > 0 ) {
+        stats = gnet_server_new(NULL, stats_port, on_connection, control);
+    }
 }
 
 static void cleanup(void)
 {
+    guint i = 0;
+    if ( stats ) {
+        gnet_server_delete(stats);
+    }
     gnet_server_delete(broad);
     gnet_server_delete(logs);
     g_free(logger);
     g_free(listener);
+    g_free(control);
+    for ( i = 0; i < N_HOPS; i++ ) {
+        ntl_histogram_free(latency[i]);
+    }
+    ntl_top_k_free(top_sites);
+    ntl_top_k_free(top_progs);
+    g_string_free(top_key, TRUE);
+    ntl_dedup_free(dedup);
+    ntl_rollup_free(rollup);
+    ntl_reorder_free(reorder);
+    g_string_free(rollup_prog, TRUE);
+    g_string_free(rollup_tag, TRUE);
+    for ( i = 0; i < listeners->len; i++ ) {
+        free_listener((Listener*) g_ptr_array_index(listeners, i));
+    }
     g_ptr_array_free(listeners, TRUE);
+    g_ptr_array_free(loggers, TRUE);
+    g_ptr_array_free(paused, TRUE);
+    if ( relay ) {
+        gnet_conn_disconnect(relay);
+        gnet_conn_unref(relay);
+        ntl_relay_queue_free(relay_queue);
+        g_string_free(relay_out, TRUE);
+        ntl_zwriter_free(relay_z);
+    }
+    g_hash_table_destroy(readers);
+    g_string_free(unzipped, TRUE);
+    g_string_free(zout, TRUE);
+    g_free(zdict);
+    ntl_shm_ring_free(shm);
 }
 
 static void sig_interrupt(int sign)
@@ -150,8 +1370,35 @@ static void sig_interrupt(int sign)
 static void run_main_event_loop()
 {
     listeners = g_ptr_array_new();
+    loggers = g_ptr_array_new_with_free_func(free_logger);
     GMainLoop* ml = g_main_new(FALSE);
+    guint      i = 0;
 
+    for ( i = 0; i < N_HOPS; i++ ) {
+        latency[i] = ntl_histogram_new();
+    }
+    top_sites = ntl_top_k_new(TOP_K, TOP_WINDOWS, MAX(top_window / TOP_WINDOWS, 1));
+    top_progs = ntl_top_k_new(TOP_K, TOP_WINDOWS, MAX(top_window / TOP_WINDOWS, 1));
+    top_key = g_string_sized_new(256);
+    dedup = ntl_dedup_new(MAX(dedup_ms, 1), send_summary, NULL);
+    g_timeout_add(MAX(dedup_ms, 1), dedup_timeout, NULL);
+    rollup = ntl_rollup_new(MAX(rollup_secs, 1), ROLLUP_KEYS, send_rollup, NULL);
+    rollup_prog = g_string_sized_new(64);
+    rollup_tag = g_string_sized_new(64);
+    g_timeout_add_seconds(1, rollup_timeout, NULL);
+    reorder = ntl_reorder_new(MAX(reorder_ms, 0), REORDER_HELD, send_ordered, NULL);
+    g_timeout_add(MAX(reorder_ms / 5, 1), reorder_timeout, NULL);
+    readers = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, (GDestroyNotify) ntl_zreader_free);
+    unzipped = g_string_sized_new(64 * 1024);
+    zout = g_string_sized_new(64 * 1024);
+    egressed = g_string_sized_new(4096);
+    paused = g_ptr_array_new();
+    if ( memory_mb > 0 ) {
+        g_timeout_add(MEMORY_CHECK_MS, memory_timeout, NULL);
+    }
+    if ( relay_to ) {
+        start_relay();
+    }
     create_servers();
     signal(SIGINT, sig_interrupt);
 
@@ -162,6 +1409,41 @@ static void run_main_event_loop()
 
 int main(int argc, char* argv[])
 {
+    GError*         err = NULL;
+    GOptionContext* ctx = g_option_context_new("- broadcast NTL traces to listeners");
+
+    g_option_context_add_main_entries(ctx, entries, NULL);
+    if ( !g_option_context_parse(ctx, &argc, &argv, &err) ) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        return EXIT_FAILURE;
+    }
+    g_option_context_free(ctx);
+    if ( relay_level ) {
+        gint level = level_index(relay_level);
+        if ( level < 0 || level > ntl_tl_Error ) {
+            g_printerr("unknown relay level: %s\n", relay_level);
+            return EXIT_FAILURE;
+        }
+        relay_min = (guint) level;
+    }
+    if ( memory_policy && 0 != g_strcmp0(memory_policy, "pause") ) {
+        if ( 0 != g_strcmp0(memory_policy, "shed") ) {
+            g_printerr("unknown memory policy: %s\n", memory_policy);
+            return EXIT_FAILURE;
+        }
+        memory_shed = TRUE;
+    }
+    if ( zdict_file && !g_file_get_contents(zdict_file, &zdict, &zdict_len, &err) ) {
+        g_printerr("%s\n", err->message);
+        g_error_free(err);
+        return EXIT_FAILURE;
+    }
+    if ( shm_path && NULL == (shm = ntl_shm_ring_create(shm_path, (gsize) MAX(shm_mb, 1) * 1024 * 1024)) ) {
+        g_printerr("failed to create %s\n", shm_path);
+        return EXIT_FAILURE;
+    }
+
     gnet_init();
 
     run_main_event_loop();
@@ -0,0 +1,64 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef __ntl_archive_h_
+#define __ntl_archive_h_
+/*
+ * A compact, columnar archive of traces. Traces are grouped into
+ * blocks; every block starts with statistics (row count, time range,
+ * levels present and the dictionaries of prog/tag/mod/fn values) so
+ * that a reader can decide whether to decode a block at all.
+ */
+
+#include "ntl_types.h"
+#include <glib.h>
+
+typedef enum {
+    ntl_ad_Prog,
+    ntl_ad_Tag,
+    ntl_ad_Mod,
+    ntl_ad_Fn,
+    ntl_ad_Count,
+} ntl_ArchiveDictT;
+
+typedef struct {
+    unsigned int rows;
+    long long    min_ms;             /* earliest trace time, ms since the epoch */
+    long long    max_ms;             /* latest trace time */
+    unsigned int level_mask;         /* bit n is set when a row has level n */
+    GPtrArray*   dict[ntl_ad_Count]; /* distinct values (gchar*) in this block */
+} ntl_ArchiveStats;
+
+typedef struct _s_ntl_archive_writer ntl_ArchiveWriter;
+typedef struct _s_ntl_archive_reader ntl_ArchiveReader;
+
+ntl_ArchiveWriter* ntl_archive_writer_new(const char* fn, unsigned int block_rows);
+gboolean           ntl_archive_writer_append(ntl_ArchiveWriter* w, const ntl_Packet* pkt);
+gboolean           ntl_archive_writer_flush(ntl_ArchiveWriter* w);
+void               ntl_archive_writer_free(ntl_ArchiveWriter* w);
+
+gboolean                ntl_archive_is_archive(const char* data, gsize len);
+ntl_ArchiveReader*      ntl_archive_reader_new(const char* data, gsize len);
+const ntl_ArchiveStats* ntl_archive_reader_next(ntl_ArchiveReader* r);
+gsize                   ntl_archive_reader_tell(const ntl_ArchiveReader* r);
+void                    ntl_archive_reader_seek(ntl_ArchiveReader* r, gsize pos);
+GPtrArray*              ntl_archive_reader_decode(ntl_ArchiveReader* r);
+void                    ntl_archive_reader_free(ntl_ArchiveReader* r);
+
+gboolean ntl_archive_stats_has(const ntl_ArchiveStats* s, ntl_ArchiveDictT d, const char* value);
+
+#endif
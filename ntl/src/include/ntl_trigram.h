@@ -0,0 +1,55 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef __ntl_trigram_h_
+#define __ntl_trigram_h_
+/*
+ * A trigram index over the messages of a closed text segment, kept
+ * beside it as <segment>.tri. The segment is cut into blocks on line
+ * boundaries and the index lists, for every trigram seen in a message,
+ * the blocks it occurs in; a search then only reads the blocks which
+ * hold all the trigrams of what it looks for.
+ */
+
+#include <glib.h>
+
+typedef struct _s_ntl_trigram_builder ntl_TrigramBuilder;
+typedef struct _s_ntl_trigram_index   ntl_TrigramIndex;
+
+/* data is the segment, fed in order and in pieces of any size */
+ntl_TrigramBuilder* ntl_trigram_builder_new(gsize block_size);
+void                ntl_trigram_builder_add(ntl_TrigramBuilder* b, const char* data, gsize len);
+gboolean            ntl_trigram_builder_write(ntl_TrigramBuilder* b, const char* fn);
+void                ntl_trigram_builder_free(ntl_TrigramBuilder* b);
+
+/* the index of a segment, whether or not the segment has been gzipped */
+gchar*              ntl_trigram_index_name(const char* segment);
+
+/* NULL unless fn is an index of source_len bytes of segment */
+ntl_TrigramIndex*   ntl_trigram_index_open(const char* fn, gsize source_len);
+guint               ntl_trigram_index_blocks(const ntl_TrigramIndex* idx);
+void                ntl_trigram_index_block(const ntl_TrigramIndex* idx, guint i, gsize* start, gsize* end);
+/* clears candidates[i] for each block whose messages cannot contain s;
+ * FALSE, with nothing cleared, if s is too short to tell */
+gboolean            ntl_trigram_index_require(const ntl_TrigramIndex* idx, const char* s, gsize len, guint8* candidates);
+void                ntl_trigram_index_free(ntl_TrigramIndex* idx);
+
+/* the literal strings that every match of a regular expression must
+ * contain, as a NULL terminated vector; empty when there are none */
+gchar**             ntl_trigram_literals(const char* regex);
+
+#endif
@@ -27,6 +27,26 @@ typedef enum {
     ntl_tl_Error,
 } ntl_TraceLevelT;
 
+/* the types of typed fields (see ntl_packet_field_* in ntll.h) */
+typedef enum {
+    ntl_ft_Int,
+    ntl_ft_Double,
+    ntl_ft_String,
+    ntl_ft_Bool,
+} ntl_FieldTypeT;
+
+typedef struct _s_ntl_fields ntl_Fields;
+
+/* optional latency stamps, in microseconds since the epoch; 0 if absent */
+typedef enum {
+    ntl_ts_Enqueue, /* lq: ntl_trace() was called */
+    ntl_ts_Send,    /* ls: the client wrote it */
+    ntl_ts_Ingress, /* li: ntld read it */
+    ntl_ts_Egress,  /* le: ntld wrote it out */
+    ntl_ts_Deliver, /* the listener decoded it */
+    ntl_ts_Count,
+} ntl_TraceStampT;
+
 typedef struct {
     char*           prog;
     unsigned int    pid;
@@ -38,6 +58,11 @@ typedef struct {
     char*           mod;
     char*           fn;
     char*           msg;
+    char*           host;   /* the host an ntld relayed it from; NULL if local */
+    ntl_Fields*     fields; /* NULL if it has none */
+    unsigned int    repeats; /* for a summary of suppressed repeats, how many */
+    int             late;    /* arrived too late for ntld to put it in order */
+    long long       stamps[ntl_ts_Count];
 } ntl_Packet;
 
 typedef struct _s_ntl_listener ntl_Listener;
@@ -21,6 +21,7 @@
  * The public interface used by a logging client to post traces.
  */
 
+#include <glib.h>
 #include <time.h>
 
 typedef enum {
@@ -30,13 +31,94 @@ typedef enum {
     ntl_tl_Error,
 } ntl_TraceLevelT;
 
+/* the types of the fields which can be attached to a trace */
+typedef enum {
+    ntl_ft_Int,
+    ntl_ft_Double,
+    ntl_ft_String,
+    ntl_ft_Bool,
+} ntl_FieldTypeT;
+
+typedef struct {
+    const char*    key;
+    ntl_FieldTypeT type;
+    union {
+        long long   i;
+        double      d;
+        const char* s;
+        int         b;
+    } v;
+} ntl_Field;
+
+#define NTL_FIELD_INT(k, x)    { (k), ntl_ft_Int, { .i = (x) } }
+#define NTL_FIELD_DOUBLE(k, x) { (k), ntl_ft_Double, { .d = (x) } }
+#define NTL_FIELD_STRING(k, x) { (k), ntl_ft_String, { .s = (x) } }
+#define NTL_FIELD_BOOL(k, x)   { (k), ntl_ft_Bool, { .b = (x) } }
+
 typedef void (*ntl_send_func)(const char* pkt);
 typedef void (*ntl_timestamp_func)(time_t* t, long* millis);
 
 void ntl_setup(const char* program_name);
 void ntl_setup_override(const char* program_name, ntl_send_func send_func, ntl_timestamp_func ts_func);
 void ntl_teardown(void);
+/*
+ * Keeps recent traces in a file-backed ring (by default
+ * $TMPDIR/ntl-<uid>/ntl-<prog>-<pid>.ring, in a directory only the user
+ * can use) so that ntl_recover can forward any that were not sent when
+ * the process died. Returns 0 on success.
+ */
+#define NTL_CRASH_RING_SIZE (1024 * 1024)
+int  ntl_setup_crash_ring(const char* path, unsigned long size);
+/* sends an already formatted packet; returns 0 if it was written */
+int  ntl_forward(const char* pkt);
+/*
+ * Traces below the minimum level are dropped before they are
+ * formatted. ntld can change the minimum at runtime, by default or for
+ * a tag or module, by sending control lines such as "lvl mod:net
+ * debug" or "lvl * reset"; ntl_control() applies one locally.
+ */
+void ntl_set_level(ntl_TraceLevelT min);
+int  ntl_enabled(ntl_TraceLevelT tl, const char* tag, const char* mod);
+int  ntl_control(const char* line);
+/* Trace and Debug traces are shed rather than wait for a busy daemon;
+ * this is how many have been */
+unsigned long ntl_shed_count(void);
+/* compress traces on their way to ntld with zlib at this level, 1
+ * (fastest) to 9, once ntld agrees to it; 0 (the default) for none.
+ * Call before ntl_setup */
+void ntl_compress(int level);
+/* when enabled, traces carry timestamps for measuring their latency:
+ * when ntl_trace was called (lq) and when the trace was written to the
+ * socket (ls), which only ntlc's own sender stamps */
+void ntl_stamp_latency(int enabled);
 void ntl_trace(ntl_TraceLevelT tl, const char* tag, const char* mod, const char* fn, const char* fmt, ...) __attribute__ ((format (printf, 5, 6)));
+void ntl_trace_fields(ntl_TraceLevelT tl, const char* tag, const char* mod, const char* fn, const ntl_Field* fields, int n_fields, const char* fmt, ...) __attribute__ ((format (printf, 7, 8)));
+
+/*
+ * Spans time nested sections of code on each thread. By default the
+ * durations are aggregated per span name and sent every flush_ms as a
+ * trace tagged "ntl.span" (see ntl_span_stats_parse() in ntll.h);
+ * with send_records, each completed span is also sent on its own,
+ * tagged "ntl.span.rec", with its start, duration and parent.
+ */
+typedef guint64 ntl_SpanId;
+
+ntl_SpanId ntl_span_begin(const char* name);
+void       ntl_span_end(ntl_SpanId id);
+void       ntl_span_configure(int flush_ms, int send_records);
+void       ntl_span_flush(void);
+
+static inline void ntl_span_scope_end(ntl_SpanId* id)
+{
+    ntl_span_end(*id);
+}
+
+#define NTL_SPAN_CAT_(a, b) a##b
+#define NTL_SPAN_CAT(a, b)  NTL_SPAN_CAT_(a, b)
+
+/* times the rest of the enclosing block */
+#define NTL_SPAN(name) \
+    ntl_SpanId NTL_SPAN_CAT(ntl_span_, __LINE__) __attribute__ ((cleanup(ntl_span_scope_end))) = ntl_span_begin(name)
 
 unsigned long ntl_util_gettid(void);
 
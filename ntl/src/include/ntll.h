@@ -26,14 +26,75 @@
 #include <glib.h>
 
 ntl_Packet* ntl_packet_decode(const char* pkt);
+ntl_Packet* ntl_packet_copy(const ntl_Packet* pkt);
 void        ntl_packet_free(ntl_Packet* pkt);
 
 const char* ntl_level_to_string(ntl_TraceLevelT lvl);
 
+/* typed fields; a double may also be read from an int field */
+guint       ntl_packet_field_count(const ntl_Packet* pkt);
+const char* ntl_packet_field_key(const ntl_Packet* pkt, guint i);
+gboolean    ntl_packet_field_type(const ntl_Packet* pkt, const char* key, ntl_FieldTypeT* type);
+gboolean    ntl_packet_field_int(const ntl_Packet* pkt, const char* key, gint64* v);
+gboolean    ntl_packet_field_double(const ntl_Packet* pkt, const char* key, gdouble* v);
+gboolean    ntl_packet_field_string(const ntl_Packet* pkt, const char* key, const char** v);
+gboolean    ntl_packet_field_bool(const ntl_Packet* pkt, const char* key, gboolean* v);
+
+/* a per-name span summary sent by ntlc; durations are in nanoseconds */
+typedef struct {
+    const char* name;
+    guint64     count;
+    guint64     p50;
+    guint64     p99;
+    guint64     max;
+} ntl_SpanStats;
+
+gboolean    ntl_span_stats_parse(const ntl_Packet* pkt, ntl_SpanStats* s);
+
+/* a window of counts from ntld's rollup stream (ntl_sub_Rollup) */
+typedef struct {
+    const char*     prog;
+    const char*     tag;
+    ntl_TraceLevelT lvl;
+    time_t          start;
+    guint           secs;
+    guint64         count;
+    guint64         bytes;
+} ntl_RollupStats;
+
+gboolean    ntl_rollup_parse(const ntl_Packet* pkt, ntl_RollupStats* s);
+
+/* the line format historically written by ntl_fl */
+#define NTL_TEMPLATE_DEFAULT "[%{tag}] [%{level}] [%{prog}, %{pid}, %{tid}] [%{time}] [%{mod}/%{fn}]: %{msg}"
+
+typedef struct _s_ntl_template ntl_Template;
+
+ntl_Template* ntl_template_compile(const char* spec);
+ntl_Template* ntl_template_json(void);
+ntl_Template* ntl_template_logfmt(void);
+void          ntl_template_render(const ntl_Template* t, GString* s, const ntl_Packet* pkt);
+void          ntl_template_free(ntl_Template* t);
+
 typedef void (*ntl_listener_pkt_func)(const ntl_Packet* pkt, gpointer data);
 
+/* what a listener asks ntld for, beyond every trace as it was sent */
+typedef enum {
+    ntl_sub_Dedup = 1 << 0,    /* runs of repeats as the first and a summary */
+    ntl_sub_Rollup = 1 << 1,   /* only per-window counts, instead of traces */
+    ntl_sub_Compress = 1 << 2, /* traces as chunks of a zlib stream */
+    ntl_sub_Order = 1 << 3,    /* traces in time order, within ntld's reorder window */
+} ntl_SubscriptionT;
+
 ntl_Listener* ntl_listener_new(const char* host, ntl_listener_pkt_func pkt_func, gpointer data);
+ntl_Listener* ntl_listener_new_full(const char* host, guint subscription, ntl_listener_pkt_func pkt_func, gpointer data);
+/* every trace, read from the shared ring ntld --shm publishes at path
+ * (see ntl_ShmRing in ntlu.h), from the main loop */
+ntl_Listener* ntl_listener_new_shm(const char* path, ntl_listener_pkt_func pkt_func, gpointer data);
 gchar*        ntl_listener_default_time_format(const ntl_Packet* pkt);
+void          ntl_listener_default_time_append(GString* s, const ntl_Packet* pkt);
+/* per-hop latency, in microseconds, of the packets which carry stamps */
+void          ntl_listener_latency_dump(const ntl_Listener* l, GString* out);
+void          ntl_listener_latency_reset(ntl_Listener* l);
 void          ntl_listener_free(ntl_Listener* l);
 
 #endif
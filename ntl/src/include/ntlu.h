@@ -0,0 +1,192 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef __ntlu_h_
+#define __ntlu_h_
+/*
+ * Utilities shared by the daemon and the listener library.
+ */
+
+#include <glib.h>
+
+/*
+ * A latency histogram in the style of HdrHistogram: values are
+ * counted in buckets whose width grows with the value, keeping about
+ * two significant digits over the whole range (up to about 12 days in
+ * microseconds). Recording is a couple of shifts and an increment.
+ */
+typedef struct _s_ntl_histogram ntl_Histogram;
+
+ntl_Histogram* ntl_histogram_new(void);
+void           ntl_histogram_record(ntl_Histogram* h, guint64 v);
+guint64        ntl_histogram_count(const ntl_Histogram* h);
+guint64        ntl_histogram_max(const ntl_Histogram* h);
+guint64        ntl_histogram_percentile(const ntl_Histogram* h, gdouble p);
+void           ntl_histogram_merge(ntl_Histogram* into, const ntl_Histogram* h);
+void           ntl_histogram_reset(ntl_Histogram* h);
+void           ntl_histogram_dump(const ntl_Histogram* h, const gchar* name, GString* out);
+void           ntl_histogram_free(ntl_Histogram* h);
+
+/*
+ * The heaviest keys in a sliding window of n_windows sub-windows, by
+ * count, in fixed memory: counts and bytes go into count-min sketches
+ * and only the k largest keys are kept. Estimates may overcount but
+ * never undercount. Times are in microseconds; keys longer than 128
+ * bytes are truncated. Listed keys are valid until the next add.
+ */
+typedef struct _s_ntl_top_k ntl_TopK;
+
+typedef struct {
+    const gchar* key;
+    guint64      count;
+    guint64      bytes;
+} ntl_TopEntry;
+
+ntl_TopK* ntl_top_k_new(guint k, guint n_windows, guint window_secs);
+void      ntl_top_k_add(ntl_TopK* t, const gchar* key, gsize bytes, gint64 now);
+guint     ntl_top_k_list(ntl_TopK* t, gint64 now, ntl_TopEntry* out, guint max);
+void      ntl_top_k_totals(ntl_TopK* t, gint64 now, guint64* count, guint64* bytes, gdouble* secs);
+void      ntl_top_k_dump(ntl_TopK* t, const gchar* name, gint64 now, guint max, GString* out);
+void      ntl_top_k_reset(ntl_TopK* t);
+void      ntl_top_k_free(ntl_TopK* t);
+
+/*
+ * Suppresses runs of identical traces from one call site. Each packet
+ * line is checked as it arrives; a repeat within window_ms of the
+ * previous one is reported as such, and when the run ends emit is
+ * given a line summarising its repeats. Times are in microseconds.
+ */
+typedef struct _s_ntl_dedup ntl_Dedup;
+
+typedef void (*ntl_dedup_func)(const gchar* summary, gpointer data);
+
+ntl_Dedup* ntl_dedup_new(guint window_ms, ntl_dedup_func emit, gpointer data);
+gboolean   ntl_dedup_check(ntl_Dedup* dd, const gchar* ln, gint64 now);
+void       ntl_dedup_expire(ntl_Dedup* dd, gint64 now);
+void       ntl_dedup_dump(const ntl_Dedup* dd, GString* out);
+void       ntl_dedup_free(ntl_Dedup* dd);
+
+/*
+ * Tumbling-window counts of traces and bytes per (prog, tag, level).
+ * As each window closes, emit is given one packet line per key seen in
+ * it, tagged NTL_ROLLUP_TAG (see ntl_rollup_parse in ntll.h). The
+ * snapshot is in the Prometheus text format. Times are in
+ * microseconds since the epoch.
+ */
+#define NTL_ROLLUP_TAG "ntl.rollup"
+
+typedef struct _s_ntl_rollup ntl_Rollup;
+
+typedef void (*ntl_rollup_func)(const gchar* line, gpointer data);
+
+ntl_Rollup* ntl_rollup_new(guint window_secs, guint max_keys, ntl_rollup_func emit, gpointer data);
+void        ntl_rollup_add(ntl_Rollup* r, const gchar* prog, const gchar* tag, guint level, gsize bytes, gint64 now);
+void        ntl_rollup_tick(ntl_Rollup* r, gint64 now);
+void        ntl_rollup_snapshot(const ntl_Rollup* r, GString* out);
+void        ntl_rollup_free(ntl_Rollup* r);
+
+/*
+ * The lines an ntld relays upstream, awaiting their acks. Pushed lines
+ * are tagged with the host they came from (as hn:) and held, sent or
+ * not, up to limit bytes, past which the oldest are dropped. A batch
+ * moves up to max_lines to out, followed by a "{ ctl:batch, seq:N }"
+ * marker for the upstream to ack with "ack N"; rewind requeues the
+ * unacked lines after a lost connection.
+ */
+typedef struct _s_ntl_relay_queue ntl_RelayQueue;
+
+ntl_RelayQueue* ntl_relay_queue_new(gsize limit);
+void            ntl_relay_queue_push(ntl_RelayQueue* q, const gchar* ln, const gchar* host);
+guint           ntl_relay_queue_unsent(const ntl_RelayQueue* q);
+gsize           ntl_relay_queue_bytes(const ntl_RelayQueue* q);
+guint64         ntl_relay_queue_batch(ntl_RelayQueue* q, guint max_lines, GString* out);
+guint           ntl_relay_queue_ack(ntl_RelayQueue* q, guint64 seq);
+void            ntl_relay_queue_rewind(ntl_RelayQueue* q);
+void            ntl_relay_queue_dump(const ntl_RelayQueue* q, GString* out);
+void            ntl_relay_queue_free(ntl_RelayQueue* q);
+
+/*
+ * Streaming compression of a link's lines. A writer turns a batch of
+ * lines into one chunk line ("z:..." or, starting a new stream,
+ * "Z:...") and a reader turns such chunks back into lines. Both keep
+ * zlib's history from chunk to chunk. dict, if given, is a sample of
+ * typical traces to start each stream with, in place of the built-in
+ * one; a reader also understands writers using the built-in one.
+ */
+typedef struct _s_ntl_zwriter ntl_ZWriter;
+typedef struct _s_ntl_zreader ntl_ZReader;
+
+#define NTL_ZCHUNK(ln) (('z' == (ln)[0] || 'Z' == (ln)[0]) && ':' == (ln)[1])
+
+ntl_ZWriter* ntl_zwriter_new(gint level, const gchar* dict, gsize dict_len);
+/* the next chunk starts a new stream, as after a lost chunk */
+void         ntl_zwriter_reset(ntl_ZWriter* z);
+void         ntl_zwriter_write(ntl_ZWriter* z, const gchar* data, gsize len, GString* out);
+void         ntl_zwriter_dump(const ntl_ZWriter* z, const gchar* name, GString* out);
+void         ntl_zwriter_free(ntl_ZWriter* z);
+
+ntl_ZReader* ntl_zreader_new(const gchar* dict, gsize dict_len);
+/* appends the chunk's lines to out; FALSE if it could not be decoded */
+gboolean     ntl_zreader_read(ntl_ZReader* z, const gchar* ln, GString* out);
+void         ntl_zreader_dump(const ntl_ZReader* z, const gchar* name, GString* out);
+void         ntl_zreader_free(ntl_ZReader* z);
+
+/*
+ * Puts packet lines from many clients back in trace-time order: each
+ * is held until the clock is window_ms past its time (but no more than
+ * max_held at once), then given to emit with the flags it was pushed
+ * with. Lines older than one already emitted are emitted at once,
+ * marked late:1. Times are in microseconds since the epoch.
+ */
+typedef struct _s_ntl_reorder ntl_Reorder;
+
+typedef void (*ntl_reorder_func)(const gchar* line, guint flags, gpointer data);
+
+ntl_Reorder* ntl_reorder_new(guint window_ms, guint max_held, ntl_reorder_func emit, gpointer data);
+void         ntl_reorder_push(ntl_Reorder* r, const gchar* ln, guint flags, gint64 now);
+void         ntl_reorder_flush(ntl_Reorder* r, gint64 now);
+gsize        ntl_reorder_bytes(const ntl_Reorder* r);
+guint64      ntl_reorder_late(const ntl_Reorder* r);
+void         ntl_reorder_dump(const ntl_Reorder* r, GString* out);
+void         ntl_reorder_free(ntl_Reorder* r);
+
+/*
+ * A ring of packet lines in a shared file, written by ntld and read by
+ * listeners on the same host without a socket in between. The writer
+ * never waits for readers: one that falls a whole ring behind is
+ * lapped and skips to the newest line. Each reader keeps its cursor in
+ * the file, so the writer can report how far behind it is. A reader
+ * should attach afresh once the ring is no longer valid, as after the
+ * writer has resized it. Lines longer than half the ring are dropped,
+ * and counted in the dump.
+ */
+typedef struct _s_ntl_shm_ring ntl_ShmRing;
+
+typedef void (*ntl_shm_ring_func)(const gchar* line, gsize len, gpointer data);
+
+ntl_ShmRing* ntl_shm_ring_create(const gchar* path, gsize size);
+void         ntl_shm_ring_publish(ntl_ShmRing* r, const gchar* ln, gsize len);
+void         ntl_shm_ring_dump(const ntl_ShmRing* r, GString* out);
+
+ntl_ShmRing* ntl_shm_ring_attach(const gchar* path);
+gboolean     ntl_shm_ring_valid(const ntl_ShmRing* r);
+/* gives fn up to max of the lines published since the last read */
+guint        ntl_shm_ring_read(ntl_ShmRing* r, guint max, ntl_shm_ring_func fn, gpointer data);
+guint64      ntl_shm_ring_laps(const ntl_ShmRing* r);
+void         ntl_shm_ring_free(ntl_ShmRing* r);
+
+#endif
@@ -0,0 +1,331 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "ntl_crash_ring.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * The file is a header followed by the ring. Each record is a 32 bit
+ * length and the packet's bytes, wrapping at the end of the ring. The
+ * head is only moved once a record is complete, so a crash part way
+ * through an append loses that record and nothing else. Appends are
+ * serialised by a mutex, which only enters the kernel when contended.
+ *
+ * Sends complete out of order across threads, and some fail, so each
+ * record carries its own sent flag in the top bit of its length; sent
+ * then moves over the run of flagged records that follows it, and
+ * recovery skips any flagged record beyond it.
+ */
+
+/* private */
+#define MAGIC       "NTLR"
+#define VERSION     2
+#define HEADER_SIZE 128
+#define PROG_SIZE   64
+#define SENT_FLAG   0x80000000u
+
+typedef struct {
+    gchar   magic[4];
+    guint32 version;
+    guint64 capacity;
+    guint64 head;
+    guint64 tail;
+    guint64 sent;
+    guint32 pid;
+    gchar   prog[PROG_SIZE];
+} Header;
+
+struct _s_ntl_crash_ring {
+    gchar*  path;
+    Header* hdr;
+    guchar* data;
+    gsize   map_size;
+    GMutex  lock;
+};
+
+static void copy_in(ntl_CrashRing* r, guint64 pos, const void* src, gsize len)
+{
+    gsize off = pos % r->hdr->capacity;
+    gsize first = MIN(len, r->hdr->capacity - off);
+
+    memcpy(r->data + off, src, first);
+    memcpy(r->data, (const guchar*) src + first, len - first);
+}
+
+static void copy_out(const ntl_CrashRing* r, guint64 pos, void* dst, gsize len)
+{
+    gsize off = pos % r->hdr->capacity;
+    gsize first = MIN(len, r->hdr->capacity - off);
+
+    memcpy(dst, r->data + off, first);
+    memcpy((guchar*) dst + first, r->data, len - first);
+}
+
+static guint32 word_at(const ntl_CrashRing* r, guint64 pos)
+{
+    guint32 rv = 0;
+    copy_out(r, pos, &rv, sizeof(rv));
+    return rv;
+}
+
+static guint32 length_at(const ntl_CrashRing* r, guint64 pos)
+{
+    return word_at(r, pos) & ~SENT_FLAG;
+}
+
+static void flag_sent(ntl_CrashRing* r, guint64 pos)
+{
+    guint32 w = word_at(r, pos) | SENT_FLAG;
+    copy_in(r, pos, &w, sizeof(w));
+}
+
+/* with the lock held */
+static void advance_sent(ntl_CrashRing* r)
+{
+    Header* h = r->hdr;
+
+    if ( h->sent < h->tail ) {
+        h->sent = h->tail;
+    }
+    while ( h->sent < h->head ) {
+        guint32 w = word_at(r, h->sent);
+        if ( !(w & SENT_FLAG) ) {
+            break;
+        }
+        h->sent += sizeof(w) + (w & ~SENT_FLAG);
+    }
+}
+
+/* a new file, or a stale one of the user's own made anew */
+static int open_new(const gchar* path)
+{
+    struct stat st;
+    int         fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+
+    if ( fd < 0 && EEXIST == errno && 0 == lstat(path, &st)
+         && S_ISREG(st.st_mode) && st.st_uid == getuid() && 0 == unlink(path) ) {
+        fd = open(path, O_RDWR | O_CREAT | O_EXCL | O_NOFOLLOW, 0600);
+    }
+    return fd;
+}
+
+static ntl_CrashRing* map(const gchar* path, int fd, gsize size)
+{
+    ntl_CrashRing* rv = NULL;
+    void*          m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if ( MAP_FAILED == m ) {
+        return NULL;
+    }
+    rv = g_new(ntl_CrashRing, 1);
+    rv->path = g_strdup(path);
+    rv->hdr = (Header*) m;
+    rv->data = (guchar*) m + HEADER_SIZE;
+    rv->map_size = size;
+    g_mutex_init(&rv->lock);
+    return rv;
+}
+
+/* public */
+gchar* ntl_crash_ring_dir(void)
+{
+    gchar*      rv = g_strdup_printf("%s/ntl-%u", g_get_tmp_dir(), (guint) getuid());
+    struct stat st;
+
+    if ( (0 != mkdir(rv, 0700) && EEXIST != errno) || 0 != lstat(rv, &st)
+         || !S_ISDIR(st.st_mode) || st.st_uid != getuid() || 0 != (st.st_mode & 077) ) {
+        g_free(rv);
+        return NULL;
+    }
+    return rv;
+}
+
+ntl_CrashRing* ntl_crash_ring_create(const gchar* path, gsize size, const gchar* prog)
+{
+    ntl_CrashRing* rv = NULL;
+    int            fd = open_new(path);
+
+    if ( fd < 0 ) {
+        return NULL;
+    }
+    size = MAX(size, 4096);
+    if ( 0 == ftruncate(fd, HEADER_SIZE + size) ) {
+        rv = map(path, fd, HEADER_SIZE + size);
+    }
+    close(fd);
+    if ( NULL == rv ) {
+        unlink(path);
+        return NULL;
+    }
+    memset(rv->hdr, 0, sizeof(Header));
+    rv->hdr->version = VERSION;
+    rv->hdr->capacity = size;
+    rv->hdr->pid = getpid();
+    g_strlcpy(rv->hdr->prog, prog ? prog : "", PROG_SIZE);
+    /* last, so a half-made file is never taken for a ring */
+    memcpy(rv->hdr->magic, MAGIC, 4);
+    return rv;
+}
+
+ntl_CrashRing* ntl_crash_ring_open(const gchar* path)
+{
+    ntl_CrashRing* rv = NULL;
+    struct stat    st;
+    int            fd = open(path, O_RDWR);
+
+    if ( fd < 0 ) {
+        return NULL;
+    }
+    if ( 0 == fstat(fd, &st) && st.st_size > HEADER_SIZE ) {
+        rv = map(path, fd, st.st_size);
+    }
+    close(fd);
+    if ( rv && (0 != memcmp(rv->hdr->magic, MAGIC, 4) || VERSION != rv->hdr->version
+             || rv->hdr->capacity != rv->map_size - HEADER_SIZE
+             || rv->hdr->tail > rv->hdr->head || rv->hdr->head - rv->hdr->tail > rv->hdr->capacity) ) {
+        ntl_crash_ring_close(rv, FALSE);
+        rv = NULL;
+    }
+    return rv;
+}
+
+guint64 ntl_crash_ring_append(ntl_CrashRing* r, const gchar* pkt, gsize len)
+{
+    Header* h = r->hdr;
+    guint32 n = (guint32) len;
+    guint64 rv = 0;
+
+    /* a partial packet would be a corrupt wire line */
+    if ( len > h->capacity / 2 || len >= SENT_FLAG ) {
+        return 0;
+    }
+
+    g_mutex_lock(&r->lock);
+    /* make room by dropping the oldest records */
+    while ( h->head + sizeof(n) + len - h->tail > h->capacity ) {
+        h->tail += sizeof(n) + length_at(r, h->tail);
+    }
+    advance_sent(r);
+    copy_in(r, h->head, &n, sizeof(n));
+    copy_in(r, h->head + sizeof(n), pkt, len);
+    rv = h->head + sizeof(n) + len;
+    __atomic_store_n(&h->head, rv, __ATOMIC_RELEASE);
+    g_mutex_unlock(&r->lock);
+
+    return rv;
+}
+
+void ntl_crash_ring_mark_sent(ntl_CrashRing* r, guint64 end, gsize len)
+{
+    guint64 start = end - sizeof(guint32) - len;
+
+    if ( 0 == end ) {
+        return;
+    }
+    /* a record already dropped from the ring has nothing to flag */
+    g_mutex_lock(&r->lock);
+    if ( start >= r->hdr->tail && length_at(r, start) == len ) {
+        flag_sent(r, start);
+        advance_sent(r);
+    }
+    g_mutex_unlock(&r->lock);
+}
+
+gboolean ntl_crash_ring_pending(const ntl_CrashRing* r)
+{
+    const Header* h = r->hdr;
+    guint64       pos = MAX(h->sent, h->tail);
+
+    /* past sent are only records flagged out of order and those that
+     * failed to send */
+    while ( pos < h->head ) {
+        guint32 w = word_at(r, pos);
+        if ( !(w & SENT_FLAG) ) {
+            return TRUE;
+        }
+        pos += sizeof(w) + (w & ~SENT_FLAG);
+    }
+    return FALSE;
+}
+
+guint ntl_crash_ring_recover(ntl_CrashRing* r, ntl_crash_ring_func fn, gpointer data, gboolean mark)
+{
+    Header* h = r->hdr;
+    guint   rv = 0;
+    guint64 pos = MAX(h->sent, h->tail);
+
+    while ( pos < h->head ) {
+        guint32  w = word_at(r, pos);
+        guint32  n = w & ~SENT_FLAG;
+        gchar*   pkt = NULL;
+        gboolean ok = FALSE;
+
+        if ( pos + sizeof(n) + n > h->head ) {
+            break;
+        }
+        if ( !(w & SENT_FLAG) ) {
+            pkt = g_malloc(n + 1);
+            copy_out(r, pos + sizeof(n), pkt, n);
+            pkt[n] = '\0';
+            ok = (*fn)(pkt, data);
+            g_free(pkt);
+            if ( !ok ) {
+                break;
+            }
+            if ( mark ) {
+                flag_sent(r, pos);
+            }
+            rv++;
+        }
+        pos += sizeof(n) + n;
+    }
+    if ( mark ) {
+        g_mutex_lock(&r->lock);
+        advance_sent(r);
+        g_mutex_unlock(&r->lock);
+    }
+    return rv;
+}
+
+pid_t ntl_crash_ring_pid(const ntl_CrashRing* r)
+{
+    return (pid_t) r->hdr->pid;
+}
+
+const gchar* ntl_crash_ring_prog(const ntl_CrashRing* r)
+{
+    return r->hdr->prog;
+}
+
+void ntl_crash_ring_close(ntl_CrashRing* r, gboolean remove)
+{
+    if ( r ) {
+        munmap(r->hdr, r->map_size);
+        if ( remove ) {
+            unlink(r->path);
+        }
+        g_mutex_clear(&r->lock);
+        g_free(r->path);
+        g_free(r);
+    }
+}
@@ -0,0 +1,55 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef __ntl_crash_ring_h_
+#define __ntl_crash_ring_h_
+
+/*
+ * A file-backed ring of recent packets. Appending is a memcpy into a
+ * shared mapping, so the packets reach the page cache without any
+ * system call and outlive the process if it crashes. Positions are
+ * byte counts since creation: head is the end of the newest record,
+ * tail the start of the oldest still held, and every record before
+ * sent is known to have been written to ntld. A packet larger than
+ * half the ring is not held; append returns 0 for it. Recovery gives
+ * fn each record not yet sent, until fn fails; with mark, it flags each
+ * one fn took as sent, and without it never writes to the ring.
+ *
+ * create never follows a symlink or opens a file it did not make; it
+ * replaces a stale ring only if the file is the user's own.
+ */
+
+#include <glib.h>
+#include <sys/types.h>
+
+typedef struct _s_ntl_crash_ring ntl_CrashRing;
+
+typedef gboolean (*ntl_crash_ring_func)(const gchar* pkt, gpointer data);
+
+/* $TMPDIR/ntl-<uid>, made if need be; NULL unless it is the user's alone */
+gchar*         ntl_crash_ring_dir(void);
+ntl_CrashRing* ntl_crash_ring_create(const gchar* path, gsize size, const gchar* prog);
+ntl_CrashRing* ntl_crash_ring_open(const gchar* path);
+guint64        ntl_crash_ring_append(ntl_CrashRing* r, const gchar* pkt, gsize len);
+void           ntl_crash_ring_mark_sent(ntl_CrashRing* r, guint64 end, gsize len);
+gboolean       ntl_crash_ring_pending(const ntl_CrashRing* r);
+guint          ntl_crash_ring_recover(ntl_CrashRing* r, ntl_crash_ring_func fn, gpointer data, gboolean mark);
+pid_t          ntl_crash_ring_pid(const ntl_CrashRing* r);
+const gchar*   ntl_crash_ring_prog(const ntl_CrashRing* r);
+void           ntl_crash_ring_close(ntl_CrashRing* r, gboolean remove);
+
+#endif
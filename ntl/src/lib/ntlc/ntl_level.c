@@ -0,0 +1,185 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "ntlc.h"
+
+#include <glib.h>
+#include <string.h>
+
+/*
+ * The minimum level of traces which are formatted and sent, by default
+ * and per tag or module. Rules change rarely, so ntl_enabled() first
+ * compares against the lowest and highest minimum in force and only
+ * takes the read lock for the levels in between. A module rule wins
+ * over a tag rule, which wins over the default.
+ */
+
+/* private */
+typedef struct {
+    gchar*          tag;
+    gchar*          mod;
+    ntl_TraceLevelT level;
+} Rule;
+
+static GRWLock    lock;
+static GPtrArray* rules = NULL;
+static gint       initial = ntl_tl_Trace;
+static gint       base = ntl_tl_Trace;
+static gint       lowest = ntl_tl_Trace;
+static gint       highest = ntl_tl_Trace;
+
+static const gchar* level_names[] = { "trace", "debug", "warn", "error" };
+
+static void free_rule(gpointer d)
+{
+    Rule* r = (Rule*) d;
+    g_free(r->tag);
+    g_free(r->mod);
+    g_free(r);
+}
+
+/* with the write lock held */
+static void update_bounds(void)
+{
+    gint  lo = base;
+    gint  hi = base;
+    guint i = 0;
+
+    for ( i = 0; rules && i < rules->len; i++ ) {
+        Rule* r = (Rule*) g_ptr_array_index(rules, i);
+        lo = MIN(lo, (gint) r->level);
+        hi = MAX(hi, (gint) r->level);
+    }
+    g_atomic_int_set(&lowest, lo);
+    g_atomic_int_set(&highest, hi);
+}
+
+/* with the write lock held; a NULL level removes the rule */
+static void set_rule(const gchar* tag, const gchar* mod, const ntl_TraceLevelT* level)
+{
+    Rule* r = NULL;
+    guint i = 0;
+
+    if ( NULL == rules ) {
+        rules = g_ptr_array_new_with_free_func(free_rule);
+    }
+    for ( i = 0; i < rules->len; i++ ) {
+        Rule* c = (Rule*) g_ptr_array_index(rules, i);
+        if ( 0 == g_strcmp0(c->tag, tag) && 0 == g_strcmp0(c->mod, mod) ) {
+            r = c;
+            break;
+        }
+    }
+    if ( NULL == level ) {
+        if ( r ) {
+            g_ptr_array_remove_index_fast(rules, i);
+        }
+        return;
+    }
+    if ( NULL == r ) {
+        r = g_new0(Rule, 1);
+        r->tag = g_strdup(tag);
+        r->mod = g_strdup(mod);
+        g_ptr_array_add(rules, r);
+    }
+    r->level = *level;
+}
+
+static gboolean level_from_string(const gchar* s, ntl_TraceLevelT* tl)
+{
+    guint i = 0;
+    for ( i = 0; i < G_N_ELEMENTS(level_names); i++ ) {
+        if ( 0 == g_ascii_strcasecmp(s, level_names[i]) ) {
+            *tl = (ntl_TraceLevelT) i;
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
+
+/* public */
+void ntl_set_level(ntl_TraceLevelT min)
+{
+    g_rw_lock_writer_lock(&lock);
+    initial = base = min;
+    update_bounds();
+    g_rw_lock_writer_unlock(&lock);
+}
+
+int ntl_enabled(ntl_TraceLevelT tl, const char* tag, const char* mod)
+{
+    gint  min = ntl_tl_Trace;
+    guint i = 0;
+
+    if ( (gint) tl >= g_atomic_int_get(&highest) ) {
+        return 1;
+    }
+    if ( (gint) tl < g_atomic_int_get(&lowest) ) {
+        return 0;
+    }
+
+    g_rw_lock_reader_lock(&lock);
+    min = base;
+    for ( i = 0; rules && i < rules->len; i++ ) {
+        Rule* r = (Rule*) g_ptr_array_index(rules, i);
+        if ( r->mod && 0 == g_strcmp0(r->mod, mod) ) {
+            min = r->level;
+            break;
+        }
+        if ( r->tag && 0 == g_strcmp0(r->tag, tag) ) {
+            min = r->level;
+        }
+    }
+    g_rw_lock_reader_unlock(&lock);
+
+    return (gint) tl >= min;
+}
+
+/*
+ * "lvl SCOPE LEVEL", where SCOPE is *, tag:NAME or mod:NAME and LEVEL
+ * is a level name or reset.
+ */
+int ntl_control(const char* line)
+{
+    gchar**         args = g_strsplit_set(line ? line : "", " \t\r\n", -1);
+    gint            rv = -1;
+    ntl_TraceLevelT tl = ntl_tl_Trace;
+    gboolean        reset = FALSE;
+
+    if ( g_strv_length(args) < 3 || 0 != g_strcmp0(args[0], "lvl") ) {
+        g_strfreev(args);
+        return -1;
+    }
+    reset = 0 == g_strcmp0(args[2], "reset");
+    if ( reset || level_from_string(args[2], &tl) ) {
+        g_rw_lock_writer_lock(&lock);
+        if ( 0 == g_strcmp0(args[1], "*") ) {
+            base = reset ? initial : (gint) tl;
+            rv = 0;
+        } else if ( g_str_has_prefix(args[1], "tag:") ) {
+            set_rule(args[1] + 4, NULL, reset ? NULL : &tl);
+            rv = 0;
+        } else if ( g_str_has_prefix(args[1], "mod:") ) {
+            set_rule(NULL, args[1] + 4, reset ? NULL : &tl);
+            rv = 0;
+        }
+        update_bounds();
+        g_rw_lock_writer_unlock(&lock);
+    }
+    g_strfreev(args);
+    return rv;
+}
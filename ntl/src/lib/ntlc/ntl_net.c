@@ -17,46 +17,318 @@
  */
 #include "ntl_net.h"
 
+#include "ntlu.h"
 #include <glib.h>
 #include <gnet.h>
+#include <errno.h>
 #include <string.h>
+#include <sys/socket.h>
 
 /*
  * A simplifying wrapper around GTcpSocket which posts log traces to
  * the ntl daemon.
  */
 
+typedef struct {
+    GTcpSocket*  sock;
+    GMutex       lock;
+    GString*     rest;  /* the unwritten end of a bulk packet */
+    guint64      rest_mark;
+    gsize        rest_len;
+    ntl_ZWriter* z;     /* NULL unless compressing */
+    GString*     chunk;
+    GString*     line;  /* the packet as it is written */
+} Lane;
+
 struct _s_ntl_net {
-    GTcpSocket* sock;
+    Lane              lanes[ntl_lane_Count];
+    gulong            shed;
+    ntl_net_sent_func on_sent;
+    gboolean          stamps;
+    GThread*          reader;
+    ntl_net_line_func on_line;
 };
 
+static int lane_fd(Lane* l)
+{
+    return g_io_channel_unix_get_fd(gnet_tcp_socket_get_io_channel(l->sock));
+}
+
+/* writes what it can without blocking; -1 on error */
+static gssize write_some(Lane* l, const gchar* data, gsize len)
+{
+    gssize rv = send(lane_fd(l), data, len, MSG_DONTWAIT | MSG_NOSIGNAL);
+    if ( rv < 0 && (EAGAIN == errno || EWOULDBLOCK == errno || EINTR == errno) ) {
+        rv = 0;
+    }
+    return rv;
+}
+
+static void sent(ntl_Net* n, guint64 mark, gsize len)
+{
+    if ( mark && n->on_sent ) {
+        (*n->on_sent)(mark, len);
+    }
+}
+
+/* the parked packet is only handed over once the last of it is written */
+static void rest_written(ntl_Net* n, Lane* l)
+{
+    sent(n, l->rest_mark, l->rest_len);
+    l->rest_mark = 0;
+}
+
+static gboolean flush_rest(ntl_Net* n, Lane* l)
+{
+    gssize wrote = 0;
+
+    if ( 0 == l->rest->len ) {
+        return TRUE;
+    }
+    wrote = write_some(l, l->rest->str, l->rest->len);
+    if ( wrote > 0 ) {
+        g_string_erase(l->rest, 0, wrote);
+        if ( 0 == l->rest->len ) {
+            rest_written(n, l);
+        }
+    }
+    return wrote >= 0;
+}
+
+static gboolean send_urgent(Lane* l, const gchar* data, gsize len)
+{
+    GIOChannel* chan = gnet_tcp_socket_get_io_channel(l->sock);
+    gsize       wrote = 0;
+
+    return G_IO_ERROR_NONE == gnet_io_channel_writen(chan, (gchar*) data, len, &wrote)
+        && wrote == len;
+}
+
+/* where the send stamp goes: after the enqueue stamp, which vtrace
+ * made the last field; NULL if there is none */
+static const gchar* stamp_point(const gchar* pkt, gsize len)
+{
+    const gchar* end = NULL;
+    const gchar* p = NULL;
+
+    if ( len < 2 || 0 != strcmp(pkt + len - 2, " }") ) {
+        return NULL;
+    }
+    end = pkt + len - 2;
+    for ( p = end; p > pkt && g_ascii_isdigit(p[-1]); p-- ) {
+    }
+    if ( p == end || p - pkt < 5 || 0 != strncmp(p - 5, ", lq:", 5) ) {
+        return NULL;
+    }
+    return end;
+}
+
+/* the packet and its newline, stamped with the time if it asks to be */
+static void frame(ntl_Net* n, Lane* l, const gchar* pkt, gsize len)
+{
+    const gchar* end = n->stamps ? stamp_point(pkt, len) : NULL;
+
+    g_string_truncate(l->line, 0);
+    if ( end ) {
+        g_string_append_len(l->line, pkt, end - pkt);
+        g_string_append_printf(l->line, ", ls:%" G_GINT64_FORMAT, g_get_real_time());
+        g_string_append(l->line, end);
+    } else {
+        g_string_append_len(l->line, pkt, len);
+    }
+    g_string_append_c(l->line, '\n');
+}
+
+/* the packet as it goes on the wire */
+static void encode(Lane* l, const gchar** data, gsize* len)
+{
+    if ( l->z ) {
+        g_string_truncate(l->chunk, 0);
+        ntl_zwriter_write(l->z, *data, *len, l->chunk);
+        *data = l->chunk->str;
+        *len = l->chunk->len;
+    }
+}
+
+/* plain is the packet's own length, as its mark knows it */
+static gboolean send_bulk(ntl_Net* n, Lane* l, const gchar* pkt, gsize plain, guint64 mark)
+{
+    const gchar* data = NULL;
+    gsize        len = 0;
+    gssize       wrote = 0;
+
+    if ( !flush_rest(n, l) ) {
+        return FALSE;
+    }
+    if ( l->rest->len > 0 ) {
+        n->shed++;
+        return FALSE;
+    }
+    frame(n, l, pkt, plain);
+    data = l->line->str;
+    len = l->line->len;
+    encode(l, &data, &len);
+    wrote = write_some(l, data, len);
+    if ( wrote < 0 ) {
+        return FALSE;
+    }
+    if ( 0 == wrote ) {
+        n->shed++;
+        if ( l->z ) {
+            /* later chunks must not refer back to this one */
+            ntl_zwriter_reset(l->z);
+        }
+        return FALSE;
+    }
+    if ( (gsize) wrote < len ) {
+        /* a line can't be left half written, so finish it later */
+        g_string_append_len(l->rest, data + wrote, len - wrote);
+        l->rest_mark = mark;
+        l->rest_len = plain;
+    } else {
+        sent(n, mark, plain);
+    }
+    return TRUE;
+}
+
+static gpointer read_lines(gpointer d)
+{
+    ntl_Net* n = (ntl_Net*) d;
+    int      fd = lane_fd(n->lanes + ntl_lane_Urgent);
+    GString* buf = g_string_sized_new(256);
+    gchar    chunk[512];
+    gssize   got = 0;
+
+    while ( (got = recv(fd, chunk, sizeof(chunk), 0)) > 0 || (got < 0 && EINTR == errno) ) {
+        gchar* nl = NULL;
+
+        g_string_append_len(buf, chunk, MAX(got, 0));
+        while ( (nl = memchr(buf->str, '\n', buf->len)) ) {
+            *nl = '\0';
+            (*n->on_line)(buf->str);
+            g_string_erase(buf, 0, nl - buf->str + 1);
+        }
+    }
+    g_string_free(buf, TRUE);
+    return NULL;
+}
+
 ntl_Net* ntl_net_new(void)
 {
-    ntl_Net* rv = g_new(ntl_Net, 1);
+    ntl_Net* rv = g_new0(ntl_Net, 1);
+    guint    i = 0;
+
     gnet_init();
-    {
+    for ( i = 0; i < ntl_lane_Count; i++ ) {
         GInetAddr* a = gnet_inetaddr_new("localhost", 4242);
-        rv->sock = gnet_tcp_socket_new(a);
+        rv->lanes[i].sock = gnet_tcp_socket_new(a);
+        rv->lanes[i].rest = g_string_new(NULL);
+        rv->lanes[i].line = g_string_sized_new(256);
+        g_mutex_init(&rv->lanes[i].lock);
         gnet_inetaddr_delete(a);
     }
     
     return rv;
 }
 
-void ntl_net_send(ntl_Net* n, const char* pkt)
+gboolean ntl_net_send(ntl_Net* n, ntl_LaneT lane, const char* pkt)
+{
+    return ntl_net_send_marked(n, lane, pkt, 0);
+}
+
+void ntl_net_on_sent(ntl_Net* n, ntl_net_sent_func fn)
 {
-    if ( n && n->sock ) {
-        GIOChannel* chan = gnet_tcp_socket_get_io_channel(n->sock);
-        gchar* data = g_strdup_printf("%s\n", pkt);
-        gsize wrote = 0;
-        
-        gnet_io_channel_writen(chan, data, strlen(data), &wrote);
-        g_free(data);
+    if ( n ) {
+        n->on_sent = fn;
+    }
+}
+
+gboolean ntl_net_send_marked(ntl_Net* n, ntl_LaneT lane, const char* pkt, guint64 mark)
+{
+    gboolean rv = FALSE;
+
+    if ( n && n->lanes[lane].sock ) {
+        Lane* l = n->lanes + lane;
+        gsize plain = strlen(pkt);
+
+        g_mutex_lock(&l->lock);
+        if ( ntl_lane_Bulk == lane ) {
+            rv = send_bulk(n, l, pkt, plain, mark);
+        } else {
+            const gchar* wire = NULL;
+            gsize        len = 0;
+
+            frame(n, l, pkt, plain);
+            wire = l->line->str;
+            len = l->line->len;
+            encode(l, &wire, &len);
+            rv = send_urgent(l, wire, len);
+            if ( rv ) {
+                sent(n, mark, plain);
+            }
+        }
+        g_mutex_unlock(&l->lock);
+    }
+    return rv;
+}
+
+gulong ntl_net_shed(const ntl_Net* n)
+{
+    return n ? n->shed : 0;
+}
+
+void ntl_net_listen(ntl_Net* n, ntl_net_line_func fn)
+{
+    if ( n && n->lanes[ntl_lane_Urgent].sock && NULL == n->reader ) {
+        n->on_line = fn;
+        n->reader = g_thread_new("ntl-control", read_lines, n);
+    }
+}
+
+void ntl_net_compress(ntl_Net* n, int level)
+{
+    guint i = 0;
+
+    for ( i = 0; n && level > 0 && i < ntl_lane_Count; i++ ) {
+        Lane* l = n->lanes + i;
+        g_mutex_lock(&l->lock);
+        if ( NULL == l->z ) {
+            l->z = ntl_zwriter_new(level, NULL, 0);
+            l->chunk = g_string_sized_new(256);
+        }
+        g_mutex_unlock(&l->lock);
+    }
+}
+
+void ntl_net_stamp_sends(ntl_Net* n, gboolean on)
+{
+    if ( n ) {
+        n->stamps = on;
     }
 }
 
 void ntl_net_free(ntl_Net* n)
 {
-    gnet_tcp_socket_delete(n->sock);
+    guint i = 0;
+
+    for ( i = 0; i < ntl_lane_Count; i++ ) {
+        Lane* l = n->lanes + i;
+        if ( l->sock && l->rest->len > 0 && send_urgent(l, l->rest->str, l->rest->len) ) {
+            rest_written(n, l);
+        }
+        if ( ntl_lane_Urgent == i && n->reader ) {
+            /* wakes the reader */
+            shutdown(lane_fd(l), SHUT_RDWR);
+            g_thread_join(n->reader);
+        }
+        gnet_tcp_socket_delete(l->sock);
+        g_string_free(l->rest, TRUE);
+        g_string_free(l->line, TRUE);
+        if ( l->z ) {
+            ntl_zwriter_free(l->z);
+            g_string_free(l->chunk, TRUE);
+        }
+        g_mutex_clear(&l->lock);
+    }
     g_free(n);
 }
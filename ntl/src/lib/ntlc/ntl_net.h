@@ -18,14 +18,52 @@
 #ifndef __ntl_net_h_
 #define __ntl_net_h_
 
+#include <glib.h>
+
 /*
  * A simplifying wrapper around GTcpSocket.
  */
 
 typedef struct _s_ntl_net ntl_Net;
 
+/*
+ * Traces travel on one of two connections so that urgent ones never
+ * queue behind bulk ones. Urgent sends block; bulk sends never do, and
+ * shed the packet instead when the connection is backed up.
+ */
+typedef enum {
+    ntl_lane_Urgent,
+    ntl_lane_Bulk,
+    ntl_lane_Count,
+} ntl_LaneT;
+
 ntl_Net* ntl_net_new();
 void     ntl_net_free(ntl_Net* n);
-void     ntl_net_send(ntl_Net* n, const char* pkt);
+/* FALSE if the packet could not be handed to the daemon, as when a
+ * bulk packet is shed */
+gboolean ntl_net_send(ntl_Net* n, ntl_LaneT lane, const char* pkt);
+gulong   ntl_net_shed(const ntl_Net* n);
+
+/*
+ * A packet sent with a non-zero mark is reported to fn, with the
+ * packet's length, once it is wholly written: at once, or when a later
+ * send or ntl_net_free writes the end of it that the socket would not
+ * take. fn is called with the lane locked.
+ */
+typedef void (*ntl_net_sent_func)(guint64 mark, gsize len);
+
+void     ntl_net_on_sent(ntl_Net* n, ntl_net_sent_func fn);
+gboolean ntl_net_send_marked(ntl_Net* n, ntl_LaneT lane, const char* pkt, guint64 mark);
+
+/* control lines sent back by ntld are passed to fn on a reader thread */
+typedef void (*ntl_net_line_func)(const char* line);
+
+void     ntl_net_listen(ntl_Net* n, ntl_net_line_func fn);
+/* from now on, packets go as chunks of one zlib stream per lane (see
+ * ntl_ZWriter in ntlu.h), compressed at level */
+void     ntl_net_compress(ntl_Net* n, int level);
+/* stamps each packet whose last field is its enqueue stamp (lq) with
+ * the time it is written to the socket (ls) */
+void     ntl_net_stamp_sends(ntl_Net* n, gboolean on);
 
 #endif
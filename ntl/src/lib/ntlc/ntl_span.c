@@ -0,0 +1,318 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "ntlc.h"
+
+#include "ntl_trace.h"
+#include "ntlu.h"
+#include <glib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Each thread keeps a stack of open spans and a table of duration
+ * histograms by span name; the tables are registered so a flush can
+ * merge them. A thread only ever contends for its own table's lock
+ * with a flush. When a thread exits its stack is freed and what its
+ * table holds is kept in a shared table until the next flush. Spans
+ * nested deeper than MAX_DEPTH are not timed.
+ *
+ * Flushes are due every flush_ms. Ending a span does one that is due,
+ * and so does a thread of its own, so that the last interval is sent
+ * when no thread is ending spans anymore. Summaries go on the urgent
+ * lane whatever the level rules are, as a flush resets what they
+ * report; records go on the bulk lane, also regardless of the rules.
+ */
+
+/* private */
+#define MAX_DEPTH 64
+
+typedef struct {
+    const char* name;
+    ntl_SpanId  id;
+    guint64     start;
+} Frame;
+
+typedef struct {
+    GMutex      lock;
+    GHashTable* spans; /* name -> ntl_Histogram* of nanoseconds */
+} Table;
+
+typedef struct {
+    Frame         frames[MAX_DEPTH];
+    guint         depth;
+    guint32       seq;
+    unsigned long tid;
+    Table*        table;
+} Stack;
+
+static void free_stack(gpointer d);
+
+static __thread Stack* stack = NULL;
+/* holds the stack too, only so that it is freed on thread exit */
+static GPrivate        stack_key = G_PRIVATE_INIT(free_stack);
+
+static GMutex     registry_lock;
+static GPtrArray* registry = NULL;
+static Table*     retired = NULL; /* of exited threads; registered */
+
+static gint            flush_ms = 10000;
+static gboolean        records = FALSE;
+static volatile gint64 next_flush = 0;
+
+static GMutex   timer_lock;
+static GCond    timer_cond;
+static GThread* timer = NULL;
+static gboolean timer_stop = FALSE;
+
+static guint64 now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (guint64) ts.tv_sec * 1000000000ull + ts.tv_nsec;
+}
+
+static void free_histogram(gpointer d)
+{
+    ntl_histogram_free((ntl_Histogram*) d);
+}
+
+static Table* new_table(void)
+{
+    Table* rv = g_new0(Table, 1);
+    g_mutex_init(&rv->lock);
+    rv->spans = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free_histogram);
+    return rv;
+}
+
+static void merge_table(gpointer k, gpointer v, gpointer d)
+{
+    GHashTable*    merged = (GHashTable*) d;
+    ntl_Histogram* h = (ntl_Histogram*) g_hash_table_lookup(merged, k);
+
+    if ( NULL == h ) {
+        h = ntl_histogram_new();
+        g_hash_table_insert(merged, g_strdup((const gchar*) k), h);
+    }
+    ntl_histogram_merge(h, (ntl_Histogram*) v);
+}
+
+static void free_stack(gpointer d)
+{
+    Stack* s = (Stack*) d;
+
+    g_mutex_lock(&registry_lock);
+    g_ptr_array_remove_fast(registry, s->table);
+    if ( NULL == retired ) {
+        retired = new_table();
+        g_ptr_array_add(registry, retired);
+    }
+    g_mutex_lock(&retired->lock);
+    g_hash_table_foreach(s->table->spans, merge_table, retired->spans);
+    g_mutex_unlock(&retired->lock);
+    g_mutex_unlock(&registry_lock);
+
+    g_hash_table_destroy(s->table->spans);
+    g_mutex_clear(&s->table->lock);
+    g_free(s->table);
+    g_free(s);
+    stack = NULL;
+}
+
+static void maybe_flush(guint64 now);
+
+static gpointer run_timer(gpointer d)
+{
+    g_mutex_lock(&timer_lock);
+    while ( !timer_stop ) {
+        gint64 ms = flush_ms > 0 ? flush_ms : 1000;
+        g_cond_wait_until(&timer_cond, &timer_lock, g_get_monotonic_time() + ms * 1000);
+        if ( !timer_stop ) {
+            g_mutex_unlock(&timer_lock);
+            maybe_flush(now_ns());
+            g_mutex_lock(&timer_lock);
+        }
+    }
+    g_mutex_unlock(&timer_lock);
+    return NULL;
+}
+
+static void start_timer(void)
+{
+    g_mutex_lock(&timer_lock);
+    if ( NULL == timer ) {
+        timer_stop = FALSE;
+        timer = g_thread_new("ntl-spans", run_timer, NULL);
+    }
+    g_mutex_unlock(&timer_lock);
+}
+
+static Stack* this_stack(void)
+{
+    if ( NULL == stack ) {
+        Stack* s = g_new0(Stack, 1);
+        s->tid = ntl_util_gettid();
+        s->table = new_table();
+
+        g_mutex_lock(&registry_lock);
+        if ( NULL == registry ) {
+            registry = g_ptr_array_new();
+        }
+        g_ptr_array_add(registry, s->table);
+        g_mutex_unlock(&registry_lock);
+        if ( 0 == next_flush && flush_ms > 0 ) {
+            next_flush = now_ns() + (guint64) flush_ms * 1000000;
+        }
+        stack = s;
+        g_private_set(&stack_key, s);
+        start_timer();
+    }
+    return stack;
+}
+
+static void record(Table* t, const char* name, guint64 ns)
+{
+    ntl_Histogram* h = NULL;
+
+    g_mutex_lock(&t->lock);
+    h = (ntl_Histogram*) g_hash_table_lookup(t->spans, name);
+    if ( NULL == h ) {
+        h = ntl_histogram_new();
+        g_hash_table_insert(t->spans, g_strdup(name), h);
+    }
+    ntl_histogram_record(h, ns);
+    g_mutex_unlock(&t->lock);
+}
+
+static void send_record(const Frame* f, ntl_SpanId parent, guint64 ns)
+{
+    gint64 start = g_get_real_time() - (gint64) (ns / 1000);
+    ntl_trace_lane(ntl_lane_Bulk, ntl_tl_Trace, "ntl.span.rec", "ntl", f->name,
+        "%s id=%" G_GUINT64_FORMAT " parent=%" G_GUINT64_FORMAT " start=%" G_GINT64_FORMAT " dur=%" G_GUINT64_FORMAT,
+        f->name, f->id, parent, start, ns);
+}
+
+static void maybe_flush(guint64 now)
+{
+    gint64 due = next_flush;
+
+    /* whoever moves the deadline on does the flush */
+    if ( due > 0 && now >= (guint64) due
+      && __sync_bool_compare_and_swap(&next_flush, due, now + (guint64) flush_ms * 1000000) ) {
+        ntl_span_flush();
+    }
+}
+
+static void send_summary(gpointer k, gpointer v, gpointer d)
+{
+    const ntl_Histogram* h = (const ntl_Histogram*) v;
+    ntl_trace_lane(ntl_lane_Urgent, ntl_tl_Trace, "ntl.span", "ntl", (const char*) k,
+        "%s count=%" G_GUINT64_FORMAT " p50=%" G_GUINT64_FORMAT " p99=%" G_GUINT64_FORMAT " max=%" G_GUINT64_FORMAT,
+        (const char*) k, ntl_histogram_count(h),
+        ntl_histogram_percentile(h, 50), ntl_histogram_percentile(h, 99), ntl_histogram_max(h));
+}
+
+/* public */
+ntl_SpanId ntl_span_begin(const char* name)
+{
+    Stack* s = this_stack();
+    Frame* f = NULL;
+
+    if ( s->depth >= MAX_DEPTH ) {
+        s->depth++;
+        return 0;
+    }
+    f = s->frames + s->depth++;
+    f->name = name;
+    f->id = ((guint64) s->tid << 32) | ++s->seq;
+    f->start = now_ns();
+    return f->id;
+}
+
+void ntl_span_end(ntl_SpanId id)
+{
+    Stack*  s = this_stack();
+    guint64 now = now_ns();
+    gint    i = 0;
+
+    if ( 0 == id ) {
+        if ( s->depth > MAX_DEPTH ) {
+            s->depth--;
+        }
+        return;
+    }
+    /* ending a span also ends any open spans inside it */
+    for ( i = (gint) MIN(s->depth, MAX_DEPTH) - 1; i >= 0; i-- ) {
+        if ( s->frames[i].id == id ) {
+            const Frame* f = s->frames + i;
+            guint64      ns = now - f->start;
+
+            record(s->table, f->name, ns);
+            if ( records ) {
+                send_record(f, i > 0 ? s->frames[i - 1].id : 0, ns);
+            }
+            s->depth = i;
+            break;
+        }
+    }
+    maybe_flush(now);
+}
+
+void ntl_span_configure(int ms, int send_records)
+{
+    flush_ms = ms;
+    records = send_records ? TRUE : FALSE;
+    next_flush = ms > 0 ? (gint64) (now_ns() + (guint64) ms * 1000000) : 0;
+    /* to wait for the new interval */
+    g_mutex_lock(&timer_lock);
+    g_cond_signal(&timer_cond);
+    g_mutex_unlock(&timer_lock);
+}
+
+void ntl_span_stop(void)
+{
+    GThread* t = NULL;
+
+    g_mutex_lock(&timer_lock);
+    t = timer;
+    timer = NULL;
+    timer_stop = TRUE;
+    g_cond_signal(&timer_cond);
+    g_mutex_unlock(&timer_lock);
+    if ( t ) {
+        g_thread_join(t);
+    }
+}
+
+void ntl_span_flush(void)
+{
+    GHashTable* merged = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free_histogram);
+    guint       i = 0;
+
+    g_mutex_lock(&registry_lock);
+    for ( i = 0; registry && i < registry->len; i++ ) {
+        Table* t = (Table*) g_ptr_array_index(registry, i);
+        g_mutex_lock(&t->lock);
+        g_hash_table_foreach(t->spans, merge_table, merged);
+        g_hash_table_remove_all(t->spans);
+        g_mutex_unlock(&t->lock);
+    }
+    g_mutex_unlock(&registry_lock);
+
+    g_hash_table_foreach(merged, send_summary, NULL);
+    g_hash_table_destroy(merged);
+}
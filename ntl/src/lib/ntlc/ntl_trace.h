@@ -0,0 +1,34 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef __ntl_trace_h_
+#define __ntl_trace_h_
+
+/*
+ * What the other parts of ntlc need of ntlc.c and of each other.
+ */
+
+#include "ntlc.h"
+#include "ntl_net.h"
+
+/* a trace sent whatever the level rules say, on the given lane */
+void ntl_trace_lane(ntl_LaneT lane, ntl_TraceLevelT tl, const char* tag, const char* mod, const char* fn, const char* fmt, ...) __attribute__ ((format (printf, 6, 7)));
+
+/* stops the thread that flushes span summaries on time, for teardown */
+void ntl_span_stop(void);
+
+#endif
@@ -17,9 +17,12 @@
  */
 #include "ntlc.h"
 
+#include "ntl_crash_ring.h"
 #include "ntl_net.h"
+#include "ntl_trace.h"
 #include <glib.h>
 #include <glib/gprintf.h>
+#include <string.h>
 #include <gnet.h>
 
 /*
@@ -30,6 +33,9 @@ typedef struct _s_ntl_block {
     ntl_send_func      send;
     ntl_timestamp_func timestamp;
     ntl_Net*           net;
+    gboolean           stamps;
+    ntl_CrashRing*     ring;
+    int                zlevel;
 } ntl_Block;
 
 static void internal_send(const char* pkt);
@@ -39,11 +45,14 @@ static ntl_Block block = {
     .send = internal_send,
     .timestamp = internal_timestamp,
     .net = NULL,
+    .stamps = FALSE,
+    .ring = NULL,
+    .zlevel = 0,
 };
 
 static void internal_send(const char* pkt)
 {
-    ntl_net_send(block.net, pkt);
+    ntl_net_send(block.net, ntl_lane_Urgent, pkt);
 }
 
 static void internal_timestamp(time_t* tm, long* millis)
@@ -54,6 +63,24 @@ static void internal_timestamp(time_t* tm, long* millis)
     *millis = tv.tv_usec / 1000;
 }
 
+static void mark_sent(guint64 mark, gsize len)
+{
+    if ( block.ring ) {
+        ntl_crash_ring_mark_sent(block.ring, mark, len);
+    }
+}
+
+static void control_line(const char* line)
+{
+    if ( 0 == strcmp(line, "zok") ) {
+        /* both lanes: ntld inflates chunks on any connection, though
+         * only the urgent one says hello */
+        ntl_net_compress(block.net, block.zlevel);
+    } else {
+        ntl_control(line);
+    }
+}
+
 static void internal_setup(const char* program_name, ntl_send_func send_func, ntl_timestamp_func ts_func)
 {
     g_set_prgname(program_name);
@@ -64,6 +91,15 @@ static void internal_setup(const char* program_name, ntl_send_func send_func, nt
         block.timestamp = ts_func;
     }
     block.net = ntl_net_new();
+    ntl_net_on_sent(block.net, mark_sent);
+    ntl_net_stamp_sends(block.net, block.stamps);
+    {
+        /* identifies the connection that ntld sends control lines to */
+        gchar* hello = g_strdup_printf("{ ctl:hello, pn:%s, pid:%u, z:%d }", g_get_prgname(), getpid(), block.zlevel);
+        ntl_net_send(block.net, ntl_lane_Urgent, hello);
+        g_free(hello);
+    }
+    ntl_net_listen(block.net, control_line);
 }
 
 void ntl_setup_override(const char* program_name, ntl_send_func send_func, ntl_timestamp_func ts_func)
@@ -78,27 +114,198 @@ void ntl_setup(const char* program_name)
 
 void ntl_teardown(void)
 {
+    ntl_span_stop();
+    ntl_span_flush();
+    /* first, as it may finish a packet and mark it sent */
     ntl_net_free(block.net);
+    block.net = NULL;
+    if ( block.ring ) {
+        /* anything unsent is left for ntl_recover */
+        ntl_crash_ring_close(block.ring, !ntl_crash_ring_pending(block.ring));
+        block.ring = NULL;
+    }
 }
 
-void ntl_trace(ntl_TraceLevelT tl, const char* tag, const char* mod, const char* fn, const char *fmt, ...)
+int ntl_setup_crash_ring(const char* path, unsigned long size)
 {
-    gchar* msg = NULL;
-    {
-        va_list args;
-        va_start(args, fmt);
-        msg = g_strdup_vprintf(fmt, args);
-        va_end(args);
+    gchar* fn = NULL;
+    gchar* dir = NULL;
+
+    if ( block.ring ) {
+        return 0;
+    }
+    if ( path ) {
+        fn = g_strdup(path);
+    } else if ( (dir = ntl_crash_ring_dir()) ) {
+        fn = g_strdup_printf("%s/ntl-%s-%u.ring",
+            dir, g_get_prgname() ? g_get_prgname() : "unknown", getpid());
+        g_free(dir);
+    } else {
+        return -1;
+    }
+    block.ring = ntl_crash_ring_create(fn, size ? size : NTL_CRASH_RING_SIZE, g_get_prgname());
+    g_free(fn);
+    return block.ring ? 0 : -1;
+}
+
+/* mark is the packet's crash ring record, or 0; it is marked sent once
+ * the packet is wholly written */
+static gboolean deliver(ntl_LaneT lane, const char* pkt, guint64 mark)
+{
+    /* only our own sender can tell whether a packet went out */
+    if ( internal_send == block.send ) {
+        return ntl_net_send_marked(block.net, lane, pkt, mark);
+    }
+    (*block.send)(pkt);
+    mark_sent(mark, strlen(pkt));
+    return TRUE;
+}
+
+int ntl_forward(const char* pkt)
+{
+    return deliver(ntl_lane_Urgent, pkt, 0) ? 0 : -1;
+}
+
+unsigned long ntl_shed_count(void)
+{
+    return ntl_net_shed(block.net);
+}
+
+void ntl_compress(int level)
+{
+    block.zlevel = CLAMP(level, 0, 9);
+}
+
+static void put_varint(GString* s, guint64 v)
+{
+    while ( v >= 0x80 ) {
+        g_string_append_c(s, (gchar) (v | 0x80));
+        v >>= 7;
+    }
+    g_string_append_c(s, (gchar) v);
+}
+
+static void put_bytes(GString* s, const gchar* b, gsize len)
+{
+    put_varint(s, len);
+    g_string_append_len(s, b, len);
+}
+
+/*
+ * Fields travel as base64 under the kv key: a version byte, then for
+ * each field its type byte, its key and its value. Strings and keys
+ * are a varint length and bytes, ints a zigzag varint, doubles 8
+ * little-endian bytes of IEEE 754 and bools one byte. See
+ * ntl_fields.c in ntll for the decoder.
+ */
+static void append_fields(GString* pkt, const ntl_Field* fields, int n_fields)
+{
+    GString* b = g_string_sized_new(64);
+    gchar*   enc = NULL;
+    int      i = 0;
+
+    g_string_append_c(b, 1);
+    for ( i = 0; i < n_fields; i++ ) {
+        const ntl_Field* f = fields + i;
+        g_string_append_c(b, (gchar) f->type);
+        put_bytes(b, f->key, strlen(f->key));
+        switch (f->type) {
+            case ntl_ft_Int:
+                put_varint(b, ((guint64) f->v.i << 1) ^ (guint64) (f->v.i >> 63));
+                break;
+
+            case ntl_ft_Double:
+            {
+                guint64 bits = 0;
+                gint    j = 0;
+                memcpy(&bits, &f->v.d, sizeof(bits));
+                for ( j = 0; j < 8; j++ ) {
+                    g_string_append_c(b, (gchar) (bits >> (8 * j)));
+                }
+                break;
+            }
+
+            case ntl_ft_String:
+                put_bytes(b, f->v.s ? f->v.s : "", f->v.s ? strlen(f->v.s) : 0);
+                break;
+
+            case ntl_ft_Bool:
+                g_string_append_c(b, f->v.b ? 1 : 0);
+                break;
+        }
     }
+    enc = g_base64_encode((const guchar*) b->str, b->len);
+    g_string_append_printf(pkt, ", kv:%s", enc);
+    g_free(enc);
+    g_string_free(b, TRUE);
+}
+
+static void vtrace(ntl_LaneT lane, ntl_TraceLevelT tl, const char* tag, const char* mod, const char* fn, const ntl_Field* fields, int n_fields, const char* fmt, va_list args)
+{
+    gint64    enqueued = block.stamps ? g_get_real_time() : 0;
+    gchar*    msg = g_strdup_vprintf(fmt, args);
+    GString*  pkt = g_string_sized_new(256);
+    time_t    st = 0;
+    long      millis = 0;
 
-    time_t st = 0;
-    long millis = 0;
     (*block.timestamp)(&st, &millis);
-    gchar* pkt = g_strdup_printf(
-        "{ pn:%s, pid:%u, tid:%lu, tl:%u, tm:%lu, millis:%lu, tag:%s, mod:%s, fn:%s, msg:%s }",
+    g_string_printf(pkt,
+        "{ pn:%s, pid:%u, tid:%lu, tl:%u, tm:%lu, millis:%lu, tag:%s, mod:%s, fn:%s, msg:%s",
         g_get_prgname(), getpid(), ntl_util_gettid(), (guint) tl, st, millis, tag, mod, fn, msg);
     g_free(msg);
-    (*block.send)(pkt);
-    g_free(pkt);
+    /* after msg, so that they win over any lookalikes in it */
+    if ( n_fields > 0 ) {
+        append_fields(pkt, fields, n_fields);
+    }
+    if ( enqueued ) {
+        /* last, for ntl_net to follow with ls as it writes the packet */
+        g_string_append_printf(pkt, ", lq:%" G_GINT64_FORMAT, enqueued);
+    }
+    g_string_append(pkt, " }");
+    deliver(lane, pkt->str, block.ring ? ntl_crash_ring_append(block.ring, pkt->str, pkt->len) : 0);
+    g_string_free(pkt, TRUE);
+}
+
+static ntl_LaneT lane_of(ntl_TraceLevelT tl)
+{
+    return tl >= ntl_tl_Warn ? ntl_lane_Urgent : ntl_lane_Bulk;
+}
+
+void ntl_stamp_latency(int enabled)
+{
+    block.stamps = enabled ? TRUE : FALSE;
+    ntl_net_stamp_sends(block.net, block.stamps);
+}
+
+void ntl_trace(ntl_TraceLevelT tl, const char* tag, const char* mod, const char* fn, const char *fmt, ...)
+{
+    va_list args;
+
+    if ( !ntl_enabled(tl, tag, mod) ) {
+        return;
+    }
+    va_start(args, fmt);
+    vtrace(lane_of(tl), tl, tag, mod, fn, NULL, 0, fmt, args);
+    va_end(args);
 }
 
+void ntl_trace_fields(ntl_TraceLevelT tl, const char* tag, const char* mod, const char* fn, const ntl_Field* fields, int n_fields, const char* fmt, ...)
+{
+    va_list args;
+
+    if ( !ntl_enabled(tl, tag, mod) ) {
+        return;
+    }
+    va_start(args, fmt);
+    vtrace(lane_of(tl), tl, tag, mod, fn, fields, n_fields, fmt, args);
+    va_end(args);
+}
+
+void ntl_trace_lane(ntl_LaneT lane, ntl_TraceLevelT tl, const char* tag, const char* mod, const char* fn, const char* fmt, ...)
+{
+    va_list args;
+
+    va_start(args, fmt);
+    vtrace(lane, tl, tag, mod, fn, NULL, 0, fmt, args);
+    va_end(args);
+}
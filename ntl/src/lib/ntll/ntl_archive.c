@@ -0,0 +1,611 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "ntl_archive.h"
+#include "ntll.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/*
+ * The archive layout:
+ *
+ *   file   := "NTLA" version:u8 pad:u8[3] block*
+ *   block  := "NTLB" length:u32le stats columns messages
+ *   stats  := rows min_ms (max_ms - min_ms) level_mask dict{4}
+ *   dict   := count (len bytes){count}
+ *   columns, messages := raw_len z_len zlib-bytes
+ *
+ * All integers other than the block length are LEB128 varints. The
+ * columns section holds, row by row per column: timestamps as
+ * zigzagged delta-of-delta milliseconds, pids, tids, levels (one byte
+ * each), the prog/tag/mod/fn dictionary indexes and message lengths.
+ * Messages are concatenated into a separately compressed section so
+ * a reader filtering on metadata never inflates them.
+ */
+
+/* private */
+static const gchar file_magic[4] = { 'N', 'T', 'L', 'A' };
+static const gchar block_magic[4] = { 'N', 'T', 'L', 'B' };
+#define ARCHIVE_VERSION 1
+#define FILE_HEADER_LEN 8
+
+/* zlib cannot inflate past about 1032:1; sizes beyond it are corrupt */
+#define MAX_INFLATE_RATIO 1032
+/* a row takes at least a byte in each of its nine columns */
+#define ROW_MIN_BYTES     (5 + ntl_ad_Count)
+
+typedef struct {
+    GHashTable* index;  /* value -> position + 1 */
+    GPtrArray*  values;
+} Dict;
+
+struct _s_ntl_archive_writer {
+    int          fd;
+    unsigned int block_rows;
+    GArray*      times;  /* gint64 ms */
+    GArray*      pids;
+    GArray*      tids;
+    GByteArray*  levels;
+    GArray*      refs[ntl_ad_Count];
+    Dict         dicts[ntl_ad_Count];
+    GArray*      msg_lens;
+    GString*     msgs;
+};
+
+struct _s_ntl_archive_reader {
+    const guchar*    data;
+    gsize            len;
+    gsize            pos;     /* start of the next block */
+    gsize            current; /* start of the current block */
+    const guchar*    body;    /* columns and messages of the current block */
+    const guchar*    end;
+    ntl_ArchiveStats stats;
+};
+
+typedef struct {
+    const guchar* p;
+    const guchar* end;
+    gboolean      ok;
+} Cursor;
+
+static void put_varint(GString* s, guint64 v)
+{
+    while ( v >= 0x80 ) {
+        g_string_append_c(s, (gchar) (v | 0x80));
+        v >>= 7;
+    }
+    g_string_append_c(s, (gchar) v);
+}
+
+static guint64 zigzag(gint64 v)
+{
+    return ((guint64) v << 1) ^ (guint64) (v >> 63);
+}
+
+static gint64 unzigzag(guint64 v)
+{
+    return (gint64) (v >> 1) ^ -(gint64) (v & 1);
+}
+
+static guint64 get_varint(Cursor* c)
+{
+    guint64 rv = 0;
+    guint   shift = 0;
+
+    while ( c->ok ) {
+        guchar b = 0;
+        if ( c->p >= c->end || shift > 63 ) {
+            c->ok = FALSE;
+            break;
+        }
+        b = *c->p++;
+        rv |= (guint64) (b & 0x7f) << shift;
+        if ( !(b & 0x80) ) {
+            return rv;
+        }
+        shift += 7;
+    }
+    return 0;
+}
+
+static const guchar* get_bytes(Cursor* c, gsize n)
+{
+    const guchar* rv = c->p;
+    if ( !c->ok || (gsize) (c->end - c->p) < n ) {
+        c->ok = FALSE;
+        return NULL;
+    }
+    c->p += n;
+    return rv;
+}
+
+static void put_compressed(GString* s, const gchar* data, gsize len)
+{
+    uLongf zlen = compressBound(len);
+    gchar* z = g_malloc(zlen);
+
+    compress2((Bytef*) z, &zlen, (const Bytef*) data, len, Z_DEFAULT_COMPRESSION);
+    put_varint(s, len);
+    put_varint(s, zlen);
+    g_string_append_len(s, z, zlen);
+    g_free(z);
+}
+
+static gchar* get_compressed(Cursor* c, gsize* len)
+{
+    guint64       raw = get_varint(c);
+    guint64       zlen = get_varint(c);
+    const guchar* z = NULL;
+    gchar*        rv = NULL;
+    uLongf        out = raw;
+
+    /* checked before anything is allocated on the strength of them */
+    if ( zlen > (guint64) (c->end - c->p) || raw > (zlen + 1) * MAX_INFLATE_RATIO ) {
+        c->ok = FALSE;
+    }
+    z = get_bytes(c, zlen);
+    if ( !c->ok ) {
+        return NULL;
+    }
+    rv = g_malloc(raw + 1);
+    if ( Z_OK != uncompress((Bytef*) rv, &out, z, zlen) || out != raw ) {
+        g_free(rv);
+        c->ok = FALSE;
+        return NULL;
+    }
+    rv[raw] = '\0';
+    *len = raw;
+    return rv;
+}
+
+static gboolean write_all(int fd, const gchar* data, gsize len)
+{
+    while ( len > 0 ) {
+        ssize_t n = write(fd, data, len);
+        if ( n < 0 ) {
+            if ( EINTR == errno ) {
+                continue;
+            }
+            return FALSE;
+        }
+        data += n;
+        len -= n;
+    }
+    return TRUE;
+}
+
+static guint dict_ref(Dict* d, const gchar* v)
+{
+    guint pos = 0;
+
+    if ( NULL == v ) {
+        v = "";
+    }
+    pos = GPOINTER_TO_UINT(g_hash_table_lookup(d->index, v));
+    if ( 0 == pos ) {
+        gchar* copy = g_strdup(v);
+        g_ptr_array_add(d->values, copy);
+        pos = d->values->len;
+        g_hash_table_insert(d->index, copy, GUINT_TO_POINTER(pos));
+    }
+    return pos - 1;
+}
+
+static void reset_block(ntl_ArchiveWriter* w)
+{
+    guint i = 0;
+
+    g_array_set_size(w->times, 0);
+    g_array_set_size(w->pids, 0);
+    g_array_set_size(w->tids, 0);
+    g_byte_array_set_size(w->levels, 0);
+    g_array_set_size(w->msg_lens, 0);
+    g_string_truncate(w->msgs, 0);
+    for ( i = 0; i < ntl_ad_Count; i++ ) {
+        g_array_set_size(w->refs[i], 0);
+        g_hash_table_remove_all(w->dicts[i].index);
+        g_ptr_array_set_size(w->dicts[i].values, 0);
+    }
+}
+
+static void encode_block(ntl_ArchiveWriter* w, GString* out)
+{
+    GString* cols = g_string_sized_new(w->times->len * 16);
+    GString* body = g_string_sized_new(w->msgs->len / 4 + w->times->len * 4);
+    gint64   min_ms = G_MAXINT64;
+    gint64   max_ms = G_MININT64;
+    gint64   prev = 0;
+    gint64   prev_delta = 0;
+    guint    mask = 0;
+    guint    i = 0;
+    guint    d = 0;
+    guint32  len = 0;
+
+    for ( i = 0; i < w->times->len; i++ ) {
+        gint64 t = g_array_index(w->times, gint64, i);
+        gint64 delta = t - prev;
+        min_ms = MIN(min_ms, t);
+        max_ms = MAX(max_ms, t);
+        /* the first row stores the absolute time, the second a delta */
+        put_varint(cols, zigzag(i < 2 ? delta : delta - prev_delta));
+        prev = t;
+        prev_delta = delta;
+    }
+    for ( i = 0; i < w->pids->len; i++ ) {
+        put_varint(cols, g_array_index(w->pids, guint, i));
+    }
+    for ( i = 0; i < w->tids->len; i++ ) {
+        put_varint(cols, g_array_index(w->tids, guint, i));
+    }
+    for ( i = 0; i < w->levels->len; i++ ) {
+        mask |= 1u << MIN(w->levels->data[i], 31);
+    }
+    g_string_append_len(cols, (const gchar*) w->levels->data, w->levels->len);
+    for ( d = 0; d < ntl_ad_Count; d++ ) {
+        for ( i = 0; i < w->refs[d]->len; i++ ) {
+            put_varint(cols, g_array_index(w->refs[d], guint, i));
+        }
+    }
+    for ( i = 0; i < w->msg_lens->len; i++ ) {
+        put_varint(cols, g_array_index(w->msg_lens, guint, i));
+    }
+
+    put_varint(body, w->times->len);
+    put_varint(body, zigzag(min_ms));
+    put_varint(body, max_ms - min_ms);
+    put_varint(body, mask);
+    for ( d = 0; d < ntl_ad_Count; d++ ) {
+        put_varint(body, w->dicts[d].values->len);
+        for ( i = 0; i < w->dicts[d].values->len; i++ ) {
+            const gchar* v = (const gchar*) g_ptr_array_index(w->dicts[d].values, i);
+            put_varint(body, strlen(v));
+            g_string_append(body, v);
+        }
+    }
+    put_compressed(body, cols->str, cols->len);
+    put_compressed(body, w->msgs->str, w->msgs->len);
+
+    len = GUINT32_TO_LE(body->len);
+    g_string_append_len(out, block_magic, 4);
+    g_string_append_len(out, (const gchar*) &len, 4);
+    g_string_append_len(out, body->str, body->len);
+
+    g_string_free(cols, TRUE);
+    g_string_free(body, TRUE);
+}
+
+static void free_stats(ntl_ArchiveStats* s)
+{
+    guint d = 0;
+    for ( d = 0; d < ntl_ad_Count; d++ ) {
+        g_ptr_array_set_size(s->dict[d], 0);
+    }
+}
+
+/* public */
+ntl_ArchiveWriter* ntl_archive_writer_new(const char* fn, unsigned int block_rows)
+{
+    ntl_ArchiveWriter* rv = NULL;
+    struct stat        st;
+    int                fd = open(fn, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    guint              d = 0;
+
+    if ( fd < 0 ) {
+        return NULL;
+    }
+    if ( 0 == fstat(fd, &st) && 0 == st.st_size ) {
+        gchar hdr[FILE_HEADER_LEN] = { 0 };
+        memcpy(hdr, file_magic, 4);
+        hdr[4] = ARCHIVE_VERSION;
+        write_all(fd, hdr, sizeof(hdr));
+    }
+
+    rv = g_new(ntl_ArchiveWriter, 1);
+    rv->fd = fd;
+    rv->block_rows = block_rows ? block_rows : 4096;
+    rv->times = g_array_sized_new(FALSE, FALSE, sizeof(gint64), rv->block_rows);
+    rv->pids = g_array_sized_new(FALSE, FALSE, sizeof(guint), rv->block_rows);
+    rv->tids = g_array_sized_new(FALSE, FALSE, sizeof(guint), rv->block_rows);
+    rv->levels = g_byte_array_sized_new(rv->block_rows);
+    rv->msg_lens = g_array_sized_new(FALSE, FALSE, sizeof(guint), rv->block_rows);
+    rv->msgs = g_string_sized_new(rv->block_rows * 64);
+    for ( d = 0; d < ntl_ad_Count; d++ ) {
+        rv->refs[d] = g_array_sized_new(FALSE, FALSE, sizeof(guint), rv->block_rows);
+        rv->dicts[d].values = g_ptr_array_new_with_free_func(g_free);
+        rv->dicts[d].index = g_hash_table_new(g_str_hash, g_str_equal);
+    }
+    return rv;
+}
+
+gboolean ntl_archive_writer_append(ntl_ArchiveWriter* w, const ntl_Packet* pkt)
+{
+    gint64       t = (gint64) pkt->time * 1000 + pkt->millis;
+    guint        lvl = (guint) pkt->lvl;
+    guint        msg_len = pkt->msg ? strlen(pkt->msg) : 0;
+    guint        ref = 0;
+    const gchar* values[ntl_ad_Count] = { pkt->prog, pkt->tag, pkt->mod, pkt->fn };
+    guint        d = 0;
+    guint8       lvl_byte = (guint8) MIN(lvl, 255);
+
+    g_array_append_val(w->times, t);
+    g_array_append_val(w->pids, pkt->pid);
+    g_array_append_val(w->tids, pkt->tid);
+    g_byte_array_append(w->levels, &lvl_byte, 1);
+    for ( d = 0; d < ntl_ad_Count; d++ ) {
+        ref = dict_ref(&w->dicts[d], values[d]);
+        g_array_append_val(w->refs[d], ref);
+    }
+    g_array_append_val(w->msg_lens, msg_len);
+    g_string_append_len(w->msgs, pkt->msg, msg_len);
+
+    if ( w->times->len >= w->block_rows ) {
+        return ntl_archive_writer_flush(w);
+    }
+    return TRUE;
+}
+
+gboolean ntl_archive_writer_flush(ntl_ArchiveWriter* w)
+{
+    GString* out = NULL;
+    gboolean rv = TRUE;
+
+    if ( 0 == w->times->len ) {
+        return TRUE;
+    }
+    out = g_string_sized_new(w->msgs->len / 2);
+    encode_block(w, out);
+    rv = write_all(w->fd, out->str, out->len);
+    g_string_free(out, TRUE);
+    reset_block(w);
+    return rv;
+}
+
+void ntl_archive_writer_free(ntl_ArchiveWriter* w)
+{
+    if ( w ) {
+        guint d = 0;
+
+        ntl_archive_writer_flush(w);
+        close(w->fd);
+        g_array_free(w->times, TRUE);
+        g_array_free(w->pids, TRUE);
+        g_array_free(w->tids, TRUE);
+        g_byte_array_free(w->levels, TRUE);
+        g_array_free(w->msg_lens, TRUE);
+        g_string_free(w->msgs, TRUE);
+        for ( d = 0; d < ntl_ad_Count; d++ ) {
+            g_array_free(w->refs[d], TRUE);
+            g_hash_table_destroy(w->dicts[d].index);
+            g_ptr_array_free(w->dicts[d].values, TRUE);
+        }
+        g_free(w);
+    }
+}
+
+gboolean ntl_archive_is_archive(const char* data, gsize len)
+{
+    return len >= FILE_HEADER_LEN && 0 == memcmp(data, file_magic, 4) && ARCHIVE_VERSION == data[4];
+}
+
+ntl_ArchiveReader* ntl_archive_reader_new(const char* data, gsize len)
+{
+    ntl_ArchiveReader* rv = NULL;
+    guint              d = 0;
+
+    if ( !ntl_archive_is_archive(data, len) ) {
+        return NULL;
+    }
+    rv = g_new0(ntl_ArchiveReader, 1);
+    rv->data = (const guchar*) data;
+    rv->len = len;
+    rv->pos = FILE_HEADER_LEN;
+    rv->current = FILE_HEADER_LEN;
+    for ( d = 0; d < ntl_ad_Count; d++ ) {
+        rv->stats.dict[d] = g_ptr_array_new_with_free_func(g_free);
+    }
+    return rv;
+}
+
+const ntl_ArchiveStats* ntl_archive_reader_next(ntl_ArchiveReader* r)
+{
+    Cursor  c;
+    guint32 len = 0;
+    guint64 rows = 0;
+    guint   d = 0;
+
+    free_stats(&r->stats);
+    r->body = NULL;
+    r->current = r->pos;
+    if ( r->len - r->pos < 8 || 0 != memcmp(r->data + r->pos, block_magic, 4) ) {
+        return NULL;
+    }
+    memcpy(&len, r->data + r->pos + 4, 4);
+    len = GUINT32_FROM_LE(len);
+    if ( r->len - r->pos - 8 < len ) {
+        /* a block cut short by a crash mid-write; stop here */
+        return NULL;
+    }
+
+    c.p = r->data + r->pos + 8;
+    c.end = c.p + len;
+    c.ok = TRUE;
+    r->pos += 8 + len;
+
+    rows = get_varint(&c);
+    if ( rows > G_MAXUINT ) {
+        c.ok = FALSE;
+    }
+    r->stats.rows = rows;
+    r->stats.min_ms = unzigzag(get_varint(&c));
+    r->stats.max_ms = r->stats.min_ms + get_varint(&c);
+    r->stats.level_mask = get_varint(&c);
+    for ( d = 0; d < ntl_ad_Count && c.ok; d++ ) {
+        guint64 n = get_varint(&c);
+        guint64 i = 0;
+        for ( i = 0; i < n && c.ok; i++ ) {
+            gsize         vlen = get_varint(&c);
+            const guchar* v = get_bytes(&c, vlen);
+            if ( v ) {
+                g_ptr_array_add(r->stats.dict[d], g_strndup((const gchar*) v, vlen));
+            }
+        }
+    }
+    if ( !c.ok ) {
+        return NULL;
+    }
+    r->body = c.p;
+    r->end = c.end;
+    return &r->stats;
+}
+
+gsize ntl_archive_reader_tell(const ntl_ArchiveReader* r)
+{
+    /* the offset of the block last returned by ntl_archive_reader_next() */
+    return r->current;
+}
+
+void ntl_archive_reader_seek(ntl_ArchiveReader* r, gsize pos)
+{
+    free_stats(&r->stats);
+    r->body = NULL;
+    r->pos = MAX(MIN(pos, r->len), FILE_HEADER_LEN);
+}
+
+GPtrArray* ntl_archive_reader_decode(ntl_ArchiveReader* r)
+{
+    GPtrArray* rv = NULL;
+    Cursor     c;
+    Cursor     cols;
+    gchar*     col_data = NULL;
+    gchar*     msgs = NULL;
+    gsize      col_len = 0;
+    gsize      msgs_len = 0;
+    gsize      msg_pos = 0;
+    guint      rows = r->stats.rows;
+    guint      i = 0;
+    guint      d = 0;
+    gint64     prev = 0;
+    gint64     prev_delta = 0;
+
+    if ( NULL == r->body ) {
+        return NULL;
+    }
+    c.p = r->body;
+    c.end = r->end;
+    c.ok = TRUE;
+    col_data = get_compressed(&c, &col_len);
+    msgs = get_compressed(&c, &msgs_len);
+    if ( c.ok && rows > col_len / ROW_MIN_BYTES ) {
+        /* more rows than the columns could hold */
+        c.ok = FALSE;
+    }
+    if ( !c.ok ) {
+        g_free(col_data);
+        g_free(msgs);
+        return NULL;
+    }
+
+    rv = g_ptr_array_new_with_free_func((GDestroyNotify) ntl_packet_free);
+    for ( i = 0; i < rows; i++ ) {
+        g_ptr_array_add(rv, g_new0(ntl_Packet, 1));
+    }
+
+    cols.p = (const guchar*) col_data;
+    cols.end = cols.p + col_len;
+    cols.ok = TRUE;
+    for ( i = 0; i < rows; i++ ) {
+        ntl_Packet* pkt = (ntl_Packet*) g_ptr_array_index(rv, i);
+        gint64      v = unzigzag(get_varint(&cols));
+        gint64      delta = i < 2 ? v : prev_delta + v;
+        gint64      t = prev + delta;
+        pkt->time = t / 1000;
+        pkt->millis = t % 1000;
+        prev = t;
+        prev_delta = delta;
+    }
+    for ( i = 0; i < rows; i++ ) {
+        ((ntl_Packet*) g_ptr_array_index(rv, i))->pid = get_varint(&cols);
+    }
+    for ( i = 0; i < rows; i++ ) {
+        ((ntl_Packet*) g_ptr_array_index(rv, i))->tid = get_varint(&cols);
+    }
+    {
+        const guchar* lvls = get_bytes(&cols, rows);
+        for ( i = 0; i < rows && lvls; i++ ) {
+            ((ntl_Packet*) g_ptr_array_index(rv, i))->lvl = (ntl_TraceLevelT) lvls[i];
+        }
+    }
+    for ( d = 0; d < ntl_ad_Count; d++ ) {
+        GPtrArray* dict = r->stats.dict[d];
+        for ( i = 0; i < rows; i++ ) {
+            ntl_Packet*  pkt = (ntl_Packet*) g_ptr_array_index(rv, i);
+            guint64      ref = get_varint(&cols);
+            gchar*       v = g_strdup(ref < dict->len ? (const gchar*) g_ptr_array_index(dict, ref) : "");
+            switch (d) {
+                case ntl_ad_Prog: pkt->prog = v; break;
+                case ntl_ad_Tag:  pkt->tag = v; break;
+                case ntl_ad_Mod:  pkt->mod = v; break;
+                default:          pkt->fn = v;
+            }
+        }
+    }
+    for ( i = 0; i < rows; i++ ) {
+        ntl_Packet* pkt = (ntl_Packet*) g_ptr_array_index(rv, i);
+        gsize       len = get_varint(&cols);
+        if ( msg_pos + len > msgs_len ) {
+            cols.ok = FALSE;
+            len = 0;
+        }
+        pkt->msg = g_strndup(msgs + msg_pos, len);
+        msg_pos += len;
+    }
+
+    g_free(col_data);
+    g_free(msgs);
+    if ( !cols.ok ) {
+        g_ptr_array_free(rv, TRUE);
+        return NULL;
+    }
+    return rv;
+}
+
+void ntl_archive_reader_free(ntl_ArchiveReader* r)
+{
+    if ( r ) {
+        guint d = 0;
+        for ( d = 0; d < ntl_ad_Count; d++ ) {
+            g_ptr_array_free(r->stats.dict[d], TRUE);
+        }
+        g_free(r);
+    }
+}
+
+gboolean ntl_archive_stats_has(const ntl_ArchiveStats* s, ntl_ArchiveDictT d, const char* value)
+{
+    guint i = 0;
+    for ( i = 0; i < s->dict[d]->len; i++ ) {
+        if ( 0 == strcmp(value, (const gchar*) g_ptr_array_index(s->dict[d], i)) ) {
+            return TRUE;
+        }
+    }
+    return FALSE;
+}
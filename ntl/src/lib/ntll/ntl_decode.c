@@ -17,7 +17,10 @@
  */
 #include "ntll.h"
 
+#include "ntl_fields.h"
+#include "ntlu.h"
 #include <glib.h>
+#include <string.h>
 
 /*
  * Procedures for decoding the trace strings sent across the network.
@@ -27,6 +30,9 @@
 static gchar pat[] = "(\\w+)\\:([^\\,|^\\}]+)";
 static GRegex* re = NULL;
 
+/* the wire keys of the stamps carried in a packet */
+static const gchar* stamp_keys[] = { "lq", "ls", "li", "le" };
+
 void free_string(gpointer d)
 {
     g_free((gchar*) d);
@@ -69,10 +75,84 @@ ntl_Packet* ntl_packet_decode(const char* pkt)
     rv->mod = g_strdup(g_hash_table_lookup(ht, "mod"));
     rv->fn = g_strdup(g_hash_table_lookup(ht, "fn"));
     rv->msg = g_strchomp(g_strdup(g_hash_table_lookup(ht, "msg")));
+    rv->host = g_strdup(g_hash_table_lookup(ht, "hn"));
+    if ( rv->host ) {
+        g_strchomp(rv->host);
+    }
+    rv->fields = ntl_fields_decode(g_hash_table_lookup(ht, "kv"));
+    rv->repeats = g_hash_table_lookup(ht, "rp") ? atol(g_hash_table_lookup(ht, "rp")) : 0;
+    rv->late = g_hash_table_lookup(ht, "late") ? atoi(g_hash_table_lookup(ht, "late")) : 0;
+    {
+        guint i = 0;
+        for ( i = 0; i < ntl_ts_Count; i++ ) {
+            const gchar* v = i < G_N_ELEMENTS(stamp_keys) ? g_hash_table_lookup(ht, stamp_keys[i]) : NULL;
+            rv->stamps[i] = v ? g_ascii_strtoll(v, NULL, 10) : 0;
+        }
+    }
     g_hash_table_destroy(ht);
     return rv;
 }
 
+gboolean ntl_span_stats_parse(const ntl_Packet* pkt, ntl_SpanStats* s)
+{
+    const gchar* keys[] = { " count=", " p50=", " p99=", " max=" };
+    guint64*     vals[] = { &s->count, &s->p50, &s->p99, &s->max };
+    guint        i = 0;
+
+    if ( 0 != g_strcmp0(pkt->tag, "ntl.span") || NULL == pkt->fn || NULL == pkt->msg ) {
+        return FALSE;
+    }
+    for ( i = 0; i < G_N_ELEMENTS(keys); i++ ) {
+        const gchar* p = strstr(pkt->msg, keys[i]);
+        if ( NULL == p ) {
+            return FALSE;
+        }
+        *vals[i] = g_ascii_strtoull(p + strlen(keys[i]), NULL, 10);
+    }
+    s->name = pkt->fn;
+    return TRUE;
+}
+
+gboolean ntl_rollup_parse(const ntl_Packet* pkt, ntl_RollupStats* s)
+{
+    const gchar* keys[] = { "count=", " bytes=", " secs=" };
+    guint64      vals[G_N_ELEMENTS(keys)];
+    guint        i = 0;
+
+    if ( 0 != g_strcmp0(pkt->tag, NTL_ROLLUP_TAG) || NULL == pkt->msg ) {
+        return FALSE;
+    }
+    for ( i = 0; i < G_N_ELEMENTS(keys); i++ ) {
+        const gchar* p = strstr(pkt->msg, keys[i]);
+        if ( NULL == p ) {
+            return FALSE;
+        }
+        vals[i] = g_ascii_strtoull(p + strlen(keys[i]), NULL, 10);
+    }
+    s->prog = pkt->prog;
+    s->tag = pkt->mod;
+    s->lvl = pkt->lvl;
+    s->start = pkt->time;
+    s->count = vals[0];
+    s->bytes = vals[1];
+    s->secs = (guint) vals[2];
+    return TRUE;
+}
+
+ntl_Packet* ntl_packet_copy(const ntl_Packet* pkt)
+{
+    ntl_Packet* rv = g_new(ntl_Packet, 1);
+    *rv = *pkt;
+    rv->prog = g_strdup(pkt->prog);
+    rv->tag = g_strdup(pkt->tag);
+    rv->mod = g_strdup(pkt->mod);
+    rv->fn = g_strdup(pkt->fn);
+    rv->msg = g_strdup(pkt->msg);
+    rv->host = g_strdup(pkt->host);
+    rv->fields = ntl_fields_copy(pkt->fields);
+    return rv;
+}
+
 void ntl_packet_free(ntl_Packet* pkt)
 {
     g_free(pkt->prog);
@@ -80,6 +160,8 @@ void ntl_packet_free(ntl_Packet* pkt)
     g_free(pkt->mod);
     g_free(pkt->fn);
     g_free(pkt->msg);
+    g_free(pkt->host);
+    ntl_fields_free(pkt->fields);
     g_free(pkt);
 }
 
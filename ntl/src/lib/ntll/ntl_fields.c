@@ -0,0 +1,283 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "ntl_fields.h"
+
+#include <string.h>
+
+/*
+ * Decodes the binary fields written by append_fields() in ntlc.c: a
+ * version byte, then for each field its type byte, its key and its
+ * value. Keys and strings are a varint length and bytes, ints a zigzag
+ * varint, doubles 8 little-endian bytes and bools one byte. Anything
+ * malformed drops the whole set.
+ */
+
+/* private */
+typedef struct {
+    gchar*         key;
+    ntl_FieldTypeT type;
+    union {
+        gint64   i;
+        gdouble  d;
+        gchar*   s;
+        gboolean b;
+    } v;
+} Field;
+
+struct _s_ntl_fields {
+    GArray* fields;
+};
+
+typedef struct {
+    const guchar* p;
+    const guchar* end;
+    gboolean      ok;
+} Reader;
+
+static guint64 get_varint(Reader* r)
+{
+    guint64 rv = 0;
+    guint   shift = 0;
+
+    while ( r->ok ) {
+        if ( r->p >= r->end || shift > 63 ) {
+            r->ok = FALSE;
+            break;
+        }
+        rv |= (guint64) (*r->p & 0x7f) << shift;
+        shift += 7;
+        if ( 0 == (*r->p++ & 0x80) ) {
+            break;
+        }
+    }
+    return rv;
+}
+
+static gchar* get_bytes(Reader* r)
+{
+    guint64 len = get_varint(r);
+
+    if ( !r->ok || len > (guint64) (r->end - r->p) ) {
+        r->ok = FALSE;
+        return NULL;
+    }
+    r->p += len;
+    return g_strndup((const gchar*) r->p - len, len);
+}
+
+static void clear_field(Field* f)
+{
+    g_free(f->key);
+    if ( ntl_ft_String == f->type ) {
+        g_free(f->v.s);
+    }
+}
+
+static const Field* find(const ntl_Packet* pkt, const char* key)
+{
+    guint i = 0;
+
+    if ( NULL == pkt->fields ) {
+        return NULL;
+    }
+    for ( i = 0; i < pkt->fields->fields->len; i++ ) {
+        const Field* f = &g_array_index(pkt->fields->fields, Field, i);
+        if ( 0 == strcmp(f->key, key) ) {
+            return f;
+        }
+    }
+    return NULL;
+}
+
+/* public */
+ntl_Fields* ntl_fields_decode(const gchar* b64)
+{
+    ntl_Fields* rv = NULL;
+    guchar*     data = NULL;
+    gsize       len = 0;
+    Reader      r;
+
+    if ( NULL == b64 ) {
+        return NULL;
+    }
+    data = g_base64_decode(b64, &len);
+    r.p = data;
+    r.end = data + len;
+    r.ok = len > 0 && 1 == data[0];
+    r.p++;
+
+    rv = g_new(ntl_Fields, 1);
+    rv->fields = g_array_new(FALSE, FALSE, sizeof(Field));
+    while ( r.ok && r.p < r.end ) {
+        Field f;
+
+        memset(&f, 0, sizeof(f));
+        f.type = (ntl_FieldTypeT) *r.p++;
+        f.key = get_bytes(&r);
+        switch (f.type) {
+            case ntl_ft_Int:
+            {
+                guint64 z = get_varint(&r);
+                f.v.i = (gint64) (z >> 1) ^ -(gint64) (z & 1);
+                break;
+            }
+
+            case ntl_ft_Double:
+            {
+                guint64 bits = 0;
+                gint    j = 0;
+                if ( r.end - r.p < 8 ) {
+                    r.ok = FALSE;
+                    break;
+                }
+                for ( j = 0; j < 8; j++ ) {
+                    bits |= (guint64) *r.p++ << (8 * j);
+                }
+                memcpy(&f.v.d, &bits, sizeof(bits));
+                break;
+            }
+
+            case ntl_ft_String:
+                f.v.s = get_bytes(&r);
+                break;
+
+            case ntl_ft_Bool:
+                if ( r.p >= r.end ) {
+                    r.ok = FALSE;
+                    break;
+                }
+                f.v.b = *r.p++ ? TRUE : FALSE;
+                break;
+
+            default:
+                r.ok = FALSE;
+        }
+        if ( r.ok ) {
+            g_array_append_val(rv->fields, f);
+        } else {
+            clear_field(&f);
+        }
+    }
+    g_free(data);
+    if ( !r.ok ) {
+        ntl_fields_free(rv);
+        rv = NULL;
+    }
+    return rv;
+}
+
+ntl_Fields* ntl_fields_copy(const ntl_Fields* f)
+{
+    ntl_Fields* rv = NULL;
+    guint       i = 0;
+
+    if ( NULL == f ) {
+        return NULL;
+    }
+    rv = g_new(ntl_Fields, 1);
+    rv->fields = g_array_sized_new(FALSE, FALSE, sizeof(Field), f->fields->len);
+    for ( i = 0; i < f->fields->len; i++ ) {
+        Field c = g_array_index(f->fields, Field, i);
+        c.key = g_strdup(c.key);
+        if ( ntl_ft_String == c.type ) {
+            c.v.s = g_strdup(c.v.s);
+        }
+        g_array_append_val(rv->fields, c);
+    }
+    return rv;
+}
+
+void ntl_fields_free(ntl_Fields* f)
+{
+    guint i = 0;
+
+    if ( NULL == f ) {
+        return;
+    }
+    for ( i = 0; i < f->fields->len; i++ ) {
+        clear_field(&g_array_index(f->fields, Field, i));
+    }
+    g_array_free(f->fields, TRUE);
+    g_free(f);
+}
+
+guint ntl_packet_field_count(const ntl_Packet* pkt)
+{
+    return pkt->fields ? pkt->fields->fields->len : 0;
+}
+
+const char* ntl_packet_field_key(const ntl_Packet* pkt, guint i)
+{
+    if ( i >= ntl_packet_field_count(pkt) ) {
+        return NULL;
+    }
+    return g_array_index(pkt->fields->fields, Field, i).key;
+}
+
+gboolean ntl_packet_field_type(const ntl_Packet* pkt, const char* key, ntl_FieldTypeT* type)
+{
+    const Field* f = find(pkt, key);
+    if ( f ) {
+        *type = f->type;
+    }
+    return NULL != f;
+}
+
+gboolean ntl_packet_field_int(const ntl_Packet* pkt, const char* key, gint64* v)
+{
+    const Field* f = find(pkt, key);
+    if ( NULL == f || ntl_ft_Int != f->type ) {
+        return FALSE;
+    }
+    *v = f->v.i;
+    return TRUE;
+}
+
+gboolean ntl_packet_field_double(const ntl_Packet* pkt, const char* key, gdouble* v)
+{
+    const Field* f = find(pkt, key);
+    if ( f && ntl_ft_Double == f->type ) {
+        *v = f->v.d;
+        return TRUE;
+    }
+    if ( f && ntl_ft_Int == f->type ) {
+        *v = (gdouble) f->v.i;
+        return TRUE;
+    }
+    return FALSE;
+}
+
+gboolean ntl_packet_field_string(const ntl_Packet* pkt, const char* key, const char** v)
+{
+    const Field* f = find(pkt, key);
+    if ( NULL == f || ntl_ft_String != f->type ) {
+        return FALSE;
+    }
+    *v = f->v.s;
+    return TRUE;
+}
+
+gboolean ntl_packet_field_bool(const ntl_Packet* pkt, const char* key, gboolean* v)
+{
+    const Field* f = find(pkt, key);
+    if ( NULL == f || ntl_ft_Bool != f->type ) {
+        return FALSE;
+    }
+    *v = f->v.b;
+    return TRUE;
+}
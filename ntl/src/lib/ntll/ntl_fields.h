@@ -0,0 +1,31 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#ifndef __ntl_fields_h_
+#define __ntl_fields_h_
+
+#include "ntll.h"
+
+/*
+ * The typed fields of a packet, decoded from the kv key of a trace.
+ */
+
+ntl_Fields* ntl_fields_decode(const gchar* b64);
+ntl_Fields* ntl_fields_copy(const ntl_Fields* f);
+void        ntl_fields_free(ntl_Fields* f);
+
+#endif
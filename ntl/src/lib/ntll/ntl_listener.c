@@ -17,20 +17,154 @@
  */
 #include "ntll.h"
 
+#include "ntlu.h"
 #include <glib.h>
 #include <gnet.h>
+#include <string.h>
 
 /*
  * The implementation of a listener.
  */
 
 /* private */
+
+/* the hops measured between two stamps of a packet */
+typedef struct {
+    const gchar*    name;
+    ntl_TraceStampT from;
+    ntl_TraceStampT to;
+} Hop;
+
+static const Hop hops[] = {
+    { "client", ntl_ts_Enqueue, ntl_ts_Send },
+    { "inbound", ntl_ts_Send, ntl_ts_Ingress },
+    { "daemon", ntl_ts_Ingress, ntl_ts_Egress },
+    { "outbound", ntl_ts_Egress, ntl_ts_Deliver },
+    { "total", ntl_ts_Enqueue, ntl_ts_Deliver },
+};
+
+#define N_HOPS G_N_ELEMENTS(hops)
+
+/* how often a shared ring is checked, and how many lines are taken
+ * from it at a time, so a busy ring cannot starve the main loop; an
+ * idle ring is checked less often, but never so rarely that the first
+ * trace after a quiet spell is later than over loopback TCP */
+#define SHM_POLL_MS     5
+#define SHM_POLL_MAX_MS 20
+#define SHM_READ_MAX    4096
+
 struct _s_ntl_listener {
     GConn*                conn;
+    guint                 subscription;
     ntl_listener_pkt_func pkt_func;
     gpointer              data;
+    ntl_Histogram*        latency[N_HOPS];
+    ntl_ZReader*          z;     /* if it asked for compression */
+    GString*              lines; /* those of the last chunk */
+    gchar*                shm_path; /* instead of conn */
+    ntl_ShmRing*          shm;
+    guint                 poll_id;
+    guint                 poll_ms;
 };
 
+static void record_latency(ntl_Listener* l, ntl_Packet* pkt)
+{
+    guint i = 0;
+
+    if ( 0 == pkt->stamps[ntl_ts_Enqueue] ) {
+        return;
+    }
+    pkt->stamps[ntl_ts_Deliver] = g_get_real_time();
+    for ( i = 0; i < N_HOPS; i++ ) {
+        long long from = pkt->stamps[hops[i].from];
+        long long to = pkt->stamps[hops[i].to];
+        if ( from && to ) {
+            /* clocks are shared on one host, but not across hosts */
+            ntl_histogram_record(l->latency[i], to > from ? to - from : 0);
+        }
+    }
+}
+
+static void deliver(ntl_Listener* l, const gchar* ln)
+{
+    ntl_Packet* pkt = ntl_packet_decode(ln);
+    record_latency(l, pkt);
+    (*l->pkt_func)(pkt, l->data);
+    ntl_packet_free(pkt);
+}
+
+static void deliver_chunk(ntl_Listener* l, const gchar* ln)
+{
+    gchar* p = NULL;
+    gchar* nl = NULL;
+
+    g_string_truncate(l->lines, 0);
+    if ( !ntl_zreader_read(l->z, ln, l->lines) ) {
+        return;
+    }
+    for ( p = l->lines->str; (nl = strchr(p, '\n')); p = nl + 1 ) {
+        *nl = '\0';
+        if ( *p ) {
+            deliver(l, p);
+        }
+    }
+}
+
+static void deliver_shm(const gchar* ln, gsize len, gpointer d)
+{
+    deliver((ntl_Listener*) d, ln);
+}
+
+static gboolean poll_shm(gpointer d);
+
+static void schedule_shm(ntl_Listener* l, guint ms)
+{
+    l->poll_ms = ms;
+    l->poll_id = g_timeout_add(ms, poll_shm, l);
+}
+
+static gboolean poll_shm(gpointer d)
+{
+    ntl_Listener* l = (ntl_Listener*) d;
+    guint         n = 0;
+    guint         ms = 0;
+
+    if ( l->shm && !ntl_shm_ring_valid(l->shm) ) {
+        ntl_shm_ring_free(l->shm);
+        l->shm = NULL;
+    }
+    if ( NULL == l->shm ) {
+        /* ntld may not be up yet, or may have made the ring anew */
+        l->shm = ntl_shm_ring_attach(l->shm_path);
+    }
+    if ( l->shm ) {
+        n = ntl_shm_ring_read(l->shm, SHM_READ_MAX, deliver_shm, l);
+    }
+    /* wake less and less often while the ring is idle, and at the
+     * usual rate again as soon as it is not */
+    ms = n > 0 ? SHM_POLL_MS : MIN(l->poll_ms * 2, SHM_POLL_MAX_MS);
+    if ( ms == l->poll_ms ) {
+        return TRUE;
+    }
+    schedule_shm(l, ms);
+    return FALSE;
+}
+
+static ntl_Listener* new_listener(guint subscription, ntl_listener_pkt_func pkt_func, gpointer data)
+{
+    ntl_Listener* rv = g_new0(ntl_Listener, 1);
+    guint         i = 0;
+    rv->subscription = subscription;
+    rv->pkt_func = pkt_func;
+    rv->data = data;
+    for ( i = 0; i < N_HOPS; i++ ) {
+        rv->latency[i] = ntl_histogram_new();
+    }
+    rv->z = subscription & ntl_sub_Compress ? ntl_zreader_new(NULL, 0) : NULL;
+    rv->lines = g_string_sized_new(4096);
+    return rv;
+}
+
 static void activity(GConn* conn, GConnEvent* event, gpointer ud)
 {
     ntl_Listener* l = (ntl_Listener*) ud;
@@ -39,15 +173,26 @@ static void activity(GConn* conn, GConnEvent* event, gpointer ud)
         case GNET_CONN_CONNECT:
         {
             gnet_conn_timeout(conn, 0);	/* reset timeout */
+            if ( l->subscription ) {
+                gchar* sub = g_strdup_printf("sub%s%s%s%s\n",
+                    l->subscription & ntl_sub_Dedup ? " dedup" : "",
+                    l->subscription & ntl_sub_Rollup ? " rollup" : "",
+                    l->subscription & ntl_sub_Compress ? " z" : "",
+                    l->subscription & ntl_sub_Order ? " order" : "");
+                gnet_conn_write(conn, sub, strlen(sub));
+                g_free(sub);
+            }
             gnet_conn_readline(conn);
         }
         break;
         
         case GNET_CONN_READ:
         {
-            ntl_Packet* pkt = ntl_packet_decode(event->buffer);
-            (*l->pkt_func)(pkt, l->data);
-            ntl_packet_free(pkt);
+            if ( l->z && NTL_ZCHUNK(event->buffer) ) {
+                deliver_chunk(l, event->buffer);
+            } else {
+                deliver(l, event->buffer);
+            }
             gnet_conn_readline(conn);
             
             break;
@@ -66,9 +211,12 @@ static void activity(GConn* conn, GConnEvent* event, gpointer ud)
 /* public */
 ntl_Listener* ntl_listener_new(const char* host, ntl_listener_pkt_func pkt_func, gpointer data)
 {
-    ntl_Listener* rv = g_new(ntl_Listener, 1);
-    rv->pkt_func = pkt_func;
-    rv->data = data;
+    return ntl_listener_new_full(host, 0, pkt_func, data);
+}
+
+ntl_Listener* ntl_listener_new_full(const char* host, guint subscription, ntl_listener_pkt_func pkt_func, gpointer data)
+{
+    ntl_Listener* rv = new_listener(subscription, pkt_func, data);
     rv->conn = gnet_conn_new(host, 4243, activity, rv);
     gnet_conn_set_watch_error(rv->conn, TRUE);
     gnet_conn_timeout(rv->conn, 30000);
@@ -76,20 +224,73 @@ ntl_Listener* ntl_listener_new(const char* host, ntl_listener_pkt_func pkt_func,
     return rv;
 }
 
+ntl_Listener* ntl_listener_new_shm(const char* path, ntl_listener_pkt_func pkt_func, gpointer data)
+{
+    ntl_Listener* rv = new_listener(0, pkt_func, data);
+    rv->shm_path = g_strdup(path);
+    rv->shm = ntl_shm_ring_attach(path);
+    schedule_shm(rv, SHM_POLL_MS);
+    return rv;
+}
+
 void ntl_listener_free(ntl_Listener* l)
 {
     if ( l ) {
-        gnet_conn_disconnect(l->conn);
-        gnet_conn_unref(l->conn);
+        guint i = 0;
+        if ( l->conn ) {
+            gnet_conn_disconnect(l->conn);
+            gnet_conn_unref(l->conn);
+        }
+        if ( l->poll_id ) {
+            g_source_remove(l->poll_id);
+        }
+        ntl_shm_ring_free(l->shm);
+        g_free(l->shm_path);
+        for ( i = 0; i < N_HOPS; i++ ) {
+            ntl_histogram_free(l->latency[i]);
+        }
+        ntl_zreader_free(l->z);
+        g_string_free(l->lines, TRUE);
         g_free(l);
     }
 }
 
+void ntl_listener_latency_dump(const ntl_Listener* l, GString* out)
+{
+    guint i = 0;
+
+    for ( i = 0; i < N_HOPS; i++ ) {
+        ntl_histogram_dump(l->latency[i], hops[i].name, out);
+    }
+}
+
+void ntl_listener_latency_reset(ntl_Listener* l)
+{
+    guint i = 0;
+
+    for ( i = 0; i < N_HOPS; i++ ) {
+        ntl_histogram_reset(l->latency[i]);
+    }
+}
+
 gchar* ntl_listener_default_time_format(const ntl_Packet* pkt)
 {
-    struct tm*  tm = localtime(&(pkt->time));
+    GString* rv = g_string_sized_new(32);
+    ntl_listener_default_time_append(rv, pkt);
+    return g_string_free(rv, FALSE);
+}
+
+void ntl_listener_default_time_append(GString* s, const ntl_Packet* pkt)
+{
+    struct tm   tm;
     char        dt_buf[64];
+    gsize       len = 0;
 
-    strftime(dt_buf, 64, "%Y-%m-%d %H:%M:%S", tm);
-    return g_strdup_printf("%s.%03lu", dt_buf, pkt->millis);
+    localtime_r(&(pkt->time), &tm);
+    len = strftime(dt_buf, 64, "%Y-%m-%d %H:%M:%S", &tm);
+    dt_buf[len++] = '.';
+    dt_buf[len++] = '0' + (pkt->millis / 100) % 10;
+    dt_buf[len++] = '0' + (pkt->millis / 10) % 10;
+    dt_buf[len++] = '0' + pkt->millis % 10;
+    g_string_append_len(s, dt_buf, len);
 }
@@ -0,0 +1,450 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "ntll.h"
+
+#include <glib.h>
+#include <math.h>
+#include <string.h>
+
+/*
+ * Output templates. A template such as
+ *
+ *     [%{tag}] [%{level}]: %{msg}
+ *
+ * is compiled once into a flat list of operations (copy a literal,
+ * append a field) so that rendering a packet is a straight walk over
+ * that list with no format-string parsing. A field may name an
+ * escaping mode, as in %{msg:json}, which is how the built-in
+ * JSON-lines and logfmt encoders are expressed. %{fields} renders a
+ * packet's typed fields, as " key=value" pairs or, escaped for JSON,
+ * as further members of an object. %{host} is the host an ntld relayed
+ * a packet from, and empty for local ones.
+ */
+
+/* private */
+typedef enum {
+    op_Literal,
+    op_Prog,
+    op_Pid,
+    op_Tid,
+    op_Level,
+    op_Lvl,
+    op_Time,
+    op_Epoch,
+    op_Millis,
+    op_Tag,
+    op_Mod,
+    op_Fn,
+    op_Msg,
+    op_Host,
+    op_Fields,
+} OpT;
+
+typedef enum {
+    esc_None,
+    esc_Json,
+    esc_Logfmt,
+} EscapeT;
+
+typedef struct {
+    OpT     op;
+    EscapeT esc;
+    gchar*  lit;
+    gsize   len;
+} Op;
+
+struct _s_ntl_template {
+    GArray* ops;
+};
+
+static const struct {
+    const gchar* name;
+    OpT          op;
+} fields[] = {
+    { "prog", op_Prog },
+    { "pid", op_Pid },
+    { "tid", op_Tid },
+    { "level", op_Level },
+    { "lvl", op_Lvl },
+    { "time", op_Time },
+    { "epoch_ms", op_Epoch },
+    { "millis", op_Millis },
+    { "tag", op_Tag },
+    { "mod", op_Mod },
+    { "fn", op_Fn },
+    { "msg", op_Msg },
+    { "host", op_Host },
+    { "fields", op_Fields },
+};
+
+static const gchar json_spec[] =
+    "{\"time\":\"%{time}\",\"ts\":%{epoch_ms},\"level\":\"%{lvl}\","
+    "\"prog\":\"%{prog:json}\",\"pid\":%{pid},\"tid\":%{tid},"
+    "\"tag\":\"%{tag:json}\",\"mod\":\"%{mod:json}\",\"fn\":\"%{fn:json}\","
+    "\"msg\":\"%{msg:json}\"%{fields:json}}";
+
+static const gchar logfmt_spec[] =
+    "time=\"%{time}\" level=%{lvl} prog=%{prog:logfmt} pid=%{pid} tid=%{tid} "
+    "tag=%{tag:logfmt} mod=%{mod:logfmt} fn=%{fn:logfmt} msg=%{msg:logfmt}%{fields:logfmt}";
+
+static const gchar hex[] = "0123456789abcdef";
+
+static void add_literal(GArray* ops, const gchar* s, gsize len)
+{
+    if ( 0 == len ) {
+        return;
+    }
+    if ( ops->len > 0 && op_Literal == g_array_index(ops, Op, ops->len - 1).op ) {
+        /* merge adjacent literals so rendering copies them in one go */
+        Op*    prev = &g_array_index(ops, Op, ops->len - 1);
+        gchar* lit = g_malloc(prev->len + len + 1);
+        memcpy(lit, prev->lit, prev->len);
+        memcpy(lit + prev->len, s, len);
+        lit[prev->len + len] = '\0';
+        g_free(prev->lit);
+        prev->lit = lit;
+        prev->len += len;
+    } else {
+        Op o = { op_Literal, esc_None, g_strndup(s, len), len };
+        g_array_append_val(ops, o);
+    }
+}
+
+static gboolean add_field(GArray* ops, const gchar* s, gsize len)
+{
+    const gchar* colon = memchr(s, ':', len);
+    gsize        name_len = colon ? (gsize) (colon - s) : len;
+    Op           o = { op_Literal, esc_None, NULL, 0 };
+    guint        i = 0;
+
+    for ( i = 0; i < G_N_ELEMENTS(fields); i++ ) {
+        if ( strlen(fields[i].name) == name_len && 0 == strncmp(fields[i].name, s, name_len) ) {
+            o.op = fields[i].op;
+            break;
+        }
+    }
+    if ( i == G_N_ELEMENTS(fields) ) {
+        return FALSE;
+    }
+
+    if ( colon ) {
+        gsize esc_len = len - name_len - 1;
+        if ( 4 == esc_len && 0 == strncmp(colon + 1, "json", 4) ) {
+            o.esc = esc_Json;
+        } else if ( 6 == esc_len && 0 == strncmp(colon + 1, "logfmt", 6) ) {
+            o.esc = esc_Logfmt;
+        } else {
+            return FALSE;
+        }
+    }
+    g_array_append_val(ops, o);
+    return TRUE;
+}
+
+static void append_uint(GString* s, guint64 v)
+{
+    gchar  buf[24];
+    gchar* p = buf + sizeof(buf);
+
+    do {
+        *--p = '0' + v % 10;
+        v /= 10;
+    } while ( v );
+    g_string_append_len(s, p, buf + sizeof(buf) - p);
+}
+
+static void append_json(GString* s, const gchar* str)
+{
+    const gchar* run = str;
+    const gchar* p = str;
+
+    for ( ; *p; p++ ) {
+        guchar c = (guchar) *p;
+        if ( c >= 0x20 && c != '"' && c != '\\' ) {
+            continue;
+        }
+        g_string_append_len(s, run, p - run);
+        run = p + 1;
+        switch (c) {
+            case '"':  g_string_append_len(s, "\\\"", 2); break;
+            case '\\': g_string_append_len(s, "\\\\", 2); break;
+            case '\n': g_string_append_len(s, "\\n", 2); break;
+            case '\r': g_string_append_len(s, "\\r", 2); break;
+            case '\t': g_string_append_len(s, "\\t", 2); break;
+            default:
+                g_string_append_len(s, "\\u00", 4);
+                g_string_append_c(s, hex[c >> 4]);
+                g_string_append_c(s, hex[c & 0xf]);
+        }
+    }
+    g_string_append_len(s, run, p - run);
+}
+
+static void append_logfmt(GString* s, const gchar* str)
+{
+    const gchar* p = str;
+
+    for ( ; *p; p++ ) {
+        guchar c = (guchar) *p;
+        if ( c <= ' ' || c == '=' || c == '"' || c == '\\' ) {
+            break;
+        }
+    }
+    if ( *p || p == str ) {
+        /* the value needs quoting; the quoted form follows JSON's rules */
+        g_string_append_c(s, '"');
+        append_json(s, str);
+        g_string_append_c(s, '"');
+    } else {
+        g_string_append_len(s, str, p - str);
+    }
+}
+
+static void append_value(GString* s, const gchar* str, EscapeT esc)
+{
+    if ( NULL == str ) {
+        str = "(null)";
+    }
+    switch (esc) {
+        case esc_Json:
+            append_json(s, str);
+            break;
+
+        case esc_Logfmt:
+            append_logfmt(s, str);
+            break;
+
+        default:
+            g_string_append(s, str);
+    }
+}
+
+static void append_field_value(GString* s, const ntl_Packet* pkt, const gchar* key, EscapeT esc)
+{
+    ntl_FieldTypeT type = ntl_ft_Int;
+    gint64         i = 0;
+    gdouble        d = 0;
+    const gchar*   str = NULL;
+    gboolean       b = FALSE;
+    gchar          buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+    ntl_packet_field_type(pkt, key, &type);
+    switch (type) {
+        case ntl_ft_Int:
+            ntl_packet_field_int(pkt, key, &i);
+            if ( i < 0 ) {
+                g_string_append_c(s, '-');
+            }
+            append_uint(s, i < 0 ? -(guint64) i : (guint64) i);
+            break;
+
+        case ntl_ft_Double:
+            ntl_packet_field_double(pkt, key, &d);
+            if ( esc_Json == esc && (isnan(d) || isinf(d)) ) {
+                g_string_append(s, "null");
+            } else {
+                g_string_append(s, g_ascii_dtostr(buf, sizeof(buf), d));
+            }
+            break;
+
+        case ntl_ft_String:
+            ntl_packet_field_string(pkt, key, &str);
+            if ( esc_Json == esc ) {
+                g_string_append_c(s, '"');
+                append_json(s, str);
+                g_string_append_c(s, '"');
+            } else {
+                append_value(s, str, esc);
+            }
+            break;
+
+        case ntl_ft_Bool:
+            ntl_packet_field_bool(pkt, key, &b);
+            g_string_append(s, b ? "true" : "false");
+            break;
+    }
+}
+
+static void append_fields(GString* s, const ntl_Packet* pkt, EscapeT esc)
+{
+    guint i = 0;
+
+    for ( i = 0; i < ntl_packet_field_count(pkt); i++ ) {
+        const gchar* key = ntl_packet_field_key(pkt, i);
+        if ( esc_Json == esc ) {
+            g_string_append_len(s, ",\"", 2);
+            append_json(s, key);
+            g_string_append_len(s, "\":", 2);
+        } else {
+            g_string_append_c(s, ' ');
+            append_value(s, key, esc);
+            g_string_append_c(s, '=');
+        }
+        append_field_value(s, pkt, key, esc);
+    }
+}
+
+static const gchar* level_name(ntl_TraceLevelT lvl)
+{
+    switch (lvl) {
+        case ntl_tl_Trace:
+            return "trace";
+
+        case ntl_tl_Debug:
+            return "debug";
+
+        case ntl_tl_Warn:
+            return "warn";
+
+        case ntl_tl_Error:
+            return "error";
+
+        default:
+            ;
+    }
+
+    return "unknown";
+}
+
+/* public */
+ntl_Template* ntl_template_compile(const char* spec)
+{
+    ntl_Template* rv = g_new(ntl_Template, 1);
+    const gchar*  run = spec;
+    const gchar*  p = spec;
+
+    rv->ops = g_array_new(FALSE, FALSE, sizeof(Op));
+    while ( *p ) {
+        if ( '%' != *p ) {
+            p++;
+            continue;
+        }
+        add_literal(rv->ops, run, p - run);
+        if ( '%' == p[1] ) {
+            add_literal(rv->ops, "%", 1);
+            p += 2;
+        } else if ( '{' == p[1] ) {
+            const gchar* end = strchr(p + 2, '}');
+            if ( NULL == end || !add_field(rv->ops, p + 2, end - (p + 2)) ) {
+                ntl_template_free(rv);
+                return NULL;
+            }
+            p = end + 1;
+        } else {
+            ntl_template_free(rv);
+            return NULL;
+        }
+        run = p;
+    }
+    add_literal(rv->ops, run, p - run);
+    add_literal(rv->ops, "\n", 1);
+
+    return rv;
+}
+
+ntl_Template* ntl_template_json(void)
+{
+    return ntl_template_compile(json_spec);
+}
+
+ntl_Template* ntl_template_logfmt(void)
+{
+    return ntl_template_compile(logfmt_spec);
+}
+
+void ntl_template_render(const ntl_Template* t, GString* s, const ntl_Packet* pkt)
+{
+    guint i = 0;
+
+    for ( i = 0; i < t->ops->len; i++ ) {
+        const Op* o = &g_array_index(t->ops, Op, i);
+        switch (o->op) {
+            case op_Literal:
+                g_string_append_len(s, o->lit, o->len);
+                break;
+
+            case op_Prog:
+                append_value(s, pkt->prog, o->esc);
+                break;
+
+            case op_Pid:
+                append_uint(s, pkt->pid);
+                break;
+
+            case op_Tid:
+                append_uint(s, pkt->tid);
+                break;
+
+            case op_Level:
+                g_string_append(s, ntl_level_to_string(pkt->lvl));
+                break;
+
+            case op_Lvl:
+                g_string_append(s, level_name(pkt->lvl));
+                break;
+
+            case op_Time:
+                ntl_listener_default_time_append(s, pkt);
+                break;
+
+            case op_Epoch:
+                append_uint(s, (guint64) pkt->time * 1000 + pkt->millis);
+                break;
+
+            case op_Millis:
+                append_uint(s, pkt->millis);
+                break;
+
+            case op_Tag:
+                append_value(s, pkt->tag, o->esc);
+                break;
+
+            case op_Mod:
+                append_value(s, pkt->mod, o->esc);
+                break;
+
+            case op_Fn:
+                append_value(s, pkt->fn, o->esc);
+                break;
+
+            case op_Msg:
+                append_value(s, pkt->msg, o->esc);
+                break;
+
+            case op_Host:
+                append_value(s, pkt->host ? pkt->host : "", o->esc);
+                break;
+
+            case op_Fields:
+                append_fields(s, pkt, o->esc);
+                break;
+        }
+    }
+}
+
+void ntl_template_free(ntl_Template* t)
+{
+    if ( t ) {
+        guint i = 0;
+        for ( i = 0; i < t->ops->len; i++ ) {
+            g_free(g_array_index(t->ops, Op, i).lit);
+        }
+        g_array_free(t->ops, TRUE);
+        g_free(t);
+    }
+}
@@ -0,0 +1,507 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "ntl_trigram.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <zlib.h>
+
+/*
+ * Only the message of a line is indexed: everything after its first
+ * "]: ", which is never later than where the message of the default
+ * text template starts. The file is a magic, the length of the body
+ * and the zlib compressed body. The body is varints throughout: the
+ * segment length, the block count and each block's length, then the
+ * trigram count and, in trigram order, each trigram (as a delta from
+ * the one before), the number of blocks it occurs in and the length
+ * and bytes of that list of blocks, again delta coded.
+ */
+
+/* private */
+#define MAGIC     "NTLTRI1\n"
+#define MAGIC_LEN 8
+#define N_GRAMS   (1 << 24)
+
+typedef struct {
+    guint32  last;  /* the last block added */
+    guint32  count;
+    GString* ids;
+} Posting;
+
+struct _s_ntl_trigram_builder {
+    gsize       block_size;
+    gsize       offset;     /* bytes added so far */
+    gsize       block_start;
+    GArray*     ends;       /* gsize, where each closed block ends */
+    guint8*     seen;       /* a bit per trigram in the open block */
+    GArray*     grams;      /* guint32, the trigrams set in seen */
+    GHashTable* postings;   /* trigram -> Posting* */
+    guint       sep;        /* how much of "]: " the line has matched */
+    gboolean    in_msg;
+    guint32     window;     /* the last three bytes of the message */
+    guint       window_len;
+};
+
+struct _s_ntl_trigram_index {
+    gchar*   body;
+    gsize    len;
+    guint    n_blocks;
+    gsize*   ends;
+    guint    n_grams;
+    guint32* grams;
+    guint32* counts;
+    gsize*   postings;     /* where each trigram's blocks start in body */
+};
+
+typedef struct {
+    const guchar* p;
+    const guchar* end;
+    gboolean      ok;
+} Cursor;
+
+static void put_varint(GString* s, guint64 v)
+{
+    while ( v >= 0x80 ) {
+        g_string_append_c(s, (gchar) (v | 0x80));
+        v >>= 7;
+    }
+    g_string_append_c(s, (gchar) v);
+}
+
+static guint64 get_varint(Cursor* c)
+{
+    guint64 rv = 0;
+    guint   shift = 0;
+
+    while ( c->ok ) {
+        guchar b = 0;
+        if ( c->p >= c->end || shift > 63 ) {
+            c->ok = FALSE;
+            break;
+        }
+        b = *c->p++;
+        rv |= (guint64) (b & 0x7f) << shift;
+        if ( !(b & 0x80) ) {
+            return rv;
+        }
+        shift += 7;
+    }
+    return 0;
+}
+
+static guint32 trigram(const char* s)
+{
+    return ((guint32) (guchar) s[0] << 16) | ((guint32) (guchar) s[1] << 8) | (guchar) s[2];
+}
+
+static void free_posting(gpointer d)
+{
+    Posting* p = (Posting*) d;
+    g_string_free(p->ids, TRUE);
+    g_free(p);
+}
+
+static void note(ntl_TrigramBuilder* b, guint32 g)
+{
+    guint8 bit = 1 << (g & 7);
+
+    if ( !(b->seen[g >> 3] & bit) ) {
+        b->seen[g >> 3] |= bit;
+        g_array_append_val(b->grams, g);
+    }
+}
+
+static void close_block(ntl_TrigramBuilder* b)
+{
+    guint32 id = b->ends->len;
+    guint   i = 0;
+
+    for ( i = 0; i < b->grams->len; i++ ) {
+        guint32  g = g_array_index(b->grams, guint32, i);
+        Posting* p = (Posting*) g_hash_table_lookup(b->postings, GUINT_TO_POINTER(g));
+
+        if ( NULL == p ) {
+            p = g_new0(Posting, 1);
+            p->ids = g_string_sized_new(16);
+            g_hash_table_insert(b->postings, GUINT_TO_POINTER(g), p);
+        }
+        put_varint(p->ids, id - p->last);
+        p->last = id;
+        p->count++;
+        b->seen[g >> 3] = 0;
+    }
+    g_array_set_size(b->grams, 0);
+    g_array_append_val(b->ends, b->offset);
+    b->block_start = b->offset;
+}
+
+static gint compare_grams(gconstpointer a, gconstpointer b)
+{
+    guint32 x = *((const guint32*) a);
+    guint32 y = *((const guint32*) b);
+    return (x > y) - (x < y);
+}
+
+static gint find_gram(const ntl_TrigramIndex* idx, guint32 g)
+{
+    guint lo = 0;
+    guint hi = idx->n_grams;
+
+    while ( lo < hi ) {
+        guint mid = lo + (hi - lo) / 2;
+        if ( idx->grams[mid] < g ) {
+            lo = mid + 1;
+        } else {
+            hi = mid;
+        }
+    }
+    return (lo < idx->n_grams && idx->grams[lo] == g) ? (gint) lo : -1;
+}
+
+static gboolean parse(ntl_TrigramIndex* idx, gsize source_len)
+{
+    Cursor  c = { (const guchar*) idx->body, (const guchar*) idx->body + idx->len, TRUE };
+    guint32 g = 0;
+    gsize   end = 0;
+    guint   i = 0;
+
+    if ( get_varint(&c) != source_len ) {
+        return FALSE;
+    }
+    idx->n_blocks = get_varint(&c);
+    if ( !c.ok || idx->n_blocks > idx->len ) {
+        return FALSE;
+    }
+    idx->ends = g_new(gsize, idx->n_blocks);
+    for ( i = 0; i < idx->n_blocks; i++ ) {
+        end += get_varint(&c);
+        idx->ends[i] = end;
+    }
+    idx->n_grams = get_varint(&c);
+    if ( !c.ok || end != source_len || idx->n_grams > idx->len ) {
+        return FALSE;
+    }
+    idx->grams = g_new(guint32, idx->n_grams);
+    idx->counts = g_new(guint32, idx->n_grams);
+    idx->postings = g_new(gsize, idx->n_grams);
+    for ( i = 0; i < idx->n_grams && c.ok; i++ ) {
+        gsize bytes = 0;
+
+        g += get_varint(&c);
+        idx->grams[i] = g;
+        idx->counts[i] = get_varint(&c);
+        bytes = get_varint(&c);
+        idx->postings[i] = c.p - (const guchar*) idx->body;
+        if ( bytes > (gsize) (c.end - c.p) ) {
+            return FALSE;
+        }
+        c.p += bytes;
+    }
+    return c.ok;
+}
+
+static const char* skip_class(const char* p)
+{
+    /* a ']' straight after the '[' or "[^" is part of the class */
+    p += ('^' == p[1]) ? 2 : 1;
+    p += (']' == *p) ? 1 : 0;
+    while ( *p && ']' != *p ) {
+        p += ('\\' == *p && p[1]) ? 2 : 1;
+    }
+    return *p ? p + 1 : p;
+}
+
+/* public */
+ntl_TrigramBuilder* ntl_trigram_builder_new(gsize block_size)
+{
+    ntl_TrigramBuilder* rv = g_new0(ntl_TrigramBuilder, 1);
+
+    rv->block_size = MAX(block_size, 1);
+    rv->ends = g_array_new(FALSE, FALSE, sizeof(gsize));
+    rv->seen = g_malloc0(N_GRAMS / 8);
+    rv->grams = g_array_sized_new(FALSE, FALSE, sizeof(guint32), 4096);
+    rv->postings = g_hash_table_new_full(g_direct_hash, g_direct_equal, NULL, free_posting);
+    return rv;
+}
+
+void ntl_trigram_builder_add(ntl_TrigramBuilder* b, const char* data, gsize len)
+{
+    static const char sep[] = "]: ";
+    gsize             i = 0;
+
+    for ( i = 0; i < len; i++ ) {
+        guchar c = (guchar) data[i];
+
+        b->offset++;
+        if ( '\n' == c ) {
+            b->sep = 0;
+            b->in_msg = FALSE;
+            b->window_len = 0;
+            if ( b->offset - b->block_start >= b->block_size ) {
+                close_block(b);
+            }
+        } else if ( b->in_msg ) {
+            b->window = ((b->window << 8) | c) & 0xffffff;
+            if ( ++b->window_len >= 3 ) {
+                note(b, b->window);
+            }
+        } else if ( c == (guchar) sep[b->sep] ) {
+            b->in_msg = (++b->sep == 3);
+        } else {
+            b->sep = (']' == c) ? 1 : 0;
+        }
+    }
+}
+
+gboolean ntl_trigram_builder_write(ntl_TrigramBuilder* b, const char* fn)
+{
+    GString*       body = g_string_sized_new(64 * 1024);
+    GString*       out = NULL;
+    GArray*        grams = g_array_sized_new(FALSE, FALSE, sizeof(guint32), g_hash_table_size(b->postings));
+    GHashTableIter it;
+    gpointer       key = NULL;
+    uLongf         zlen = 0;
+    guint32        prev = 0;
+    gsize          end = 0;
+    guint          i = 0;
+    gboolean       rv = FALSE;
+
+    if ( b->offset > b->block_start ) {
+        close_block(b);
+    }
+    put_varint(body, b->offset);
+    put_varint(body, b->ends->len);
+    for ( i = 0; i < b->ends->len; i++ ) {
+        put_varint(body, g_array_index(b->ends, gsize, i) - end);
+        end = g_array_index(b->ends, gsize, i);
+    }
+
+    g_hash_table_iter_init(&it, b->postings);
+    while ( g_hash_table_iter_next(&it, &key, NULL) ) {
+        guint32 g = GPOINTER_TO_UINT(key);
+        g_array_append_val(grams, g);
+    }
+    g_array_sort(grams, compare_grams);
+    put_varint(body, grams->len);
+    for ( i = 0; i < grams->len; i++ ) {
+        guint32  g = g_array_index(grams, guint32, i);
+        Posting* p = (Posting*) g_hash_table_lookup(b->postings, GUINT_TO_POINTER(g));
+
+        put_varint(body, g - prev);
+        put_varint(body, p->count);
+        put_varint(body, p->ids->len);
+        g_string_append_len(body, p->ids->str, p->ids->len);
+        prev = g;
+    }
+    g_array_free(grams, TRUE);
+
+    zlen = compressBound(body->len);
+    out = g_string_sized_new(MAGIC_LEN + 10 + zlen);
+    g_string_append_len(out, MAGIC, MAGIC_LEN);
+    put_varint(out, body->len);
+    g_string_set_size(out, out->len + zlen);
+    if ( Z_OK == compress2((Bytef*) out->str + out->len - zlen, &zlen, (const Bytef*) body->str, body->len, Z_DEFAULT_COMPRESSION) ) {
+        g_string_truncate(out, out->len - compressBound(body->len) + zlen);
+        /* via a temporary file, so a reader never sees a partial index */
+        rv = g_file_set_contents(fn, out->str, out->len, NULL);
+    }
+    g_string_free(out, TRUE);
+    g_string_free(body, TRUE);
+    return rv;
+}
+
+void ntl_trigram_builder_free(ntl_TrigramBuilder* b)
+{
+    if ( b ) {
+        g_array_free(b->ends, TRUE);
+        g_free(b->seen);
+        g_array_free(b->grams, TRUE);
+        g_hash_table_destroy(b->postings);
+        g_free(b);
+    }
+}
+
+gchar* ntl_trigram_index_name(const char* segment)
+{
+    gsize len = strlen(segment);
+
+    if ( g_str_has_suffix(segment, ".gz") ) {
+        len -= 3;
+    }
+    return g_strdup_printf("%.*s.tri", (int) len, segment);
+}
+
+ntl_TrigramIndex* ntl_trigram_index_open(const char* fn, gsize source_len)
+{
+    ntl_TrigramIndex* rv = NULL;
+    gchar*            data = NULL;
+    gsize             len = 0;
+    Cursor            c;
+    uLongf            raw = 0;
+
+    if ( !g_file_get_contents(fn, &data, &len, NULL) ) {
+        return NULL;
+    }
+    c.p = (const guchar*) data + MAGIC_LEN;
+    c.end = (const guchar*) data + len;
+    c.ok = len > MAGIC_LEN && 0 == memcmp(data, MAGIC, MAGIC_LEN);
+    raw = get_varint(&c);
+    if ( c.ok ) {
+        rv = g_new0(ntl_TrigramIndex, 1);
+        rv->body = g_malloc(raw + 1);
+        rv->len = raw;
+        if ( Z_OK != uncompress((Bytef*) rv->body, &raw, c.p, c.end - c.p) || raw != rv->len
+             || !parse(rv, source_len) ) {
+            ntl_trigram_index_free(rv);
+            rv = NULL;
+        }
+    }
+    g_free(data);
+    return rv;
+}
+
+guint ntl_trigram_index_blocks(const ntl_TrigramIndex* idx)
+{
+    return idx->n_blocks;
+}
+
+void ntl_trigram_index_block(const ntl_TrigramIndex* idx, guint i, gsize* start, gsize* end)
+{
+    *start = i ? idx->ends[i - 1] : 0;
+    *end = idx->ends[i];
+}
+
+gboolean ntl_trigram_index_require(const ntl_TrigramIndex* idx, const char* s, gsize len, guint8* candidates)
+{
+    guint8* has = NULL;
+    gsize   i = 0;
+
+    if ( len < 3 ) {
+        return FALSE;
+    }
+    has = g_new(guint8, MAX(idx->n_blocks, 1));
+    for ( i = 0; i + 3 <= len; i++ ) {
+        gint   g = find_gram(idx, trigram(s + i));
+        Cursor c;
+        guint  id = 0;
+        guint  j = 0;
+
+        if ( g < 0 ) {
+            memset(candidates, 0, idx->n_blocks);
+            break;
+        }
+        memset(has, 0, idx->n_blocks);
+        c.p = (const guchar*) idx->body + idx->postings[g];
+        c.end = (const guchar*) idx->body + idx->len;
+        c.ok = TRUE;
+        for ( j = 0; j < idx->counts[g] && c.ok; j++ ) {
+            id += get_varint(&c);
+            if ( id < idx->n_blocks ) {
+                has[id] = 1;
+            }
+        }
+        for ( j = 0; j < idx->n_blocks; j++ ) {
+            candidates[j] &= has[j];
+        }
+    }
+    g_free(has);
+    return TRUE;
+}
+
+void ntl_trigram_index_free(ntl_TrigramIndex* idx)
+{
+    if ( idx ) {
+        g_free(idx->body);
+        g_free(idx->ends);
+        g_free(idx->grams);
+        g_free(idx->counts);
+        g_free(idx->postings);
+        g_free(idx);
+    }
+}
+
+/*
+ * Conservative: literal runs end at anything which is not a plain
+ * byte, a byte made optional by a quantifier is dropped, and groups
+ * and classes are skipped whole. Any alternation or inline option
+ * could make every run optional, so then there are none.
+ */
+gchar** ntl_trigram_literals(const char* regex)
+{
+    GPtrArray*  rv = g_ptr_array_new();
+    GString*    run = g_string_sized_new(32);
+    const char* p = regex;
+    gboolean    last_lit = FALSE; /* the last atom is the end of run */
+
+    if ( strchr(regex, '|') || strstr(regex, "(?") ) {
+        p = "";
+    }
+    while ( TRUE ) {
+        gboolean lit = FALSE;
+
+        if ( '\\' == *p && p[1] && !g_ascii_isalnum(p[1]) ) {
+            g_string_append_c(run, p[1]);
+            p += 2;
+            lit = TRUE;
+        } else if ( *p && !strchr("\\[](){}.^$*+?", *p) ) {
+            g_string_append_c(run, *p++);
+            lit = TRUE;
+        } else if ( '*' == *p || '?' == *p || '{' == *p ) {
+            if ( last_lit ) {
+                g_string_truncate(run, run->len - 1);
+            }
+            if ( '{' == *p ) {
+                const char* close = strchr(p, '}');
+                p = close ? close : p + strlen(p) - 1;
+            }
+            p++;
+        } else if ( '[' == *p ) {
+            p = skip_class(p);
+        } else if ( '(' == *p ) {
+            guint depth = 0;
+            do {
+                if ( '[' == *p ) {
+                    p = skip_class(p);
+                    continue;
+                }
+                depth += ('(' == *p) - (')' == *p);
+                p += ('\\' == *p && p[1]) ? 2 : 1;
+            } while ( *p && depth > 0 );
+        } else if ( *p ) {
+            /* '+' keeps the byte before it; anything else matches any */
+            p += ('\\' == *p && p[1]) ? 2 : 1;
+        }
+        if ( !lit ) {
+            /* lazy and possessive quantifiers */
+            while ( '?' == *p || '+' == *p ) {
+                p++;
+            }
+            if ( run->len >= 3 ) {
+                g_ptr_array_add(rv, g_strdup(run->str));
+            }
+            g_string_truncate(run, 0);
+        }
+        last_lit = lit;
+        if ( '\0' == *p && 0 == run->len ) {
+            break;
+        }
+    }
+    g_string_free(run, TRUE);
+    g_ptr_array_add(rv, NULL);
+    return (gchar**) g_ptr_array_free(rv, FALSE);
+}
@@ -0,0 +1,201 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "ntlu.h"
+
+#include <string.h>
+#include <time.h>
+
+/*
+ * A run is the latest message seen from one call site, found by a hash
+ * of the prog, pid, level, tag, module and function of a packet line.
+ * A line whose message (and fields) hash the same as its run's, within
+ * the window of the run's last line, is a repeat. When the run ends,
+ * by a different message or by going quiet, its repeats are reported
+ * as one summary line built from the run's first line.
+ */
+
+/* private */
+typedef struct {
+    guint64 site;
+    guint64 msg;
+    gchar*  first;
+    guint   repeats;
+    gint64  first_ms; /* trace time of the first and last repeat */
+    gint64  last_ms;
+    gint64  seen;     /* when the last line arrived */
+} Run;
+
+struct _s_ntl_dedup {
+    gint64         window;
+    ntl_dedup_func emit;
+    gpointer       data;
+    GHashTable*    runs; /* &site -> Run* */
+    gint64         now;  /* during an expiry */
+    guint64        suppressed;
+    guint64        summaries;
+};
+
+/* hashes the text from one key up to another, or to the end */
+static guint64 hash_span(guint64 h, const gchar* ln, const gchar* from, const gchar* to)
+{
+    const gchar* a = from ? strstr(ln, from) : ln;
+    const gchar* b = a ? strstr(a, to) : NULL;
+
+    if ( NULL == a ) {
+        return h;
+    }
+    if ( NULL == b ) {
+        b = a + strlen(a);
+    }
+    for ( ; a < b; a++ ) {
+        h = (h ^ (guchar) *a) * G_GUINT64_CONSTANT(1099511628211);
+    }
+    return h;
+}
+
+static gint64 value_of(const gchar* ln, const gchar* key)
+{
+    const gchar* p = strstr(ln, key);
+    return p ? g_ascii_strtoll(p + strlen(key), NULL, 10) : 0;
+}
+
+static void clock_of(gint64 ms, gchar* buf, gsize len)
+{
+    time_t    t = (time_t) (ms / 1000);
+    struct tm tm;
+    gsize     n = 0;
+
+    localtime_r(&t, &tm);
+    n = strftime(buf, len, "%H:%M:%S", &tm);
+    g_snprintf(buf + n, len - n, ".%03d", (gint) (ms % 1000));
+}
+
+static void summarise(ntl_Dedup* dd, Run* r)
+{
+    const gchar* tm = strstr(r->first, " tm:");
+    const gchar* tag = strstr(r->first, " tag:");
+    const gchar* msg = strstr(r->first, " msg:");
+    gchar        from[32];
+    gchar        to[32];
+    gchar*       ln = NULL;
+
+    if ( 0 == r->repeats ) {
+        return;
+    }
+    if ( tm && tag && msg && tm < tag && tag < msg ) {
+        clock_of(r->first_ms, from, sizeof(from));
+        clock_of(r->last_ms, to, sizeof(to));
+        ln = g_strdup_printf(
+            "%.*s tm:%" G_GINT64_FORMAT ", millis:%" G_GINT64_FORMAT ",%.*s msg:repeated %u times between %s and %s, rp:%u }",
+            (gint) (tm - r->first), r->first, r->last_ms / 1000, r->last_ms % 1000,
+            (gint) (msg - tag), tag, r->repeats, from, to, r->repeats);
+        (*dd->emit)(ln, dd->data);
+        dd->summaries++;
+        g_free(ln);
+    }
+    r->repeats = 0;
+}
+
+static void free_run(gpointer d)
+{
+    Run* r = (Run*) d;
+    g_free(r->first);
+    g_free(r);
+}
+
+static gboolean expired(gpointer k, gpointer v, gpointer d)
+{
+    ntl_Dedup* dd = (ntl_Dedup*) d;
+    Run*       r = (Run*) v;
+
+    if ( dd->now - r->seen <= dd->window ) {
+        return FALSE;
+    }
+    summarise(dd, r);
+    return TRUE;
+}
+
+/* public */
+ntl_Dedup* ntl_dedup_new(guint window_ms, ntl_dedup_func emit, gpointer data)
+{
+    ntl_Dedup* rv = g_new0(ntl_Dedup, 1);
+    rv->window = (gint64) MAX(window_ms, 1) * 1000;
+    rv->emit = emit;
+    rv->data = data;
+    rv->runs = g_hash_table_new_full(g_int64_hash, g_int64_equal, NULL, free_run);
+    return rv;
+}
+
+gboolean ntl_dedup_check(ntl_Dedup* dd, const gchar* ln, gint64 now)
+{
+    guint64 site = G_GUINT64_CONSTANT(14695981039346656037);
+    guint64 msg = site;
+    Run*    r = NULL;
+
+    site = hash_span(site, ln, NULL, " tid:");
+    site = hash_span(site, ln, " tl:", " tm:");
+    site = hash_span(site, ln, " tag:", " msg:");
+    /* the latency stamps differ every time, so stop short of them */
+    msg = hash_span(msg, ln, " msg:", ", lq:");
+
+    r = (Run*) g_hash_table_lookup(dd->runs, &site);
+    if ( r && r->msg == msg && now - r->seen <= dd->window ) {
+        gint64 ms = value_of(ln, " tm:") * 1000 + value_of(ln, " millis:");
+        if ( 0 == r->repeats++ ) {
+            r->first_ms = ms;
+        }
+        r->last_ms = ms;
+        r->seen = now;
+        dd->suppressed++;
+        return TRUE;
+    }
+
+    if ( NULL == r ) {
+        r = g_new0(Run, 1);
+        r->site = site;
+        g_hash_table_insert(dd->runs, &r->site, r);
+    } else {
+        summarise(dd, r);
+        g_free(r->first);
+    }
+    r->msg = msg;
+    r->first = g_strdup(ln);
+    r->seen = now;
+    return FALSE;
+}
+
+void ntl_dedup_expire(ntl_Dedup* dd, gint64 now)
+{
+    dd->now = now;
+    g_hash_table_foreach_remove(dd->runs, expired, dd);
+}
+
+void ntl_dedup_dump(const ntl_Dedup* dd, GString* out)
+{
+    g_string_append_printf(out,
+        "dedup runs=%u suppressed=%" G_GUINT64_FORMAT " summaries=%" G_GUINT64_FORMAT "\n",
+        g_hash_table_size(dd->runs), dd->suppressed, dd->summaries);
+}
+
+void ntl_dedup_free(ntl_Dedup* dd)
+{
+    if ( dd ) {
+        g_hash_table_destroy(dd->runs);
+        g_free(dd);
+    }
+}
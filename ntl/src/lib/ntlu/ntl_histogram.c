@@ -0,0 +1,138 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "ntlu.h"
+
+#include <string.h>
+
+/*
+ * Values below SUB_COUNT have a bucket each. Above that, each power
+ * of two is split into SUB_COUNT / 2 equal buckets: a value is placed
+ * by its top SUB_BITS bits, and the buckets of successive powers
+ * follow each other.
+ */
+
+/* private */
+#define SUB_BITS  6
+#define SUB_COUNT (1 << SUB_BITS)
+#define HALF      (SUB_COUNT / 2)
+#define MAX_BITS  40
+#define N_BUCKETS ((MAX_BITS - SUB_BITS + 1) * HALF + HALF)
+
+struct _s_ntl_histogram {
+    guint64 count;
+    guint64 max;
+    guint64 buckets[N_BUCKETS];
+};
+
+static guint bucket_of(guint64 v)
+{
+    guint shift = 0;
+
+    if ( v < SUB_COUNT ) {
+        return (guint) v;
+    }
+    shift = (63 - __builtin_clzll(v)) - (SUB_BITS - 1);
+    return shift * HALF + (guint) (v >> shift);
+}
+
+/* the largest value which falls in a bucket */
+static guint64 highest_in(guint i)
+{
+    guint shift = 0;
+
+    if ( i < SUB_COUNT ) {
+        return i;
+    }
+    shift = i / HALF - 1;
+    return (((guint64) (i - shift * HALF) + 1) << shift) - 1;
+}
+
+/* public */
+ntl_Histogram* ntl_histogram_new(void)
+{
+    return g_new0(ntl_Histogram, 1);
+}
+
+void ntl_histogram_record(ntl_Histogram* h, guint64 v)
+{
+    v = MIN(v, (G_GUINT64_CONSTANT(1) << MAX_BITS) - 1);
+    h->buckets[bucket_of(v)]++;
+    h->count++;
+    h->max = MAX(h->max, v);
+}
+
+guint64 ntl_histogram_count(const ntl_Histogram* h)
+{
+    return h->count;
+}
+
+guint64 ntl_histogram_max(const ntl_Histogram* h)
+{
+    return h->max;
+}
+
+guint64 ntl_histogram_percentile(const ntl_Histogram* h, gdouble p)
+{
+    guint64 want = 0;
+    guint64 seen = 0;
+    guint   i = 0;
+
+    if ( 0 == h->count ) {
+        return 0;
+    }
+    want = (guint64) (CLAMP(p, 0.0, 100.0) / 100.0 * h->count + 0.5);
+    want = CLAMP(want, 1, h->count);
+    for ( i = 0; i < N_BUCKETS; i++ ) {
+        seen += h->buckets[i];
+        if ( seen >= want ) {
+            return MIN(highest_in(i), h->max);
+        }
+    }
+    return h->max;
+}
+
+void ntl_histogram_merge(ntl_Histogram* into, const ntl_Histogram* h)
+{
+    guint i = 0;
+
+    for ( i = 0; i < N_BUCKETS; i++ ) {
+        into->buckets[i] += h->buckets[i];
+    }
+    into->count += h->count;
+    into->max = MAX(into->max, h->max);
+}
+
+void ntl_histogram_reset(ntl_Histogram* h)
+{
+    memset(h, 0, sizeof(*h));
+}
+
+void ntl_histogram_dump(const ntl_Histogram* h, const gchar* name, GString* out)
+{
+    g_string_append_printf(out,
+        "%s count=%" G_GUINT64_FORMAT " p50=%" G_GUINT64_FORMAT " p90=%" G_GUINT64_FORMAT
+        " p99=%" G_GUINT64_FORMAT " p999=%" G_GUINT64_FORMAT " max=%" G_GUINT64_FORMAT "\n",
+        name, h->count,
+        ntl_histogram_percentile(h, 50), ntl_histogram_percentile(h, 90),
+        ntl_histogram_percentile(h, 99), ntl_histogram_percentile(h, 99.9), h->max);
+}
+
+void ntl_histogram_free(ntl_Histogram* h)
+{
+    g_free(h);
+}
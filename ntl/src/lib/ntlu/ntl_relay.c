@@ -0,0 +1,202 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "ntlu.h"
+
+#include <string.h>
+
+/*
+ * Lines move from the unsent queue to the unacked one as they go out
+ * in a batch, and are dropped when its ack arrives. Each batch ends
+ * with a marker line carrying its sequence number, which the upstream
+ * daemon acks once it has read the lines before it. Acks are
+ * cumulative. After a reconnect the unacked lines are sent again, so
+ * the upstream may see a line twice but never loses an acked one.
+ * Both queues count against the limit; an upstream that stays
+ * connected without acking loses its oldest unacked lines first.
+ */
+
+/* private */
+typedef struct {
+    guint64 seq;
+    guint   lines;
+} Batch;
+
+struct _s_ntl_relay_queue {
+    gsize   limit;
+    gsize   bytes;   /* in both queues */
+    GQueue  unsent;
+    GQueue  unacked;
+    GQueue  batches; /* Batch*, oldest first */
+    guint64 seq;
+    guint64 relayed;
+    guint64 dropped;
+    guint64 resent;
+};
+
+static void drop_head(ntl_RelayQueue* q, GQueue* from)
+{
+    GString* s = (GString*) g_queue_pop_head(from);
+    q->bytes -= s->len;
+    g_string_free(s, TRUE);
+}
+
+/* its batch is still acked, with one line fewer */
+static void drop_unacked(ntl_RelayQueue* q)
+{
+    GList* l = NULL;
+
+    drop_head(q, &q->unacked);
+    for ( l = q->batches.head; l; l = l->next ) {
+        Batch* b = (Batch*) l->data;
+        if ( b->lines > 0 ) {
+            b->lines--;
+            break;
+        }
+    }
+}
+
+/* hn is always appended last, so an earlier " hn:" is message text */
+static gboolean has_host(const gchar* ln, const gchar* end)
+{
+    const gchar* p = g_strrstr_len(ln, end - ln, ", ");
+    return NULL != p && 0 == strncmp(p, ", hn:", 5);
+}
+
+/* public */
+ntl_RelayQueue* ntl_relay_queue_new(gsize limit)
+{
+    ntl_RelayQueue* rv = g_new0(ntl_RelayQueue, 1);
+    rv->limit = limit;
+    g_queue_init(&rv->unsent);
+    g_queue_init(&rv->unacked);
+    g_queue_init(&rv->batches);
+    return rv;
+}
+
+void ntl_relay_queue_push(ntl_RelayQueue* q, const gchar* ln, const gchar* host)
+{
+    const gchar* end = strrchr(ln, '}');
+    GString*     s = NULL;
+
+    if ( host && end && !has_host(ln, end) ) {
+        /* relayed lines keep the host they were first relayed from */
+        gsize len = end - ln;
+        while ( len > 0 && ' ' == ln[len - 1] ) {
+            len--;
+        }
+        s = g_string_new_len(ln, len);
+        g_string_append_printf(s, ", hn:%s }", host);
+    } else {
+        s = g_string_new(ln);
+    }
+    g_string_append_c(s, '\n');
+    g_queue_push_tail(&q->unsent, s);
+    q->bytes += s->len;
+    /* the oldest lines go first, and those in flight are older */
+    while ( q->bytes > q->limit && !g_queue_is_empty(&q->unacked) ) {
+        drop_unacked(q);
+        q->dropped++;
+    }
+    while ( q->bytes > q->limit && !g_queue_is_empty(&q->unsent) ) {
+        drop_head(q, &q->unsent);
+        q->dropped++;
+    }
+}
+
+gsize ntl_relay_queue_bytes(const ntl_RelayQueue* q)
+{
+    return q->bytes;
+}
+
+guint ntl_relay_queue_unsent(const ntl_RelayQueue* q)
+{
+    return g_queue_get_length((GQueue*) &q->unsent);
+}
+
+guint64 ntl_relay_queue_batch(ntl_RelayQueue* q, guint max_lines, GString* out)
+{
+    Batch* b = NULL;
+
+    if ( g_queue_is_empty(&q->unsent) ) {
+        return 0;
+    }
+    b = g_new(Batch, 1);
+    b->seq = ++q->seq;
+    b->lines = 0;
+    while ( b->lines < MAX(max_lines, 1) && !g_queue_is_empty(&q->unsent) ) {
+        GString* s = (GString*) g_queue_pop_head(&q->unsent);
+        g_string_append_len(out, s->str, s->len);
+        g_queue_push_tail(&q->unacked, s);
+        b->lines++;
+    }
+    g_string_append_printf(out, "{ ctl:batch, seq:%" G_GUINT64_FORMAT " }\n", b->seq);
+    g_queue_push_tail(&q->batches, b);
+    return b->seq;
+}
+
+guint ntl_relay_queue_ack(ntl_RelayQueue* q, guint64 seq)
+{
+    guint  rv = 0;
+    Batch* b = NULL;
+
+    while ( (b = (Batch*) g_queue_peek_head(&q->batches)) && b->seq <= seq ) {
+        guint i = 0;
+        for ( i = 0; i < b->lines; i++ ) {
+            drop_head(q, &q->unacked);
+        }
+        rv += b->lines;
+        g_free(g_queue_pop_head(&q->batches));
+    }
+    q->relayed += rv;
+    return rv;
+}
+
+void ntl_relay_queue_rewind(ntl_RelayQueue* q)
+{
+    GString* s = NULL;
+    while ( (s = (GString*) g_queue_pop_tail(&q->unacked)) ) {
+        g_queue_push_head(&q->unsent, s);
+        q->resent++;
+    }
+    while ( !g_queue_is_empty(&q->batches) ) {
+        g_free(g_queue_pop_head(&q->batches));
+    }
+}
+
+void ntl_relay_queue_dump(const ntl_RelayQueue* q, GString* out)
+{
+    g_string_append_printf(out,
+        "unsent=%u unacked=%u bytes=%" G_GSIZE_FORMAT " limit=%" G_GSIZE_FORMAT
+        " relayed=%" G_GUINT64_FORMAT " dropped=%" G_GUINT64_FORMAT " resent=%" G_GUINT64_FORMAT "\n",
+        g_queue_get_length((GQueue*) &q->unsent), g_queue_get_length((GQueue*) &q->unacked),
+        q->bytes, q->limit, q->relayed, q->dropped, q->resent);
+}
+
+void ntl_relay_queue_free(ntl_RelayQueue* q)
+{
+    if ( q ) {
+        while ( !g_queue_is_empty(&q->unsent) ) {
+            drop_head(q, &q->unsent);
+        }
+        while ( !g_queue_is_empty(&q->unacked) ) {
+            drop_head(q, &q->unacked);
+        }
+        ntl_relay_queue_rewind(q);
+        g_free(q);
+    }
+}
@@ -0,0 +1,215 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "ntlu.h"
+
+#include <string.h>
+
+/*
+ * Lines wait in a min-heap keyed on their trace time (ties broken by
+ * arrival) until the clock has passed that time by the window. A line
+ * stamped in the future is keyed on its arrival instead, so that a
+ * client's fast clock can't hold it back indefinitely. A line older
+ * than one already emitted can no longer be put in order; it is sent
+ * at once, marked with late:1.
+ */
+
+/* private */
+typedef struct {
+    gint64  key; /* trace time, in milliseconds */
+    guint64 seq;
+    guint   flags;
+    gsize   len;
+    gchar   line[1];
+} Entry;
+
+struct _s_ntl_reorder {
+    gint64           window; /* in milliseconds */
+    guint            max_held;
+    ntl_reorder_func emit;
+    gpointer         data;
+    GPtrArray*       heap;
+    gsize            bytes;
+    guint64          seq;
+    gint64           last;   /* the key of the last line emitted */
+    guint64          emitted;
+    guint64          late;
+    guint64          forced; /* emitted early, to stay within max_held */
+};
+
+static gboolean before(const Entry* a, const Entry* b)
+{
+    return a->key < b->key || (a->key == b->key && a->seq < b->seq);
+}
+
+#define AT(r, i) ((Entry*) g_ptr_array_index((r)->heap, (i)))
+
+static void swap(ntl_Reorder* r, guint a, guint b)
+{
+    gpointer e = g_ptr_array_index(r->heap, a);
+    g_ptr_array_index(r->heap, a) = g_ptr_array_index(r->heap, b);
+    g_ptr_array_index(r->heap, b) = e;
+}
+
+static void sift_up(ntl_Reorder* r, guint i)
+{
+    while ( i > 0 && before(AT(r, i), AT(r, (i - 1) / 2)) ) {
+        swap(r, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void sift_down(ntl_Reorder* r, guint i)
+{
+    guint n = r->heap->len;
+    for ( ;; ) {
+        guint least = i;
+        guint c = 2 * i + 1;
+
+        if ( c < n && before(AT(r, c), AT(r, least)) ) {
+            least = c;
+        }
+        if ( c + 1 < n && before(AT(r, c + 1), AT(r, least)) ) {
+            least = c + 1;
+        }
+        if ( least == i ) {
+            return;
+        }
+        swap(r, i, least);
+        i = least;
+    }
+}
+
+static gint64 value_of(const gchar* ln, const gchar* key, gboolean* found)
+{
+    const gchar* p = strstr(ln, key);
+    if ( found ) {
+        *found = NULL != p;
+    }
+    return p ? g_ascii_strtoll(p + strlen(key), NULL, 10) : 0;
+}
+
+static void emit_late(ntl_Reorder* r, const gchar* ln, guint flags)
+{
+    const gchar* end = strrchr(ln, '}');
+    gint         len = end ? end - ln : (gint) strlen(ln);
+    gchar*       marked = NULL;
+
+    while ( len > 0 && ' ' == ln[len - 1] ) {
+        len--;
+    }
+    marked = g_strdup_printf("%.*s, late:1 }%s", len, ln, end ? end + 1 : "");
+    (*r->emit)(marked, flags, r->data);
+    g_free(marked);
+    r->late++;
+}
+
+static void pop(ntl_Reorder* r)
+{
+    Entry* e = AT(r, 0);
+    guint  last = r->heap->len - 1;
+
+    swap(r, 0, last);
+    g_ptr_array_set_size(r->heap, last);
+    sift_down(r, 0);
+    r->bytes -= e->len;
+    r->last = MAX(r->last, e->key);
+    r->emitted++;
+    (*r->emit)(e->line, e->flags, r->data);
+    g_free(e);
+}
+
+/* public */
+ntl_Reorder* ntl_reorder_new(guint window_ms, guint max_held, ntl_reorder_func emit, gpointer data)
+{
+    ntl_Reorder* rv = g_new0(ntl_Reorder, 1);
+    rv->window = window_ms;
+    rv->max_held = MAX(max_held, 1);
+    rv->emit = emit;
+    rv->data = data;
+    rv->heap = g_ptr_array_new();
+    rv->last = G_MININT64;
+    return rv;
+}
+
+void ntl_reorder_push(ntl_Reorder* r, const gchar* ln, guint flags, gint64 now)
+{
+    gboolean found = FALSE;
+    gint64   now_ms = now / 1000;
+    gint64   key = value_of(ln, " tm:", &found) * 1000 + value_of(ln, " millis:", NULL);
+    gsize    len = strlen(ln);
+    Entry*   e = NULL;
+
+    if ( !found || key > now_ms ) {
+        key = now_ms;
+    }
+    if ( key < r->last ) {
+        emit_late(r, ln, flags);
+        return;
+    }
+    e = (Entry*) g_malloc(sizeof(Entry) + len);
+    e->key = key;
+    e->seq = r->seq++;
+    e->flags = flags;
+    e->len = len;
+    memcpy(e->line, ln, len + 1);
+    g_ptr_array_add(r->heap, e);
+    sift_up(r, r->heap->len - 1);
+    r->bytes += len;
+    while ( r->heap->len > r->max_held ) {
+        r->forced++;
+        pop(r);
+    }
+}
+
+void ntl_reorder_flush(ntl_Reorder* r, gint64 now)
+{
+    gint64 due = now / 1000 - r->window;
+    while ( r->heap->len > 0 && AT(r, 0)->key <= due ) {
+        pop(r);
+    }
+}
+
+gsize ntl_reorder_bytes(const ntl_Reorder* r)
+{
+    return r->bytes;
+}
+
+guint64 ntl_reorder_late(const ntl_Reorder* r)
+{
+    return r->late;
+}
+
+void ntl_reorder_dump(const ntl_Reorder* r, GString* out)
+{
+    g_string_append_printf(out,
+        "window=%" G_GINT64_FORMAT " held=%u bytes=%" G_GSIZE_FORMAT " emitted=%" G_GUINT64_FORMAT
+        " late=%" G_GUINT64_FORMAT " forced=%" G_GUINT64_FORMAT "\n",
+        r->window, r->heap->len, r->bytes, r->emitted, r->late, r->forced);
+}
+
+void ntl_reorder_free(ntl_Reorder* r)
+{
+    if ( r ) {
+        guint i = 0;
+        for ( i = 0; i < r->heap->len; i++ ) {
+            g_free(g_ptr_array_index(r->heap, i));
+        }
+        g_ptr_array_free(r->heap, TRUE);
+        g_free(r);
+    }
+}
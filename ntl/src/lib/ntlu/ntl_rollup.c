@@ -0,0 +1,221 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "ntlu.h"
+
+#include <string.h>
+
+/*
+ * A cell per (prog, tag, level) counts traces and bytes in the current
+ * window, the last closed window and since the start. Windows are
+ * aligned to the wall clock, so a one minute window closes on the
+ * minute. Once max_keys cells exist, new keys share one cell per prog
+ * and level with the tag OTHER_TAG, bounding the memory used.
+ */
+
+/* private */
+#define OTHER_TAG "_other"
+
+typedef struct {
+    gchar*  prog;
+    gchar*  tag;
+    guint   level;
+    guint64 count;
+    guint64 bytes;
+    guint64 last_count;
+    guint64 last_bytes;
+    guint64 total_count;
+    guint64 total_bytes;
+} Cell;
+
+struct _s_ntl_rollup {
+    gint64          window;
+    gint64          start;
+    guint           max_keys;
+    ntl_rollup_func emit;
+    gpointer        data;
+    GHashTable*     cells; /* "prog\037tag\037level" -> Cell* */
+    GString*        key;
+};
+
+static const gchar* level_names[] = { "trace", "debug", "warn", "error" };
+
+static const gchar* level_name(guint level)
+{
+    return level < G_N_ELEMENTS(level_names) ? level_names[level] : "unknown";
+}
+
+static void free_cell(gpointer d)
+{
+    Cell* c = (Cell*) d;
+    g_free(c->prog);
+    g_free(c->tag);
+    g_free(c);
+}
+
+static Cell* cell_for(ntl_Rollup* r, const gchar* prog, const gchar* tag, guint level)
+{
+    Cell* rv = NULL;
+
+    g_string_printf(r->key, "%s\037%s\037%u", prog, tag, level);
+    rv = (Cell*) g_hash_table_lookup(r->cells, r->key->str);
+    if ( rv ) {
+        return rv;
+    }
+    if ( g_hash_table_size(r->cells) >= r->max_keys && 0 != g_strcmp0(tag, OTHER_TAG) ) {
+        return cell_for(r, prog, OTHER_TAG, level);
+    }
+    rv = g_new0(Cell, 1);
+    rv->prog = g_strdup(prog);
+    rv->tag = g_strdup(tag);
+    rv->level = level;
+    g_hash_table_insert(r->cells, g_strdup(r->key->str), rv);
+    return rv;
+}
+
+static void close_cell(gpointer k, gpointer v, gpointer d)
+{
+    ntl_Rollup* r = (ntl_Rollup*) d;
+    Cell*       c = (Cell*) v;
+
+    c->last_count = c->count;
+    c->last_bytes = c->bytes;
+    if ( c->count > 0 && r->emit ) {
+        gchar* ln = g_strdup_printf(
+            "{ pn:%s, pid:0, tid:0, tl:%u, tm:%" G_GINT64_FORMAT ", millis:0, tag:" NTL_ROLLUP_TAG
+            ", mod:%s, fn:%s, msg:count=%" G_GUINT64_FORMAT " bytes=%" G_GUINT64_FORMAT " secs=%" G_GINT64_FORMAT " }",
+            c->prog, c->level, r->start / G_USEC_PER_SEC, c->tag, level_name(c->level),
+            c->count, c->bytes, r->window / G_USEC_PER_SEC);
+        (*r->emit)(ln, r->data);
+        g_free(ln);
+    }
+    c->count = 0;
+    c->bytes = 0;
+}
+
+/* the window before now passed with no traces at all */
+static void clear_last(gpointer k, gpointer v, gpointer d)
+{
+    Cell* c = (Cell*) v;
+
+    c->last_count = 0;
+    c->last_bytes = 0;
+}
+
+static void append_label(GString* out, const gchar* name, const gchar* v, gboolean last)
+{
+    g_string_append_printf(out, "%s=\"", name);
+    for ( ; *v; v++ ) {
+        if ( '\\' == *v || '"' == *v ) {
+            g_string_append_c(out, '\\');
+            g_string_append_c(out, *v);
+        } else if ( '\n' == *v ) {
+            g_string_append(out, "\\n");
+        } else {
+            g_string_append_c(out, *v);
+        }
+    }
+    g_string_append(out, last ? "\"}" : "\",");
+}
+
+typedef struct {
+    GString*     out;
+    const gchar* metric;
+    gsize        offset; /* of the value in a Cell */
+} Series;
+
+static void append_series(gpointer k, gpointer v, gpointer d)
+{
+    Series* s = (Series*) d;
+    Cell*   c = (Cell*) v;
+
+    g_string_append_printf(s->out, "%s{", s->metric);
+    append_label(s->out, "prog", c->prog, FALSE);
+    append_label(s->out, "tag", c->tag, FALSE);
+    append_label(s->out, "level", level_name(c->level), TRUE);
+    g_string_append_printf(s->out, " %" G_GUINT64_FORMAT "\n", G_STRUCT_MEMBER(guint64, c, s->offset));
+}
+
+/* public */
+ntl_Rollup* ntl_rollup_new(guint window_secs, guint max_keys, ntl_rollup_func emit, gpointer data)
+{
+    ntl_Rollup* rv = g_new0(ntl_Rollup, 1);
+    rv->window = (gint64) MAX(window_secs, 1) * G_USEC_PER_SEC;
+    rv->max_keys = MAX(max_keys, 1);
+    rv->emit = emit;
+    rv->data = data;
+    rv->cells = g_hash_table_new_full(g_str_hash, g_str_equal, g_free, free_cell);
+    rv->key = g_string_sized_new(128);
+    return rv;
+}
+
+void ntl_rollup_add(ntl_Rollup* r, const gchar* prog, const gchar* tag, guint level, gsize bytes, gint64 now)
+{
+    Cell* c = NULL;
+
+    ntl_rollup_tick(r, now);
+    c = cell_for(r, prog ? prog : "", tag ? tag : "", level);
+    c->count++;
+    c->bytes += bytes;
+    c->total_count++;
+    c->total_bytes += bytes;
+}
+
+void ntl_rollup_tick(ntl_Rollup* r, gint64 now)
+{
+    if ( 0 == r->start ) {
+        r->start = now - now % r->window;
+    } else if ( now >= r->start + r->window ) {
+        g_hash_table_foreach(r->cells, close_cell, r);
+        if ( now >= r->start + 2 * r->window ) {
+            g_hash_table_foreach(r->cells, clear_last, NULL);
+        }
+        r->start = now - now % r->window;
+    }
+}
+
+void ntl_rollup_snapshot(const ntl_Rollup* r, GString* out)
+{
+    static const struct {
+        const gchar* metric;
+        const gchar* type;
+        const gchar* help;
+        gsize        offset;
+    } metrics[] = {
+        { "ntl_traces_total", "counter", "Traces received", G_STRUCT_OFFSET(Cell, total_count) },
+        { "ntl_trace_bytes_total", "counter", "Bytes of traces received", G_STRUCT_OFFSET(Cell, total_bytes) },
+        { "ntl_traces_last_window", "gauge", "Traces received in the last closed window", G_STRUCT_OFFSET(Cell, last_count) },
+        { "ntl_trace_bytes_last_window", "gauge", "Bytes of traces received in the last closed window", G_STRUCT_OFFSET(Cell, last_bytes) },
+    };
+    guint i = 0;
+
+    for ( i = 0; i < G_N_ELEMENTS(metrics); i++ ) {
+        Series s = { out, metrics[i].metric, metrics[i].offset };
+        g_string_append_printf(out, "# HELP %s %s\n# TYPE %s %s\n",
+            metrics[i].metric, metrics[i].help, metrics[i].metric, metrics[i].type);
+        g_hash_table_foreach(r->cells, append_series, &s);
+    }
+}
+
+void ntl_rollup_free(ntl_Rollup* r)
+{
+    if ( r ) {
+        g_hash_table_destroy(r->cells);
+        g_string_free(r->key, TRUE);
+        g_free(r);
+    }
+}
@@ -0,0 +1,378 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "ntlu.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/*
+ * The file is a header followed by the ring, laid out like the crash
+ * ring of ntlc: records are a 32 bit length and the line's bytes,
+ * wrapping at the end, and positions are byte counts since the ring
+ * was made. head is the end of the newest record and tail the start of
+ * the oldest one intact. Before overwriting, the writer moves tail past
+ * what it is about to overwrite; a reader copies a record out and then
+ * checks that tail has not passed it, so it never delivers a torn one.
+ * Each reader claims a slot in the header for its cursor, on its own
+ * cache line, which only it writes. A line longer than half the ring
+ * is not published at all, and a record chain found broken, by a
+ * restarted writer or while moving tail, starts the ring over.
+ */
+
+/* private */
+#define MAGIC       "NTLS"
+#define DEAD        "DEAD"
+#define VERSION     1
+#define HEADER_SIZE 4096
+#define MAX_READERS 32
+
+typedef struct {
+    guint32 pid;     /* 0 when free */
+    guint32 unused;
+    guint64 pos;     /* where it reads next */
+    guint64 laps;    /* times it fell a whole ring behind */
+    guint64 skipped; /* bytes it lost doing so */
+    guint8  pad[32];
+} Cursor;
+
+typedef struct {
+    gchar   magic[4];
+    guint32 version;
+    guint64 capacity;
+    guint64 head;
+    guint64 tail;
+    guint8  pad[32];
+    Cursor  cursors[MAX_READERS];
+} Header;
+
+struct _s_ntl_shm_ring {
+    gchar*   path;
+    Header*  hdr;
+    guchar*  data;
+    gsize    map_size;
+    gboolean writer;
+    gint     slot;      /* a reader's cursor in the header, or -1 */
+    guint64  pos;
+    guint64  laps;
+    GString* line;
+    guint64  published;
+    guint64  oversized; /* lines too long to publish */
+};
+
+static void copy_in(ntl_ShmRing* r, guint64 pos, const void* src, gsize len)
+{
+    gsize off = pos % r->hdr->capacity;
+    gsize first = MIN(len, r->hdr->capacity - off);
+
+    memcpy(r->data + off, src, first);
+    memcpy(r->data, (const guchar*) src + first, len - first);
+}
+
+static void copy_out(const ntl_ShmRing* r, guint64 pos, void* dst, gsize len)
+{
+    gsize off = pos % r->hdr->capacity;
+    gsize first = MIN(len, r->hdr->capacity - off);
+
+    memcpy(dst, r->data + off, first);
+    memcpy((guchar*) dst + first, r->data, len - first);
+}
+
+static guint32 length_at(const ntl_ShmRing* r, guint64 pos)
+{
+    guint32 rv = 0;
+    copy_out(r, pos, &rv, sizeof(rv));
+    return rv;
+}
+
+static ntl_ShmRing* map(const gchar* path, int fd, gsize size, gboolean writer)
+{
+    ntl_ShmRing* rv = NULL;
+    void*        m = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+
+    if ( MAP_FAILED == m ) {
+        return NULL;
+    }
+    rv = g_new0(ntl_ShmRing, 1);
+    rv->path = g_strdup(path);
+    rv->hdr = (Header*) m;
+    rv->data = (guchar*) m + HEADER_SIZE;
+    rv->map_size = size;
+    rv->writer = writer;
+    rv->slot = -1;
+    rv->line = g_string_sized_new(writer ? 0 : 4096);
+    return rv;
+}
+
+static gboolean valid(const ntl_ShmRing* r)
+{
+    return 0 == memcmp(r->hdr->magic, MAGIC, 4) && VERSION == r->hdr->version
+        && r->hdr->capacity == r->map_size - HEADER_SIZE;
+}
+
+/* every record from tail must end within head, the last exactly on it */
+static gboolean chain_intact(const ntl_ShmRing* r)
+{
+    const Header* h = r->hdr;
+    guint64       pos = h->tail;
+
+    if ( h->tail > h->head || h->head - h->tail > h->capacity ) {
+        return FALSE;
+    }
+    while ( pos < h->head ) {
+        guint32 len = length_at(r, pos);
+        if ( len > h->capacity / 2 || pos + sizeof(len) + len > h->head ) {
+            return FALSE;
+        }
+        pos += sizeof(len) + len;
+    }
+    return TRUE;
+}
+
+static gboolean alive(guint32 pid)
+{
+    return 0 == kill((pid_t) pid, 0) || EPERM == errno;
+}
+
+/* a free cursor, or one left by a reader that has gone */
+static void claim_slot(ntl_ShmRing* r)
+{
+    guint32 me = (guint32) getpid();
+    guint   i = 0;
+
+    for ( i = 0; i < MAX_READERS; i++ ) {
+        Cursor* c = r->hdr->cursors + i;
+        guint32 pid = __atomic_load_n(&c->pid, __ATOMIC_ACQUIRE);
+
+        if ( (0 == pid || !alive(pid))
+             && __atomic_compare_exchange_n(&c->pid, &pid, me, FALSE, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE) ) {
+            c->pos = r->pos;
+            c->laps = 0;
+            c->skipped = 0;
+            r->slot = (gint) i;
+            return;
+        }
+    }
+}
+
+/* public */
+ntl_ShmRing* ntl_shm_ring_create(const gchar* path, gsize size)
+{
+    ntl_ShmRing* rv = NULL;
+    struct stat  st;
+    int          fd = open(path, O_RDWR | O_CREAT, 0644);
+
+    if ( fd < 0 ) {
+        return NULL;
+    }
+    if ( 0 != fstat(fd, &st) ) {
+        close(fd);
+        return NULL;
+    }
+    size = MAX(size, 64 * 1024);
+    if ( (gsize) st.st_size == HEADER_SIZE + size ) {
+        /* carry on where the last writer stopped, readers and all */
+        rv = map(path, fd, HEADER_SIZE + size, TRUE);
+        if ( rv && valid(rv) && chain_intact(rv) ) {
+            close(fd);
+            return rv;
+        }
+    } else if ( st.st_size > 0 ) {
+        /* readers have the old size mapped; have them attach afresh */
+        if ( st.st_size >= HEADER_SIZE ) {
+            ntl_ShmRing* old = map(path, fd, st.st_size, TRUE);
+            if ( old ) {
+                memcpy(old->hdr->magic, DEAD, 4);
+                ntl_shm_ring_free(old);
+            }
+        }
+        close(fd);
+        unlink(path);
+        fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+        if ( fd < 0 ) {
+            return NULL;
+        }
+    }
+    if ( NULL == rv && 0 == ftruncate(fd, HEADER_SIZE + size) ) {
+        rv = map(path, fd, HEADER_SIZE + size, TRUE);
+    }
+    close(fd);
+    if ( NULL == rv ) {
+        return NULL;
+    }
+    memset(rv->hdr, 0, sizeof(Header));
+    rv->hdr->version = VERSION;
+    rv->hdr->capacity = size;
+    /* last, so a half-made file is never taken for a ring */
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    memcpy(rv->hdr->magic, MAGIC, 4);
+    return rv;
+}
+
+void ntl_shm_ring_publish(ntl_ShmRing* r, const gchar* ln, gsize len)
+{
+    Header* h = r->hdr;
+    guint64 tail = h->tail;
+    guint32 n = (guint32) len;
+
+    /* a truncated line would reach readers as a corrupt trace */
+    if ( len > h->capacity / 2 ) {
+        r->oversized++;
+        return;
+    }
+    while ( h->head + sizeof(n) + len - tail > h->capacity ) {
+        guint32 old = length_at(r, tail);
+        if ( old > h->capacity / 2 || tail + sizeof(old) + old > h->head ) {
+            /* a broken chain; drop all of it, and readers with it */
+            tail = h->head;
+            break;
+        }
+        tail += sizeof(old) + old;
+    }
+    if ( tail != h->tail ) {
+        /* readers must see the new tail before any of the new bytes */
+        __atomic_store_n(&h->tail, tail, __ATOMIC_RELAXED);
+        __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    }
+    copy_in(r, h->head, &n, sizeof(n));
+    copy_in(r, h->head + sizeof(n), ln, len);
+    __atomic_store_n(&h->head, h->head + sizeof(n) + len, __ATOMIC_RELEASE);
+    r->published++;
+}
+
+void ntl_shm_ring_dump(const ntl_ShmRing* r, GString* out)
+{
+    guint64 head = __atomic_load_n(&r->hdr->head, __ATOMIC_ACQUIRE);
+    guint   i = 0;
+
+    g_string_append_printf(out,
+        "%s capacity=%" G_GUINT64_FORMAT " held=%" G_GUINT64_FORMAT " published=%" G_GUINT64_FORMAT
+        " oversized=%" G_GUINT64_FORMAT "\n",
+        r->path, r->hdr->capacity, head - r->hdr->tail, r->published, r->oversized);
+    for ( i = 0; i < MAX_READERS; i++ ) {
+        const Cursor* c = r->hdr->cursors + i;
+        guint32       pid = __atomic_load_n(&c->pid, __ATOMIC_ACQUIRE);
+        guint64       pos = __atomic_load_n(&c->pos, __ATOMIC_RELAXED);
+
+        if ( pid && alive(pid) ) {
+            g_string_append_printf(out,
+                "reader pid=%u behind=%" G_GUINT64_FORMAT " laps=%" G_GUINT64_FORMAT " skipped=%" G_GUINT64_FORMAT "\n",
+                pid, head > pos ? head - pos : 0, c->laps, c->skipped);
+        }
+    }
+}
+
+ntl_ShmRing* ntl_shm_ring_attach(const gchar* path)
+{
+    ntl_ShmRing* rv = NULL;
+    struct stat  st;
+    int          fd = open(path, O_RDWR);
+
+    if ( fd < 0 ) {
+        return NULL;
+    }
+    if ( 0 == fstat(fd, &st) && st.st_size > HEADER_SIZE ) {
+        rv = map(path, fd, st.st_size, FALSE);
+    }
+    close(fd);
+    if ( rv && !valid(rv) ) {
+        ntl_shm_ring_free(rv);
+        rv = NULL;
+    }
+    if ( rv ) {
+        /* from now on; what is already there is history */
+        rv->pos = __atomic_load_n(&rv->hdr->head, __ATOMIC_ACQUIRE);
+        claim_slot(rv);
+    }
+    return rv;
+}
+
+gboolean ntl_shm_ring_valid(const ntl_ShmRing* r)
+{
+    return valid(r);
+}
+
+guint ntl_shm_ring_read(ntl_ShmRing* r, guint max, ntl_shm_ring_func fn, gpointer data)
+{
+    Header* h = r->hdr;
+    guint64 head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+    guint64 skipped = 0;
+    guint   rv = 0;
+
+    if ( r->pos > head ) {
+        /* the writer started the ring over */
+        r->pos = head;
+    }
+    while ( r->pos < head && rv < max ) {
+        guint64 tail = __atomic_load_n(&h->tail, __ATOMIC_ACQUIRE);
+        guint32 len = 0;
+
+        if ( r->pos >= tail ) {
+            len = length_at(r, r->pos);
+            if ( len <= h->capacity / 2 && r->pos + sizeof(len) + len <= head ) {
+                g_string_set_size(r->line, len);
+                copy_out(r, r->pos + sizeof(len), r->line->str, len);
+            }
+            /* whatever was copied is only good if tail has not moved
+             * over it meanwhile */
+            __atomic_thread_fence(__ATOMIC_ACQUIRE);
+            tail = __atomic_load_n(&h->tail, __ATOMIC_RELAXED);
+        }
+        if ( r->pos < tail || len > h->capacity / 2 || r->pos + sizeof(len) + len > head ) {
+            /* lapped: skip to the newest, to have a whole ring of slack */
+            head = __atomic_load_n(&h->head, __ATOMIC_ACQUIRE);
+            skipped += head - r->pos;
+            r->pos = head;
+            r->laps++;
+            if ( r->slot >= 0 ) {
+                h->cursors[r->slot].laps++;
+            }
+            break;
+        }
+        r->pos += sizeof(len) + len;
+        (*fn)(r->line->str, len, data);
+        rv++;
+    }
+    if ( r->slot >= 0 ) {
+        h->cursors[r->slot].skipped += skipped;
+        __atomic_store_n(&h->cursors[r->slot].pos, r->pos, __ATOMIC_RELAXED);
+    }
+    return rv;
+}
+
+guint64 ntl_shm_ring_laps(const ntl_ShmRing* r)
+{
+    return r->laps;
+}
+
+void ntl_shm_ring_free(ntl_ShmRing* r)
+{
+    if ( r ) {
+        if ( r->slot >= 0 ) {
+            __atomic_store_n(&r->hdr->cursors[r->slot].pid, 0, __ATOMIC_RELEASE);
+        }
+        munmap(r->hdr, r->map_size);
+        g_string_free(r->line, TRUE);
+        g_free(r->path);
+        g_free(r);
+    }
+}
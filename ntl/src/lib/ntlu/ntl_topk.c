@@ -0,0 +1,358 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "ntlu.h"
+
+#include <stdlib.h>
+#include <string.h>
+
+/*
+ * Counts and bytes per key are kept in count-min sketches, one per
+ * sub-window plus their running sum, so a key's estimate over the
+ * window is the smallest of its DEPTH counters in the sum and never
+ * an undercount. When a sub-window expires it is subtracted from the
+ * sum and cleared. The keys with the largest estimates are kept in a
+ * min-heap of k entries, indexed by key, and re-estimated whenever a
+ * sub-window expires.
+ */
+
+/* private */
+#define DEPTH   4
+#define WIDTH   1024
+#define KEY_MAX 128
+
+typedef struct {
+    guint64 count[DEPTH][WIDTH];
+    guint64 bytes[DEPTH][WIDTH];
+    guint64 total_count;
+    guint64 total_bytes;
+} Sketch;
+
+typedef struct {
+    gchar*  key;
+    guint64 hash;
+    guint64 count;
+    guint64 bytes;
+    guint   pos;
+} Entry;
+
+struct _s_ntl_top_k {
+    guint       k;
+    guint       n_windows;
+    gint64      window_us;
+    gint64      first;   /* the first add since a reset */
+    gint64      started; /* the start of the current sub-window */
+    guint       current;
+    Sketch*     windows;
+    Sketch      sum;
+    Entry**     heap;
+    guint       n;
+    GHashTable* index;   /* key -> Entry* */
+};
+
+static guint64 hash_of(const gchar* key, gsize len)
+{
+    guint64 h = G_GUINT64_CONSTANT(14695981039346656037);
+    gsize   i = 0;
+
+    for ( i = 0; i < len; i++ ) {
+        h = (h ^ (guchar) key[i]) * G_GUINT64_CONSTANT(1099511628211);
+    }
+    return h;
+}
+
+static guint column(guint64 h, guint row)
+{
+    guint32 h1 = (guint32) h;
+    guint32 h2 = (guint32) (h >> 32) | 1;
+    return (h1 + row * h2) % WIDTH;
+}
+
+static void estimate(const ntl_TopK* t, guint64 h, guint64* count, guint64* bytes)
+{
+    guint row = 0;
+
+    *count = G_MAXUINT64;
+    *bytes = G_MAXUINT64;
+    for ( row = 0; row < DEPTH; row++ ) {
+        guint c = column(h, row);
+        *count = MIN(*count, t->sum.count[row][c]);
+        *bytes = MIN(*bytes, t->sum.bytes[row][c]);
+    }
+}
+
+static void swap(ntl_TopK* t, guint a, guint b)
+{
+    Entry* e = t->heap[a];
+    t->heap[a] = t->heap[b];
+    t->heap[b] = e;
+    t->heap[a]->pos = a;
+    t->heap[b]->pos = b;
+}
+
+static void sift_up(ntl_TopK* t, guint i)
+{
+    while ( i > 0 && t->heap[(i - 1) / 2]->count > t->heap[i]->count ) {
+        swap(t, i, (i - 1) / 2);
+        i = (i - 1) / 2;
+    }
+}
+
+static void sift_down(ntl_TopK* t, guint i)
+{
+    for ( ;; ) {
+        guint least = i;
+        guint c = 2 * i + 1;
+
+        if ( c < t->n && t->heap[c]->count < t->heap[least]->count ) {
+            least = c;
+        }
+        if ( c + 1 < t->n && t->heap[c + 1]->count < t->heap[least]->count ) {
+            least = c + 1;
+        }
+        if ( least == i ) {
+            return;
+        }
+        swap(t, i, least);
+        i = least;
+    }
+}
+
+static void free_entry(Entry* e)
+{
+    g_free(e->key);
+    g_free(e);
+}
+
+/* re-estimates every entry, dropping those which have aged out */
+static void refresh(ntl_TopK* t)
+{
+    guint i = 0;
+    guint kept = 0;
+
+    for ( i = 0; i < t->n; i++ ) {
+        Entry* e = t->heap[i];
+        estimate(t, e->hash, &e->count, &e->bytes);
+        if ( 0 == e->count ) {
+            g_hash_table_remove(t->index, e->key);
+            free_entry(e);
+        } else {
+            e->pos = kept;
+            t->heap[kept++] = e;
+        }
+    }
+    t->n = kept;
+    for ( i = t->n / 2; i-- > 0; ) {
+        sift_down(t, i);
+    }
+}
+
+static void clear_window(ntl_TopK* t, Sketch* w)
+{
+    guint row = 0;
+    guint c = 0;
+
+    for ( row = 0; row < DEPTH; row++ ) {
+        for ( c = 0; c < WIDTH; c++ ) {
+            t->sum.count[row][c] -= w->count[row][c];
+            t->sum.bytes[row][c] -= w->bytes[row][c];
+        }
+    }
+    t->sum.total_count -= w->total_count;
+    t->sum.total_bytes -= w->total_bytes;
+    memset(w, 0, sizeof(Sketch));
+}
+
+static void rotate(ntl_TopK* t, gint64 now)
+{
+    guint expired = 0;
+
+    if ( 0 == t->started ) {
+        t->first = t->started = now;
+        return;
+    }
+    while ( now - t->started >= t->window_us && expired <= t->n_windows ) {
+        t->current = (t->current + 1) % t->n_windows;
+        clear_window(t, t->windows + t->current);
+        t->started += t->window_us;
+        expired++;
+    }
+    if ( expired > 0 ) {
+        if ( now - t->started >= t->window_us ) {
+            /* idle for longer than the whole window */
+            t->started = now;
+        }
+        refresh(t);
+    }
+}
+
+static gint by_count(gconstpointer a, gconstpointer b)
+{
+    const ntl_TopEntry* x = (const ntl_TopEntry*) a;
+    const ntl_TopEntry* y = (const ntl_TopEntry*) b;
+    return x->count < y->count ? 1 : (x->count > y->count ? -1 : 0);
+}
+
+/* public */
+ntl_TopK* ntl_top_k_new(guint k, guint n_windows, guint window_secs)
+{
+    ntl_TopK* rv = g_new0(ntl_TopK, 1);
+
+    rv->k = MAX(k, 1);
+    rv->n_windows = MAX(n_windows, 1);
+    rv->window_us = (gint64) MAX(window_secs, 1) * G_USEC_PER_SEC;
+    rv->windows = g_new0(Sketch, rv->n_windows);
+    rv->heap = g_new0(Entry*, rv->k);
+    rv->index = g_hash_table_new(g_str_hash, g_str_equal);
+    return rv;
+}
+
+void ntl_top_k_add(ntl_TopK* t, const gchar* key, gsize bytes, gint64 now)
+{
+    gsize   len = MIN(strlen(key), KEY_MAX);
+    guint64 h = hash_of(key, len);
+    Sketch* w = NULL;
+    Entry*  e = NULL;
+    guint64 count = 0;
+    guint64 total = 0;
+    guint   row = 0;
+
+    rotate(t, now);
+    w = t->windows + t->current;
+    for ( row = 0; row < DEPTH; row++ ) {
+        guint c = column(h, row);
+        w->count[row][c]++;
+        w->bytes[row][c] += bytes;
+        t->sum.count[row][c]++;
+        t->sum.bytes[row][c] += bytes;
+    }
+    w->total_count++;
+    w->total_bytes += bytes;
+    t->sum.total_count++;
+    t->sum.total_bytes += bytes;
+
+    estimate(t, h, &count, &total);
+    if ( len < strlen(key) ) {
+        /* only ever seen truncated */
+        gchar* k = g_strndup(key, len);
+        e = (Entry*) g_hash_table_lookup(t->index, k);
+        g_free(k);
+    } else {
+        e = (Entry*) g_hash_table_lookup(t->index, key);
+    }
+    if ( e ) {
+        e->count = count;
+        e->bytes = total;
+        sift_down(t, e->pos);
+        return;
+    }
+    if ( t->n < t->k ) {
+        e = g_new0(Entry, 1);
+        e->pos = t->n;
+        t->heap[t->n++] = e;
+    } else if ( count > t->heap[0]->count ) {
+        e = t->heap[0];
+        g_hash_table_remove(t->index, e->key);
+        g_free(e->key);
+    } else {
+        return;
+    }
+    e->key = g_strndup(key, len);
+    e->hash = h;
+    e->count = count;
+    e->bytes = total;
+    g_hash_table_insert(t->index, e->key, e);
+    sift_up(t, e->pos);
+    sift_down(t, e->pos);
+}
+
+guint ntl_top_k_list(ntl_TopK* t, gint64 now, ntl_TopEntry* out, guint max)
+{
+    ntl_TopEntry* all = g_new(ntl_TopEntry, t->n + 1);
+    guint         i = 0;
+
+    rotate(t, now);
+    for ( i = 0; i < t->n; i++ ) {
+        all[i].key = t->heap[i]->key;
+        all[i].count = t->heap[i]->count;
+        all[i].bytes = t->heap[i]->bytes;
+    }
+    qsort(all, t->n, sizeof(ntl_TopEntry), by_count);
+    max = MIN(max, t->n);
+    memcpy(out, all, max * sizeof(ntl_TopEntry));
+    g_free(all);
+    return max;
+}
+
+void ntl_top_k_totals(ntl_TopK* t, gint64 now, guint64* count, guint64* bytes, gdouble* secs)
+{
+    rotate(t, now);
+    *count = t->sum.total_count;
+    *bytes = t->sum.total_bytes;
+    /* the expired sub-windows plus the current one, since the first add */
+    *secs = MIN((gdouble) (now - t->first),
+                (gdouble) ((t->n_windows - 1) * t->window_us + (now - t->started))) / G_USEC_PER_SEC;
+}
+
+void ntl_top_k_dump(ntl_TopK* t, const gchar* name, gint64 now, guint max, GString* out)
+{
+    ntl_TopEntry* top = g_new(ntl_TopEntry, t->k);
+    guint64       count = 0;
+    guint64       bytes = 0;
+    gdouble       secs = 0;
+    guint         n = ntl_top_k_list(t, now, top, MIN(max, t->k));
+    guint         i = 0;
+
+    ntl_top_k_totals(t, now, &count, &bytes, &secs);
+    secs = MAX(secs, 1e-3);
+    g_string_append_printf(out,
+        "%s window=%.0fs count=%" G_GUINT64_FORMAT " rate=%.1f bytes=%" G_GUINT64_FORMAT "\n",
+        name, secs, count, count / secs, bytes);
+    for ( i = 0; i < n; i++ ) {
+        g_string_append_printf(out,
+            "%s %u %s count=%" G_GUINT64_FORMAT " rate=%.1f bytes=%" G_GUINT64_FORMAT " share=%.1f%%\n",
+            name, i + 1, top[i].key, top[i].count, top[i].count / secs, top[i].bytes,
+            bytes ? 100.0 * top[i].bytes / bytes : 0.0);
+    }
+    g_free(top);
+}
+
+void ntl_top_k_reset(ntl_TopK* t)
+{
+    guint i = 0;
+
+    for ( i = 0; i < t->n; i++ ) {
+        free_entry(t->heap[i]);
+    }
+    t->n = 0;
+    g_hash_table_remove_all(t->index);
+    memset(t->windows, 0, t->n_windows * sizeof(Sketch));
+    memset(&t->sum, 0, sizeof(Sketch));
+    t->current = 0;
+    t->first = t->started = 0;
+}
+
+void ntl_top_k_free(ntl_TopK* t)
+{
+    if ( t ) {
+        ntl_top_k_reset(t);
+        g_hash_table_destroy(t->index);
+        g_free(t->heap);
+        g_free(t->windows);
+        g_free(t);
+    }
+}
@@ -0,0 +1,265 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "ntlu.h"
+
+#include <string.h>
+#include <zlib.h>
+
+/*
+ * A link's lines are compressed as one zlib stream, flushed to a byte
+ * boundary after each chunk, so that every chunk can be decoded as it
+ * arrives and later chunks still refer back to earlier ones. Chunks go
+ * out base64-encoded as "z:..." lines, or "Z:..." for the first chunk
+ * of a new stream, which is how a writer restarts after a chunk was
+ * lost (say, shed by a backed-up connection). Both ends start each
+ * stream with a preset dictionary; the built-in one is a few typical
+ * traces, so that even the first lines compress well.
+ */
+
+/* private */
+#define DICT_MAX (32 * 1024)
+
+/* the most common strings go last, nearest the data */
+static const gchar default_dict[] =
+    "msg:repeated 2 times between 00:00:00.000 and 00:00:00.000, rp:2 }\n"
+    "{ pn:ntld, pid:0, tid:0, tl:0, tm:1300000000, millis:0, tag:ntl.rollup, mod:main, fn:trace, msg:count=1 bytes=100 secs=60 }\n"
+    "{ pn:main, pid:1000, tid:1000, tl:0, tm:1300000000, millis:0, tag:ntl.span, mod:main, fn:main, msg:count=1 p50=1 p99=1 max=1 }\n"
+    "{ pn:main, pid:1000, tid:1000, tl:2, tm:1300000000, millis:100, tag:main, mod:main.c, fn:main, msg:failed: error, kv:AQ }\n"
+    "{ pn:main, pid:1000, tid:1000, tl:1, tm:1300000000, millis:100, tag:main, mod:main.c, fn:main, msg:, lq:1300000000000000, ls:1300000000000000, li:1300000000000000, le:1300000000000000, hn:localhost }\n"
+    "{ pn:main, pid:1000, tid:1000, tl:0, tm:1300000000, millis:100, tag:main, mod:main.c, fn:main, msg: }\n";
+
+struct _s_ntl_zwriter {
+    z_stream zs;
+    gboolean fresh; /* the next chunk starts a new stream */
+    gchar*   dict;
+    gsize    dict_len;
+    GString* buf;
+    guint64  raw;
+    guint64  wire;
+    guint64  chunks;
+    guint64  usecs;
+};
+
+struct _s_ntl_zreader {
+    z_stream zs;
+    gboolean live; /* in a stream, and it decodes */
+    gchar*   dict;
+    gsize    dict_len;
+    GString* buf;
+    guint64  raw;
+    guint64  wire;
+    guint64  chunks;
+    guint64  errors;
+    guint64  usecs;
+};
+
+/* only the last 32KB of a dictionary is of any use to zlib */
+static gchar* copy_dict(const gchar* dict, gsize len, gsize* dict_len)
+{
+    if ( NULL == dict || 0 == len ) {
+        dict = default_dict;
+        len = sizeof(default_dict) - 1;
+    }
+    if ( len > DICT_MAX ) {
+        dict += len - DICT_MAX;
+        len = DICT_MAX;
+    }
+    *dict_len = len;
+    return g_memdup(dict, len);
+}
+
+static void dump(const gchar* name, guint64 raw, guint64 wire, guint64 chunks, guint64 usecs, GString* out)
+{
+    g_string_append_printf(out,
+        "%s raw=%" G_GUINT64_FORMAT " wire=%" G_GUINT64_FORMAT " ratio=%.2f chunks=%" G_GUINT64_FORMAT
+        " us=%" G_GUINT64_FORMAT,
+        name, raw, wire, wire ? (gdouble) raw / wire : 0.0, chunks, usecs);
+}
+
+/* tries the dictionary zlib asks for, by its checksum */
+static gboolean set_dict(ntl_ZReader* z)
+{
+    uLong want = z->zs.adler;
+
+    if ( want == adler32(adler32(0, NULL, 0), (const Bytef*) z->dict, z->dict_len) ) {
+        return Z_OK == inflateSetDictionary(&z->zs, (const Bytef*) z->dict, z->dict_len);
+    }
+    if ( want == adler32(adler32(0, NULL, 0), (const Bytef*) default_dict, sizeof(default_dict) - 1) ) {
+        return Z_OK == inflateSetDictionary(&z->zs, (const Bytef*) default_dict, sizeof(default_dict) - 1);
+    }
+    return FALSE;
+}
+
+/* public */
+ntl_ZWriter* ntl_zwriter_new(gint level, const gchar* dict, gsize dict_len)
+{
+    ntl_ZWriter* rv = g_new0(ntl_ZWriter, 1);
+
+    if ( Z_OK != deflateInit2(&rv->zs, CLAMP(level, 1, 9), Z_DEFLATED, 15, 8, Z_DEFAULT_STRATEGY) ) {
+        g_free(rv);
+        return NULL;
+    }
+    rv->fresh = TRUE;
+    rv->dict = copy_dict(dict, dict_len, &rv->dict_len);
+    rv->buf = g_string_sized_new(4096);
+    return rv;
+}
+
+void ntl_zwriter_reset(ntl_ZWriter* z)
+{
+    z->fresh = TRUE;
+}
+
+void ntl_zwriter_write(ntl_ZWriter* z, const gchar* data, gsize len, GString* out)
+{
+    gint64 start = g_get_monotonic_time();
+    gsize  used = 0;
+    gsize  from = out->len;
+    gsize  at = 0;
+    gint   state = 0;
+    gint   save = 0;
+
+    if ( z->fresh ) {
+        deflateReset(&z->zs);
+        deflateSetDictionary(&z->zs, (const Bytef*) z->dict, z->dict_len);
+    }
+    g_string_set_size(z->buf, deflateBound(&z->zs, len) + 64);
+    z->zs.next_in = (Bytef*) data;
+    z->zs.avail_in = len;
+    do {
+        if ( used == z->buf->len ) {
+            g_string_set_size(z->buf, z->buf->len * 2);
+        }
+        z->zs.next_out = (Bytef*) z->buf->str + used;
+        z->zs.avail_out = z->buf->len - used;
+        deflate(&z->zs, Z_SYNC_FLUSH);
+        used = z->buf->len - z->zs.avail_out;
+    } while ( 0 == z->zs.avail_out );
+
+    g_string_append(out, z->fresh ? "Z:" : "z:");
+    at = out->len;
+    g_string_set_size(out, at + (used / 3 + 2) * 4 + 4);
+    at += g_base64_encode_step((const guchar*) z->buf->str, used, FALSE, out->str + at, &state, &save);
+    at += g_base64_encode_close(FALSE, out->str + at, &state, &save);
+    g_string_truncate(out, at);
+    g_string_append_c(out, '\n');
+
+    z->fresh = FALSE;
+    z->raw += len;
+    z->wire += out->len - from;
+    z->chunks++;
+    z->usecs += g_get_monotonic_time() - start;
+}
+
+void ntl_zwriter_dump(const ntl_ZWriter* z, const gchar* name, GString* out)
+{
+    dump(name, z->raw, z->wire, z->chunks, z->usecs, out);
+    g_string_append_c(out, '\n');
+}
+
+void ntl_zwriter_free(ntl_ZWriter* z)
+{
+    if ( z ) {
+        deflateEnd(&z->zs);
+        g_free(z->dict);
+        g_string_free(z->buf, TRUE);
+        g_free(z);
+    }
+}
+
+ntl_ZReader* ntl_zreader_new(const gchar* dict, gsize dict_len)
+{
+    ntl_ZReader* rv = g_new0(ntl_ZReader, 1);
+
+    if ( Z_OK != inflateInit2(&rv->zs, 15) ) {
+        g_free(rv);
+        return NULL;
+    }
+    rv->dict = copy_dict(dict, dict_len, &rv->dict_len);
+    rv->buf = g_string_sized_new(4096);
+    return rv;
+}
+
+gboolean ntl_zreader_read(ntl_ZReader* z, const gchar* ln, GString* out)
+{
+    gint64 start = g_get_monotonic_time();
+    gsize  len = strcspn(ln, "\r\n");
+    gsize  n = 0;
+    gint   state = 0;
+    guint  save = 0;
+    gint   rc = Z_OK;
+
+    if ( !NTL_ZCHUNK(ln) ) {
+        return FALSE;
+    }
+    if ( 'Z' == ln[0] ) {
+        inflateReset(&z->zs);
+        z->live = TRUE;
+    }
+    if ( !z->live ) {
+        /* lost the start of this stream; wait for the next one */
+        z->errors++;
+        return FALSE;
+    }
+    g_string_set_size(z->buf, (len - 2) / 4 * 3 + 3);
+    n = g_base64_decode_step(ln + 2, len - 2, (guchar*) z->buf->str, &state, &save);
+    z->zs.next_in = (Bytef*) z->buf->str;
+    z->zs.avail_in = n;
+    while ( TRUE ) {
+        gsize at = out->len;
+        gsize room = MAX(n * 4, 4096);
+
+        g_string_set_size(out, at + room);
+        z->zs.next_out = (Bytef*) out->str + at;
+        z->zs.avail_out = room;
+        rc = inflate(&z->zs, Z_SYNC_FLUSH);
+        g_string_set_size(out, at + room - z->zs.avail_out);
+        z->raw += room - z->zs.avail_out;
+        if ( Z_NEED_DICT == rc && set_dict(z) ) {
+            continue;
+        }
+        if ( Z_OK != rc && Z_BUF_ERROR != rc ) {
+            z->live = FALSE;
+            z->errors++;
+            return FALSE;
+        }
+        if ( 0 == z->zs.avail_in && z->zs.avail_out > 0 ) {
+            break;
+        }
+    }
+    z->wire += len + 1;
+    z->chunks++;
+    z->usecs += g_get_monotonic_time() - start;
+    return TRUE;
+}
+
+void ntl_zreader_dump(const ntl_ZReader* z, const gchar* name, GString* out)
+{
+    dump(name, z->raw, z->wire, z->chunks, z->usecs, out);
+    g_string_append_printf(out, " errors=%" G_GUINT64_FORMAT "\n", z->errors);
+}
+
+void ntl_zreader_free(ntl_ZReader* z)
+{
+    if ( z ) {
+        inflateEnd(&z->zs);
+        g_free(z->dict);
+        g_string_free(z->buf, TRUE);
+        g_free(z);
+    }
+}
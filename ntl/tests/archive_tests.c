@@ -0,0 +1,180 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "archive_tests.h"
+
+#include "ntl_archive.h"
+#include "ntll.h"
+#include "cmockery_all.h"
+#include <glib.h>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+static gchar* write_archive(guint rows, guint block_rows)
+{
+    gchar*             fn = g_strdup_printf("%s/ntl_archive_test.%u", g_get_tmp_dir(), getpid());
+    ntl_ArchiveWriter* w = NULL;
+    guint              i = 0;
+
+    unlink(fn);
+    w = ntl_archive_writer_new(fn, block_rows);
+    for ( i = 0; i < rows; i++ ) {
+        ntl_Packet pkt;
+        gchar*     msg = g_strdup_printf("message number %u", i);
+
+        pkt.prog = "test_prog";
+        pkt.pid = 1122;
+        pkt.tid = 3344 + i % 3;
+        pkt.lvl = (0 == i % 10) ? ntl_tl_Error : ntl_tl_Debug;
+        pkt.time = 5555 + i / 7;
+        pkt.millis = (i * 37) % 1000;
+        pkt.tag = (i < block_rows) ? "first" : "later";
+        pkt.mod = "module";
+        pkt.fn = "fn";
+        pkt.msg = msg;
+        pkt.host = NULL;
+        pkt.fields = NULL;
+        ntl_archive_writer_append(w, &pkt);
+        g_free(msg);
+    }
+    ntl_archive_writer_free(w);
+    return fn;
+}
+
+void test_archive_roundtrip(void** state)
+{
+    gchar*                  fn = write_archive(250, 100);
+    gchar*                  data = NULL;
+    gsize                   len = 0;
+    ntl_ArchiveReader*      r = NULL;
+    const ntl_ArchiveStats* s = NULL;
+    guint                   blocks = 0;
+    guint                   row = 0;
+
+    assert_true(g_file_get_contents(fn, &data, &len, NULL));
+    assert_true(ntl_archive_is_archive(data, len));
+    r = ntl_archive_reader_new(data, len);
+    assert_false(NULL == r);
+
+    while ( (s = ntl_archive_reader_next(r)) ) {
+        GPtrArray* pkts = ntl_archive_reader_decode(r);
+        guint      i = 0;
+
+        assert_false(NULL == pkts);
+        assert_int_equal(s->rows, pkts->len);
+        assert_int_equal(0 == blocks, ntl_archive_stats_has(s, ntl_ad_Tag, "first"));
+        assert_int_equal((1u << ntl_tl_Error) | (1u << ntl_tl_Debug), s->level_mask);
+        for ( i = 0; i < pkts->len; i++, row++ ) {
+            ntl_Packet* pkt = (ntl_Packet*) g_ptr_array_index(pkts, i);
+            gchar*      msg = g_strdup_printf("message number %u", row);
+            long long   ms = (long long) pkt->time * 1000 + pkt->millis;
+
+            assert_int_equal(5555 + row / 7, pkt->time);
+            assert_int_equal((row * 37) % 1000, pkt->millis);
+            assert_int_equal(3344 + row % 3, pkt->tid);
+            assert_true(ms >= s->min_ms && ms <= s->max_ms);
+            assert_string_equal("test_prog", pkt->prog);
+            assert_string_equal(msg, pkt->msg);
+            g_free(msg);
+        }
+        g_ptr_array_free(pkts, TRUE);
+        blocks++;
+    }
+    assert_int_equal(3, blocks);
+    assert_int_equal(250, row);
+
+    ntl_archive_reader_free(r);
+    unlink(fn);
+    g_free(data);
+    g_free(fn);
+}
+
+static void put_varint(GString* s, guint64 v)
+{
+    while ( v >= 0x80 ) {
+        g_string_append_c(s, (gchar) (v | 0x80));
+        v >>= 7;
+    }
+    g_string_append_c(s, (gchar) v);
+}
+
+static void put_section(GString* s, guint64 raw, const gchar* data, gsize len)
+{
+    uLongf zlen = compressBound(len);
+    gchar* z = g_malloc(zlen);
+
+    compress2((Bytef*) z, &zlen, (const Bytef*) data, len, Z_DEFAULT_COMPRESSION);
+    put_varint(s, raw);
+    put_varint(s, zlen);
+    g_string_append_len(s, z, zlen);
+    g_free(z);
+}
+
+/* an archive of one block holding the given row count and sections */
+static gboolean decodes(guint64 rows, guint64 col_raw, guint64 extra_zlen)
+{
+    GString*           s = g_string_new_len("NTLA\1\0\0\0NTLB\0\0\0\0", 16);
+    guint32            len = 0;
+    guint              d = 0;
+    ntl_ArchiveReader* r = NULL;
+    GPtrArray*         pkts = NULL;
+    gboolean           rv = FALSE;
+
+    put_varint(s, rows);
+    put_varint(s, 0);
+    put_varint(s, 0);
+    put_varint(s, 0);
+    for ( d = 0; d < ntl_ad_Count; d++ ) {
+        put_varint(s, 0);
+    }
+    put_section(s, col_raw, "\0\0\0\0\0\0\0\0\0", 9);
+    if ( extra_zlen ) {
+        put_varint(s, 1);
+        put_varint(s, extra_zlen);
+    } else {
+        put_section(s, 0, "", 0);
+    }
+    len = GUINT32_TO_LE(s->len - 16);
+    memcpy(s->str + 12, &len, 4);
+
+    r = ntl_archive_reader_new(s->str, s->len);
+    if ( ntl_archive_reader_next(r) ) {
+        pkts = ntl_archive_reader_decode(r);
+        rv = NULL != pkts;
+        if ( pkts ) {
+            g_ptr_array_free(pkts, TRUE);
+        }
+    }
+    ntl_archive_reader_free(r);
+    g_string_free(s, TRUE);
+    return rv;
+}
+
+void test_archive_corrupt(void** state)
+{
+    /* one row of zeros is well formed */
+    assert_true(decodes(1, 9, 0));
+    /* more rows than the columns hold */
+    assert_false(decodes(1000 * 1000 * 1000, 9, 0));
+    assert_false(decodes(G_MAXUINT64 >> 1, 9, 0));
+    /* a raw size beyond what the compressed bytes could inflate to */
+    assert_false(decodes(1, G_GUINT64_CONSTANT(1) << 40, 0));
+    /* a compressed size past the end of the block */
+    assert_false(decodes(1, 9, 1 << 30));
+}
@@ -55,3 +55,102 @@ void test_decode(void** state)
     g_free(wire_pkt);
     ntl_packet_free(pkt);
 }
+
+void test_decode_stamps(void** state)
+{
+    ntl_Packet* plain = ntl_packet_decode(
+        "{ pn:p, pid:1, tid:2, tl:0, tm:5555, millis:42, tag:t, mod:m, fn:f, msg:the msg }");
+    ntl_Packet* stamped = ntl_packet_decode(
+        "{ pn:p, pid:1, tid:2, tl:0, tm:5555, millis:42, tag:t, mod:m, fn:f, msg:the msg"
+        ", lq:1000000000000001, ls:1000000000000002, li:1000000000000003, le:1000000000000004 }");
+
+    assert_int_equal(0, plain->stamps[ntl_ts_Enqueue]);
+    assert_int_equal(0, plain->stamps[ntl_ts_Egress]);
+    assert_true(1000000000000001LL == stamped->stamps[ntl_ts_Enqueue]);
+    assert_true(1000000000000002LL == stamped->stamps[ntl_ts_Send]);
+    assert_true(1000000000000003LL == stamped->stamps[ntl_ts_Ingress]);
+    assert_true(1000000000000004LL == stamped->stamps[ntl_ts_Egress]);
+    assert_int_equal(0, stamped->stamps[ntl_ts_Deliver]);
+    assert_string_equal("the msg", stamped->msg);
+
+    ntl_packet_free(plain);
+    ntl_packet_free(stamped);
+}
+
+void test_span_stats(void** state)
+{
+    ntl_Packet*   pkt = ntl_packet_decode(
+        "{ pn:p, pid:1, tid:2, tl:0, tm:5555, millis:42, tag:ntl.span, mod:ntl, fn:db.query"
+        ", msg:db.query count=12 p50=1500 p99=90000 max=123456 }");
+    ntl_Packet*   other = ntl_packet_decode(
+        "{ pn:p, pid:1, tid:2, tl:0, tm:5555, millis:42, tag:t, mod:m, fn:f, msg:count=1 p50=2 p99=3 max=4 }");
+    ntl_SpanStats s;
+
+    assert_true(ntl_span_stats_parse(pkt, &s));
+    assert_string_equal("db.query", s.name);
+    assert_int_equal(12, s.count);
+    assert_int_equal(1500, s.p50);
+    assert_int_equal(90000, s.p99);
+    assert_int_equal(123456, s.max);
+    assert_false(ntl_span_stats_parse(other, &s));
+
+    ntl_packet_free(pkt);
+    ntl_packet_free(other);
+}
+
+void test_decode_fields(void** state)
+{
+    /* as sent by ntl_trace_fields() with bytes=-1234567890123, ms=2.5,
+     * path="/a, b}" and hit=true */
+    ntl_Packet*    pkt = ntl_packet_decode(
+        "{ pn:p, pid:1, tid:2, tl:2, tm:5555, millis:42, tag:t, mod:m, fn:f, msg:sent 3"
+        ", kv:AQAFYnl0ZXOVk9if7kcBAm1zAAAAAAAABEACBHBhdGgGL2EsIGJ9AwNoaXQB }");
+    ntl_Packet*    copy = NULL;
+    ntl_Packet*    bad = ntl_packet_decode(
+        "{ pn:p, pid:1, tid:2, tl:2, tm:5555, millis:42, tag:t, mod:m, fn:f, msg:x, kv:AQAF }");
+    ntl_FieldTypeT type = ntl_ft_Bool;
+    gint64         i = 0;
+    gdouble        d = 0;
+    const char*    s = NULL;
+    gboolean       b = FALSE;
+
+    assert_int_equal(4, ntl_packet_field_count(pkt));
+    assert_string_equal("bytes", ntl_packet_field_key(pkt, 0));
+    assert_true(ntl_packet_field_type(pkt, "bytes", &type));
+    assert_int_equal(ntl_ft_Int, type);
+    assert_true(ntl_packet_field_int(pkt, "bytes", &i));
+    assert_true(-1234567890123LL == i);
+    assert_true(ntl_packet_field_double(pkt, "bytes", &d));
+    assert_true(ntl_packet_field_double(pkt, "ms", &d));
+    assert_true(2.5 == d);
+    assert_false(ntl_packet_field_int(pkt, "ms", &i));
+    assert_true(ntl_packet_field_string(pkt, "path", &s));
+    assert_string_equal("/a, b}", s);
+    assert_true(ntl_packet_field_bool(pkt, "hit", &b));
+    assert_true(b);
+    assert_false(ntl_packet_field_type(pkt, "nonesuch", &type));
+    assert_string_equal("sent 3", pkt->msg);
+
+    copy = ntl_packet_copy(pkt);
+    ntl_packet_free(pkt);
+    assert_true(ntl_packet_field_string(copy, "path", &s));
+    assert_string_equal("/a, b}", s);
+
+    {
+        ntl_Template* t = ntl_template_compile("%{msg}%{fields}|%{fields:json}");
+        GString*      out = g_string_new(NULL);
+        ntl_template_render(t, out, copy);
+        assert_string_equal(
+            "sent 3 bytes=-1234567890123 ms=2.5 path=/a, b} hit=true"
+            "|,\"bytes\":-1234567890123,\"ms\":2.5,\"path\":\"/a, b}\",\"hit\":true\n",
+            out->str);
+        g_string_free(out, TRUE);
+        ntl_template_free(t);
+    }
+
+    /* a truncated set is dropped */
+    assert_int_equal(0, ntl_packet_field_count(bad));
+
+    ntl_packet_free(copy);
+    ntl_packet_free(bad);
+}
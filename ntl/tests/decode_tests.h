@@ -19,5 +19,8 @@
 #define __decode_tests_h_
 
 void test_decode(void** state);
+void test_decode_stamps(void** state);
+void test_decode_fields(void** state);
+void test_span_stats(void** state);
 
 #endif
@@ -0,0 +1,85 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "dedup_tests.h"
+
+#include "ntll.h"
+#include "ntlu.h"
+#include "cmockery_all.h"
+#include <glib.h>
+
+static void keep_summary(const gchar* ln, gpointer d)
+{
+    g_ptr_array_add((GPtrArray*) d, g_strdup(ln));
+}
+
+static gchar* line(guint pid, const gchar* fn, guint millis, const gchar* msg)
+{
+    return g_strdup_printf(
+        "{ pn:prog, pid:%u, tid:7, tl:1, tm:1000, millis:%u, tag:tag, mod:mod, fn:%s, msg:%s, lq:%u, ls:%u }",
+        pid, millis, fn, msg, millis, millis);
+}
+
+static gboolean check(ntl_Dedup* dd, guint pid, const gchar* fn, guint millis, const gchar* msg, gint64 now)
+{
+    gchar*   ln = line(pid, fn, millis, msg);
+    gboolean rv = ntl_dedup_check(dd, ln, now);
+    g_free(ln);
+    return rv;
+}
+
+void test_dedup(void** state)
+{
+    GPtrArray*  sums = g_ptr_array_new_with_free_func(g_free);
+    ntl_Dedup*  dd = ntl_dedup_new(100, keep_summary, sums);
+    ntl_Packet* pkt = NULL;
+    gint64      now = 1000000;
+    guint       i = 0;
+
+    assert_false(check(dd, 1, "f", 0, "retrying", now));
+    for ( i = 1; i <= 5; i++ ) {
+        assert_true(check(dd, 1, "f", i, "retrying", now + i));
+    }
+    /* another pid or call site is another run */
+    assert_false(check(dd, 2, "f", 6, "retrying", now + 6));
+    assert_false(check(dd, 1, "g", 7, "retrying", now + 7));
+    assert_int_equal(0, sums->len);
+
+    /* a new message ends the run */
+    assert_false(check(dd, 1, "f", 8, "gave up", now + 8));
+    assert_int_equal(1, sums->len);
+    pkt = ntl_packet_decode(g_ptr_array_index(sums, 0));
+    assert_int_equal(5, pkt->repeats);
+    assert_int_equal(1, pkt->pid);
+    assert_string_equal("f", pkt->fn);
+    assert_int_equal(5, pkt->millis);
+    assert_true(g_str_has_prefix(pkt->msg, "repeated 5 times between "));
+    ntl_packet_free(pkt);
+
+    /* as does going quiet for longer than the window */
+    assert_true(check(dd, 1, "f", 9, "gave up", now + 9));
+    assert_false(check(dd, 1, "f", 500, "gave up", now + 200000));
+    assert_int_equal(2, sums->len);
+    assert_true(check(dd, 1, "f", 501, "gave up", now + 200001));
+    ntl_dedup_expire(dd, now + 200002);
+    assert_int_equal(2, sums->len);
+    ntl_dedup_expire(dd, now + 400000);
+    assert_int_equal(3, sums->len);
+
+    ntl_dedup_free(dd);
+    g_ptr_array_free(sums, TRUE);
+}
@@ -0,0 +1,70 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "histogram_tests.h"
+
+#include "ntlu.h"
+#include "cmockery_all.h"
+#include <glib.h>
+
+/* true if a reported value is within the histogram's precision */
+static gboolean close_to(guint64 expected, guint64 actual)
+{
+    guint64 diff = expected > actual ? expected - actual : actual - expected;
+    return diff * 32 <= expected || diff <= 1;
+}
+
+void test_histogram_percentiles(void** state)
+{
+    ntl_Histogram* h = ntl_histogram_new();
+    ntl_Histogram* m = ntl_histogram_new();
+    GString*       out = g_string_new("");
+    guint64        v = 0;
+
+    assert_int_equal(0, ntl_histogram_percentile(h, 50));
+
+    for ( v = 1; v <= 100000; v++ ) {
+        ntl_histogram_record(h, v);
+    }
+    assert_int_equal(100000, ntl_histogram_count(h));
+    assert_int_equal(100000, ntl_histogram_max(h));
+    assert_true(close_to(50000, ntl_histogram_percentile(h, 50)));
+    assert_true(close_to(99000, ntl_histogram_percentile(h, 99)));
+    assert_true(close_to(1000, ntl_histogram_percentile(h, 1)));
+    assert_int_equal(100000, ntl_histogram_percentile(h, 100));
+
+    /* small values are exact */
+    ntl_histogram_record(m, 7);
+    ntl_histogram_record(m, 7);
+    ntl_histogram_record(m, 63);
+    assert_int_equal(7, ntl_histogram_percentile(m, 50));
+    assert_int_equal(63, ntl_histogram_percentile(m, 100));
+
+    ntl_histogram_merge(m, h);
+    assert_int_equal(100003, ntl_histogram_count(m));
+
+    ntl_histogram_dump(m, "hop", out);
+    assert_true(g_str_has_prefix(out->str, "hop count=100003 p50="));
+
+    ntl_histogram_reset(m);
+    assert_int_equal(0, ntl_histogram_count(m));
+    assert_int_equal(0, ntl_histogram_max(m));
+
+    g_string_free(out, TRUE);
+    ntl_histogram_free(h);
+    ntl_histogram_free(m);
+}
@@ -18,12 +18,50 @@
 #include "cmockery_all.h"
 #include "trace_tests.h"
 #include "decode_tests.h"
+#include "template_tests.h"
+#include "archive_tests.h"
+#include "histogram_tests.h"
+#include "topk_tests.h"
+#include "dedup_tests.h"
+#include "rollup_tests.h"
+#include "relay_tests.h"
+#include "zstream_tests.h"
+#include "reorder_tests.h"
+#include "trigram_tests.h"
+#include "shm_ring_tests.h"
+#include "writer_tests.h"
+#include "shard_tests.h"
 
 int main(int argc, char* argv[])
 {
     const UnitTest tests[] = {
         unit_test_setup_teardown(test_trace, NULL, NULL),
+        unit_test_setup_teardown(test_span, NULL, NULL),
+        unit_test_setup_teardown(test_level_control, NULL, NULL),
+        unit_test_setup_teardown(test_crash_ring, NULL, NULL),
+        unit_test_setup_teardown(test_crash_ring_files, NULL, NULL),
         unit_test_setup_teardown(test_decode, NULL, NULL),
+        unit_test_setup_teardown(test_decode_stamps, NULL, NULL),
+        unit_test_setup_teardown(test_decode_fields, NULL, NULL),
+        unit_test_setup_teardown(test_span_stats, NULL, NULL),
+        unit_test_setup_teardown(test_template_default, NULL, NULL),
+        unit_test_setup_teardown(test_template_escaping, NULL, NULL),
+        unit_test_setup_teardown(test_archive_roundtrip, NULL, NULL),
+        unit_test_setup_teardown(test_archive_corrupt, NULL, NULL),
+        unit_test_setup_teardown(test_histogram_percentiles, NULL, NULL),
+        unit_test_setup_teardown(test_top_k, NULL, NULL),
+        unit_test_setup_teardown(test_dedup, NULL, NULL),
+        unit_test_setup_teardown(test_rollup, NULL, NULL),
+        unit_test_setup_teardown(test_relay_queue, NULL, NULL),
+        unit_test_setup_teardown(test_zstream, NULL, NULL),
+        unit_test_setup_teardown(test_reorder, NULL, NULL),
+        unit_test_setup_teardown(test_trigram_index, NULL, NULL),
+        unit_test_setup_teardown(test_shm_ring, NULL, NULL),
+        unit_test_setup_teardown(test_writer_rotation, NULL, NULL),
+        unit_test_setup_teardown(test_writer_retention_bytes, NULL, NULL),
+        unit_test_setup_teardown(test_writer_retention_shards, NULL, NULL),
+        unit_test_setup_teardown(test_sharder_order, NULL, NULL),
+        unit_test_setup_teardown(test_sharder_max_open, NULL, NULL),
     };
 
     return run_tests(tests);
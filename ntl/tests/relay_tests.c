@@ -0,0 +1,125 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "relay_tests.h"
+
+#include "ntll.h"
+#include "ntlu.h"
+#include "cmockery_all.h"
+#include <glib.h>
+#include <string.h>
+
+static void push(ntl_RelayQueue* q, guint i, const gchar* hn)
+{
+    gchar* ln = g_strdup_printf(
+        "{ pn:prog, pid:1, tid:1, tl:2, tm:1000, millis:%u, tag:tag, mod:mod, fn:fn, msg:number %u%s%s }",
+        i, i, hn ? ", hn:" : "", hn ? hn : "");
+    ntl_relay_queue_push(q, ln, "here");
+    g_free(ln);
+}
+
+void test_relay_queue(void** state)
+{
+    ntl_RelayQueue* q = ntl_relay_queue_new(1024 * 1024);
+    GString*        out = g_string_new("");
+    gchar**         lines = NULL;
+    ntl_Packet*     pkt = NULL;
+    guint           i = 0;
+
+    for ( i = 0; i < 3; i++ ) {
+        push(q, i, NULL);
+    }
+    /* already relayed once, so it keeps its first host */
+    push(q, 3, "there");
+    assert_int_equal(4, ntl_relay_queue_unsent(q));
+    assert_true(ntl_relay_queue_bytes(q) > 4 * 50);
+
+    assert_int_equal(1, ntl_relay_queue_batch(q, 2, out));
+    assert_int_equal(2, ntl_relay_queue_batch(q, 2, out));
+    assert_int_equal(0, ntl_relay_queue_batch(q, 2, out));
+    assert_int_equal(0, ntl_relay_queue_unsent(q));
+
+    lines = g_strsplit(out->str, "\n", -1);
+    assert_int_equal(7, g_strv_length(lines));
+    assert_string_equal("{ ctl:batch, seq:1 }", lines[2]);
+    assert_string_equal("{ ctl:batch, seq:2 }", lines[5]);
+    pkt = ntl_packet_decode(lines[0]);
+    assert_string_equal("here", pkt->host);
+    assert_string_equal("number 0", pkt->msg);
+    ntl_packet_free(pkt);
+    pkt = ntl_packet_decode(lines[4]);
+    assert_string_equal("there", pkt->host);
+    ntl_packet_free(pkt);
+    g_strfreev(lines);
+
+    /* acks are cumulative; what is unacked is sent again after a rewind */
+    assert_int_equal(2, ntl_relay_queue_ack(q, 1));
+    assert_int_equal(0, ntl_relay_queue_ack(q, 1));
+    ntl_relay_queue_rewind(q);
+    assert_int_equal(2, ntl_relay_queue_unsent(q));
+    g_string_truncate(out, 0);
+    assert_int_equal(3, ntl_relay_queue_batch(q, 10, out));
+    assert_true(NULL != strstr(out->str, "msg:number 2,"));
+    assert_int_equal(2, ntl_relay_queue_ack(q, 3));
+    assert_int_equal(0, ntl_relay_queue_bytes(q));
+    ntl_relay_queue_free(q);
+
+    /* past the limit, the oldest unsent lines are dropped */
+    q = ntl_relay_queue_new(256);
+    for ( i = 0; i < 10; i++ ) {
+        push(q, i, NULL);
+    }
+    assert_true(ntl_relay_queue_unsent(q) < 3);
+    g_string_truncate(out, 0);
+    ntl_relay_queue_batch(q, 10, out);
+    assert_true(NULL != strstr(out->str, "msg:number 9,"));
+    assert_true(NULL == strstr(out->str, "msg:number 0,"));
+    g_string_truncate(out, 0);
+    ntl_relay_queue_dump(q, out);
+    assert_true(NULL != strstr(out->str, " dropped="));
+    ntl_relay_queue_free(q);
+
+    /* an upstream that never acks still cannot grow the queue: the
+     * oldest unacked lines are dropped first */
+    q = ntl_relay_queue_new(400);
+    for ( i = 0; i < 3; i++ ) {
+        push(q, i, NULL);
+    }
+    g_string_truncate(out, 0);
+    ntl_relay_queue_batch(q, 10, out);
+    push(q, 3, NULL);
+    push(q, 4, NULL);
+    assert_true(ntl_relay_queue_bytes(q) <= 400);
+    assert_int_equal(2, ntl_relay_queue_unsent(q));
+    ntl_relay_queue_rewind(q);
+    g_string_truncate(out, 0);
+    ntl_relay_queue_batch(q, 10, out);
+    assert_true(NULL == strstr(out->str, "msg:number 0,"));
+    assert_true(NULL != strstr(out->str, "msg:number 2,"));
+    assert_true(NULL != strstr(out->str, "msg:number 4,"));
+    ntl_relay_queue_free(q);
+
+    /* a message mentioning hn: is still tagged with its host */
+    q = ntl_relay_queue_new(1024);
+    ntl_relay_queue_push(q, "{ pn:prog, pid:1, tid:1, tl:2, tm:1000, millis:0, tag:tag, mod:mod, fn:fn, msg:set hn:x }", "here");
+    g_string_truncate(out, 0);
+    ntl_relay_queue_batch(q, 10, out);
+    assert_true(NULL != strstr(out->str, "msg:set hn:x, hn:here }"));
+    ntl_relay_queue_free(q);
+
+    g_string_free(out, TRUE);
+}
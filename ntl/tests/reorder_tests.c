@@ -0,0 +1,91 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "reorder_tests.h"
+
+#include "ntll.h"
+#include "ntlu.h"
+#include "cmockery_all.h"
+#include <glib.h>
+#include <string.h>
+
+static void keep_line(const gchar* ln, guint flags, gpointer d)
+{
+    g_ptr_array_add((GPtrArray*) d, g_strdup_printf("%u %s", flags, ln));
+}
+
+static void push(ntl_Reorder* r, guint pid, gint64 ms, gint64 now_ms)
+{
+    gchar* ln = g_strdup_printf(
+        "{ pn:prog, pid:%u, tid:1, tl:1, tm:%" G_GINT64_FORMAT ", millis:%" G_GINT64_FORMAT ", tag:t, mod:m, fn:f, msg:hi }",
+        pid, ms / 1000, ms % 1000);
+    ntl_reorder_push(r, ln, pid, now_ms * 1000);
+    g_free(ln);
+}
+
+void test_reorder(void** state)
+{
+    GPtrArray*   lines = g_ptr_array_new_with_free_func(g_free);
+    ntl_Reorder* r = ntl_reorder_new(50, 4, keep_line, lines);
+    gint64       t = G_GINT64_CONSTANT(1300000000000);
+    ntl_Packet*  pkt = NULL;
+    GString*     out = g_string_new("");
+
+    /* arrival order 3, 1, 2; trace-time order 1, 2, 3 */
+    push(r, 3, t + 30, t + 31);
+    push(r, 1, t + 10, t + 32);
+    push(r, 2, t + 20, t + 33);
+    ntl_reorder_flush(r, (t + 59) * 1000);
+    assert_int_equal(0, lines->len);
+    ntl_reorder_flush(r, (t + 70) * 1000);
+    assert_int_equal(2, lines->len);
+    assert_true(g_str_has_prefix(g_ptr_array_index(lines, 0), "1 "));
+    assert_true(g_str_has_prefix(g_ptr_array_index(lines, 1), "2 "));
+    ntl_reorder_flush(r, (t + 80) * 1000);
+    assert_int_equal(3, lines->len);
+    assert_true(g_str_has_prefix(g_ptr_array_index(lines, 2), "3 "));
+
+    /* older than what was emitted: sent at once, marked */
+    push(r, 5, t + 25, t + 81);
+    assert_int_equal(4, lines->len);
+    pkt = ntl_packet_decode((const gchar*) g_ptr_array_index(lines, 3) + 2);
+    assert_int_equal(1, pkt->late);
+    assert_int_equal(5, pkt->pid);
+    ntl_packet_free(pkt);
+    assert_int_equal(1, ntl_reorder_late(r));
+
+    /* a fast clock is taken as the arrival time; too many held are
+     * emitted early */
+    push(r, 6, t + 5000, t + 100);
+    push(r, 7, t + 90, t + 100);
+    assert_true(ntl_reorder_bytes(r) > 0);
+    ntl_reorder_flush(r, (t + 150) * 1000);
+    assert_int_equal(6, lines->len);
+    assert_true(g_str_has_prefix(g_ptr_array_index(lines, 4), "7 "));
+    assert_true(g_str_has_prefix(g_ptr_array_index(lines, 5), "6 "));
+    assert_int_equal(0, ntl_reorder_bytes(r));
+    for ( t += 1000; lines->len < 7; t++ ) {
+        push(r, 8, t, t);
+    }
+    ntl_reorder_dump(r, out);
+    assert_true(g_str_has_prefix(out->str, "window=50 held=4 "));
+    assert_true(NULL != strstr(out->str, " late=1 forced=1\n"));
+
+    g_string_free(out, TRUE);
+    ntl_reorder_free(r);
+    g_ptr_array_free(lines, TRUE);
+}
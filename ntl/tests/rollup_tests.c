@@ -0,0 +1,91 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "rollup_tests.h"
+
+#include "ntll.h"
+#include "ntlu.h"
+#include "cmockery_all.h"
+#include <glib.h>
+#include <string.h>
+
+static void keep_line(const gchar* ln, gpointer d)
+{
+    g_ptr_array_add((GPtrArray*) d, g_strdup(ln));
+}
+
+void test_rollup(void** state)
+{
+    GPtrArray*      lines = g_ptr_array_new_with_free_func(g_free);
+    ntl_Rollup*     r = ntl_rollup_new(60, 3, keep_line, lines);
+    GString*        out = g_string_new("");
+    gint64          now = (gint64) 1000 * 60 * G_USEC_PER_SEC + 5;
+    ntl_Packet*     pkt = NULL;
+    ntl_RollupStats rs;
+    gint            i = 0;
+
+    for ( i = 0; i < 3; i++ ) {
+        ntl_rollup_add(r, "prog", "db", ntl_tl_Error, 100, now + i);
+    }
+    ntl_rollup_add(r, "prog", "db", ntl_tl_Warn, 10, now);
+    ntl_rollup_add(r, "other", "net", ntl_tl_Error, 10, now);
+    /* past max_keys, new tags are counted together */
+    ntl_rollup_add(r, "prog", "cache", ntl_tl_Error, 10, now);
+    ntl_rollup_add(r, "prog", "queue", ntl_tl_Error, 10, now);
+
+    ntl_rollup_tick(r, now + 59 * G_USEC_PER_SEC);
+    assert_int_equal(0, lines->len);
+    ntl_rollup_tick(r, now + 60 * G_USEC_PER_SEC);
+    assert_int_equal(4, lines->len);
+
+    for ( i = 0; i < (gint) lines->len; i++ ) {
+        pkt = ntl_packet_decode(g_ptr_array_index(lines, i));
+        assert_true(ntl_rollup_parse(pkt, &rs));
+        assert_int_equal(60, rs.secs);
+        assert_int_equal(1000 * 60, rs.start);
+        if ( 0 == g_strcmp0(rs.prog, "prog") && 0 == g_strcmp0(rs.tag, "db") && ntl_tl_Error == rs.lvl ) {
+            assert_int_equal(3, rs.count);
+            assert_int_equal(300, rs.bytes);
+        }
+        if ( 0 == g_strcmp0(rs.tag, "_other") ) {
+            assert_int_equal(2, rs.count);
+        }
+        ntl_packet_free(pkt);
+    }
+
+    /* counts keep accumulating across windows */
+    ntl_rollup_add(r, "prog", "db", ntl_tl_Error, 100, now + 61 * G_USEC_PER_SEC);
+    ntl_rollup_snapshot(r, out);
+    assert_true(g_str_has_prefix(out->str, "# HELP ntl_traces_total "));
+    assert_false(NULL == strstr(out->str, "\nntl_traces_total{prog=\"prog\",tag=\"db\",level=\"error\"} 4\n"));
+    assert_false(NULL == strstr(out->str, "\nntl_traces_last_window{prog=\"prog\",tag=\"db\",level=\"error\"} 3\n"));
+
+    /* after an idle window, the last closed window saw nothing */
+    g_string_truncate(out, 0);
+    ntl_rollup_tick(r, now + 240 * G_USEC_PER_SEC);
+    ntl_rollup_snapshot(r, out);
+    assert_false(NULL == strstr(out->str, "\nntl_traces_total{prog=\"prog\",tag=\"db\",level=\"error\"} 4\n"));
+    assert_false(NULL == strstr(out->str, "\nntl_traces_last_window{prog=\"prog\",tag=\"db\",level=\"error\"} 0\n"));
+
+    pkt = ntl_packet_decode("{ pn:p, pid:1, tid:1, tl:0, tm:0, millis:0, tag:t, mod:m, fn:f, msg:count=1 }");
+    assert_false(ntl_rollup_parse(pkt, &rs));
+    ntl_packet_free(pkt);
+
+    g_string_free(out, TRUE);
+    ntl_rollup_free(r);
+    g_ptr_array_free(lines, TRUE);
+}
@@ -0,0 +1,152 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "shard_tests.h"
+
+#include "ntl_shard.h"
+#include "cmockery_all.h"
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+static gchar* make_dir(void)
+{
+    gchar* rv = g_strdup_printf("%s/ntl_shard_test.XXXXXX", g_get_tmp_dir());
+    assert_false(NULL == mkdtemp(rv));
+    return rv;
+}
+
+static void remove_dir(const gchar* dir)
+{
+    GDir*        d = g_dir_open(dir, 0, NULL);
+    const gchar* name = NULL;
+
+    while ( (name = g_dir_read_name(d)) ) {
+        gchar* fn = g_build_filename(dir, name, NULL);
+        unlink(fn);
+        g_free(fn);
+    }
+    g_dir_close(d);
+    rmdir(dir);
+}
+
+static ntl_Sharder* new_sharder(const gchar* fn, ntl_Template* t, guint threads, guint max_open)
+{
+    ntl_ShardConfig cfg;
+
+    memset(&cfg, 0, sizeof(cfg));
+    cfg.key = ntl_sk_Prog;
+    cfg.threads = threads;
+    cfg.tmpl = t;
+    cfg.max_open = max_open;
+    ntl_writer_config_init(&cfg.writer);
+    return ntl_sharder_new(fn, &cfg);
+}
+
+/* n rounds of one trace for each of progs p0..p<progs-1>, interleaved */
+static void push_rounds(ntl_Sharder* s, guint progs, guint from, guint n)
+{
+    guint i = 0;
+    guint j = 0;
+
+    for ( i = from; i < from + n; i++ ) {
+        for ( j = 0; j < progs; j++ ) {
+            ntl_Packet pkt;
+            gchar*     prog = g_strdup_printf("p%u", j);
+            gchar*     msg = g_strdup_printf("seq %u", i);
+
+            memset(&pkt, 0, sizeof(pkt));
+            pkt.prog = prog;
+            pkt.tag = "tag";
+            pkt.mod = "mod";
+            pkt.fn = "fn";
+            pkt.msg = msg;
+            ntl_sharder_push(s, &pkt);
+            g_free(msg);
+            g_free(prog);
+        }
+    }
+}
+
+/* that fn.p<prog> holds exactly seq 0 .. n-1 of that prog, in order */
+static void check_shard(const gchar* fn, guint prog, guint n)
+{
+    gchar*  path = g_strdup_printf("%s.p%u", fn, prog);
+    gchar*  text = NULL;
+    gchar** lines = NULL;
+    guint   i = 0;
+
+    assert_true(g_file_get_contents(path, &text, NULL, NULL));
+    lines = g_strsplit(text, "\n", -1);
+    assert_int_equal(n + 1, g_strv_length(lines));
+    for ( i = 0; i < n; i++ ) {
+        gchar* want = g_strdup_printf("p%u seq %u", prog, i);
+        assert_string_equal(want, lines[i]);
+        g_free(want);
+    }
+    assert_string_equal("", lines[n]);
+    g_strfreev(lines);
+    g_free(text);
+    g_free(path);
+}
+
+void test_sharder_order(void** state)
+{
+    gchar*        dir = make_dir();
+    gchar*        fn = g_build_filename(dir, "fl", NULL);
+    ntl_Template* t = ntl_template_compile("%{prog} %{msg}");
+    ntl_Sharder*  s = NULL;
+    guint         i = 0;
+
+    /* more rounds than a worker's queue holds, over several workers */
+    s = new_sharder(fn, t, 3, 0);
+    push_rounds(s, 7, 0, 3000);
+    /* returns only once everything pushed is written */
+    ntl_sharder_free(s);
+    for ( i = 0; i < 7; i++ ) {
+        check_shard(fn, i, 3000);
+    }
+
+    ntl_template_free(t);
+    remove_dir(dir);
+    g_free(fn);
+    g_free(dir);
+}
+
+void test_sharder_max_open(void** state)
+{
+    gchar*        dir = make_dir();
+    gchar*        fn = g_build_filename(dir, "fl", NULL);
+    ntl_Template* t = ntl_template_compile("%{prog} %{msg}");
+    ntl_Sharder*  s = NULL;
+    guint         i = 0;
+
+    /* two open at once for five progs: each trace closes a shard, and
+     * its file is appended to when the shard comes back */
+    s = new_sharder(fn, t, 1, 2);
+    push_rounds(s, 5, 0, 50);
+    ntl_sharder_free(s);
+    for ( i = 0; i < 5; i++ ) {
+        check_shard(fn, i, 50);
+    }
+
+    ntl_template_free(t);
+    remove_dir(dir);
+    g_free(fn);
+    g_free(dir);
+}
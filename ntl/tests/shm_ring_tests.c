@@ -0,0 +1,143 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "shm_ring_tests.h"
+
+#include "ntlu.h"
+#include "cmockery_all.h"
+#include <fcntl.h>
+#include <glib.h>
+#include <string.h>
+#include <unistd.h>
+
+static void keep_line(const gchar* ln, gsize len, gpointer d)
+{
+    assert_int_equal(strlen(ln), len);
+    g_ptr_array_add((GPtrArray*) d, g_strdup(ln));
+}
+
+static void publish(ntl_ShmRing* w, guint from, guint n)
+{
+    guint i = 0;
+    for ( i = from; i < from + n; i++ ) {
+        gchar* ln = g_strdup_printf("{ pn:prog, pid:%u, msg:line %u }", i, i);
+        ntl_shm_ring_publish(w, ln, strlen(ln));
+        g_free(ln);
+    }
+}
+
+/* fills the ring's data, past its 4096 byte header, with bad lengths */
+static void scribble(const gchar* fn)
+{
+    gchar junk[64 * 1024];
+    int   fd = open(fn, O_WRONLY);
+
+    assert_true(fd >= 0);
+    memset(junk, 0xff, sizeof(junk));
+    assert_int_equal(sizeof(junk), pwrite(fd, junk, sizeof(junk), 4096));
+    close(fd);
+}
+
+void test_shm_ring(void** state)
+{
+    gchar*       fn = g_strdup_printf("%s/ntl_shm_test.%u", g_get_tmp_dir(), getpid());
+    GPtrArray*   lines = g_ptr_array_new_with_free_func(g_free);
+    GString*     out = g_string_new("");
+    ntl_ShmRing* w = NULL;
+    ntl_ShmRing* r = NULL;
+    gchar*       want = NULL;
+    gchar*       big = NULL;
+
+    unlink(fn);
+    w = ntl_shm_ring_create(fn, 64 * 1024);
+    assert_false(NULL == w);
+    publish(w, 0, 3);
+    /* a reader starts from the newest */
+    r = ntl_shm_ring_attach(fn);
+    assert_false(NULL == r);
+    assert_int_equal(0, ntl_shm_ring_read(r, 100, keep_line, lines));
+    publish(w, 3, 5);
+    assert_int_equal(2, ntl_shm_ring_read(r, 2, keep_line, lines));
+    assert_int_equal(3, ntl_shm_ring_read(r, 100, keep_line, lines));
+    assert_int_equal(5, lines->len);
+    assert_string_equal("{ pn:prog, pid:3, msg:line 3 }", g_ptr_array_index(lines, 0));
+    assert_string_equal("{ pn:prog, pid:7, msg:line 7 }", g_ptr_array_index(lines, 4));
+
+    /* the writer reports each reader's position */
+    ntl_shm_ring_dump(w, out);
+    want = g_strdup_printf("reader pid=%u behind=0 laps=0", getpid());
+    assert_false(NULL == strstr(out->str, want));
+    g_free(want);
+
+    /* more than a ring's worth unread: lapped, then caught up */
+    publish(w, 8, 4000);
+    assert_int_equal(0, ntl_shm_ring_read(r, 100, keep_line, lines));
+    assert_int_equal(1, ntl_shm_ring_laps(r));
+    publish(w, 4008, 1);
+    assert_int_equal(1, ntl_shm_ring_read(r, 100, keep_line, lines));
+    assert_string_equal("{ pn:prog, pid:4008, msg:line 4008 }", g_ptr_array_index(lines, lines->len - 1));
+
+    /* a restarted writer of the same size carries on */
+    ntl_shm_ring_free(w);
+    w = ntl_shm_ring_create(fn, 64 * 1024);
+    publish(w, 4009, 1);
+    assert_int_equal(1, ntl_shm_ring_read(r, 100, keep_line, lines));
+    assert_true(ntl_shm_ring_valid(r));
+
+    /* a line over half the ring is dropped whole, and counted */
+    big = g_strnfill(40 * 1024, 'x');
+    ntl_shm_ring_publish(w, big, strlen(big));
+    g_free(big);
+    assert_int_equal(0, ntl_shm_ring_read(r, 100, keep_line, lines));
+    g_string_truncate(out, 0);
+    ntl_shm_ring_dump(w, out);
+    assert_false(NULL == strstr(out->str, "published=1 oversized=1"));
+
+    /* a chain broken under a live writer starts the ring over */
+    scribble(fn);
+    publish(w, 4010, 1);
+    g_string_truncate(out, 0);
+    ntl_shm_ring_dump(w, out);
+    assert_false(NULL == strstr(out->str, " held=40 "));
+    assert_int_equal(1, ntl_shm_ring_read(r, 100, keep_line, lines));
+    assert_string_equal("{ pn:prog, pid:4010, msg:line 4010 }", g_ptr_array_index(lines, lines->len - 1));
+
+    /* as does one found by a restarted writer */
+    ntl_shm_ring_free(w);
+    scribble(fn);
+    w = ntl_shm_ring_create(fn, 64 * 1024);
+    assert_true(ntl_shm_ring_valid(r));
+    assert_int_equal(0, ntl_shm_ring_read(r, 100, keep_line, lines));
+    publish(w, 4012, 1);
+    assert_int_equal(1, ntl_shm_ring_read(r, 100, keep_line, lines));
+    assert_string_equal("{ pn:prog, pid:4012, msg:line 4012 }", g_ptr_array_index(lines, lines->len - 1));
+
+    /* one of another size makes readers attach afresh */
+    ntl_shm_ring_free(w);
+    w = ntl_shm_ring_create(fn, 128 * 1024);
+    assert_false(ntl_shm_ring_valid(r));
+    ntl_shm_ring_free(r);
+    r = ntl_shm_ring_attach(fn);
+    assert_true(ntl_shm_ring_valid(r));
+
+    ntl_shm_ring_free(r);
+    ntl_shm_ring_free(w);
+    unlink(fn);
+    g_free(fn);
+    g_string_free(out, TRUE);
+    g_ptr_array_free(lines, TRUE);
+}
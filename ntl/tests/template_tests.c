@@ -0,0 +1,83 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "template_tests.h"
+
+#include "ntll.h"
+#include "cmockery_all.h"
+#include <glib.h>
+
+static void fill_packet(ntl_Packet* pkt, gchar* msg)
+{
+    pkt->prog = "test_prog";
+    pkt->pid = 1122;
+    pkt->tid = 3344;
+    pkt->lvl = ntl_tl_Warn;
+    pkt->time = 5555;
+    pkt->millis = 42;
+    pkt->tag = "tag";
+    pkt->mod = "module";
+    pkt->fn = "fn";
+    pkt->msg = msg;
+    pkt->host = NULL;
+    pkt->fields = NULL;
+}
+
+void test_template_default(void** state)
+{
+    ntl_Packet    pkt;
+    ntl_Template* t = ntl_template_compile(NTL_TEMPLATE_DEFAULT);
+    GString*      s = g_string_new(NULL);
+    gchar*        tm = NULL;
+    gchar*        expected = NULL;
+
+    fill_packet(&pkt, "the msg");
+    tm = ntl_listener_default_time_format(&pkt);
+    expected = g_strdup_printf("[%s] [%s] [%s, %u, %u] [%s] [%s/%s]: %s\n",
+        pkt.tag, ntl_level_to_string(pkt.lvl),
+        pkt.prog, pkt.pid, pkt.tid,
+        tm, pkt.mod, pkt.fn, pkt.msg);
+
+    assert_false(NULL == t);
+    ntl_template_render(t, s, &pkt);
+    assert_string_equal(expected, s->str);
+
+    assert_true(NULL == ntl_template_compile("%{nonesuch}"));
+    assert_true(NULL == ntl_template_compile("%{msg"));
+    assert_true(NULL == ntl_template_compile("%{msg:yaml}"));
+
+    g_free(tm);
+    g_free(expected);
+    g_string_free(s, TRUE);
+    ntl_template_free(t);
+}
+
+void test_template_escaping(void** state)
+{
+    ntl_Packet    pkt;
+    ntl_Template* t = ntl_template_compile("%{msg:json}|%{msg:logfmt}|%{tag:logfmt}|100%%");
+    GString*      s = g_string_new(NULL);
+
+    fill_packet(&pkt, "say \"hi\"\\\n\x01");
+    ntl_template_render(t, s, &pkt);
+    assert_string_equal(
+        "say \\\"hi\\\"\\\\\\n\\u0001|\"say \\\"hi\\\"\\\\\\n\\u0001\"|tag|100%\n",
+        s->str);
+
+    g_string_free(s, TRUE);
+    ntl_template_free(t);
+}
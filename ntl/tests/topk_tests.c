@@ -0,0 +1,82 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "topk_tests.h"
+
+#include "ntlu.h"
+#include "cmockery_all.h"
+#include <glib.h>
+
+void test_top_k(void** state)
+{
+    ntl_TopK*    t = ntl_top_k_new(3, 4, 10);
+    ntl_TopEntry top[3];
+    GString*     out = g_string_new("");
+    gint64       now = 1000 * G_USEC_PER_SEC;
+    guint64      count = 0;
+    guint64      bytes = 0;
+    gdouble      secs = 0;
+    gint         i = 0;
+
+    /* a long tail of distinct keys around three heavy ones */
+    for ( i = 0; i < 20000; i++ ) {
+        gchar* key = g_strdup_printf("tail%d", i);
+        ntl_top_k_add(t, key, 10, now);
+        g_free(key);
+        if ( 0 == i % 10 ) {
+            ntl_top_k_add(t, "heavy", 100, now);
+        }
+        if ( 0 == i % 20 ) {
+            ntl_top_k_add(t, "medium", 10, now);
+        }
+        if ( 0 == i % 40 ) {
+            ntl_top_k_add(t, "light", 10, now);
+        }
+    }
+    assert_int_equal(3, ntl_top_k_list(t, now, top, 3));
+    assert_string_equal("heavy", top[0].key);
+    assert_string_equal("medium", top[1].key);
+    assert_string_equal("light", top[2].key);
+    /* never an undercount, and not far over */
+    assert_true(top[0].count >= 2000 && top[0].count < 2100);
+    assert_true(top[0].bytes >= 200000);
+
+    ntl_top_k_totals(t, now, &count, &bytes, &secs);
+    assert_int_equal(20000 + 2000 + 1000 + 500, count);
+
+    ntl_top_k_dump(t, "site", now, 3, out);
+    assert_true(g_str_has_prefix(out->str, "site window="));
+    assert_false(NULL == strstr(out->str, "site 1 heavy count="));
+
+    /* a new talker displaces the lightest, then outlives the rest */
+    now += 30 * G_USEC_PER_SEC;
+    for ( i = 0; i < 600; i++ ) {
+        ntl_top_k_add(t, "burst", 1, now);
+    }
+    assert_int_equal(3, ntl_top_k_list(t, now, top, 3));
+    assert_string_equal("burst", top[2].key);
+    now += 15 * G_USEC_PER_SEC;
+    assert_int_equal(1, ntl_top_k_list(t, now, top, 3));
+    assert_string_equal("burst", top[0].key);
+    assert_int_equal(600, top[0].count);
+
+    ntl_top_k_reset(t);
+    assert_int_equal(0, ntl_top_k_list(t, now, top, 3));
+
+    g_string_free(out, TRUE);
+    ntl_top_k_free(t);
+}
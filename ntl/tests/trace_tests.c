@@ -18,8 +18,12 @@
 #include "trace_tests.h"
 
 #include "ntlc.h"
+#include "ntl_crash_ring.h"
 #include "cmockery_all.h"
 #include <glib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
 
 static gchar* actual_sent = NULL;
 static time_t mock_time = 5555;
@@ -62,3 +66,242 @@ void test_trace(void** state)
     g_free(actual_sent);
     g_free(expected_sent);
 }
+
+static gboolean sent_after(ntl_TraceLevelT tl, const gchar* tag, const gchar* mod)
+{
+    gboolean rv = FALSE;
+
+    actual_sent = NULL;
+    ntl_trace(tl, tag, mod, "fn", "msg");
+    rv = NULL != actual_sent;
+    g_free(actual_sent);
+    actual_sent = NULL;
+    return rv;
+}
+
+void test_level_control(void** state)
+{
+    ntl_setup_override("test_level", mock_send, mock_timestamp);
+    ntl_set_level(ntl_tl_Debug);
+    assert_false(sent_after(ntl_tl_Trace, "tag", "mod"));
+    assert_true(sent_after(ntl_tl_Debug, "tag", "mod"));
+
+    assert_int_equal(0, ntl_control("lvl * warn"));
+    assert_false(sent_after(ntl_tl_Debug, "tag", "mod"));
+    assert_true(sent_after(ntl_tl_Error, "tag", "mod"));
+
+    /* a module rule wins over a tag rule */
+    assert_int_equal(0, ntl_control("lvl tag:net trace"));
+    assert_int_equal(0, ntl_control("lvl mod:io error"));
+    assert_true(sent_after(ntl_tl_Trace, "net", "mod"));
+    assert_false(sent_after(ntl_tl_Warn, "net", "io"));
+    assert_false(sent_after(ntl_tl_Debug, "other", "mod"));
+
+    assert_int_equal(0, ntl_control("lvl tag:net reset"));
+    assert_int_equal(0, ntl_control("lvl mod:io reset"));
+    assert_int_equal(0, ntl_control("lvl * reset"));
+    assert_true(sent_after(ntl_tl_Debug, "net", "io"));
+    assert_false(sent_after(ntl_tl_Trace, "net", "io"));
+
+    assert_int_equal(-1, ntl_control("lvl * loud"));
+    assert_int_equal(-1, ntl_control("lvl pid:1 warn"));
+    assert_int_equal(-1, ntl_control("nonesuch"));
+
+    ntl_set_level(ntl_tl_Trace);
+    ntl_teardown();
+}
+
+static GPtrArray* spans_sent = NULL;
+
+static void mock_send_span(const char* pkt)
+{
+    g_ptr_array_add(spans_sent, g_strdup(pkt));
+}
+
+static gboolean sent_contains(guint i, const gchar* s)
+{
+    return i < spans_sent->len && NULL != strstr((const gchar*) g_ptr_array_index(spans_sent, i), s);
+}
+
+static gpointer span_thread(gpointer d)
+{
+    ntl_span_end(ntl_span_begin("threaded"));
+    return NULL;
+}
+
+void test_span(void** state)
+{
+    ntl_SpanId outer = 0;
+    ntl_SpanId inner = 0;
+    gchar*     parent = NULL;
+    guint      i = 0;
+
+    spans_sent = g_ptr_array_new_with_free_func(g_free);
+    ntl_setup_override("test_span", mock_send_span, mock_timestamp);
+    ntl_span_configure(0, 1);
+
+    outer = ntl_span_begin("outer");
+    inner = ntl_span_begin("inner");
+    assert_true(0 != outer && 0 != inner && outer != inner);
+    ntl_span_end(inner);
+    {
+        NTL_SPAN("scoped");
+    }
+    ntl_span_end(outer);
+
+    /* one record per span, as each ends */
+    assert_int_equal(3, spans_sent->len);
+    parent = g_strdup_printf("parent=%" G_GUINT64_FORMAT " ", outer);
+    assert_true(sent_contains(0, "tag:ntl.span.rec"));
+    assert_true(sent_contains(0, "msg:inner id="));
+    assert_true(sent_contains(0, parent));
+    assert_true(sent_contains(1, "msg:scoped id="));
+    assert_true(sent_contains(1, parent));
+    assert_true(sent_contains(2, "msg:outer id="));
+    assert_true(sent_contains(2, "parent=0 "));
+
+    /* then one summary per name */
+    ntl_span_configure(0, 0);
+    outer = ntl_span_begin("outer");
+    ntl_span_end(outer);
+    assert_int_equal(3, spans_sent->len);
+    ntl_span_flush();
+    assert_int_equal(6, spans_sent->len);
+    for ( i = 3; i < 6; i++ ) {
+        assert_true(sent_contains(i, "tag:ntl.span,"));
+        if ( sent_contains(i, "msg:outer ") ) {
+            assert_true(sent_contains(i, " count=2 "));
+        } else {
+            assert_true(sent_contains(i, " count=1 "));
+        }
+    }
+
+    /* a thread's spans outlive the thread */
+    g_thread_join(g_thread_new("span_thread", span_thread, NULL));
+    ntl_span_flush();
+    assert_int_equal(7, spans_sent->len);
+    assert_true(sent_contains(6, "msg:threaded count=1 "));
+
+    /* summaries are sent whatever the level rules, and on time even
+     * when no span ends to send them */
+    assert_int_equal(0, ntl_control("lvl * warn"));
+    ntl_span_configure(20, 0);
+    ntl_span_end(ntl_span_begin("late"));
+    g_usleep(200 * 1000);
+    ntl_span_configure(0, 0);
+    assert_int_equal(8, spans_sent->len);
+    assert_true(sent_contains(7, "msg:late count=1 "));
+    assert_int_equal(0, ntl_control("lvl * reset"));
+
+    ntl_teardown();
+    g_free(parent);
+    g_ptr_array_free(spans_sent, TRUE);
+}
+
+static gboolean collect(const gchar* pkt, gpointer d)
+{
+    g_ptr_array_add((GPtrArray*) d, g_strdup(pkt));
+    return TRUE;
+}
+
+void test_crash_ring(void** state)
+{
+    gchar*         fn = g_strdup_printf("%s/ntl-test-%u.ring", g_get_tmp_dir(), getpid());
+    ntl_CrashRing* r = ntl_crash_ring_create(fn, 4096, "test_prog");
+    ntl_CrashRing* after = NULL;
+    GPtrArray*     got = g_ptr_array_new_with_free_func(g_free);
+    gchar          big[1000];
+    guint64        end = 0;
+    guint64        ends[2];
+    gint           i = 0;
+
+    memset(big, 'x', sizeof(big));
+    assert_false(NULL == r);
+    end = ntl_crash_ring_append(r, "one", 3);
+    ntl_crash_ring_mark_sent(r, end, 3);
+    assert_false(ntl_crash_ring_pending(r));
+
+    /* two sends completing out of order, around one that failed */
+    ntl_crash_ring_append(r, "two", 3);
+    ends[0] = ntl_crash_ring_append(r, "three", 5);
+    ends[1] = ntl_crash_ring_append(r, "four", 4);
+    ntl_crash_ring_mark_sent(r, ends[1], 4);
+    ntl_crash_ring_mark_sent(r, ends[0], 5);
+    assert_true(ntl_crash_ring_pending(r));
+
+    /* too large to hold whole, so not held at all */
+    assert_int_equal(0, ntl_crash_ring_append(r, big, sizeof(big) * 3));
+    ntl_crash_ring_mark_sent(r, 0, sizeof(big) * 3);
+
+    /* a second mapping sees what a crashed process left: only the
+     * failed send */
+    after = ntl_crash_ring_open(fn);
+    assert_false(NULL == after);
+    assert_int_equal(getpid(), ntl_crash_ring_pid(after));
+    assert_string_equal("test_prog", ntl_crash_ring_prog(after));
+    /* a dry run first, which leaves it for the real recovery */
+    assert_int_equal(1, ntl_crash_ring_recover(after, collect, got, FALSE));
+    assert_string_equal("two", g_ptr_array_index(got, 0));
+    assert_true(ntl_crash_ring_pending(r));
+    assert_int_equal(1, ntl_crash_ring_recover(after, collect, got, TRUE));
+    assert_int_equal(2, got->len);
+    assert_string_equal("two", g_ptr_array_index(got, 1));
+    assert_false(ntl_crash_ring_pending(r));
+    assert_int_equal(0, ntl_crash_ring_recover(after, collect, got, TRUE));
+    ntl_crash_ring_close(after, FALSE);
+
+    /* wrapping drops the oldest records whole */
+    for ( i = 0; i < 10; i++ ) {
+        big[0] = '0' + i;
+        ntl_crash_ring_append(r, big, sizeof(big));
+    }
+    g_ptr_array_set_size(got, 0);
+    assert_int_equal(4, ntl_crash_ring_recover(r, collect, got, TRUE));
+    assert_int_equal('6', ((gchar*) g_ptr_array_index(got, 0))[0]);
+    assert_int_equal(sizeof(big), strlen(g_ptr_array_index(got, 3)));
+    ntl_crash_ring_close(r, TRUE);
+
+    assert_true(NULL == ntl_crash_ring_open(fn));
+    g_ptr_array_free(got, TRUE);
+    g_free(fn);
+}
+
+void test_crash_ring_files(void** state)
+{
+    gchar*         dir = ntl_crash_ring_dir();
+    gchar*         fn = NULL;
+    gchar*         victim = NULL;
+    gchar*         text = NULL;
+    ntl_CrashRing* r = NULL;
+    struct stat    st;
+
+    /* the default directory is the user's alone */
+    assert_false(NULL == dir);
+    assert_int_equal(0, lstat(dir, &st));
+    assert_true(S_ISDIR(st.st_mode));
+    assert_int_equal(0700, st.st_mode & 0777);
+
+    /* a planted symlink is not followed, nor replaced */
+    fn = g_strdup_printf("%s/ntl-test-%u.ring", g_get_tmp_dir(), getpid());
+    victim = g_strdup_printf("%s/ntl-test-%u.victim", g_get_tmp_dir(), getpid());
+    assert_true(g_file_set_contents(victim, "keep me", -1, NULL));
+    unlink(fn);
+    assert_int_equal(0, symlink(victim, fn));
+    assert_true(NULL == ntl_crash_ring_create(fn, 4096, "test_prog"));
+    assert_true(g_file_get_contents(victim, &text, NULL, NULL));
+    assert_string_equal("keep me", text);
+    unlink(fn);
+
+    /* a stale ring of the user's own is made anew */
+    assert_true(g_file_set_contents(fn, "stale", -1, NULL));
+    r = ntl_crash_ring_create(fn, 4096, "test_prog");
+    assert_false(NULL == r);
+    assert_int_equal(getpid(), ntl_crash_ring_pid(r));
+    ntl_crash_ring_close(r, TRUE);
+
+    unlink(victim);
+    g_free(text);
+    g_free(victim);
+    g_free(fn);
+    g_free(dir);
+}
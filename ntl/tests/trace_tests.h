@@ -19,5 +19,9 @@
 #define __trace_tests_h_
 
 void test_trace(void** state);
+void test_span(void** state);
+void test_level_control(void** state);
+void test_crash_ring(void** state);
+void test_crash_ring_files(void** state);
 
 #endif
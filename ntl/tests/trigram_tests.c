@@ -0,0 +1,108 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "trigram_tests.h"
+
+#include "ntl_trigram.h"
+#include "cmockery_all.h"
+#include <glib.h>
+#include <string.h>
+#include <unistd.h>
+
+static const gchar* lines[] = {
+    "[alpha] [DEBUG] [prog, 1, 2] [2011-03-01 10:00:00.000] [mod/fn]: connected to server\n",
+    "[alpha] [DEBUG] [prog, 1, 2] [2011-03-01 10:00:00.001] [mod/fn]: request took 12ms\n",
+    "[beta] [ERROR] [prog, 1, 2] [2011-03-01 10:00:00.002] [mod/fn]: disk full on /var\n",
+    "[beta] [DEBUG] [prog, 1, 2] [2011-03-01 10:00:00.003] [mod/fn]: request took 40ms\n",
+};
+
+static gboolean literals_are(const gchar* regex, const gchar* want)
+{
+    gchar**  got = ntl_trigram_literals(regex);
+    gchar*   joined = g_strjoinv(",", got);
+    gboolean rv = (0 == strcmp(joined, want));
+
+    g_free(joined);
+    g_strfreev(got);
+    return rv;
+}
+
+void test_trigram_index(void** state)
+{
+    gchar*              fn = g_strdup_printf("%s/ntl_trigram_test.%u.tri", g_get_tmp_dir(), getpid());
+    GString*            seg = g_string_new("");
+    ntl_TrigramBuilder* b = ntl_trigram_builder_new(1);
+    ntl_TrigramIndex*   idx = NULL;
+    guint8              cand[4];
+    gchar*              name = NULL;
+    gsize               start = 0;
+    gsize               end = 0;
+    guint               i = 0;
+
+    for ( i = 0; i < G_N_ELEMENTS(lines); i++ ) {
+        g_string_append(seg, lines[i]);
+    }
+    /* in pieces which split lines and the "]: " */
+    for ( i = 0; i < seg->len; i += 7 ) {
+        ntl_trigram_builder_add(b, seg->str + i, MIN(7, seg->len - i));
+    }
+    assert_true(ntl_trigram_builder_write(b, fn));
+    ntl_trigram_builder_free(b);
+
+    assert_true(NULL == ntl_trigram_index_open(fn, seg->len + 1));
+    idx = ntl_trigram_index_open(fn, seg->len);
+    assert_false(NULL == idx);
+    assert_int_equal(4, ntl_trigram_index_blocks(idx));
+    ntl_trigram_index_block(idx, 2, &start, &end);
+    assert_int_equal(strlen(lines[0]) + strlen(lines[1]), start);
+    assert_int_equal(start + strlen(lines[2]), end);
+
+    memset(cand, 1, sizeof(cand));
+    assert_true(ntl_trigram_index_require(idx, "request took", 12, cand));
+    assert_int_equal(0, cand[0]);
+    assert_int_equal(1, cand[1]);
+    assert_int_equal(0, cand[2]);
+    assert_int_equal(1, cand[3]);
+    assert_true(ntl_trigram_index_require(idx, "40ms", 4, cand));
+    assert_int_equal(0, cand[1]);
+    assert_int_equal(1, cand[3]);
+
+    /* only messages are indexed */
+    memset(cand, 1, sizeof(cand));
+    assert_true(ntl_trigram_index_require(idx, "alpha", 5, cand));
+    assert_int_equal(0, cand[0] | cand[1] | cand[2] | cand[3]);
+    memset(cand, 1, sizeof(cand));
+    assert_false(ntl_trigram_index_require(idx, "ms", 2, cand));
+    assert_int_equal(1, cand[0] & cand[1] & cand[2] & cand[3]);
+    ntl_trigram_index_free(idx);
+
+    name = ntl_trigram_index_name("/logs/fl.20110301-100000.gz");
+    assert_string_equal("/logs/fl.20110301-100000.tri", name);
+    g_free(name);
+
+    assert_true(literals_are("disk full", "disk full"));
+    assert_true(literals_are("^took [0-9]+ms$", "took "));
+    assert_true(literals_are("conn?ected\\.to (ab)xyz+", "con,ected.to ,xyz"));
+    assert_true(literals_are("abcd*?efgh{2}", "abc,efg"));
+    assert_true(literals_are("\\d+ requests", " requests"));
+    assert_true(literals_are("full|empty", ""));
+    assert_true(literals_are("(?i)disk", ""));
+
+    unlink(fn);
+    g_free(fn);
+    g_string_free(seg, TRUE);
+}
@@ -0,0 +1,247 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "writer_tests.h"
+
+#include "ntl_writer.h"
+#include "cmockery_all.h"
+#include <glib.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <zlib.h>
+
+/* every line is this long, so that each one fills a segment */
+#define LINE_LEN 40
+
+static gchar* make_dir(void)
+{
+    gchar* rv = g_strdup_printf("%s/ntl_writer_test.XXXXXX", g_get_tmp_dir());
+    assert_false(NULL == mkdtemp(rv));
+    return rv;
+}
+
+static void remove_dir(const gchar* dir)
+{
+    GDir*        d = g_dir_open(dir, 0, NULL);
+    const gchar* name = NULL;
+
+    while ( (name = g_dir_read_name(d)) ) {
+        gchar* fn = g_build_filename(dir, name, NULL);
+        unlink(fn);
+        g_free(fn);
+    }
+    g_dir_close(d);
+    rmdir(dir);
+}
+
+static void write_line(ntl_Writer* w, guint i)
+{
+    g_string_append_printf(ntl_writer_buffer(w), "line %02u %*s\n", i, LINE_LEN - 9, "x");
+    ntl_writer_commit(w);
+}
+
+static void write_lines(ntl_Writer* w, guint n)
+{
+    guint i = 0;
+    for ( i = 0; i < n; i++ ) {
+        write_line(w, i);
+    }
+}
+
+static gchar* read_segment(const gchar* fn)
+{
+    GString* rv = g_string_new("");
+    gzFile   gz = gzopen(fn, "rb");
+    gchar    buf[1024];
+    int      n = 0;
+
+    assert_false(NULL == gz);
+    while ( (n = gzread(gz, buf, sizeof(buf))) > 0 ) {
+        g_string_append_len(rv, buf, n);
+    }
+    gzclose(gz);
+    return g_string_free(rv, FALSE);
+}
+
+/* name is base itself or one of its segments' names */
+static gboolean under(const gchar* name, const gchar* base)
+{
+    return g_str_has_prefix(name, base) && ('\0' == name[strlen(base)] || '.' == name[strlen(base)]);
+}
+
+/* the segments in dir, checking that each is named <base>.YYYYmmdd-HHMMSS[.N][.gz];
+ * names not under base, or under other, are another writer's */
+static GPtrArray* list_segments(const gchar* dir, const gchar* base, const gchar* other, gboolean compressed)
+{
+    GPtrArray*   rv = g_ptr_array_new_with_free_func(g_free);
+    GDir*        d = g_dir_open(dir, 0, NULL);
+    const gchar* name = NULL;
+    gsize        len = strlen(base);
+
+    while ( (name = g_dir_read_name(d)) ) {
+        const gchar* p = name + len + 1;
+        guint        i = 0;
+
+        if ( 0 == strcmp(name, base) || !under(name, base) || (other && under(name, other)) ) {
+            continue;
+        }
+        for ( i = 0; i < 15; i++ ) {
+            assert_true(8 == i ? '-' == p[i] : g_ascii_isdigit(p[i]));
+        }
+        p += 15;
+        if ( '.' == *p && g_ascii_isdigit(p[1]) ) {
+            for ( p++; g_ascii_isdigit(*p); p++ ) {
+            }
+        }
+        assert_string_equal(compressed ? ".gz" : "", p);
+        g_ptr_array_add(rv, g_build_filename(dir, name, NULL));
+    }
+    g_dir_close(d);
+    return rv;
+}
+
+static gboolean holds_line(GPtrArray* segments, guint i)
+{
+    gchar*   want = g_strdup_printf("line %02u ", i);
+    gboolean rv = FALSE;
+    guint    j = 0;
+
+    for ( j = 0; j < segments->len; j++ ) {
+        gchar* text = read_segment((const gchar*) g_ptr_array_index(segments, j));
+        rv = rv || 0 == strncmp(text, want, strlen(want));
+        g_free(text);
+    }
+    g_free(want);
+    return rv;
+}
+
+void test_writer_rotation(void** state)
+{
+    gchar*           dir = make_dir();
+    gchar*           fn = g_build_filename(dir, "fl", NULL);
+    ntl_WriterConfig cfg;
+    ntl_Writer*      w = NULL;
+    GPtrArray*       segs = NULL;
+    gchar*           live = NULL;
+    guint            i = 0;
+
+    ntl_writer_config_init(&cfg);
+    cfg.buffer_size = 1;
+    cfg.rotate_bytes = LINE_LEN + LINE_LEN / 2;
+    cfg.compress = TRUE;
+    cfg.keep_count = 3;
+    w = ntl_writer_new(fn, &cfg);
+    assert_false(NULL == w);
+
+    /* one line per segment: nine closed, most within the same second */
+    write_lines(w, 10);
+    /* waits for the rotator to compress and trim */
+    ntl_writer_free(w);
+
+    segs = list_segments(dir, "fl", NULL, TRUE);
+    assert_int_equal(3, segs->len);
+    for ( i = 0; i < 6; i++ ) {
+        assert_false(holds_line(segs, i));
+    }
+    for ( i = 6; i < 9; i++ ) {
+        assert_true(holds_line(segs, i));
+    }
+    assert_true(g_file_get_contents(fn, &live, NULL, NULL));
+    assert_int_equal(LINE_LEN, strlen(live));
+    assert_int_equal(0, strncmp("line 09 ", live, 8));
+
+    g_free(live);
+    g_ptr_array_free(segs, TRUE);
+    remove_dir(dir);
+    g_free(fn);
+    g_free(dir);
+}
+
+void test_writer_retention_bytes(void** state)
+{
+    gchar*           dir = make_dir();
+    gchar*           fn = g_build_filename(dir, "fl", NULL);
+    ntl_WriterConfig cfg;
+    ntl_Writer*      w = NULL;
+    GPtrArray*       segs = NULL;
+
+    ntl_writer_config_init(&cfg);
+    cfg.buffer_size = 1;
+    cfg.rotate_bytes = LINE_LEN;
+    cfg.keep_bytes = 2 * LINE_LEN + LINE_LEN / 2;
+    w = ntl_writer_new(fn, &cfg);
+    assert_false(NULL == w);
+    write_lines(w, 6);
+    ntl_writer_free(w);
+
+    /* uncompressed, and only the newest that fit in the byte limit */
+    segs = list_segments(dir, "fl", NULL, FALSE);
+    assert_int_equal(2, segs->len);
+    assert_true(holds_line(segs, 3));
+    assert_true(holds_line(segs, 4));
+
+    g_ptr_array_free(segs, TRUE);
+    remove_dir(dir);
+    g_free(fn);
+    g_free(dir);
+}
+
+void test_writer_retention_shards(void** state)
+{
+    gchar*           dir = make_dir();
+    gchar*           fn = g_build_filename(dir, "fl.v1", NULL);
+    gchar*           other_fn = g_build_filename(dir, "fl.v1.2", NULL);
+    ntl_WriterConfig cfg;
+    ntl_Writer*      w = NULL;
+    ntl_Writer*      other = NULL;
+    GPtrArray*       segs = NULL;
+    guint            i = 0;
+
+    /* shards whose names extend one another, as with --shard-by */
+    ntl_writer_config_init(&cfg);
+    cfg.buffer_size = 1;
+    cfg.rotate_bytes = LINE_LEN;
+    cfg.keep_count = 2;
+    w = ntl_writer_new(fn, &cfg);
+    other = ntl_writer_new(other_fn, &cfg);
+    assert_false(NULL == w);
+    assert_false(NULL == other);
+    for ( i = 0; i < 6; i++ ) {
+        write_line(w, i);
+        write_line(other, i);
+    }
+    ntl_writer_free(w);
+    ntl_writer_free(other);
+
+    /* each keeps its own newest two, whatever the other's retention did */
+    segs = list_segments(dir, "fl.v1", "fl.v1.2", FALSE);
+    assert_int_equal(2, segs->len);
+    assert_true(holds_line(segs, 3));
+    assert_true(holds_line(segs, 4));
+    g_ptr_array_free(segs, TRUE);
+    segs = list_segments(dir, "fl.v1.2", NULL, FALSE);
+    assert_int_equal(2, segs->len);
+    assert_true(holds_line(segs, 3));
+    assert_true(holds_line(segs, 4));
+
+    g_ptr_array_free(segs, TRUE);
+    remove_dir(dir);
+    g_free(other_fn);
+    g_free(fn);
+    g_free(dir);
+}
@@ -0,0 +1,93 @@
+/*
+ *  Part of "NTL" - a simple network logging system
+ *
+ *  Copyright 2011 Don Kelly <karfai@gmail.com>
+ *
+ *  Licensed under the Apache License, Version 2.0 (the "License");
+ *  you may not use this file except in compliance with the License.
+ *  You may obtain a copy of the License at
+ *
+ *      http://www.apache.org/licenses/LICENSE-2.0
+ *
+ *  Unless required by applicable law or agreed to in writing, software
+ *  distributed under the License is distributed on an "AS IS" BASIS,
+ *  WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied.
+ *  See the License for the specific language governing permissions and
+ *  limitations under the License.
+ */
+#include "zstream_tests.h"
+
+#include "ntlu.h"
+#include "cmockery_all.h"
+#include <glib.h>
+#include <string.h>
+
+static void batch(GString* s, guint from, guint n)
+{
+    guint i = 0;
+    g_string_truncate(s, 0);
+    for ( i = from; i < from + n; i++ ) {
+        g_string_append_printf(s,
+            "{ pn:prog, pid:42, tid:42, tl:1, tm:%u, millis:%u, tag:db, mod:pool.c, fn:acquire, msg:connection %u acquired }\n",
+            1300000000 + i / 100, i % 1000, i % 8);
+    }
+}
+
+void test_zstream(void** state)
+{
+    ntl_ZWriter* w = ntl_zwriter_new(1, NULL, 0);
+    ntl_ZReader* r = ntl_zreader_new("a sample that the writer did not use", 36);
+    GString*     lines = g_string_new("");
+    GString*     chunk = g_string_new("");
+    GString*     out = g_string_new("");
+    gsize        first = 0;
+    guint        i = 0;
+
+    /* a reader falls back on the built-in dictionary */
+    batch(lines, 0, 1);
+    ntl_zwriter_write(w, lines->str, lines->len, chunk);
+    assert_true(g_str_has_prefix(chunk->str, "Z:"));
+    assert_true('\n' == chunk->str[chunk->len - 1]);
+    assert_true(ntl_zreader_read(r, chunk->str, out));
+    assert_string_equal(lines->str, out->str);
+
+    /* later chunks refer back to earlier ones */
+    for ( i = 1; i < 10; i++ ) {
+        g_string_truncate(chunk, 0);
+        g_string_truncate(out, 0);
+        batch(lines, i * 50, 50);
+        ntl_zwriter_write(w, lines->str, lines->len, chunk);
+        assert_true(g_str_has_prefix(chunk->str, "z:"));
+        assert_true(ntl_zreader_read(r, chunk->str, out));
+        assert_string_equal(lines->str, out->str);
+        if ( 1 == i ) {
+            first = chunk->len;
+        }
+    }
+    assert_true(chunk->len < first);
+    assert_true(chunk->len * 4 < lines->len);
+
+    /* a lost chunk breaks the stream until the writer starts another */
+    g_string_truncate(chunk, 0);
+    ntl_zwriter_write(w, lines->str, lines->len, chunk);
+    ntl_zwriter_reset(w);
+    g_string_truncate(chunk, 0);
+    ntl_zwriter_write(w, lines->str, lines->len, chunk);
+    assert_true(g_str_has_prefix(chunk->str, "Z:"));
+    g_string_truncate(out, 0);
+    assert_true(ntl_zreader_read(r, chunk->str, out));
+    assert_string_equal(lines->str, out->str);
+    assert_false(ntl_zreader_read(r, "z:bm90IGEgY2h1bms=\n", out));
+    assert_false(ntl_zreader_read(r, "{ pn:prog }", out));
+
+    g_string_truncate(out, 0);
+    ntl_zreader_dump(r, "reader", out);
+    assert_true(g_str_has_prefix(out->str, "reader raw="));
+    assert_true(NULL != strstr(out->str, " errors=1\n"));
+
+    ntl_zwriter_free(w);
+    ntl_zreader_free(r);
+    g_string_free(lines, TRUE);
+    g_string_free(chunk, TRUE);
+    g_string_free(out, TRUE);
+}